@@ -0,0 +1,157 @@
+/*
+ * ai-scheduler.cc - shared worker pool that runs every AI player's loop
+ */
+
+#include "src/ai-scheduler.h"
+
+#include <cstdint>
+#include <thread>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+
+#include "src/ai.h"
+#include "src/log.h"
+
+AIScheduler::AIScheduler()
+  : worker_count(0)
+  , blocked_count(0) {
+  max_workers = std::thread::hardware_concurrency();
+  // hardware_concurrency is allowed to return 0 if it can't tell
+  if (max_workers == 0) {
+    max_workers = 2;
+  }
+}
+
+// never destroyed, the workers are detached the same way the old AI threads
+//  were and may still be waiting on the mutex while the process exits
+AIScheduler &
+AIScheduler::get_instance() {
+  static AIScheduler *instance = new AIScheduler();
+  return *instance;
+}
+
+void
+AIScheduler::add(AI *ai) {
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry entry;
+  entry.ai = ai;
+  entry.due = Clock::now();
+  entry.priority = PriorityNormal;
+  entry.used = Clock::duration::zero();
+  entry.running = false;
+  entries.push_back(entry);
+  add_worker_if_needed();
+  Log::Debug["ai-scheduler"] << "added AI " << ai->name << ", "
+                             << entries.size() << " AIs on " << worker_count
+                             << " workers";
+  wake.notify_one();
+}
+
+void
+AIScheduler::add_worker_if_needed() {
+  // a blocked worker holds its AI, so one per AI is still the most needed
+  if (working_count() < max_workers &&
+      worker_count < entries.size()) {
+    std::thread worker_thread(&AIScheduler::worker, this);
+    worker_thread.detach();
+    worker_count++;
+  }
+}
+
+AIScheduler::Blocking::Blocking() {
+  AIScheduler &scheduler = AIScheduler::get_instance();
+  std::lock_guard<std::mutex> lock(scheduler.mutex);
+  scheduler.blocked_count++;
+  scheduler.add_worker_if_needed();
+}
+
+// the extra worker started for the wait, if any, retires in worker()
+AIScheduler::Blocking::~Blocking() {
+  AIScheduler &scheduler = AIScheduler::get_instance();
+  std::lock_guard<std::mutex> lock(scheduler.mutex);
+  scheduler.blocked_count--;
+}
+
+unsigned int
+AIScheduler::get_worker_count() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return worker_count;
+}
+
+AIScheduler::Entries::iterator
+AIScheduler::next_due(Clock::time_point now, Clock::time_point *earliest) {
+  Entries::iterator best = entries.end();
+  *earliest = Clock::time_point::max();
+  for (Entries::iterator it = entries.begin(); it != entries.end(); ++it) {
+    if (it->running) {
+      continue;
+    }
+    if (it->due > now) {
+      if (it->due < *earliest) {
+        *earliest = it->due;
+      }
+      continue;
+    }
+    if (best == entries.end() || it->priority > best->priority ||
+        (it->priority == best->priority && it->used < best->used)) {
+      best = it;
+    }
+  }
+  return best;
+}
+
+void
+AIScheduler::worker() {
+  Log::Debug["ai-scheduler"] << "AI worker starting, thread_id: "
+                             << std::this_thread::get_id();
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    // a Blocking is over and there are more workers working than cores
+    if (working_count() > max_workers) {
+      worker_count--;
+      Log::Debug["ai-scheduler"] << "AI worker exiting, " << worker_count
+                                 << " workers left";
+      return;
+    }
+    Clock::time_point earliest;
+    Entries::iterator entry = next_due(Clock::now(), &earliest);
+    if (entry == entries.end()) {
+      if (earliest == Clock::time_point::max()) {
+        wake.wait(lock);
+      } else {
+        wake.wait_until(lock, earliest);
+      }
+      continue;
+    }
+
+    entry->running = true;
+    AI *ai = entry->ai;
+    lock.unlock();
+
+    Clock::time_point start = Clock::now();
+    StepResult result = ai->run_step();
+    Clock::duration took = Clock::now() - start;
+    int64_t took_msec =
+      std::chrono::duration_cast<std::chrono::milliseconds>(took).count();
+    if (!result.finished && took_msec > static_cast<int64_t>(result.budget_msec)) {
+      Log::Debug["ai-scheduler"] << ai->name << " step "
+                                 << result.step_name << " took " << took_msec
+                                 << "ms, over its " << result.budget_msec
+                                 << "ms budget";
+    }
+
+    lock.lock();
+    if (result.finished) {
+      Log::Debug["ai-scheduler"] << "AI " << ai->name << " finished, "
+                                 << entries.size() - 1 << " AIs remain";
+      entries.erase(entry);
+    } else {
+      entry->running = false;
+      entry->used += took;
+      entry->due = Clock::now() +
+                   std::chrono::milliseconds(result.pause_msec);
+      entry->priority = result.priority;
+    }
+    // any other worker that went to sleep while this AI was running may
+    //  now have something to do sooner than it thinks
+    wake.notify_all();
+  }
+}
@@ -0,0 +1,108 @@
+/*
+ * ai-scheduler.h - shared worker pool that runs every AI player's loop
+ *
+ *  Each AI used to get its own detached std::thread running AI::next_loop
+ *   forever, blocking in sleep_speed_adjusted between (and inside) the do_
+ *   functions.  With many AI players on few cores the threads fought over
+ *   the CPU with no notion of fairness, and most of the time they were just
+ *   asleep holding a thread anyway.
+ *  Now AI::next_loop queues the loop as steps (about one do_ function each)
+ *   and the scheduler runs one step of one AI at a time on a pool of worker
+ *   threads, one per core at most.  A step's sleeps are not slept, the AI
+ *   just isn't due again until they are over.  Of the AIs that are due, the
+ *   one whose next step has the highest priority goes first, and ties go to
+ *   the AI that has used the least worker time so far, so a player whose
+ *   steps are slow can't starve the others.
+ *  An AI never runs on two workers at once, so AI state is still only ever
+ *   touched by one thread at a time like before.
+ *  Some steps still have to really wait, for the result of a command the
+ *   game applies at its next update (AI::wait_command) or in a real sleep.
+ *   Those waits are wrapped in a Blocking, the worker then doesn't count
+ *   against the one per core and another one is started if there are AIs
+ *   left to run, so with more AIs than cores one AI's wait doesn't hold up
+ *   the others.  Workers beyond that go away again once the wait is over.
+ */
+
+#ifndef SRC_AI_SCHEDULER_H_
+#define SRC_AI_SCHEDULER_H_
+
+#include <chrono>              //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <condition_variable>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <list>
+#include <mutex>               //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+
+class AI;
+
+class AIScheduler {
+ public:
+  typedef enum Priority {
+    PriorityLow = 0,   // housekeeping that can wait a bit
+    PriorityNormal,
+    PriorityHigh,      // geologists and mine placement, the signs fade
+  } Priority;
+
+  // what AI::run_step reports back after each step
+  typedef struct StepResult {
+    bool finished;            // the AI has exited, forget about it
+    unsigned int pause_msec;  // wall time before its next step is due
+    Priority priority;        // of its next step
+    const char *step_name;    // of the step that just ran, for logging
+    unsigned int budget_msec; // how long that step was expected to take
+  } StepResult;
+
+  // steps taking longer than their budget are logged.  Most do_ functions
+  //  finish well inside the default, the road building ones can pathfind
+  //  for seconds on a big realm
+  static const unsigned int default_budget_msec = 500;
+  static const unsigned int road_budget_msec = 5000;
+
+  // for as long as it exists the calling worker is waiting, not working
+  class Blocking {
+   public:
+    Blocking();
+    ~Blocking();
+  };
+
+ protected:
+  typedef std::chrono::steady_clock Clock;
+
+  typedef struct Entry {
+    AI *ai;
+    Clock::time_point due;
+    Priority priority;
+    Clock::duration used;     // worker time spent on this AI so far
+    bool running;
+  } Entry;
+  // a list so an Entry stays put while its AI runs unlocked
+  typedef std::list<Entry> Entries;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  Entries entries;
+  unsigned int worker_count;
+  unsigned int blocked_count;  // workers inside a Blocking
+  unsigned int max_workers;
+
+  AIScheduler();
+  void worker();
+  // caller holds mutex.  Workers not inside a Blocking, a Blocking outside
+  //  of a worker (plot_road called from elsewhere) must not wrap this around
+  unsigned int working_count() const {
+    return (worker_count > blocked_count) ? worker_count - blocked_count : 0;
+  }
+  // caller holds mutex.  Start a worker if fewer than max_workers are
+  //  working and there is an AI for it
+  void add_worker_if_needed();
+  // caller holds mutex.  Sets earliest to when the next not-yet-due AI is due
+  Entries::iterator next_due(Clock::time_point now, Clock::time_point *earliest);
+
+ public:
+  static AIScheduler &get_instance();
+
+  // start running this AI's steps, adds a worker if there are fewer
+  //  workers than AIs and cores to put them on
+  void add(AI *ai);
+  unsigned int get_worker_count();
+};
+
+#endif  // SRC_AI_SCHEDULER_H_
@@ -40,6 +40,9 @@ AI::AI(PGame current_game, unsigned int _player_index) {
   //stopbuilding_pos = std::numeric_limits<unsigned int>::max() - 2;
   //stop_building = false;  // replace the 'stopbuilding_pos' idea with this, and set this to true as needed, reset at start of each loop
   loop_count = 0;
+  loop_clock_start = 0;
+  pending_pause_msec = 0;
+  logged_paused = false;
   castle = nullptr;
   castle_pos = bad_map_pos;
   castle_flag_pos = bad_map_pos;
@@ -112,76 +115,124 @@ AI::AI(PGame current_game, unsigned int _player_index) {
   player->change_knight_occupation(2, 1, -5);
 }
 
-void
-AI::start() {
-  AILogInfo["start"] << "AI is starting, thread_id: " << std::this_thread::get_id();
-
-  while (true) {
-    //AILogDebug["start"] << "start AI::start while(true)";
-    bool logged_paused = false;
-    if (game->should_ai_stop() == true) {
-      AILogInfo["start"] << "received stop_ai_threads signal, exiting!";
-      game->ai_thread_exiting();
-      return;
-    }
-    else if (game->get_game_speed() == 0) {
-      // avoid repeat log messages when paused
-      if (!logged_paused){
-        AILogDebug["start"] << "game is paused, not running AI loops until unpaused";
-        logged_paused = true;
-      }
-      ai_status.assign("AI_PAUSED");
-      sleep_speed_adjusted(6000);
-    }
-    else if (game->is_ai_locked()) {
-      AILogDebug["start"] << "AI is still locked, sleeping until game->unlock_ai called (when game init_box is closed)";
-      sleep_speed_adjusted(6000);
-    }
-    else {
-      next_loop();
-      //AILogDebug["start"] << "done next_loop()";
+AIScheduler::StepResult
+AI::run_step() {
+  AIScheduler::StepResult result;
+  result.finished = false;
+  result.pause_msec = 0;
+  result.priority = AIScheduler::PriorityNormal;
+  result.step_name = "none";
+  result.budget_msec = AIScheduler::default_budget_msec;
+
+  if (game->should_ai_stop() == true) {
+    AILogInfo["run_step"] << "received stop_ai_threads signal, exiting!";
+    game->ai_thread_exiting();
+    result.finished = true;
+    return result;
+  }
+  else if (game->get_game_speed() == 0) {
+    // avoid repeat log messages when paused
+    if (!logged_paused){
+      AILogDebug["run_step"] << "game is paused, not running AI steps until unpaused";
+      logged_paused = true;
     }
-    //AILogDebug["start"] << "end AI::start while(true)";
+    ai_status.assign("AI_PAUSED");
+    result.pause_msec = speed_adjusted_msec(6000);
+    return result;
   }
+  logged_paused = false;
+  if (game->is_ai_locked()) {
+    AILogDebug["run_step"] << "AI is still locked, sleeping until game->unlock_ai called (when game init_box is closed)";
+    result.pause_msec = speed_adjusted_msec(6000);
+    return result;
+  }
+
+  if (steps.empty()) {
+    next_loop();
+  }
+  // pop it first, a step is allowed to add or drop the steps after it
+  AIStep step = steps.front();
+  steps.pop_front();
+  pending_pause_msec = 0;
+  step.run();
+
+  result.pause_msec = pending_pause_msec;
+  result.step_name = step.name;
+  result.budget_msec = step.budget_msec;
+  if (!steps.empty()) {
+    result.priority = steps.front().priority;
+  }
+  return result;
 }
 
+void
+AI::add_step(std::deque<AIStep> *to, const char *name, AIScheduler::Priority priority,
+             std::function<void()> run, unsigned int budget_msec) {
+  AIStep step;
+  step.name = name;
+  step.priority = priority;
+  step.budget_msec = budget_msec;
+  step.run = run;
+  to->push_back(step);
+}
+
+// queue up the next AI loop as steps for AIScheduler to run.  This used to
+//  run the whole loop right here with sleeps in between, now every
+//  sleep_speed_adjusted a step makes becomes the pause before the next one
 void
 AI::next_loop(){
   AILogDebug["next_loop"] << "inside AI::next_loop()";
-  loop_count++;
-
-  ai_status.assign("SLEEPING_AT_START");
-  AILogDebug["next_loop"] << "sleeping 6sec at start of new loop";
-  sleep_speed_adjusted(6000);
-
-  AILogDebug["next_loop"] << "starting AI loop #" << loop_count;
-  // time entire loop
-  //std::clock_t loop_clock_start;
-  //loop_clock_start = std::clock();
-  std::time_t loop_clock_start = std::time(0);
-  int loop_clock_duration;
-
-  // place castle if this is start of new game
-  do_place_castle();  
-
-  // end loop early if AI is essentially defeated
-  do_consider_capitulation(); if (!have_inventory_building){ return; }
-
-  do_update_clear_reset();
-  update_stocks_pos();
-  inventory_pos = castle_flag_pos;  // need to set this so various functions work on the very first AI loop, before the loop over Inventories starts
-  update_buildings();
-  do_get_inventory(castle_flag_pos);
-
-  // this is broken since messing with flagsearch, see details here:  https://github.com/forkserf/forkserf/issues/70
-  //DEBUG
-  //if (realm_building_count[Building::TypeHut] > 1){
-  //  AI::identify_arterial_roads(map);
-  //  //return;
-  //}
+  const AIScheduler::Priority low = AIScheduler::PriorityLow;
+  const AIScheduler::Priority normal = AIScheduler::PriorityNormal;
+  const AIScheduler::Priority high = AIScheduler::PriorityHigh;
+  const unsigned int road_budget = AIScheduler::road_budget_msec;
+
+  add_step(&steps, "start_loop", normal, [this]{
+    loop_count++;
+    ai_status.assign("SLEEPING_AT_START");
+    AILogDebug["next_loop"] << "sleeping 6sec at start of new loop";
+    sleep_speed_adjusted(6000);
+  });
+
+  add_step(&steps, "stagger_castle", normal, [this]{
+    // so the AI players don't all start placing castles at exactly the
+    //  same time, only the pause before the next step, not a real sleep
+    if (!player->has_castle()) {
+      AILogDebug["next_loop"] << "waiting " << player_index << "sec before placing castle";
+      pending_pause_msec += 2000 * player_index;
+    }
+  });
+
+  add_step(&steps, "place_castle", normal, [this]{
+    AILogDebug["next_loop"] << "starting AI loop #" << loop_count;
+    // time entire loop
+    loop_clock_start = std::time(0);
+    // place castle if this is start of new game
+    do_place_castle();
+  });
+
+  add_step(&steps, "wait_for_castle", normal, [this]{ do_wait_for_castle(); });
 
-  do_get_serfs();  // is this actually needed?
-  //do_debug_building_triggers();   // not using these right now
+  add_step(&steps, "update_state", normal, [this]{
+    // end loop early if AI is essentially defeated
+    do_consider_capitulation(); if (!have_inventory_building){ steps.clear(); return; }
+
+    do_update_clear_reset();
+    update_stocks_pos();
+    inventory_pos = castle_flag_pos;  // need to set this so various functions work on the very first AI loop, before the loop over Inventories starts
+    update_buildings();
+    do_get_inventory(castle_flag_pos);
+
+    // this is broken since messing with flagsearch, see details here:  https://github.com/forkserf/forkserf/issues/70
+    //DEBUG
+    //if (realm_building_count[Building::TypeHut] > 1){
+    //  AI::identify_arterial_roads(map);
+    //  //return;
+    //}
+
+    do_get_serfs();  // is this actually needed?
+    //do_debug_building_triggers();   // not using these right now
+  });
 
   //-----------------------------------------------------------
   // housekeeping tasks
@@ -190,24 +241,26 @@ AI::next_loop(){
   //      rather it should be done after first few buildings/roads placed
   //-----------------------------------------------------------
 
-  do_connect_disconnected_flags(); // except mines
-  //AILogError["next_loop"] << "ENDING LOOP EARLY FOR DEBUGGING!";
-  //return;
-  do_connect_disconnected_road_networks();
-  do_build_better_roads_for_important_buildings();  // is this working?  I still see pretty inefficient roads for important buildings
-  do_pollute_castle_area_roads_with_flags(); // CHANGE THIS TO USE ARTERIAL ROADS  (nah, it works well enough as it is, do that later)
-  do_fix_stuck_serfs();  // this is definitely still an issue, try to fix root cause
-  do_fix_missing_transporters();  // is this still a problem anymore??  YES
-  do_remove_road_stubs();
-  do_demolish_unproductive_3rd_lumberjacks();
-  do_demolish_unproductive_stonecutters();
-  do_demolish_unproductive_mines();
-  do_manage_tool_priorities();
-  do_manage_mine_food_priorities();
-  do_balance_sword_shield_priorities();
-  // do_attack();  moving this to end of loop as it depends on information that is per stock (can expand borders, missing resources)
-  do_manage_knight_occupation_levels();
-  do_send_geologists();
+  add_step(&steps, "connect_disconnected_flags", low, [this]{ do_connect_disconnected_flags(); }, road_budget); // except mines
+  add_step(&steps, "connect_disconnected_road_networks", low, [this]{ do_connect_disconnected_road_networks(); }, road_budget);
+  add_step(&steps, "build_better_roads_for_important_buildings", low, [this]{ do_build_better_roads_for_important_buildings(); }, road_budget);  // is this working?  I still see pretty inefficient roads for important buildings
+  add_step(&steps, "pollute_castle_area_roads_with_flags", low, [this]{ do_pollute_castle_area_roads_with_flags(); }); // CHANGE THIS TO USE ARTERIAL ROADS  (nah, it works well enough as it is, do that later)
+  add_step(&steps, "fix_stuck_serfs", low, [this]{ do_fix_stuck_serfs(); });  // this is definitely still an issue, try to fix root cause
+  add_step(&steps, "fix_missing_transporters", low, [this]{ do_fix_missing_transporters(); });  // is this still a problem anymore??  YES
+  add_step(&steps, "remove_road_stubs", low, [this]{ do_remove_road_stubs(); }, road_budget);
+  add_step(&steps, "demolish_unproductive_buildings", low, [this]{
+    do_demolish_unproductive_3rd_lumberjacks();
+    do_demolish_unproductive_stonecutters();
+    do_demolish_unproductive_mines();
+  });
+  add_step(&steps, "manage_priorities", low, [this]{
+    do_manage_tool_priorities();
+    do_manage_mine_food_priorities();
+    do_balance_sword_shield_priorities();
+    // do_attack();  moving this to end of loop as it depends on information that is per stock (can expand borders, missing resources)
+    do_manage_knight_occupation_levels();
+  });
+  add_step(&steps, "send_geologists", high, [this]{ do_send_geologists(); });
 
   // MUST CALL do_send_geologists OFTEN, and place_mines also 
   //  As the game progresses, the AI loops get longer and longer 
@@ -216,11 +269,47 @@ AI::next_loop(){
   //   after most AI do_actions.  The send_geologists function will only actualy run if so many ticks have passed
   // AND need to run place mines often, because the signs may fade between AI loops!
 
-  // rename this to Inventories instead of Stocks
-  update_stocks_pos();
+  // the per-Inventory steps can only be queued once it is known which
+  //  Inventories there are, they go in front of the rest of the loop
+  add_step(&steps, "economy", normal, [this]{
+    // rename this to Inventories instead of Stocks
+    update_stocks_pos();
+    std::deque<AIStep> economy;
+    for (MapPos this_inventory_pos : stocks_pos) {
+      queue_inventory_steps(&economy, this_inventory_pos);
+    }
+    steps.insert(steps.begin(), economy.begin(), economy.end());
+  });
 
-  for (MapPos this_inventory_pos : stocks_pos) {
-    inventory_pos = this_inventory_pos;
+  // marks where skip_economy_steps stops skipping
+  add_step(&steps, "done_economy", normal, []{});
+
+  // create parallel infrastructure!
+  add_step(&steps, "build_warehouse", normal, [this]{ do_build_warehouse(); sleep_speed_adjusted(1000); do_send_geologists(); });
+
+  // ATTACK ENEMIES
+  add_step(&steps, "attack", normal, [this]{ do_attack(); });
+
+  add_step(&steps, "end_loop", normal, [this]{
+    AILogDebug["next_loop"] << "Done AI Loop #" << loop_count;
+    ai_status.assign("END OF LOOP");
+    AILogDebug["next_loop"] << "loop complete, sleeping 2sec";
+    int loop_clock_duration = std::time(0) - loop_clock_start;
+    AILogDebug["next_loop"] << "done next_loop, loop took " << loop_clock_duration;
+    sleep_speed_adjusted(2000);
+  });
+}
+
+// the economy loop for one Inventory (Castle or Warehouse)
+void
+AI::queue_inventory_steps(std::deque<AIStep> *to, MapPos pos) {
+  const AIScheduler::Priority low = AIScheduler::PriorityLow;
+  const AIScheduler::Priority normal = AIScheduler::PriorityNormal;
+  const AIScheduler::Priority high = AIScheduler::PriorityHigh;
+  const unsigned int road_budget = AIScheduler::road_budget_msec;
+
+  add_step(to, "start_inventory", normal, [this, pos]{
+    inventory_pos = pos;
     AILogDebug["next_loop"] << "Starting economy loop for Inventory at pos " << inventory_pos;
 
     update_buildings();
@@ -235,100 +324,125 @@ AI::next_loop(){
     do_promote_serfs_to_knights();  // this is actually done per-stock in AI, not per-realm like the button does
     do_count_resources_sitting_at_flags(inventory_pos);
     do_check_resource_needs();
-    do_create_star_roads_for_new_warehouses();
-    do_send_geologists();
+  });
+  add_step(to, "create_star_roads_for_new_warehouses", normal, [this]{ do_create_star_roads_for_new_warehouses(); do_send_geologists(); }, road_budget);
 
-    do_build_sawmill_lumberjacks(); sleep_speed_adjusted(1000); do_send_geologists();
+  add_step(to, "build_sawmill_lumberjacks", normal, [this]{ do_build_sawmill_lumberjacks(); sleep_speed_adjusted(1000); do_send_geologists(); });
 
+  add_step(to, "expand_borders", normal, [this]{
     if(do_can_build_knight_huts())
       //do_remove_road_stubs();  // run this again to minimize creation of daisy-chained knight hut paths that can no longer qualify as stubs
       expand_borders(); sleep_speed_adjusted(1000); do_send_geologists();
+  });
 
-    // PLACE MINES EARLY - but do not connect them to roads so they do not actually get built until later
-    //   this is to secure good placement when resources are found, before the signs fade
+  // PLACE MINES EARLY - but do not connect them to roads so they do not actually get built until later
+  //   this is to secure good placement when resources are found, before the signs fade
+  add_step(to, "place_mines", high, [this]{
     do_place_coal_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_iron_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_gold_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists();
+  });
 
-    // if this is the Castle, don't place any other buildings until these have their materials
+  // if this is the Castle, don't place any other buildings until these have their materials
+  add_step(to, "wait_until_sawmill_lumberjacks_built", normal, [this]{
     if (inventory_pos == castle_flag_pos && do_wait_until_sawmill_lumberjacks_built() == false)
-        break;
+        skip_economy_steps();
+  });
 
-    do_build_stonecutter(); sleep_speed_adjusted(1000); do_send_geologists();
-    do_build_rangers(); sleep_speed_adjusted(1000); do_send_geologists();
+  add_step(to, "build_stonecutter", normal, [this]{ do_build_stonecutter(); sleep_speed_adjusted(1000); do_send_geologists(); });
+  add_step(to, "build_rangers", normal, [this]{ do_build_rangers(); sleep_speed_adjusted(1000); do_send_geologists(); });
 
+  add_step(to, "build_toolmaker_steelsmelter", normal, [this]{
     if(do_can_build_other())
       {do_build_toolmaker_steelsmelter(); sleep_speed_adjusted(1000); do_send_geologists();}
+  });
 
+  add_step(to, "build_food_buildings", normal, [this]{
     if(do_can_build_other())
       {do_build_food_buildings(); sleep_speed_adjusted(1000); do_send_geologists();}
+  });
 
-    // do this often because signs fade
+  // do this often because signs fade
+  add_step(to, "place_mines", high, [this]{
     do_place_coal_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_iron_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_gold_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists();
+  });
 
+  add_step(to, "build_3rd_lumberjack", normal, [this]{
     if(do_can_build_other())
       {do_build_3rd_lumberjack(); sleep_speed_adjusted(1000); do_send_geologists();}
+  });
 
+  add_step(to, "connect_coal_mines", normal, [this]{
     if(do_can_build_other())
       {do_connect_coal_mines(); sleep_speed_adjusted(1000); do_send_geologists();}
+  }, road_budget);
 
+  add_step(to, "connect_iron_mines", normal, [this]{
     if(do_can_build_other())
       {do_connect_iron_mines(); sleep_speed_adjusted(1000); do_send_geologists();}
+  }, road_budget);
 
-    //if(do_can_build_other())
-    //  {do_connect_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists();}
-    // must always be willing to build & connect stone mines if needed, because once needed they are URGENT
-    do_connect_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists();
+  //if(do_can_build_other())
+  //  {do_connect_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists();}
+  // must always be willing to build & connect stone mines if needed, because once needed they are URGENT
+  add_step(to, "connect_stone_mines", high, [this]{ do_connect_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists(); }, road_budget);
 
+  add_step(to, "build_steelsmelter", normal, [this]{
     if(do_can_build_other())
       {do_build_steelsmelter(); sleep_speed_adjusted(1000); do_send_geologists();}
+  });
 
+  add_step(to, "build_blacksmith", normal, [this]{
     if(do_can_build_other())
       {do_build_blacksmith(); sleep_speed_adjusted(1000); do_send_geologists();}
+  });
 
+  add_step(to, "build_gold_smelter_and_connect_gold_mines", normal, [this]{
     if(do_can_build_other())
       {do_build_gold_smelter_and_connect_gold_mines(); sleep_speed_adjusted(1000); do_send_geologists();}
+  }, road_budget);
 
-    // do this often because signs fade
+  // do this often because signs fade
+  add_step(to, "place_mines", high, [this]{
     do_place_coal_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_iron_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_gold_mines(); sleep_speed_adjusted(1000); do_send_geologists();
     do_place_stone_mines(); sleep_speed_adjusted(1000); do_send_geologists();
-    
+  });
+
+  add_step(to, "demolish_excess_buildings", low, [this]{
     do_demolish_excess_lumberjacks(); do_send_geologists();
     do_demolish_excess_foresters(); do_send_geologists();
-	  do_demolish_excess_food_buildings(); do_send_geologists();
+    do_demolish_excess_food_buildings(); do_send_geologists();
     if (stocks_pos.size() > 1){  // if only have the initial castle, instead use the food slider to manage excess mine output
       do_disconnect_or_demolish_excess_coal_mines(); do_send_geologists();
       do_disconnect_or_demolish_excess_iron_mines(); do_send_geologists();
       do_disconnect_or_demolish_excess_gold_mines(); do_send_geologists();
     }
-    do_send_geologists(); sleep_speed_adjusted(1000);
-    do_spiderweb_roads(); sleep_speed_adjusted(1000);
+  });
+  add_step(to, "send_geologists", high, [this]{ do_send_geologists(); sleep_speed_adjusted(1000); });
+  add_step(to, "spiderweb_roads", low, [this]{ do_spiderweb_roads(); sleep_speed_adjusted(1000); }, road_budget);
 
+  add_step(to, "done_inventory", normal, [this]{
     AILogDebug["next_loop"] << "Done with economy loop for Inventory at pos " << inventory_pos;
 
     // ATTACK ENEMIES
     int morale = (100*player->get_knight_morale())/0x1000;  // this should be % morale, not the integer that defaults to 4096
     if (morale > 75){do_attack();}
-  }
-
-  // create parallel infrastructure!
-  do_build_warehouse(); sleep_speed_adjusted(1000); do_send_geologists();
+  });
+}
 
-  // ATTACK ENEMIES
-  do_attack();
-
-  AILogDebug["next_loop"] << "Done AI Loop #" << loop_count;
-  ai_status.assign("END OF LOOP");
-  AILogDebug["next_loop"] << "loop complete, sleeping 2sec";
-  loop_clock_duration = std::time(0) - loop_clock_start;
-  AILogDebug["next_loop"] << "done next_loop, loop took " << loop_clock_duration;
-  sleep_speed_adjusted(2000);
+// the Castle is still waiting for its sawmill and lumberjacks, this used to
+//  break out of the loop over Inventories
+void
+AI::skip_economy_steps() {
+  while (!steps.empty() && std::strcmp(steps.front().name, "done_economy") != 0) {
+    steps.pop_front();
+  }
 }
 
 
@@ -354,8 +468,7 @@ AI::do_place_castle() {
     //      the time that is fed to seed the random function gets a different time-seed for each player
     // changed this to mutex.lock() instead, but keeping this because... I dunno it seems nicer when they don't all start at exactly the same time
     //   maybe start doing random wait instead?  meh
-    AILogDebug["do_place_castle"] << "sleeping " << player_index << "sec so each AI player thread gets different seed for random map pos";
-    std::this_thread::sleep_for(std::chrono::milliseconds(2000 * player_index));
+    //  (the stagger_castle step in next_loop does the waiting now, each AI also has its own ai_rnd)
     int maxtries = 1500;  // crash if failed to place castle after this many tries, regardless of desperation
     int lower_standards_tries = 120;  // reduce standards after this many tries (can happen repeatedly)
     int desperation = 0;  // current level of lowered standards
@@ -374,7 +487,7 @@ AI::do_place_castle() {
         desperation++;
         AILogDebug["do_place_castle"] << "unable to place castle after " << x << " tries, lowering standards to desperation level " << desperation;
       }
-      MapPos pos = map->get_rnd_coord(NULL, NULL, game->get_rand());
+      MapPos pos = map->get_rnd_coord(NULL, NULL, &ai_rnd);
       AILogDebug["do_place_castle"] << " considering placing castle at random pos " << pos;
       // first see if it is even possible to build large building here
       if (!game->can_build_castle(pos, player)) {
@@ -385,9 +498,7 @@ AI::do_place_castle() {
       //if (place_castle(game, pos, spiral_dist(8), desperation)) {
       if (place_castle(game, pos, desperation)) {
         AILogDebug["do_place_castle"] << "found acceptable place to build castle, at pos: " << pos;
-        mutex_lock("AI::do_place_castle calling game->build_castle");
-        bool was_built = game->build_castle(pos, player);
-        mutex_unlock();
+        bool was_built = run_command(ReplayCommand(ReplayCommand::TypeBuildCastle, player_index, pos));
         if (was_built) {
           AILogDebug["do_place_castle"] << "built castle at pos: " << pos << " after " << x << " tries";
           castle_pos = pos;
@@ -417,6 +528,27 @@ AI::do_place_castle() {
   }
 }
 
+// nothing else the AI does makes sense until its castle is built.  This
+//  used to block the AI thread inside update_buildings, now the step just
+//  queues itself again so the worker can run other AIs in the meantime
+void
+AI::do_wait_for_castle() {
+  ai_status.assign("do_wait_for_castle");
+  Game::ListBuildings buildings = game->get_player_buildings(player);
+  for (Building *building : buildings) {
+    if (building == nullptr)
+      continue;
+    if (building->get_type() == Building::TypeCastle && !building->is_done()) {
+      AILogDebug["do_wait_for_castle"] << "player's castle is not done building yet.  Checking again in a bit";
+      std::deque<AIStep> again;
+      add_step(&again, "wait_for_castle", AIScheduler::PriorityNormal, [this]{ do_wait_for_castle(); });
+      steps.insert(steps.begin(), again.begin(), again.end());
+      sleep_speed_adjusted(1000);
+      return;
+    }
+  }
+}
+
 // check and see if conditions are met for AI to consider itself defeated
 //  currently, this will happen if AI loses its Castle and all Stocks
 // Could have the AI thread exit entirely but, for now just have it quit 
@@ -541,7 +673,7 @@ AI::do_debug_building_triggers() {
     // don't resume AI until most serfs have made it back into the castle
     AILogDebug["do_debug_building_triggers"] << "done rebuild_all_roads, waiting for lost serfs to clear out";
     for (int x = 0; x < 50; x++) {
-      sleep_speed_adjusted(15000);
+      wait_speed_adjusted(15000);
       unsigned int lost_serfs = 0;
       for (Serf *serf : game->get_player_serfs(player)) {
         if (serf->get_state() == Serf::StateFreeWalking) {
@@ -594,19 +726,27 @@ AI::do_promote_serfs_to_knights() {
   // this 'promotable' function doesn't seem to work right, it doesn't limit the number promoted to the specified integer like it suggests
   //int promoted = player->promote_serfs_to_knights(promotable);
   int promoted = 0;
+  // pick the serfs under the lock, the promotions themselves are applied by
+  //  the next game update.  Inventory::promote_serf_to_knight checks for a sword
+  //  and shield itself so asking for too many just fails the extra ones
+  std::vector<ReplayCommand> commands;
   mutex_lock("AI::do_promote_serfs_to_knights calling game->get_player_serfs(player) (for do_manage_knight_occupation_levels is_waiting)");
   for (Serf *serf : game->get_player_serfs(player)) {
     if (promotable < 1) { break; }
     if (serf->get_state() == Serf::StateIdleInStock &&
       serf->get_type() == Serf::TypeGeneric) {
-      Inventory *inv = game->get_inventory(serf->get_idle_in_stock_inv_index());
-      if (inv->promote_serf_to_knight(serf)) {
-        promoted++;
-        promotable--;
-      }
+      commands.push_back(ReplayCommand(ReplayCommand::TypePromoteSerfToKnight, player_index, serf->get_idle_in_stock_inv_index(), serf->get_index()));
+      promotable--;
     }
   }
   mutex_unlock();
+  std::vector<GameCommandQueue::Result> results = game->post_commands(commands);
+  for (GameCommandQueue::Result &result : results) {
+    if (wait_command(&result)) {
+      promoted++;
+    }
+  }
+  AILogDebug["do_promote_serfs_to_knights"] << "promoted " << promoted << " serfs to knights";
 }
 
 
@@ -618,16 +758,16 @@ AI::do_connect_disconnected_flags() {
   start = std::clock();
   AILogDebug["do_connect_disconnected_flags"] << "inside do_connect_disconnected_flags";
   ai_status.assign("do_connect_disconnected_flags");
-  // got a segfault during flags_copy = game->get_flags... need to mutex wrap all AI game->get_flags calls?
-  Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-  for (Flag *flag : flags_copy) {
-    if (flag == nullptr)
+  PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+    if (flag_info.owner != player_index)
       continue;
-    if (flag->get_owner() != player_index)
+    if (flag_info.pos == castle_flag_pos)
       continue;
-    if (flag->get_position() == castle_flag_pos)
+    if (flag_info.connected)
       continue;
-    if (flag->is_connected())
+    Flag *flag = get_live_flag(flag_info);
+    if (flag == nullptr || flag->is_connected())
       continue;
     if (flag->has_building()) {
       AILogDebug["do_connect_disconnected_flags"] << "flag at pos " << flag->get_position() << " has an attached building of type " << NameBuilding[flag->get_building()->get_type()];
@@ -697,19 +837,17 @@ AI::do_connect_disconnected_flags() {
           }
         }
         // burn any attached building and destroy the flag
-        mutex_lock("AI::do_connect_disconnected_flags calling demolish_flag (and maybe attached building)");
         if (must_demolish_building){
           AILogDebug["do_connect_disconnected_flags"] << "failed to connect disconnected flag to road network!  BURNING ATTACHED BUILDING!";
           // how did this ever work before??
           //game->demolish_building(flag->get_position(), player);
-          game->demolish_building(map->move_up_left(flag_pos), player);
+          run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, map->move_up_left(flag_pos)));
           // sleep to appear more human
           sleep_speed_adjusted(3000);
         }
         AILogDebug["do_connect_disconnected_flags"] << "failed to connect disconnected flag to road network!  removing it";
-        // got exception here, adding nullptr check
-        if (flag != nullptr){ game->demolish_flag(flag_pos, player); }
-        mutex_unlock();
+        // Game::demolish_flag checks the flag still exists
+        run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
       }
     }
   }
@@ -987,11 +1125,9 @@ AI::do_pollute_castle_area_roads_with_flags() {
     if (map->has_any_path(pos)){
       if (game->can_build_flag(pos, player)) {
         AILogDebug["do_pollute_castle_area_roads_with_flags"] << "building a pollution flag at pos " << pos;
-        mutex_lock("AI::do_pollute_castle_area_roads_with_flags calling game->build_flag");
-        if (game->build_flag(pos, player)) {
+        if (run_command(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, pos))) {
           created_flags++;
         }
-        mutex_unlock();
       }
     }
   }
@@ -1090,9 +1226,7 @@ AI::do_fix_stuck_serfs() {
         if (serf_job == Serf::TypeKnight0 || serf_job == Serf::TypeKnight1 || serf_job == Serf::TypeKnight2 || serf_job == Serf::TypeKnight3 || serf_job == Serf::TypeKnight4) {
           AILogWarn["do_fix_stuck_serfs"] << "WARNING - a knight was booted, see if this causes military building with flag pos " << serf_dest_flag_pos << " to have a forever empty slot!";
         }
-        mutex_lock("AI::do_fix_stuck_serfs calling serf->set_lost_state (for bug workaround stuck serfs)");
-        serf->set_lost_state();
-        mutex_unlock();
+        run_command(ReplayCommand(ReplayCommand::TypeSetSerfLost, player_index, serf->get_index()));
         // still seeing this happen for Transporter serfs... but rare... keep an eye on it
         // - the first time I watched this closely since tracking serf dests I saw a transporter on way to a flag
         //  to become a transporter, and whent it was made lost a replacement seems to have been sent, which is good
@@ -1183,15 +1317,14 @@ AI::do_fix_missing_transporters() {
         //sleep_speed_adjusted(5000);
         //game->pause();
         AILogDebug["do_fix_missing_transporters"] << "timer trying to force call a transporter";
-        mutex_lock("AI::do_fix_missing_transporters calling flag->call_transporter, to work around no-transporter issue");
         // got access violation w/ 2x AIs, even with mutex, look for a foreach loop being invalidated elsewhere
         //Access violation reading location 0xFFFFFFFFFFFFFFFF.
         // oh... I think I just wasn't checking that this player owns the flag!  adding that
         // now getting some other read access violation after Inventory->have serfs... on Load Game testing though, dunno
         //AILogDebug["do_fix_missing_transporters"] << "NOT calling out missing new transporterZZZ, trying to debug this now";
         //bool was_called = false;
-        bool was_called = flag->call_transporter(dir, false);  // hardcoding is_water_path to false because I am seeing weird crash with this checking for Serf::TypeSailor
-        mutex_unlock();
+        // hardcoding is_water_path to false because I am seeing weird crash with this checking for Serf::TypeSailor
+        bool was_called = run_command(ReplayCommand(ReplayCommand::TypeCallTransporter, player_index, flag->get_index(), dir, false));
         if (!was_called) {
           AILogDebug["do_fix_missing_transporters"] << "WARNING - flag->call_transporter failed while trying to work around no-transporter issue!  I guess let it try again next time";
         }
@@ -1212,9 +1345,12 @@ AI::do_fix_missing_transporters() {
   // look for missing transporters and if found set timers for them
   //
   unsigned int flag_index = 0;
-  Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-  for (Flag *flag : flags_copy) {
-    if (flag == nullptr || flag->get_owner() != player_index || !flag->is_connected())
+  PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+    if (flag_info.owner != player_index || !flag_info.connected)
+      continue;
+    Flag *flag = get_live_flag(flag_info);
+    if (flag == nullptr || !flag->is_connected())
       continue;
     // it seems the castle shows as having a path Up-Left into it...
     //    I wonder if any other buildings do also?  warehouses?
@@ -1318,9 +1454,8 @@ AI::do_fix_missing_transporters() {
           //AILogDebug["do_fix_missing_transporters"] << "NOT calling out missing new transporter, trying to debug this now";
           //bool was_called = false;
           AILogWarn["do_fix_missing_transporters"] << "trying to immediately force call a transporter";
-          mutex_lock("do_fix_missing_transporters calling flag->call_transporter, to work around RARER no-transporter issue");
-          bool was_called = flag->call_transporter(dir, false);  // hardcoding is_water_path to false because I am seeing weird crash with this checking for Serf::TypeSailor
-          mutex_unlock();
+          // hardcoding is_water_path to false because I am seeing weird crash with this checking for Serf::TypeSailor
+          bool was_called = run_command(ReplayCommand(ReplayCommand::TypeCallTransporter, player_index, flag->get_index(), dir, false));
 
           /*
           if (!was_called) {
@@ -1663,10 +1798,8 @@ AI::do_send_geologists() {
           }
           if (other_flags == 0) {
             AILogDebug["do_send_geologists"] << inventory_pos << " no other flags nearby " << pos << ", building flag here";
-            mutex_lock("AI::do_send_geologists calling game->build_flag, for geologist");
-            //bool flag_was_built = game->build_flag(pos, player);
-            game->build_flag(pos, player);  // we aren't checking return code, instead checking if the game sees the flag
-            mutex_unlock();
+            // we aren't checking return code, instead checking if the game sees the flag
+            run_command(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, pos));
             sleep_speed_adjusted(2000);
             if (!map->has_flag(pos)) {
               AILogDebug["do_send_geologists"] << inventory_pos << " failed to build flag at pos " << pos << "!!! why??";
@@ -1695,9 +1828,7 @@ AI::do_send_geologists() {
                 // it seems this check is not actually required because Game::demolish_flag will check first, oh well
                 AILogDebug["do_send_geologists"] << inventory_pos << " this flag no longer exists!  not removing";
               }else{
-                mutex_lock("AI::do_send_geologists calling demolish_flag (built for geologist, couldn't connect)");
-                game->demolish_flag(pos, player);
-                mutex_unlock();
+                run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, pos));
                 sleep_speed_adjusted(2000);
                 AILogDebug["do_send_geologists"] << inventory_pos << " adding this flag pos " << pos << " to bad_building_pos list";
                 // because there is no Building::Type for a plain flag, use Building::TypeNone for now.
@@ -1733,9 +1864,7 @@ AI::do_send_geologists() {
             AILogDebug["do_send_geologists"] << inventory_pos << " no idle or potential geologists available, returning";
             return;
           }
-          mutex_lock("AI::do_send_geologists calling game->send_geologist(flag)");
-          bool was_sent = game->send_geologist(flag);
-          mutex_unlock();
+          bool was_sent = run_command(ReplayCommand(ReplayCommand::TypeSendGeologist, player_index, flag->get_index()));
           if (was_sent) {
             AILogDebug["do_send_geologists"] << inventory_pos << " sent an geologist to pos " << pos << ", moving on to next corner";
             idle_geologists--;
@@ -1861,9 +1990,7 @@ AI::do_demolish_unproductive_3rd_lumberjacks() {
       }
       if (ranger_count > 0 && mature_tree_count < near_trees_min) {
         AILogDebug["do_demolish_unproductive_3rd_lumberjacks"] << "3rd lumberjack at pos " << lumberjack_pos << " has a nearby ranger yet still only has " << mature_tree_count << ", less than near_trees_min " << near_trees_min << ".  Burning it so it can be replaced in a better spot";
-        mutex_lock("AI::do_demolish_unproductive_3rd_lumberjacks calling game->demolish_building");
-        game->demolish_building(lumberjack_pos, player);
-        mutex_unlock();
+        run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, lumberjack_pos));
         // sleep to appear more human
         sleep_speed_adjusted(3000);
         break;
@@ -1908,9 +2035,7 @@ AI::do_remove_road_stubs() {
     Direction road_dir = DirectionNone;
     if (flag_and_road_suitable_for_removal(game, map, flag_pos, &road_dir)) {
       AILogDebug["do_remove_road_stubs"] << "occupied ranger at pos " << pos << "'s flag has only one path and no resources, removing the stub road";
-      mutex_lock("AI::do_remove_road_stubs calling game->demolish_road() (for do_remove_road_stubs) for ranger");
-      game->demolish_road(map->move(flag_pos, road_dir), player);
-      mutex_unlock();
+      run_command(ReplayCommand(ReplayCommand::TypeDemolishRoad, player_index, map->move(flag_pos, road_dir)));
       roads_removed++;
       // sleep a bit to be more human like
       sleep_speed_adjusted(3000);
@@ -1919,9 +2044,12 @@ AI::do_remove_road_stubs() {
   //
   // a mountain/geologist road, if sign density > max
   //
-  Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-  for (Flag *flag : flags_copy) {
-    if (flag == nullptr || flag->get_owner() != player_index || !flag->is_connected() || flag->has_building())
+  PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+    if (flag_info.owner != player_index || !flag_info.connected || flag_info.has_building)
+      continue;
+    Flag *flag = get_live_flag(flag_info);
+    if (flag == nullptr || !flag->is_connected() || flag->has_building())
       continue;
     MapPos flag_pos = flag->get_position();
     if (!AI::has_terrain_type(game, flag_pos, Map::TerrainTundra0, Map::TerrainSnow1))
@@ -1950,10 +2078,8 @@ AI::do_remove_road_stubs() {
     Direction road_dir = DirectionNone;
     if (flag_and_road_suitable_for_removal(game, map, flag_pos, &road_dir)) {
       AILogDebug["do_remove_road_stubs"] << "eligible geologist road ending with flag at pos " << flag_pos << " has only one path and no resources, removing the stub road and its end flag";
-      mutex_lock("AI::do_remove_road_stubs calling game->demolish_road() and flag (for do_remove_road_stubs) for geologist flag");
-      game->demolish_road(map->move(flag_pos, road_dir), player);
-      game->demolish_flag(flag_pos, player);
-      mutex_unlock();
+      run_commands({ReplayCommand(ReplayCommand::TypeDemolishRoad, player_index, map->move(flag_pos, road_dir)),
+                    ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos)});
       roads_removed++;
       // sleep a bit to be more human like
       sleep_speed_adjusted(3000);
@@ -1962,9 +2088,12 @@ AI::do_remove_road_stubs() {
   //
   // any non-mountain road that dead-ends and has no building attached
   //
-  flags_copy = *(game->get_flags());  // refresh the a copy
-  for (Flag *flag : flags_copy) {
-    if (flag == nullptr || flag->get_owner() != player_index || !flag->is_connected() || flag->has_building())
+  snapshot = game->get_world_snapshot();  // refresh, the mountain stubs are gone now if the game thread published since
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+    if (flag_info.owner != player_index || !flag_info.connected || flag_info.has_building)
+      continue;
+    Flag *flag = get_live_flag(flag_info);
+    if (flag == nullptr || !flag->is_connected() || flag->has_building())
       continue;
     MapPos flag_pos = flag->get_position();
     if (AI::has_terrain_type(game, flag_pos, Map::TerrainTundra0, Map::TerrainSnow1))
@@ -1972,10 +2101,8 @@ AI::do_remove_road_stubs() {
     Direction road_dir = DirectionNone;
     if (flag_and_road_suitable_for_removal(game, map, flag_pos, &road_dir)) {
       AILogDebug["do_remove_road_stubs"] << "eligible non-mountain road ending with flag at pos " << flag_pos << " has only one path and no resources, removing the stub road and its end flag";
-      mutex_lock("AI::do_remove_road_stubs calling game->demolish_road() and flag (for do_remove_road_stubs) for non-mountain flag");
-      game->demolish_road(map->move(flag_pos, road_dir), player);
-      game->demolish_flag(flag_pos, player);
-      mutex_unlock();
+      run_commands({ReplayCommand(ReplayCommand::TypeDemolishRoad, player_index, map->move(flag_pos, road_dir)),
+                    ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos)});
       roads_removed++;
       // sleep a bit to be more human like
       sleep_speed_adjusted(3000);
@@ -1996,9 +2123,15 @@ AI::do_remove_road_stubs() {
   if (loop_count % 6 != 0) {
     AILogDebug["do_remove_road_stubs"] << "skipping eligible knight hut stub roads, only running this every X loops";
   }else{
-    flags_copy = *(game->get_flags());  // refresh the copy again
-    for (Flag *flag : flags_copy) {
-      if (flag == nullptr || flag->get_owner() != player_index || !flag->is_connected() || !flag->has_building())
+    snapshot = game->get_world_snapshot();  // refresh again
+    for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+      if (flag_info.owner != player_index || !flag_info.connected || !flag_info.has_building)
+        continue;
+      const WorldSnapshot::BuildingInfo *building_info = snapshot->get_building(flag_info.building_index);
+      if (building_info == nullptr || building_info->type != Building::TypeHut || !building_info->done || !building_info->has_knight)
+        continue;
+      Flag *flag = get_live_flag(flag_info);
+      if (flag == nullptr || !flag->is_connected() || !flag->has_building())
         continue;
       if (flag->get_building()->get_type() != Building::TypeHut)
         continue;
@@ -2084,36 +2217,40 @@ AI::do_remove_road_stubs() {
             continue;
           }
 
-          // build the road (and new flag if needed)
-          mutex_lock("AI::do_remove_road_stubs calling game->build_flag/build_road() for knight hut stub");
-          bool built_flag = false;
+          // build the road (and new flag if needed), in the same update
+          std::vector<ReplayCommand> commands;
           if (needs_flag){
             AILogDebug["do_remove_road_stubs"] << "trying to build flag for replacement road for knight hut stub road ending with flag at pos " << flag_pos;
-            built_flag = game->build_flag(pos, player);
+            commands.push_back(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, pos));
+          }
+          AILogDebug["do_remove_road_stubs"] << "trying to build replacement road for knight hut stub road ending with flag at pos " << flag_pos;
+          commands.push_back(build_road_command(proposed_direct_road));
+          std::vector<GameCommandQueue::Result> results = game->post_commands(commands);
+          bool built_flag = false;
+          if (needs_flag){
+            built_flag = wait_command(&results.front());
             if (built_flag){
               AILogDebug["do_remove_road_stubs"] << "eligible knight hut stub road ending with flag at pos " << flag_pos << ", successfully built flag for replacement road, at pos " << pos;
             }else{
+              // the road cannot have been built either without its end flag
               AILogDebug["do_remove_road_stubs"] << "eligible knight hut stub road ending with flag at pos " << flag_pos << ", failed to build flag for replacement road, at pos " << pos << ", will keep trying";
-              mutex_unlock();
+              wait_command(&results.back());
               continue;
             }
           }
-          AILogDebug["do_remove_road_stubs"] << "trying to build replacement road for knight hut stub road ending with flag at pos " << flag_pos;
-          was_built = game->build_road(proposed_direct_road, player);
+          was_built = wait_command(&results.back());
           roads_removed++;
           if (was_built){
             AILogDebug["do_remove_road_stubs"] << "eligible knight hut stub road ending with flag at pos " << flag_pos << ", successfully built replacement road, to flag/pos " << pos;
-            mutex_unlock();
             break;
           }else{
             AILogDebug["do_remove_road_stubs"] << "eligible knight hut stub road ending with flag at pos " << flag_pos << ", failed to build replacement road to flag/pos " << pos << ", will keep trying";
             // demolish any newly built flag if road failed
             if (built_flag){
               AILogDebug["do_remove_road_stubs"] << "demolishing newly built flag for replacement road for knight hut stub road ending with flag at pos " << flag_pos;
-              game->demolish_flag(pos, player);
+              run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, pos));
             }
           }
-          mutex_unlock();
         }
       }
 
@@ -2121,9 +2258,7 @@ AI::do_remove_road_stubs() {
 
       if (was_built){
         AILogDebug["do_remove_road_stubs"] << "eligible knight hut stub road ending with flag at pos " << flag_pos << " had replacement road built, destroying old road in dir " << NameDirection[road_dir] << " / " << road_dir;
-        mutex_lock("AI::do_remove_road_stubs calling game->demolish_road() for knight hut road");
-        game->demolish_road(map->move(flag_pos, road_dir), player);
-        mutex_unlock();
+        run_command(ReplayCommand(ReplayCommand::TypeDemolishRoad, player_index, map->move(flag_pos, road_dir)));
         roads_removed++;
         // sleep a bit to be more human like
         sleep_speed_adjusted(3000);
@@ -2153,9 +2288,7 @@ AI::do_demolish_unproductive_stonecutters() {
     int stones_check = AI::count_stones_near_pos(pos, AI::spiral_dist(4));
     if (stones_check < 1) {
       AILogDebug["do_demolish_unproductive_stonecutters"] << "stonecutter at pos " << pos << " has no more stones nearby!  burning it";
-      mutex_lock("AI::do_demolish_unproductive_stonecutters calling game->demolish_building()");
-      game->demolish_building(pos, player);
-      mutex_unlock();
+      run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, pos));
       // mark as bad pos, because there should be no reason it could ever become valid again (stone piles cannot regrow)
       bad_building_pos.insert(std::make_pair(pos, Building::TypeStonecutter));
       // sleep to appear more human
@@ -2264,9 +2397,7 @@ AI::do_demolish_unproductive_mines() {
     }else{
       AILogDebug["do_demolish_unproductive_mines"] << "mine of type " << NameBuilding[building_type] << " at pos " << building_pos << " has 'progress' " << std::bitset<16>(building->get_progress()) << " which shows no recent success, will demolish";
       AILogDebug["do_demolish_unproductive_mines"] << "burning unproductive mine of type " << NameBuilding[building_type] << " at pos " << building_pos;
-      mutex_lock("AI::do_demolish_unproductive_mines calling game->demolish_building (for demolish unproductive mines)");
-      game->demolish_building(building_pos, player);
-      mutex_unlock();
+      run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building_pos));
       // mark as bad pos, because rebuilding same mine type seems pointless if it is actually out of resources
       bad_building_pos.insert(std::make_pair(building_pos, building_type));
       // sleep to appear more human
@@ -2302,9 +2433,7 @@ AI::do_demolish_excess_lumberjacks() {
         }
         else {
           AILogDebug["do_demolish_excess_lumberjacks"] << inventory_pos << " burning lumberjack at pos " << pos;
-          mutex_lock("AI::do_demolish_excess_lumberjacks calling game->demolish_building()");
-          game->demolish_building(pos, player);
-          mutex_unlock();
+          run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, pos));
           // do NOT mark as bad pos
           //bad_building_pos.AI::do_demolish_excess_lumberjacks() {
           // sleep to appear more human
@@ -2379,9 +2508,7 @@ AI::do_demolish_excess_foresters() {
       }
       AILogDebug["do_demolish_excess_foresters"] << inventory_pos << " forester hut at pos " << forester_pos << " has " << open_positions << " open_positions within its work radius out of " << possible_positions << " possible_positions, this is below min of " << min_pct_open_positions_burn_excess_forester << "%, burning it to avoid crowding";
       AILogDebug["do_demolish_excess_foresters"] << inventory_pos << " burning forester at pos " << forester_pos;
-      mutex_lock("AI::do_demolish_excess_foresters calling game->demolish_building()");
-      game->demolish_building(forester_pos, player);
-      mutex_unlock();
+      run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, forester_pos));
       sleep_speed_adjusted(3000); // sleep to appear more human
     }
   }
@@ -2413,9 +2540,7 @@ AI::do_demolish_excess_food_buildings() {
 		    if (find_nearest_inventory(map, player_index, building->get_position(), DistType::FlagOnly, &ai_mark_pos) != inventory_pos)
           continue;
         AILogDebug["do_demolish_excess_food_buildings"] << inventory_pos << " burning food building of type " << NameBuilding[building->get_type()] << " at pos " << building->get_position();
-        mutex_lock("AI::do_demolish_excess_food_buildings calling game->get_player_buildings(player)");
-        game->demolish_building(building->get_position(), player);
-        mutex_unlock();
+        run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building->get_position()));
         // sleep to appear more human
         sleep_speed_adjusted(3000);
       }
@@ -2464,17 +2589,13 @@ AI::do_disconnect_or_demolish_excess_mines(std::string type, Building::Type buil
     }else if (paths == 1){
       // remove the road to disconnect the flag
       AILogDebug["do_disconnect_excess_mines"] << inventory_pos << " excess " << type << " mine at pos " << building->get_position() << "'s flag has only a single road, disconnecting it";
-      mutex_lock("AI::do_disconnect_excess_mines calling game->demolish_road()");
-      game->demolish_road(map->move(bld_flag->get_position(), last_path_dir), player);
-      mutex_unlock();
+      run_command(ReplayCommand(ReplayCommand::TypeDemolishRoad, player_index, map->move(bld_flag->get_position(), last_path_dir)));
       sleep_speed_adjusted(3000); // sleep a bit to be more human like
       continue;
     }else{
       // cannot remove the road, instead burn the mine
       AILogDebug["do_disconnect_excess_mines"] << inventory_pos << " excess " << type << " mine at pos " << building->get_position() << "'s flag has multiple roads, burning mine instead";
-      mutex_lock("AI::do_disconnect_excess_mines calling demolish building");
-      game->demolish_building(building->get_position(), player);
-      mutex_unlock();
+      run_command(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building->get_position()));
       sleep_speed_adjusted(3000); // sleep a bit to be more human like
     }
   } // foreach Building
@@ -3859,9 +3980,15 @@ AI::do_connect_coal_mines() {
       return;
     }
     // connect a disconnected coal mine that was placed if conditions are right
-    Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-    for (Flag *flag : flags_copy) {
-      if (flag == nullptr || flag->get_owner() != player_index || flag->is_connected() || !flag->has_building())
+    PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+    for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+      if (flag_info.owner != player_index || flag_info.connected || !flag_info.has_building)
+        continue;
+      const WorldSnapshot::BuildingInfo *building_info = snapshot->get_building(flag_info.building_index);
+      if (building_info == nullptr || building_info->type != Building::TypeCoalMine)
+        continue;
+      Flag *flag = get_live_flag(flag_info);
+      if (flag == nullptr || flag->is_connected() || !flag->has_building())
         continue;
       if (flag->get_building()->get_type() != Building::TypeCoalMine)
         continue;
@@ -3884,19 +4011,19 @@ AI::do_connect_coal_mines() {
         // the build_best road call can be long, double-check to make sure this building and flag even still exist!
         Flag *failed_flag = game->get_flag_at_pos(flag_pos);
         Building *failed_building = game->get_building_at_pos(building_pos);
-        mutex_lock("AI::do_connect_coal_mines calling demolish flag&building (failed to connect coal mine)");
+        std::vector<ReplayCommand> commands;
         if (failed_building == nullptr){
           AILogInfo["do_connect_coal_mines"] << inventory_pos << " the failed building no longer exists, nothing to demolish";
         }else{
-          game->demolish_building(building_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building_pos));
         }
         AILogDebug["do_connect_coal_mines"] << inventory_pos << " demolishing flag for coal mine that could not be connected to road network";
         if (failed_flag == nullptr){
           AILogInfo["do_connect_coal_mines"] << inventory_pos << " the failed flag no longer exists, nothing to demolish";
         }else{
-          game->demolish_flag(flag_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
         }
-        mutex_unlock();
+        run_commands(commands);
         // sleep to appear more human
         sleep_speed_adjusted(3000);
       }
@@ -3934,9 +4061,15 @@ AI::do_connect_iron_mines() {
       return;
     }
     // connect any disconnected iron mine that was placed if conditions are right
-    Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-    for (Flag *flag : flags_copy) {
-      if (flag == nullptr || flag->get_owner() != player_index || flag->is_connected() || !flag->has_building())
+    PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+    for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+      if (flag_info.owner != player_index || flag_info.connected || !flag_info.has_building)
+        continue;
+      const WorldSnapshot::BuildingInfo *building_info = snapshot->get_building(flag_info.building_index);
+      if (building_info == nullptr || building_info->type != Building::TypeIronMine)
+        continue;
+      Flag *flag = get_live_flag(flag_info);
+      if (flag == nullptr || flag->is_connected() || !flag->has_building())
         continue;
       if (flag->get_building()->get_type() != Building::TypeIronMine)
         continue;
@@ -3959,19 +4092,19 @@ AI::do_connect_iron_mines() {
         // the build_best road call can be long, double-check to make sure this building and flag even still exist!
         Flag *failed_flag = game->get_flag_at_pos(flag_pos);
         Building *failed_building = game->get_building_at_pos(building_pos);
-        mutex_lock("AI::do_connect_iron_mines calling demolish flag&building (failed to connect iron mine)");
+        std::vector<ReplayCommand> commands;
         if (failed_building == nullptr){
           AILogInfo["do_connect_iron_mines"] << inventory_pos << " the failed building no longer exists, nothing to demolish";
         }else{
-          game->demolish_building(building_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building_pos));
         }
         AILogDebug["do_connect_iron_mines"] << inventory_pos << " demolishing flag for iron mine that could not be connected to road network";
         if (failed_flag == nullptr){
           AILogInfo["do_connect_iron_mines"] << inventory_pos << " the failed flag no longer exists, nothing to demolish";
         }else{
-          game->demolish_flag(flag_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
         }
-        mutex_unlock();
+        run_commands(commands);
         // sleep to appear more human
         sleep_speed_adjusted(3000);
       }
@@ -4001,9 +4134,15 @@ AI::do_connect_stone_mines() {
       return;
     }
     // connect any disconnected stone mine that was placed if conditions are right
-    Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-    for (Flag *flag : flags_copy) {
-      if (flag == nullptr || flag->get_owner() != player_index || flag->is_connected() || !flag->has_building())
+    PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+    for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+      if (flag_info.owner != player_index || flag_info.connected || !flag_info.has_building)
+        continue;
+      const WorldSnapshot::BuildingInfo *building_info = snapshot->get_building(flag_info.building_index);
+      if (building_info == nullptr || building_info->type != Building::TypeStoneMine)
+        continue;
+      Flag *flag = get_live_flag(flag_info);
+      if (flag == nullptr || flag->is_connected() || !flag->has_building())
         continue;
       if (flag->get_building()->get_type() != Building::TypeStoneMine)
         continue;
@@ -4026,19 +4165,19 @@ AI::do_connect_stone_mines() {
         // the build_best road call can be long, double-check to make sure this building and flag even still exist!
         Flag *failed_flag = game->get_flag_at_pos(flag_pos);
         Building *failed_building = game->get_building_at_pos(building_pos);
-        mutex_lock("AI::do_connect_stone_mines calling demolish flag&building (failed to connect stone mine)");
+        std::vector<ReplayCommand> commands;
         if (failed_building == nullptr){
           AILogInfo["do_connect_stone_mines"] << inventory_pos << " the failed building no longer exists, nothing to demolish";
         }else{
-          game->demolish_building(building_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building_pos));
         }
         AILogDebug["do_connect_stone_mines"] << inventory_pos << " demolishing flag for stone mine that could not be connected to road network";
         if (failed_flag == nullptr){
           AILogInfo["do_connect_stone_mines"] << inventory_pos << " the failed flag no longer exists, nothing to demolish";
         }else{
-          game->demolish_flag(flag_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
         }
-        mutex_unlock();
+        run_commands(commands);
         // sleep to appear more human
         sleep_speed_adjusted(3000);
       }
@@ -4273,9 +4412,15 @@ AI::do_build_gold_smelter_and_connect_gold_mines() {
   //
   if (stock_building_counts.at(inventory_pos).needs_gold_ore){
     AILogDebug["do_build_gold_smelter_and_connect_gold_mines"] << inventory_pos << " looking for a disconnected gold mine to connect to road system";
-    Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-    for (Flag *flag : flags_copy) {
-      if (flag == nullptr || flag->get_owner() != player_index || flag->is_connected() || !flag->has_building())
+    PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+    for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+      if (flag_info.owner != player_index || flag_info.connected || !flag_info.has_building)
+        continue;
+      const WorldSnapshot::BuildingInfo *building_info = snapshot->get_building(flag_info.building_index);
+      if (building_info == nullptr || building_info->type != Building::TypeGoldMine)
+        continue;
+      Flag *flag = get_live_flag(flag_info);
+      if (flag == nullptr || flag->is_connected() || !flag->has_building())
         continue;
       if (flag->get_building()->get_type() != Building::TypeGoldMine)
         continue;
@@ -4298,19 +4443,19 @@ AI::do_build_gold_smelter_and_connect_gold_mines() {
         // the build_best road call can be long, double-check to make sure this building and flag even still exist!
         Flag *failed_flag = game->get_flag_at_pos(flag_pos);
         Building *failed_building = game->get_building_at_pos(building_pos);
-        mutex_lock("AI::do_build_gold_smelter_and_connect_gold_mines calling demolish flag&building (failed to connect gold mine)");
+        std::vector<ReplayCommand> commands;
         if (failed_building == nullptr){
           AILogInfo["do_build_gold_smelter_and_connect_gold_mines"] << inventory_pos << " the failed building no longer exists, nothing to demolish";
         }else{
-          game->demolish_building(building_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishBuilding, player_index, building_pos));
         }
         AILogDebug["do_build_gold_smelter_and_connect_gold_mines"] << inventory_pos << " demolishing flag for gold mine that could not be connected to road network";
         if (failed_flag == nullptr){
           AILogInfo["do_build_gold_smelter_and_connect_gold_mines"] << inventory_pos << " the failed flag no longer exists, nothing to demolish";
         }else{
-          game->demolish_flag(flag_pos, player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
         }
-        mutex_unlock();
+        run_commands(commands);
         // sleep to appear more human
         sleep_speed_adjusted(3000);
       }
@@ -4586,30 +4731,21 @@ AI::do_count_resources_sitting_at_flags(MapPos inv_pos) {
   AILogDebug["do_count_resources_sitting_at_flags"] << inv_pos << " HouseKeeping: count resources sitting at flag";
   ai_status.assign("do_count_resources_sitting_at_flags");
   ResourceMap res_at_flags;
-  Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-  for (Flag *flag : flags_copy) {
-    if (flag == nullptr)
-      continue;
-    if (flag->get_owner() != player_index)
+  PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+    if (flag_info.owner != player_index)
       continue;
-    if (!flag->is_connected())
+    if (!flag_info.connected)
       continue;
     // don't spend time doing a flagsearch unless it actually has a resource sitting
-    bool has_res = false;
-    for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
-      Resource::Type type = flag->get_resource_at_slot(i);
-      if (type != Resource::TypeNone){
-        has_res = true;
-      }
-    }
-    if (!has_res)
+    if (!flag_info.has_resources())
       continue;
-    if (find_nearest_inventory(map, player_index, flag->get_position(), DistType::FlagOnly, &ai_mark_pos) != inv_pos)
+    if (find_nearest_inventory(map, player_index, flag_info.pos, DistType::FlagOnly, &ai_mark_pos) != inv_pos)
       continue;
     for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
-      Resource::Type type = flag->get_resource_at_slot(i);
+      Resource::Type type = flag_info.slot[i];
       if (type != Resource::TypeNone){
-        //AILogDebug["do_count_resources_sitting_at_flags"] << "flag at pos " << flag->get_position() << " has a resource of type " << NameResource[type] << " at slot " << i;
+        //AILogDebug["do_count_resources_sitting_at_flags"] << "flag at pos " << flag_info.pos << " has a resource of type " << NameResource[type] << " at slot " << i;
         stock_res_sitting_at_flags[inv_pos][type]++;
         realm_res_sitting_at_flags[type]++;
       }
@@ -5094,9 +5230,7 @@ AI::do_create_star_roads_for_new_warehouses(){
         //not now... first see how well it works
 
         AILogDebug["do_create_star_roads_for_new_warehouse"] << inventory_pos << " destroying road for flag_pos " << flag_pos << " in dir " << only_dir << " / " << NameDirection[only_dir];
-        mutex_lock("AI::do_create_star_roads_for_new_warehouse calling game->demolish_road()");
-        bool was_destroyed = game->demolish_road(map->move(flag_pos, only_dir), player);
-        mutex_unlock();
+        bool was_destroyed = run_command(ReplayCommand(ReplayCommand::TypeDemolishRoad, player_index, map->move(flag_pos, only_dir)));
         if (was_destroyed){
           roads_removed++;
           // any time a road is removed, force retrying the entire set in case new possibilities open up
@@ -5133,86 +5267,34 @@ AI::do_connect_disconnected_road_networks(){
   AILogDebug["do_connect_disconnected_road_networks"] << "starting";
   ai_status.assign("do_connect_disconnected_road_networks");
 
+  // the game keeps track of which flags are connected by roads (see
+  //  flag-components.h), this used to work the groups out here by merging
+  //  sets of neighbouring flags.  Only the networks that cannot reach an
+  //  inventory need connecting, the one with the castle always can
   std::vector<std::set<unsigned int>> network = {};
+  std::map<unsigned int, size_t> network_by_id = {};
 
-  Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-  for (Flag *flag : flags_copy) {
+  PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
 
-    if (flag == nullptr)
+    if (flag_info.owner != player_index)
       continue;
-    if (flag->get_owner() != player_index)
+    if (flag_info.connected_to_inventory)
       continue;
 
-    //AILogDebug["do_connect_disconnected_road_networks"] << "global flag " << flag->get_index();
-
-    // create a list containing this flag and its neighbors
-    std::set<unsigned int> these_flags = { flag->get_index() };
-    for (Direction dir : cycle_directions_cw()){
-      Flag *other_end_flag = flag->get_other_end_flag(dir);
-      bool rejected = false;
-      if (other_end_flag == nullptr){
-        // this seems to happen constantly and isn't really an issue?
-        //AILogWarn["do_connect_disconnected_road_networks"] << "other_end_flag is nullptr!  skipping this dir";
-        rejected = true;
-        continue;
-      }
-      // I am seeing other_end_flag giving a valid flag, but one that isn't actaully connected to this flag!! why???
-      //  adding a backup check, and throwing a warning if they do not both agree
-      if (!map->has_path_IMPROVED(flag->get_position(), dir)){
-        //AILogDebug["do_connect_disconnected_road_networks"] << "map has no path in dir " << dir << " / " << NameDirection[dir] << "! rejecting";
-        rejected = true;
-      }else if (other_end_flag == nullptr){
-        AILogWarn["do_connect_disconnected_road_networks"] << "RARE sanity check failed! other_end_flag in dir " << dir << " / " << NameDirection[dir] << " is nullptr, but map has path in dir! is this Dir4/UpLeft?  is there a building here?";
-        //AILogError["do_connect_disconnected_road_networks"] << "pausing game for debugging RARE sanity checked failed other_end_flag in dir";
-        //game->pause();
-      }
-
-      if (rejected)
-        continue;
-      unsigned int other_end_flag_index = other_end_flag->get_index();
-      //AILogDebug["do_connect_disconnected_road_networks"] << "global flag has partner in dir " << dir << " / " << NameDirection[dir] << " with index " << other_end_flag_index;
-      these_flags.insert(other_end_flag_index);
-    }
-
-    //for (unsigned int flag_index : these_flags){
-    //  AILogDebug["do_connect_disconnected_road_networks"] << "these_flags contains " << flag_index;
-    //}
-
-    int found = -1; // the first matching group, if any match found
-    for (unsigned int flag_index : these_flags){
-      found = -1;
-      for (int i = 0; i < network.size(); i++){
-        if (network[i].count(flag_index)){
-          //AILogDebug["do_connect_disconnected_road_networks"] << "found " << flag_index << " in group #" << i;
-          if (found == -1){
-            // this is first group found with a matching flag, insert all these_flags into group
-            found = i;
-            //AILogDebug["do_connect_disconnected_road_networks"] << "first group found, inserting these_flags into network[" << i << "]";
-            network[i].insert(these_flags.begin(), these_flags.end());
-          }else{
-            //AILogDebug["do_connect_disconnected_road_networks"] << "another found, merging this group #" << i << " into first found group #" << found;
-            // this is another matching group, merge it into the first group found, they must be one network
-            network[found].insert(network[i].begin(), network[i].end());
-            // erase the group that was merged into earlier group
-            //  by swapping it to the end of the vector and then popping it off
-            //AILogDebug["do_connect_disconnected_road_networks"] << "removing group #" << i;
-            std::swap(network[i], network.back());
-            network.pop_back();
-          }
-        }
-      }
-    }
-    if (found == -1){
-      //AILogDebug["do_connect_disconnected_road_networks"] << "no match, creating new group containing these_flags";
-      network.push_back(these_flags);
+    auto found = network_by_id.find(flag_info.road_network);
+    if (found == network_by_id.end()){
+      found = network_by_id.insert(std::make_pair(flag_info.road_network, network.size())).first;
+      network.push_back({});
     }
+    network[found->second].insert(flag_info.index);
 
   } // foreach Flag in entire game
 
   //AILogDebug["do_connect_disconnected_road_networks"] << "done search, found " << network.size() << " separate flag_groups";
   for (int i = 0; i < network.size(); i++){
     //AILogDebug["do_connect_disconnected_road_networks"] << "network[" << i << "] contains " << network[i].size() << " elements";
-    if (i > 0 && network[i].size() > 1){
+    if (network[i].size() > 1){
       AILogDebug["do_connect_disconnected_road_networks"] << "DISCONNECTED ROAD SYSTEM FOUND: network[" << i << "] contains " << network[i].size() << " elements";
       Roads possible_roads = {};
       for (unsigned int flag_index : network[i]){
@@ -5267,22 +5349,24 @@ AI::do_connect_disconnected_road_networks(){
       bool was_built = false;
       for (Road road : possible_roads){
         AILogDebug["do_connect_disconnected_road_networks"] << "DISCONNECTED ROAD SYSTEM: network[" << i << "], attempting to build road to connect this road_network (using build_best_road which shuold connect to nearest inventory?)";
-        bool built_flag = false;
-        mutex_lock("AI::do_connect_disconnected_road_networks calling game->build_road");
+        // the splitting flag (if needed) and the road in the same update
+        std::vector<ReplayCommand> commands;
         if (!map->has_flag(road.get_end(map.get()))){
-          built_flag = game->build_flag(road.get_end(map.get()), player);
+          commands.push_back(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, road.get_end(map.get())));
         }
-        was_built = game->build_road(road, player);
+        commands.push_back(build_road_command(road));
+        std::vector<GameCommandQueue::Result> results = game->post_commands(commands);
+        bool built_flag = (commands.size() > 1 && wait_command(&results.front()));
+        was_built = wait_command(&results.back());
         if (was_built) {
           AILogInfo["do_connect_disconnected_road_networks"] << "DISCONNECTED ROAD SYSTEM: network[" << i << "], successfully built road to connect this road_network, from " << road.get_source() << " to " << road.get_end(map.get());
         }else{
           AILogDebug["do_connect_disconnected_road_networks"] << "DISCONNECTED ROAD SYSTEM: network[" << i << "], failed to build road! from " << road.get_source() << " to " << road.get_end(map.get()) << ", will try next one in list";
           if (built_flag){
             AILogDebug["do_connect_disconnected_road_networks"] << "DISCONNECTED ROAD SYSTEM: network[" << i << "], failed to build road! from " << road.get_source() << " to " << road.get_end(map.get()) << ", demolishing flag built for this splitting road";
-            game->demolish_flag(road.get_end(map.get()), player);
+            run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, road.get_end(map.get())));
           }
         }
-        mutex_unlock();
         if (was_built){
           sleep_speed_adjusted(3000); 
           break;
@@ -6,6 +6,8 @@
 #ifndef SRC_AI_H_
 #define SRC_AI_H_
 
+#include <deque>
+#include <functional>
 #include <map>
 #include <set>
 #include <string>        // to satisfy cpplinter
@@ -19,6 +21,7 @@
 #include <ctime>         // for timing function call runs
 #include <cstring>       // for memset
 
+#include "src/ai-scheduler.h"
 #include "src/audio.h"   // for audio notifications
 #include "src/flag.h"    // for flag->call_transporter for
 #include "src/game.h"
@@ -46,12 +49,27 @@ class AI {
   PGame game;
   PMap map;
   Player *player;
+  // the AI's own random numbers, drawing from the game Random from the AI
+  //  thread would make the game impossible to replay without the AI
+  Random ai_rnd;
   //Flags *flags;   // don't use a pointer to game.flags, not thread safe   ?  is this still used?  oct28 2020
   //Flags flags;    // instead use a copy that is created before each foreach Flag loop   ?  is this still used?  oct28 2020
   Flags *flags;        //or maybe just create a copy and move the pointer to point to that new copy instead?? is that easier than changing all the foreach Flag loops?   ?  is this still used?  oct28 2020
   Flags flags_static_copy;  // store the copy here each time it is fetched from game->get_flags    ?  is this still used?  oct28 2020
   unsigned int loop_count;
+  std::time_t loop_clock_start;  // to time the entire loop
   unsigned int player_index;
+  // one slice of the AI loop, next_loop queues them and AIScheduler runs
+  //  them one at a time, see ai-scheduler.h
+  typedef struct AIStep {
+    const char *name;
+    AIScheduler::Priority priority;
+    unsigned int budget_msec;
+    std::function<void()> run;
+  } AIStep;
+  std::deque<AIStep> steps;         // what is left of the current loop
+  unsigned int pending_pause_msec;  // sleep_speed_adjusted calls made by the step being run
+  bool logged_paused;
   std::string ai_status;        // used to describe what AI is doing when AI overlay is on (top-left corner of screen)
   unsigned int unfinished_building_count;
   unsigned int unfinished_hut_count;
@@ -123,8 +141,14 @@ class AI {
 
  public:
   AI(PGame, unsigned int);
-  void start();
+  // run the next step of the AI loop, called by AIScheduler.  Starts a new
+  //  loop with next_loop when the last one is done
+  AIScheduler::StepResult run_step();
   void next_loop();
+  void add_step(std::deque<AIStep> *to, const char *name, AIScheduler::Priority priority,
+                std::function<void()> run, unsigned int budget_msec = AIScheduler::default_budget_msec);
+  void queue_inventory_steps(std::deque<AIStep> *to, MapPos pos);
+  void skip_economy_steps();
   ColorDotMap * get_ai_mark_pos() { return &ai_mark_pos; }
   std::vector<int> * get_ai_mark_serf() { return &ai_mark_serf; }
   Road * get_ai_mark_road() { return ai_mark_road; }
@@ -195,7 +219,18 @@ class AI {
   // stupid way to pass game speed and AI loop count to viewport for AI overlay
   unsigned int get_game_speed() { return game->get_game_speed(); }
   unsigned int get_loop_count() { return loop_count; }
+  // the AI runs on AIScheduler's shared workers, so this doesn't actually
+  //  sleep, it adds to the pause before this AI's next step is run
   void sleep_speed_adjusted(int msec){
+    pending_pause_msec += speed_adjusted_msec(msec);
+  }
+  // really block, only for the few places that wait for the game to change.
+  //  AIScheduler starts another worker for the other AIs meanwhile
+  void wait_speed_adjusted(int msec){
+    AIScheduler::Blocking blocking;
+    std::this_thread::sleep_for(std::chrono::milliseconds(speed_adjusted_msec(msec) + 1));
+  }
+  unsigned int speed_adjusted_msec(int msec){
     // sleep for specified millisec if speed is normal '2'
     // adjust sleep speed to be less as game speed increases
     int speed = game->get_game_speed();
@@ -207,8 +242,7 @@ class AI {
       //msec_ = msec_ * 1/((speed - 1) / 4);  // this works pretty well, at game speed 40 ai pause time is about 9% of game speed 2
     }
     //AILogDebug["sleep_speed_adjusted"] << "msec: " << msec << ", game speed: " << speed << ", adjusted msec: " << int(msec_);
-    msec = msec_;
-    std::this_thread::sleep_for(std::chrono::milliseconds(msec + 1));
+    return static_cast<unsigned int>(msec_);
   }
   std::set<std::string> get_ai_expansion_goals() { return expand_towards; }
   MapPos get_ai_inventory_pos() { return inventory_pos; }
@@ -218,6 +252,13 @@ class AI {
   void set_forbidden_pos_around_inventory(MapPos inventory_flag_pos);
   void mutex_lock(const char* message);
   void mutex_unlock();
+  // AI writes are posted to the game's command queue rather than made under
+  //  the mutex, see game-command-queue.h.  These wait until Game::update has
+  //  applied them, run_commands applies all of them in the same update
+  bool run_command(const ReplayCommand &command);
+  bool run_commands(const std::vector<ReplayCommand> &commands);
+  bool wait_command(GameCommandQueue::Result *result);
+  ReplayCommand build_road_command(const Road &road);
   
  protected:
   //
@@ -229,6 +270,8 @@ class AI {
   //bool place_castle(PGame, MapPos, unsigned int, unsigned int);
   bool place_castle(PGame, MapPos, unsigned int);  // moving the radius considered into the place_castle function instead of as argument
   static unsigned int spiral_dist(int);   // why does this need to be static?
+  // the live Flag for a flag seen in a WorldSnapshot, nullptr if it is gone since
+  Flag * get_live_flag(const WorldSnapshot::FlagInfo &flag_info);
   //void rebuild_all_roads();  // no longer need this
   // changing these to support *planning* a road without actually building it, prior to placing a new building
   //bool build_best_road(MapPos, RoadOptions, Building::Type optional_affinity = Building::TypeNone, MapPos optional_target = bad_map_pos);
@@ -331,6 +374,7 @@ class AI {
   // ai.cc
   //
   void do_place_castle();
+  void do_wait_for_castle();
   void do_consider_capitulation();
   void do_get_inventory(MapPos);
   void do_update_clear_reset();
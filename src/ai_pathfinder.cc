@@ -184,7 +184,10 @@ AI::plot_road(PMap map, unsigned int player_index, MapPos start_pos, MapPos end_
     // PERFORMANCE - try pausing for a very brief time every thousand pos checked to give the CPU a break, see if it fixes frame rate lag
     if (total_pos_considered > 0 && total_pos_considered % 1000 == 0){
       //AILogDebug["plot_road"] << start_pos << " to " << end_pos << ", plot_road: taking a quick sleep at " << total_pos_considered << " to give CPU a break";
-      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      {
+        AIScheduler::Blocking blocking;
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      }
       slept_msec += 200;
     }
     total_pos_considered++;
@@ -759,7 +762,10 @@ AI::plot_road(PMap map, unsigned int player_index, MapPos start_pos, MapPos end_
             // PERFORMANCE - try pausing for a very brief time every thousand pos checked to give the CPU a break, see if it fixes frame rate lag
             if (total_pos_considered > 0 && total_pos_considered % 1000 == 0){
               //AILogDebug["plot_road"] << start_pos << " to " << end_pos << ", plot_road: taking a quick sleep at " << total_pos_considered << " to give CPU a break";
-              std::this_thread::sleep_for(std::chrono::milliseconds(200));
+              {
+                AIScheduler::Blocking blocking;
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+              }
               slept_msec += 200;
             }
             total_pos_considered++;
@@ -1525,18 +1531,16 @@ AI::identify_arterial_roads(PMap map){
   //    val unsigned int  - number of times Flag appears in this InvFlag-Path combination
   std::map<MapPos,std::map<Direction,std::map<MapPos, unsigned int>>> flag_counts = {};
 
-  Flags flags_copy = *(game->get_flags());  // create a copy so we don't conflict with the game thread, and don't want to mutex lock for a long function
-  for (Flag *flag : flags_copy) {
-    if (flag == nullptr)
-      continue;
-    if (flag->get_owner() != player_index)
+  PWorldSnapshot snapshot = game->get_world_snapshot();  // read-only copy published by the game thread, no lock needed for a long function
+  for (const WorldSnapshot::FlagInfo &flag_info : snapshot->get_flags()) {
+    if (flag_info.owner != player_index)
       continue;
-    if (!flag->is_connected())
+    if (!flag_info.connected)
       continue;
     // don't do searches on Inventory flags (castle, warehouse/stocks)
-    if (flag->accepts_resources())
+    if (flag_info.accepts_resources)
       continue;
-    MapPos flag_pos = flag->get_position();
+    MapPos flag_pos = flag_info.pos;
     //AILogDebug["util_identify_arterial_roads"] << "checking flag at pos " << flag_pos;
 
     std::vector<PFlagSearchNode> open = {};
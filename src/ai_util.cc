@@ -79,6 +79,18 @@ AI::has_terrain_type(PGame game, MapPos pos, Map::Terrain res_start_index, Map::
   return false;
 }
 
+// the snapshot was taken up to WORLD_SNAPSHOT_TICKS ago, the flag may have been
+//  demolished since and its index even reused by a new flag somewhere else
+//  so check it is still the same one before touching it
+Flag *
+AI::get_live_flag(const WorldSnapshot::FlagInfo &flag_info) {
+  Flag *flag = game->get_flag(flag_info.index);
+  if (flag == nullptr || flag->get_position() != flag_info.pos || flag->get_owner() != flag_info.owner) {
+    return nullptr;
+  }
+  return flag;
+}
+
 // score specified area in terms of castle placement
 //   initially this is just ensuring enough wood, stones, and building sites
 //   long term it should also care about resources in the surrounding areas!  including mountains, fishable waters, etc.
@@ -291,14 +303,9 @@ AI::update_buildings() {
 
     if (type == Building::TypeCastle) {
       if (!building->is_done()) {
+        // the wait_for_castle step holds the AI loop until it is done, so
+        //  this shouldn't happen
         AILogDebug["util_update_buildings"] << "player's castle is not done building yet";
-        while (!building->is_done()) {
-          AILogDebug["util_update_buildings"] << "player's castle is not done building yet.  Sleeping a bit";
-          sleep_speed_adjusted(1000);
-        }
-        AILogDebug["util_update_buildings"] << "player's castle is now built, updating stocks";
-        // does the stocks_pos logic rely on the Castle always being the first building?  does it matter?
-        update_stocks_pos();
       }
       realm_occupied_military_pos.push_back(flag_pos);
       stock_building_counts.at(flag_pos).occupied_military_pos.push_back(flag_pos);
@@ -715,9 +722,7 @@ AI::build_best_road(MapPos start_pos, RoadOptions road_options, Road *built_road
         if (!map->has_flag(target_pos)){
           AILogDebug["util_build_best_road"] << "" << calling_function << " zzz direct road requested, no flag at target_pos, trying to build one";
           if (game->can_build_flag(target_pos, player)){
-            mutex_lock("AI::build_best_road calling game->build_flag (direct road target_pos has no flag)");
-            built_flag = game->build_flag(target_pos, player);
-            mutex_unlock();
+            built_flag = run_command(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, target_pos));
             if (built_flag){
               AILogDebug["util_build_best_road"] << "" << calling_function << " zzz direct road requested, built new flag at target_pos";
             }else{
@@ -776,9 +781,7 @@ AI::build_best_road(MapPos start_pos, RoadOptions road_options, Road *built_road
 
       bool was_built = false;
       if (plotted_succesfully && !convolution_rejected){
-        mutex_lock("AI::build_best_road calling game->build_road (direct road)");
-        was_built = game->build_road(proposed_direct_road, player);
-        mutex_unlock();
+        was_built = run_command(build_road_command(proposed_direct_road));
       }
       if (was_built) {
         AILogDebug["util_build_best_road"] << "" << calling_function << " zzz successfully built direct road from flag at " << start_pos << " to flag at " << target_pos;
@@ -808,9 +811,7 @@ AI::build_best_road(MapPos start_pos, RoadOptions road_options, Road *built_road
         AILogDebug["util_build_best_road"] << "" << calling_function << " zzz failed to connect specified flag to road system! returning false";
         if (built_flag){
           AILogDebug["util_build_best_road"] << "" << calling_function << " zzz removing newly built flag that was intended to terminate this failed road";
-          mutex_lock("AI::build_best_road calling game->demolish_flag (direct road to new flag failed)");
-          game->demolish_flag(target_pos, player);
-          mutex_unlock();
+          run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, target_pos));
         }
         return false;
       }
@@ -1870,9 +1871,7 @@ AI::build_best_road(MapPos start_pos, RoadOptions road_options, Road *built_road
         bool created_new_flag = false;
         if (!map->has_flag(this_segment_end_pos)) {
           AILogDebug["util_build_best_road"] << "" << calling_function << " this_segment_end_pos " << this_segment_end_pos << ", on way to final end_pos " << end_pos << " has no flag, must be fake flag/split road, trying to create a real flag";
-          mutex_lock("AI::build_best_road calling game->build_flag (split road)");
-          bool was_built = game->build_flag(this_segment_end_pos, player);
-          mutex_unlock();
+          bool was_built = run_command(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, this_segment_end_pos));
           if (was_built) {
             AILogDebug["util_build_best_road"] << "" << calling_function << " successfully built new flag at this_segment_end_pos " << this_segment_end_pos << ", on way to final end_pos " << end_pos << ", splitting the road";
             created_new_flag = true;
@@ -2049,9 +2048,7 @@ AI::build_best_road(MapPos start_pos, RoadOptions road_options, Road *built_road
         }else{
           // build the Road!
           AILogDebug["util_build_best_road"] << "" << calling_function << " about to build road with source=" << this_segment_start_pos << ", end=" << this_segment_end_pos << " and size " << road.get_length();
-          mutex_lock("AI::build_best_road calling game->build_road (non-direct road)");
-          bool was_built = game->build_road(road, game->get_player(player_index));
-          mutex_unlock();
+          bool was_built = run_command(build_road_command(road));
           if (was_built) {
             //roads_built++;
             AILogDebug["util_build_best_road"] << "" << calling_function << " successfully built road segment from " << this_segment_start_pos << " to " << this_segment_end_pos << ", with final end_pos " << end_pos << " as specified in PotentialRoad, roads segments built this target solution: " << road_segment_num;
@@ -2105,9 +2102,7 @@ AI::build_best_road(MapPos start_pos, RoadOptions road_options, Road *built_road
             //failed_solution_flags.push_back(this_segment_end_pos);
 
             AILogDebug["util_build_best_road"] << "" << calling_function << " removing the newly created flag at end_pos so it doesn't screw up the rest of the road solutions";
-            mutex_lock("AI::build_best_road calling game->demolish_flag (couldn't connect new flag)");
-            game->demolish_flag(end_pos, game->get_player(player_index));
-            mutex_unlock();
+            run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, end_pos));
           }
 
           if (!was_built){
@@ -2636,14 +2631,13 @@ AI::count_terrain_near_pos(MapPos center_pos, unsigned int distance, Map::Terrai
   //AILogDebug["util_count_terrain_near_pos"] << "inside count_terrain_near_pos";
   //AILogDebug["util_count_terrain_near_pos"] << "AI: center_pos " << center_pos << ", distance " << distance << ", res_start_index " << NameTerrain[res_start_index] << ", res_end_index " << NameTerrain[res_end_index];
   unsigned int count = 0;
-  for (unsigned int i = 0; i < distance; i++) {
-    MapPos pos = map->pos_add_extended_spirally(center_pos, i);
+  map->for_each_extended_spiral(center_pos, distance, [&](MapPos pos) {
     //AILogDebug["util_count_terrain_near_pos"] << "AI: terrain at pos " << pos << " has type " << terrain;
     if (AI::has_terrain_type(game, pos, res_start_index, res_end_index)) {
       //AILogDebug["util_count_terrain_near_pos"] << "AI: found matching terrain at pos " << pos;
       ++count;
     }
-  }
+  });
   //AILogDebug["util_count_terrain_near_pos"] << "AI: found count " << count << " matching terrain of types " << NameTerrain[res_start_index] << " - " << NameTerrain[res_end_index];
   return count;
 }
@@ -2659,8 +2653,7 @@ AI::count_empty_terrain_near_pos(MapPos center_pos, unsigned int distance, Map::
   //AILogDebug["util_count_empty_terrain_near_pos"] << "AI: inside AI::count_empty_terrain_near_pos";
   //AILogDebug["util_count_empty_terrain_near_pos"] << "AI: center_pos " << center_pos << ", distance " << distance << ", res_start_index " << NameTerrain[res_start_index] << ", res_end_index " << NameTerrain[res_end_index];
   unsigned int count = 0;
-  for (unsigned int i = 0; i < distance; i++) {
-    MapPos pos = map->pos_add_extended_spirally(center_pos, i);
+  map->for_each_extended_spiral(center_pos, distance, [&](MapPos pos) {
     //AILogDebug["util_count_empty_terrain_near_pos"] << "AI: terrain at pos " << pos << " has type " << terrain;
     if (AI::has_terrain_type(game, pos, res_start_index, res_end_index)) {
       Map::Object obj_type = map->get_obj(pos);
@@ -2671,7 +2664,7 @@ AI::count_empty_terrain_near_pos(MapPos center_pos, unsigned int distance, Map::
         ++count;
       }
     }
-  }
+  });
   //AILogDebug["util_count_empty_terrain_near_pos"] << "AI: found count " << count << " matching empty terrain of types " << NameTerrain[res_start_index] << " - " << NameTerrain[res_end_index];
   return count;
 }
@@ -2849,14 +2842,13 @@ AI::count_objects_near_pos(MapPos center_pos, unsigned int distance, Map::Object
   //AILogDebug["util_count_objects_near_pos"] << "AI: center_pos " << center_pos << ", distance " << distance << ", res_start_index " << res_start_index << "(" << NameObject[res_start_index] << ")"
   //      << ", res_end_index " << res_end_index << "(" << NameObject[res_end_index] << ")";
   unsigned int count = 0;
-  for (unsigned int i = 0; i < distance; i++) {
-    MapPos pos = map->pos_add_extended_spirally(center_pos, i);
+  map->for_each_extended_spiral(center_pos, distance, [&](MapPos pos) {
     if (map->get_obj(pos) >= res_start_index && map->get_obj(pos) <= res_end_index) {
       ++count;
       //AILogDebug["util_count_objects_near_pos"] << "AI: found matching object at pos " << pos << ", type " << map->get_obj(pos);
     }
     //sleep_speed_adjusted(0);
-  }
+  });
   //AILogDebug["util_count_objects_near_pos"] << "AI: found count " << count << " matching objects of types " << NameObject[res_start_index] << " - " << NameObject[res_end_index];
   return count;
 }
@@ -3076,9 +3068,7 @@ AI::build_near_pos(MapPos center_pos, unsigned int distance, Building::Type buil
       bool built_new_flag = false;
       if (!map->has_flag(flag_pos)){
         AILogDebug["util_build_near_pos"] << "no flag yet exists at flag_pos " << flag_pos << " for potential new building of type " << NameBuilding[building_type] << " at pos " << pos << ", trying to build one";
-        mutex_lock("AI::build_near_pos calling game->demolish_flag (build_near_pos verify_stock test)");
-        built_new_flag = game->build_flag(flag_pos, player);
-        mutex_unlock();
+        built_new_flag = run_command(ReplayCommand(ReplayCommand::TypeBuildFlag, player_index, flag_pos));
         if (!built_new_flag){
           AILogWarn["util_build_near_pos"] << "failed to build flag at flag_pos " << flag_pos << " for potential new building of type " << NameBuilding[building_type] << " at pos " << pos << "!  skipping this pos";
           continue;
@@ -3117,9 +3107,7 @@ AI::build_near_pos(MapPos center_pos, unsigned int distance, Building::Type buil
             AILogDebug["util_build_best_road"] << "verify_stock for existing flag - flag at flag_pos " << flag_pos << " is not closest to current inventory_pos " << inventory_pos << ", skipping";
             // if a new flag was built, remove it
             if (built_new_flag){
-              mutex_lock("AI::build_near_pos calling game->demolish_flag (build_near_pos verify_stock test)");
-              game->demolish_flag(flag_pos, player);
-              mutex_unlock();
+              run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
             }
             // skip this flag/pos and try the next position
             continue;
@@ -3135,9 +3123,7 @@ AI::build_near_pos(MapPos center_pos, unsigned int distance, Building::Type buil
         //ai_mark_pos.erase(pos);
         //ai_mark_pos.insert(std::make_pair(pos, "cyan"));
         //sleep_speed_adjusted(5000);
-        mutex_lock("AI::build_near_pos calling game->demolish_flag (build_near_pos failed to connect)");
-        game->demolish_flag(flag_pos, player);
-        mutex_unlock();
+        run_command(ReplayCommand(ReplayCommand::TypeDemolishFlag, player_index, flag_pos));
         // mark as bad pos, to avoid repeateadly rebuilding same building in same spot
         bad_building_pos.insert(std::make_pair(pos, building_type));
         // try the next position
@@ -3159,9 +3145,7 @@ AI::build_near_pos(MapPos center_pos, unsigned int distance, Building::Type buil
     } // if is_mine
 
     // try to build it
-    mutex_lock("AI::build_near_pos calling game->build_building (build_near_pos)");
-    bool was_built = game->build_building(pos, building_type, player);
-    mutex_unlock();
+    bool was_built = run_command(ReplayCommand(ReplayCommand::TypeBuildBuilding, player_index, pos, building_type));
     if (!was_built) {
       AILogDebug["util_build_near_pos"] << "failed to build building of type " << NameBuilding[building_type] << " despite can_build being true!  WAITING 10sec - look at the pos in coral!";
       //ai_mark_pos.insert(ColorDot(pos, "coral"));
@@ -3985,7 +3969,7 @@ AI::attack_best_target(MapPosSet *scored_targets, int loss_tolerance) {
     }
 
     // avoid attacking again while attack already in progress... most of the time
-    if (target_building->is_under_attack() && game->random_int() & 7 == 0){
+    if (target_building->is_under_attack() && ai_rnd.random() & 7 == 0){
       AILogDebug["util_attack_best_target"] << "this building is already under attack (by somebody, might not be us), and rand roll failed, skipping it for now";
       continue;
     }
@@ -3993,8 +3977,12 @@ AI::attack_best_target(MapPosSet *scored_targets, int loss_tolerance) {
     AILogDebug["util_attack_best_target"] << "PROCEEDING WITH THE ATTACK on target_pos " << target_pos;
     player->building_attacked = target_building->get_index();
     player->attacking_building_count = attacking_knights;
+    // the attack is started by the next game update, with the attacking
+    //  buildings knights_available_for_attack found just now
+    ReplayCommand attack(ReplayCommand::TypeStartAttack, player_index, player->building_attacked, player->knights_attacking);
+    attack.list = player->get_attacking_buildings();
     AILogDebug["util_attack_best_target"] << "calling player->start_attack()";
-    player->start_attack();
+    run_command(attack);
     AILogDebug["util_attack_best_target"] << "DONE calling player->start_attack()";
 
     AILogDebug["util_attack_best_target"] << "only doing one attack per AI loop";
@@ -4152,6 +4140,55 @@ AI::set_forbidden_pos_around_inventory(MapPos inventory_flag_pos){
 }
 
 
+// post a command for Game::update to apply and wait for its result, the
+//  same thing calling the game function under mutex_lock used to do
+bool
+AI::run_command(const ReplayCommand &command) {
+  GameCommandQueue::Result result = game->post_command(command);
+  return wait_command(&result);
+}
+
+// true only if every command succeeded
+bool
+AI::run_commands(const std::vector<ReplayCommand> &commands) {
+  std::vector<GameCommandQueue::Result> results = game->post_commands(commands);
+  bool all_succeeded = true;
+  for (GameCommandQueue::Result &result : results) {
+    if (!wait_command(&result)) {
+      all_succeeded = false;
+    }
+  }
+  return all_succeeded;
+}
+
+// the game may be paused but Game::update still runs then, only give up
+//  when told to exit (the game stopped updating for good).  The worker is
+//  blocked until the next update, AIScheduler runs the other AIs on
+//  another one meanwhile
+bool
+AI::wait_command(GameCommandQueue::Result *result) {
+  if (result->wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+    return result->get();
+  }
+  AIScheduler::Blocking blocking;
+  while (result->wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+    if (game->should_ai_stop()) {
+      AILogDebug["wait_command"] << "received stop_ai_threads signal while waiting for a command result";
+      return false;
+    }
+  }
+  return result->get();
+}
+
+ReplayCommand
+AI::build_road_command(const Road &road) {
+  ReplayCommand command(ReplayCommand::TypeBuildRoad, player_index, road.get_source());
+  for (Direction dir : road.get_dirs()) {
+    command.list.push_back(dir);
+  }
+  return command;
+}
+
 // lock and unlock mutex during non-threadsafe
 //  iterations and changes between game and AI threads
 // this calls mutex_lock, ut is only separate so that
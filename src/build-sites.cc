@@ -0,0 +1,63 @@
+/*
+ * build-sites.cc - cached large building and military site checks
+ */
+
+#include "src/build-sites.h"
+
+BuildSites::BuildSites(Map *map_)
+  : map(map_) {
+  sites.assign(map->geom().tile_count(), 0);
+}
+
+/* The checks read up to two shells out (leveling buildings three, but
+   those are never cached), the handler is called for the neighbours of
+   the changed tile, so forgetting two shells around each of them covers
+   everything within three of the change. */
+void
+BuildSites::forget_around(MapPos pos) {
+  for (int i = 0; i < 1+6+12; i++) {
+    sites[map->pos_add_spirally(pos, i)] = 0;
+  }
+}
+
+bool
+BuildSites::get(MapPos pos, Site site, const Check &check) {
+  uint8_t known = 1 << (2*site);
+  uint8_t yes = 2 << (2*site);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (sites[pos] & known) {
+    return (sites[pos] & yes) != 0;
+  }
+
+  bool cacheable = true;
+  bool result = check(pos, &cacheable);
+  if (cacheable) {
+    sites[pos] |= known;
+    if (result) {
+      sites[pos] |= yes;
+    }
+  }
+  return result;
+}
+
+void
+BuildSites::invalidate_around(MapPos pos) {
+  std::lock_guard<std::mutex> lock(mutex);
+  forget_around(pos);
+  for (Direction d : cycle_directions_cw()) {
+    forget_around(map->move(pos, d));
+  }
+}
+
+void
+BuildSites::on_height_changed(MapPos pos) {
+  std::lock_guard<std::mutex> lock(mutex);
+  forget_around(pos);
+}
+
+void
+BuildSites::on_object_changed(MapPos pos) {
+  std::lock_guard<std::mutex> lock(mutex);
+  forget_around(pos);
+}
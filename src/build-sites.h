@@ -0,0 +1,63 @@
+/*
+ * build-sites.h - cached large building and military site checks
+ *
+ *  Game::can_build_large and can_build_military look at up to 37 tiles
+ *   around a position, and the build overlay of the viewport and the AI's
+ *   building placement ask it for every tile they consider, over and over
+ *   for the same tiles.  Both only depend on the objects and heights
+ *   around the position (and the terrain, which does not change once the
+ *   map is made), so the answer is kept per tile until Map::Handler
+ *   reports an object or height change close enough to matter.
+ *  Land ownership and roads are not part of these two checks, and Map has
+ *   no hooks for them, so they stay in Game::can_build_building and
+ *   can_player_build.  can_build_small and can_build_mine only look at
+ *   the terrain, not worth a cache.
+ *  This only stores the answers, Game computes them.  The compute runs
+ *   under the mutex so a change reported in the meantime (AI threads ask
+ *   too) always wins over a result that did not see it.
+ */
+
+#ifndef SRC_BUILD_SITES_H_
+#define SRC_BUILD_SITES_H_
+
+#include <cstdint>
+#include <functional>
+#include <mutex>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <vector>
+
+#include "src/map.h"
+
+class BuildSites : public Map::Handler {
+ public:
+  typedef enum Site {
+    SiteLarge = 0,
+    SiteMilitary,
+  } Site;
+
+  // the answer for the position, and false in cacheable if it depends on
+  //  something that can change without a map notification
+  typedef std::function<bool(MapPos pos, bool *cacheable)> Check;
+
+ protected:
+  Map *map;
+  std::mutex mutex;
+  // per tile, two bits per site: known and the answer
+  std::vector<uint8_t> sites;
+
+  void forget_around(MapPos pos);
+
+ public:
+  explicit BuildSites(Map *map);
+
+  // the cached answer, or check's if there is none yet
+  bool get(MapPos pos, Site site, const Check &check);
+
+  // for changes made without notification (Map::set_height_no_refresh)
+  void invalidate_around(MapPos pos);
+
+  // Map::Handler, called for the six tiles around a changed one
+  virtual void on_height_changed(MapPos pos);
+  virtual void on_object_changed(MapPos pos);
+};
+
+#endif  // SRC_BUILD_SITES_H_
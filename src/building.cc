@@ -23,6 +23,7 @@
 
 #include "src/game.h"
 #include "src/inventory.h"
+#include "src/state-hash.h"
 #include "src/debug.h"
 #include "src/savegame.h"
 #include "src/game-options.h"
@@ -68,6 +69,13 @@ Building::Building(Game *game, unsigned int index)
   burning_counter = 0;
 }
 
+// keeps Game::get_player_buildings current
+void
+Building::set_owner(unsigned int new_owner) {
+  owner = new_owner;
+  game->building_owner_changed(this);
+}
+
 typedef struct ConstructionInfo {
   Map::Object map_obj;
   int planks;
@@ -2249,3 +2257,30 @@ operator << (SaveWriterText &writer, Building &building) {
 
   return writer;
 }
+
+void
+Building::add_state_hash(StateHash *hash) const {
+  hash->add(index);
+  hash->add(pos);
+  hash->add(type);
+  hash->add(owner);
+  hash->add(constructing);
+  hash->add(threat_level);
+  hash->add(serf_request_failed);
+  hash->add(serf_requested);
+  hash->add(burning);
+  hash->add(active);
+  hash->add(holder);
+  hash->add(flag);
+  for (unsigned int i = 0; i < kMaxStock; i++) {
+    hash->add(stock[i].type);
+    hash->add(stock[i].prio);
+    hash->add(stock[i].available);
+    hash->add(stock[i].requested);
+    hash->add(stock[i].maximum);
+  }
+  hash->add(holder_or_first_knight);
+  hash->add(burning_counter);
+  hash->add(progress);
+  hash->add(u.tick);
+}
@@ -55,6 +55,7 @@ class Serf;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Building : public GameObject {
  public:
@@ -160,7 +161,7 @@ class Building : public GameObject {
                                     (type == TypeCastle); }
   /* Owning player of the building. */
   unsigned int get_owner() const { return owner; }
-  void set_owner(unsigned int new_owner) { owner = new_owner; }
+  void set_owner(unsigned int new_owner);
   /* Whether construction of the building is finished. */
   bool is_done() const { return !constructing; }
   bool is_leveling() const { return (!is_done() && progress == 0); }
@@ -301,6 +302,10 @@ class Building : public GameObject {
   friend SaveWriterText&
     operator << (SaveWriterText &writer, Building &building);
 
+  // fold the fields that change as the game runs into a state hash, see
+  //  Game::get_state_hash
+  void add_state_hash(StateHash *hash) const;
+
  private:
   void update();
   void update_unfinished();
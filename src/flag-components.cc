@@ -0,0 +1,140 @@
+/*
+ * flag-components.cc - which flags are connected by roads
+ */
+
+#include "src/flag-components.h"
+
+#include <algorithm>
+
+#include "src/flag.h"
+#include "src/game.h"
+
+FlagComponents::FlagComponents(Game *game_)
+  : game(game_)
+  , valid(false) {
+}
+
+unsigned int
+FlagComponents::find(unsigned int index) {
+  while (parent[index] != index) {
+    parent[index] = parent[parent[index]];
+    index = parent[index];
+  }
+  return index;
+}
+
+void
+FlagComponents::join(unsigned int index_1, unsigned int index_2) {
+  unsigned int root_1 = find(index_1);
+  unsigned int root_2 = find(index_2);
+  if (root_1 == root_2) {
+    return;
+  }
+  if (root_2 < root_1) {
+    std::swap(root_1, root_2);
+  }
+  parent[root_2] = root_1;
+  inventories[root_1] += inventories[root_2];
+  inventories[root_2] = 0;
+}
+
+void
+FlagComponents::rebuild() {
+  // the Collection's size is how many flags exist, indexes can be higher
+  //  once flags were removed
+  size_t size = game->get_flags()->size() + 1;
+  for (Flag *flag : *game->get_flags()) {
+    size = std::max<size_t>(size, flag->get_index() + 1);
+  }
+  parent.resize(size);
+  inventories.assign(size, 0);
+  for (unsigned int i = 0; i < size; i++) {
+    parent[i] = i;
+  }
+  for (Flag *flag : *game->get_flags()) {
+    if (flag->has_inventory()) {
+      inventories[flag->get_index()] = 1;
+    }
+  }
+  for (Flag *flag : *game->get_flags()) {
+    for (Direction d : cycle_directions_cw()) {
+      // up-left of a flag with a building is the building, not a road
+      if (!flag->has_path(d) ||
+          (d == DirectionUpLeft && flag->has_building())) {
+        continue;
+      }
+      Flag *other_flag = flag->get_other_end_flag(d);
+      if (other_flag != nullptr && other_flag->get_index() < size) {
+        join(flag->get_index(), other_flag->get_index());
+      }
+    }
+  }
+  valid = true;
+}
+
+void
+FlagComponents::flag_added(const Flag *flag) {
+  if (!valid) {
+    return;
+  }
+  unsigned int index = flag->get_index();
+  if (index >= parent.size()) {
+    size_t size = parent.size();
+    parent.resize(index + 1);
+    inventories.resize(index + 1, 0);
+    for (size_t i = size; i < parent.size(); i++) {
+      parent[i] = static_cast<unsigned int>(i);
+    }
+  }
+  // the index can be one of a flag that was taken away, nothing points to
+  //  it any more since the rebuild that followed
+  parent[index] = index;
+  inventories[index] = 0;
+}
+
+void
+FlagComponents::road_added(const Flag *flag_1, const Flag *flag_2) {
+  if (!valid) {
+    return;
+  }
+  if (flag_1->get_index() >= parent.size() ||
+      flag_2->get_index() >= parent.size()) {
+    valid = false;
+    return;
+  }
+  join(flag_1->get_index(), flag_2->get_index());
+}
+
+void
+FlagComponents::inventory_added(const Flag *flag) {
+  if (!valid) {
+    return;
+  }
+  if (flag->get_index() >= parent.size()) {
+    valid = false;
+    return;
+  }
+  inventories[find(flag->get_index())] += 1;
+}
+
+unsigned int
+FlagComponents::get_network(const Flag *flag) {
+  if (!valid) {
+    rebuild();
+  }
+  if (flag->get_index() >= parent.size()) {
+    return flag->get_index();
+  }
+  return find(flag->get_index());
+}
+
+bool
+FlagComponents::has_inventory(const Flag *flag) {
+  if (!valid) {
+    rebuild();
+  }
+  if (flag->get_index() >= parent.size()) {
+    return flag->has_inventory();
+  }
+  return inventories[find(flag->get_index())] > 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * flag-components.h - which flags are connected by roads
+ *
+ *  Asking whether a flag can be reached from an inventory used to take a
+ *   FlagSearch from the flag that only gave up once it had been through
+ *   the whole road network, and Game::send_serf_to_flag does that for
+ *   every unconnected building that wants a serf, every time it asks.
+ *  This keeps the flags in union-find sets, one per road network, with
+ *   the number of inventory flags in each.  Roads only ever join two
+ *   networks when they are built or a flag splits one, so that is done as
+ *   it happens.  Taking a road or a flag away, or a building losing its
+ *   inventory, can split a network or empty it, that is rare enough that
+ *   everything is just built again from the flags on the next use.
+ *  Every road counts, also water roads without a sailor, so a flag whose
+ *   network has no inventory really cannot be reached from one, but one
+ *   whose network has an inventory may still need a search to find a way.
+ *  Game thread only.
+ */
+
+#ifndef SRC_FLAG_COMPONENTS_H_
+#define SRC_FLAG_COMPONENTS_H_
+
+#include <vector>
+
+class Game;
+class Flag;
+
+class FlagComponents {
+ protected:
+  Game *game;
+  bool valid;
+  std::vector<unsigned int> parent;       // by flag index
+  std::vector<unsigned int> inventories;  // by root flag index
+
+  unsigned int find(unsigned int index);
+  void join(unsigned int index_1, unsigned int index_2);
+  void rebuild();
+
+ public:
+  explicit FlagComponents(Game *game);
+
+  // something was taken away, build everything again on the next use.
+  //  Also for a new or loaded map
+  void clear() { valid = false; }
+
+  // a new flag, without roads or building yet
+  void flag_added(const Flag *flag);
+  // a road was built between the two flags
+  void road_added(const Flag *flag_1, const Flag *flag_2);
+  // the flag got an inventory
+  void inventory_added(const Flag *flag);
+
+  // the same for all flags in the same road network, the index of one of
+  //  them.  Can change whenever roads are built or taken away
+  unsigned int get_network(const Flag *flag);
+  // whether a flag in the road network has an inventory
+  bool has_inventory(const Flag *flag);
+};
+
+#endif  // SRC_FLAG_COMPONENTS_H_
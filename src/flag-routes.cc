@@ -0,0 +1,105 @@
+/*
+ * flag-routes.cc - cached routes over the resource transport road network
+ */
+
+#include "src/flag-routes.h"
+
+#include <algorithm>
+
+#include "src/flag.h"
+#include "src/game.h"
+
+FlagRoutes::FlagRoutes(Game *game_)
+  : game(game_) {
+}
+
+void
+FlagRoutes::clear() {
+  hops_to.clear();
+  orders.clear();
+}
+
+// breadth-first from dest, backwards along the roads.  A road can only be
+//  used from the side that has the transporter bit, same as FlagSearch
+const std::vector<int> &
+FlagRoutes::get_hops_to(const Flag *dest) {
+  auto it = hops_to.find(dest->get_index());
+  if (it != hops_to.end()) {
+    return it->second;
+  }
+  if (hops_to.size() >= max_cached) {
+    hops_to.clear();
+  }
+
+  // the Collection's size is how many flags exist, indexes can be higher
+  //  once flags were removed
+  std::vector<int> &hops = hops_to[dest->get_index()];
+  hops.assign(std::max<size_t>(game->get_flags()->size(),
+                               dest->get_index()) + 1, -1);
+  std::vector<const Flag*> queue;
+  queue.push_back(dest);
+  hops[dest->get_index()] = 0;
+  for (size_t next = 0; next < queue.size(); next++) {
+    const Flag *flag = queue[next];
+    for (Direction d : cycle_directions_ccw()) {
+      if (!flag->has_path(d)) {
+        continue;
+      }
+      const Flag *other_flag = flag->get_other_end_flag(d);
+      if (other_flag == nullptr ||
+          !other_flag->has_transporter(flag->get_other_end_dir(d))) {
+        continue;
+      }
+      unsigned int index = other_flag->get_index();
+      if (index >= hops.size()) {
+        hops.resize(index + 1, -1);
+      }
+      if (hops[index] >= 0) {
+        continue;
+      }
+      hops[index] = hops[flag->get_index()] + 1;
+      queue.push_back(other_flag);
+    }
+  }
+  return hops;
+}
+
+int
+FlagRoutes::get_hops(const Flag *from, const Flag *dest) {
+  const std::vector<int> &hops = get_hops_to(dest);
+  if (from->get_index() >= hops.size()) {
+    return -1;
+  }
+  return hops[from->get_index()];
+}
+
+static bool
+record_order_cb(Flag *flag, void *data) {
+  FlagRoutes::Order *order = static_cast<FlagRoutes::Order*>(data);
+  order->push_back(FlagRoutes::Visit(flag->get_index(),
+                                     flag->get_search_dir()));
+  return false;
+}
+
+FlagRoutes::POrder
+FlagRoutes::get_transport_order(const Sources &sources) {
+  auto it = orders.find(sources);
+  if (it != orders.end()) {
+    return it->second;
+  }
+  if (orders.size() >= max_cached) {
+    orders.clear();
+  }
+
+  // let a real search do the walking, so the order can't drift from what
+  //  FlagSearch::execute would do
+  std::shared_ptr<Order> order = std::make_shared<Order>();
+  FlagSearch search(game);
+  for (const Visit &source : sources) {
+    search.add_source(game->get_flag(source.first), source.second);
+  }
+  search.execute(record_order_cb, false, true, order.get());
+
+  orders[sources] = order;
+  return order;
+}
@@ -0,0 +1,66 @@
+/*
+ * flag-routes.h - cached routes over the resource transport road network
+ *
+ *  Every resource waiting at a flag used to run its own FlagSearch each
+ *   time it was scheduled, and Game::update_inventories ran one per
+ *   resource type it handed out.  In a big economy that is a BFS over
+ *   hundreds of flags for every single resource, while the roads and
+ *   their transporters hardly ever change between two of them.
+ *  This keeps, for the network of roads that have a transporter:
+ *   - per destination flag, how many flags away every other flag is, so
+ *      a resource with a known destination just looks up which of its
+ *      flag's roads gets closer to it
+ *   - per set of search sources, the order a FlagSearch from them visits
+ *      the flags in, so the searches that pick a destination can walk the
+ *      same order again without searching
+ *  Everything is thrown away by Game::road_network_changed whenever a road
+ *   is built, removed, split or merged, or a road gains or loses its
+ *   transporter, and built again on the first use after that.
+ *  Game thread only.
+ */
+
+#ifndef SRC_FLAG_ROUTES_H_
+#define SRC_FLAG_ROUTES_H_
+
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "src/map-geometry.h"
+
+class Game;
+class Flag;
+
+class FlagRoutes {
+ public:
+  // flag index and the search dir it was added / reached with
+  typedef std::pair<unsigned int, Direction> Visit;
+  typedef std::vector<Visit> Sources;
+  typedef std::vector<Visit> Order;
+  typedef std::shared_ptr<const Order> POrder;
+
+ protected:
+  // keep the cache from growing without bound on huge maps, start over
+  //  once it holds this many tables / orders
+  static const size_t max_cached = 256;
+
+  Game *game;
+  std::map<unsigned int, std::vector<int>> hops_to;  // by dest flag index
+  std::map<Sources, POrder> orders;
+
+  const std::vector<int> &get_hops_to(const Flag *dest);
+
+ public:
+  explicit FlagRoutes(Game *game);
+
+  void clear();
+
+  // number of transporter roads between the flags, -1 if there is no way
+  int get_hops(const Flag *from, const Flag *dest);
+  // the order FlagSearch::execute(cb, false, true, data) visits the flags
+  //  in when started from these sources, as it would run to the end
+  POrder get_transport_order(const Sources &sources);
+};
+
+#endif  // SRC_FLAG_ROUTES_H_
@@ -0,0 +1,38 @@
+/*
+ * flag-worklist.cc - flags that Game::update_flags has to look at
+ */
+
+#include "src/flag-worklist.h"
+
+void
+FlagWorklist::add(unsigned int flag) {
+  size_t word = flag / 64;
+  if (word >= words.size()) {
+    words.resize(word + 1, 0);
+  }
+  words[word] |= UINT64_C(1) << (flag % 64);
+}
+
+bool
+FlagWorklist::take_next(unsigned int *flag) {
+  size_t word = *flag / 64;
+  if (word >= words.size()) {
+    return false;
+  }
+  // leave out the bits before *flag in its own word
+  uint64_t bits = words[word] & (~UINT64_C(0) << (*flag % 64));
+  while (bits == 0) {
+    if (++word >= words.size()) {
+      return false;
+    }
+    bits = words[word];
+  }
+  unsigned int bit = 0;
+  while ((bits & 1) == 0) {
+    bits >>= 1;
+    bit++;
+  }
+  words[word] &= ~(UINT64_C(1) << bit);
+  *flag = static_cast<unsigned int>(word * 64 + bit);
+  return true;
+}
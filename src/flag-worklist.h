@@ -0,0 +1,38 @@
+/*
+ * flag-worklist.h - flags that Game::update_flags has to look at
+ *
+ *  Game::update_flags used to call Flag::update on every flag every tick.
+ *   Most flags have nothing waiting to be scheduled and all their roads
+ *   served, and for them Flag::update changes nothing.  It only reads the
+ *   flag's own slots, paths, transporters and road lengths, so once an
+ *   update leaves all of those as they were (and did not try to schedule
+ *   a resource or call a transporter, which depend on the rest of the
+ *   world) the next one would do nothing either.
+ *  A flag is in the worklist from the time one of those fields changes
+ *   (Flag::changed) until an update finds nothing to do.  It is a bitmap
+ *   by flag index so update_flags still goes through the flags in index
+ *   order, and a flag changed by one earlier in the same pass is still
+ *   updated in that pass, the same as when it went through all of them.
+ */
+
+#ifndef SRC_FLAG_WORKLIST_H_
+#define SRC_FLAG_WORKLIST_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class FlagWorklist {
+ protected:
+  std::vector<uint64_t> words;
+
+ public:
+  // forget everything, a new or loaded map.  Its flags add themselves
+  void clear() { words.clear(); }
+
+  void add(unsigned int flag);
+  // take out the first flag at or after *flag, false if there is none
+  bool take_next(unsigned int *flag);
+};
+
+#endif  // SRC_FLAG_WORKLIST_H_
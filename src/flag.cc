@@ -22,37 +22,158 @@
 #include "src/flag.h"
 
 #include <algorithm>
+#include <memory>
 
 #include "src/game.h"
+#include "src/flag-routes.h"
 #include "src/savegame.h"
+#include "src/state-hash.h"
 #include "src/log.h"
 #include "src/inventory.h"
 #include "src/game-options.h"
 
 #define SEARCH_MAX_DEPTH  0x10000
 
+// the queue is a ring buffer, each flag is queued at most once per search
+//  (unless a caller adds the same source twice) so it only grows when the
+//  map gets more flags.  visited[] holds the generation of the search that
+//  last reached each flag index, so starting a search is just bumping the
+//  generation instead of clearing every flag
+class FlagSearch::Context {
+ public:
+  std::vector<Flag*> queue;
+  size_t head;
+  size_t count;
+  std::vector<uint32_t> visited;  // per flag index
+  std::vector<Direction> dirs;    // per flag index, valid if visited
+  uint32_t generation;
+
+  Context() : head(0), count(0), generation(0) {}
+
+  void start(size_t flag_count) {
+    head = 0;
+    count = 0;
+    if (queue.size() < flag_count) {
+      queue.resize(flag_count);
+    }
+    if (visited.size() < flag_count) {
+      visited.resize(flag_count, 0);
+      dirs.resize(flag_count, DirectionNone);
+    }
+    generation += 1;
+    /* If we're back at zero the counter has overflown,
+     every mark needs a reset to be safe. */
+    if (generation == 0) {
+      std::fill(visited.begin(), visited.end(), 0);
+      generation = 1;
+    }
+  }
+
+  void push(Flag *flag) {
+    if (count == queue.size()) {
+      // unwrap into a bigger buffer
+      std::vector<Flag*> bigger(std::max<size_t>(queue.size() * 2, 64));
+      for (size_t i = 0; i < count; i++) {
+        bigger[i] = queue[(head + i) % queue.size()];
+      }
+      queue.swap(bigger);
+      head = 0;
+    }
+    queue[(head + count) % queue.size()] = flag;
+    count += 1;
+  }
+
+  Flag *pop() {
+    Flag *flag = queue[head];
+    head = (head + 1) % queue.size();
+    count -= 1;
+    return flag;
+  }
+
+  bool is_visited(unsigned int index) const {
+    return (index < visited.size() && visited[index] == generation);
+  }
+
+  void visit(unsigned int index, Direction dir) {
+    if (index >= visited.size()) {
+      // a flag built since start(), grow with some headroom
+      visited.resize(index + 64, 0);
+      dirs.resize(index + 64, DirectionNone);
+    }
+    visited[index] = generation;
+    dirs[index] = dir;
+  }
+};
+
+// one Context per nesting level, searches on this thread from outermost
+//  to innermost.  FlagSearch objects only ever live on the stack so they
+//  are destroyed in reverse order
+struct FlagSearch::Stack {
+  std::vector<std::unique_ptr<Context>> contexts;
+  std::vector<const FlagSearch*> searches;
+};
+
+FlagSearch::Stack &
+FlagSearch::get_stack() {
+  static thread_local Stack stack;
+  return stack;
+}
+
 FlagSearch::FlagSearch(Game *game_) {
   game = game_;
-  id = game->next_search_id();
+  Stack &stack = get_stack();
+  stack.searches.push_back(this);
+  if (stack.contexts.size() < stack.searches.size()) {
+    stack.contexts.emplace_back(new Context());
+  }
+  context = stack.contexts[stack.searches.size() - 1].get();
+  context->start(game->get_flags()->size() + 1);
+}
+
+FlagSearch::~FlagSearch() {
+  get_stack().searches.pop_back();
+}
+
+const FlagSearch *
+FlagSearch::get_current() {
+  Stack &stack = get_stack();
+  return stack.searches.empty() ? nullptr : stack.searches.back();
+}
+
+void
+FlagSearch::add_source(Flag *flag, Direction dir) {
+  context->visit(flag->get_index(), dir);
+  context->push(flag);
+}
+
+bool
+FlagSearch::is_visited(const Flag *flag) const {
+  return context->is_visited(flag->get_index());
 }
 
 void
-FlagSearch::add_source(Flag *flag) {
-  queue.push_back(flag);
-  flag->search_num = id;
+FlagSearch::mark_visited(const Flag *flag, Direction dir) {
+  context->visit(flag->get_index(), dir);
+}
+
+Direction
+FlagSearch::get_dir(const Flag *flag) const {
+  if (!context->is_visited(flag->get_index())) {
+    return DirectionNone;
+  }
+  return context->dirs[flag->get_index()];
 }
 
 bool
 FlagSearch::execute(flag_search_func *callback, bool land,
                     bool transporter, void *data) {
   //Log::Info["flag"] << "thread #" << std::this_thread::get_id() << "debug: inside FlagSearch::execute with current flag queue.front()" << queue.front()->get_position();
-  for (int i = 0; i < SEARCH_MAX_DEPTH && !queue.empty(); i++) {
-    Flag *flag = queue.front();
-    queue.erase(queue.begin());
+  for (int i = 0; i < SEARCH_MAX_DEPTH && context->count > 0; i++) {
+    Flag *flag = context->pop();
 
     if (callback(flag, data)) {
       /* Clean up */
-      queue.clear();
+      context->count = 0;
       return true;
     }
 
@@ -168,7 +289,8 @@ FlagSearch::execute(flag_search_func *callback, bool land,
       
       // if this is the same flag we just checked(?)
       //Log::Info["flag"] << "debug: inside FlagSearch::execute, checking dir: " << i << ", for flag at pos " << flag->get_position() << ", about to check flag->other_endpoint.f[" << i << "]->search_num to see if it matches id " << id;
-      if (flag->other_endpoint.f[i]->search_num == id) {
+      Flag *other_flag = flag->other_endpoint.f[i];
+      if (context->is_visited(other_flag->get_index())) {
         //Log::Info["flag"] << "debug: inside FlagSearch::execute, checking dir: " << i << " flag->other_endpoint.f[" << i << "]->search_num matches id " << id << " (meaning already visited this?), skipping this dir";
         // ... skip this dir/flag
         continue;
@@ -176,17 +298,36 @@ FlagSearch::execute(flag_search_func *callback, bool land,
       //Log::Info["flag"] << "debug: inside FlagSearch::execute, continuing search";
 
       // if NONE of the above exclusions were true, continue the search
-      flag->other_endpoint.f[i]->search_num = id;
-      flag->other_endpoint.f[i]->search_dir = flag->search_dir;
-      Flag *other_flag = flag->other_endpoint.f[i];
-      queue.push_back(other_flag);
+      add_source(other_flag, context->dirs[flag->get_index()]);
       //Log::Info["flag"] << "debug: inside FlagSearch::execute, done adding new node at end of loop";
     }
 
   }
 
   /* Clean up */
-  queue.clear();
+  context->count = 0;
+
+  return false;
+}
+
+bool
+FlagSearch::execute_transport(flag_search_func *callback, void *data) {
+  FlagRoutes::Sources sources;
+  for (size_t i = 0; i < context->count; i++) {
+    Flag *flag = context->queue[(context->head + i) % context->queue.size()];
+    sources.push_back(FlagRoutes::Visit(flag->get_index(),
+                                        context->dirs[flag->get_index()]));
+  }
+  context->count = 0;
+
+  FlagRoutes::POrder order =
+    game->get_flag_routes()->get_transport_order(sources);
+  for (const FlagRoutes::Visit &visit : *order) {
+    context->visit(visit.first, visit.second);
+    if (callback(game->get_flag(visit.first), data)) {
+      return true;
+    }
+  }
 
   return false;
 }
@@ -200,6 +341,12 @@ FlagSearch::single(Flag *src, flag_search_func *callback, bool land,
   return search.execute(callback, land, transporter, data);
 }
 
+Direction
+Flag::get_search_dir() const {
+  const FlagSearch *search = FlagSearch::get_current();
+  return (search != nullptr) ? search->get_dir(this) : search_dir;
+}
+
 Flag::Flag(Game *game, unsigned int index)
   : GameObject(game, index)
   , owner(-1)
@@ -220,11 +367,21 @@ Flag::Flag(Game *game, unsigned int index)
     slot[j].type = Resource::TypeNone;
     slot[j].dest = 0;
     slot[j].dir = DirectionNone;
+    slot_changed(j);
   }
+  changed();
+  game->get_flag_components()->flag_added(this);
+}
+
+// see flag-worklist.h
+void
+Flag::changed() {
+  game->flag_changed(this);
 }
 
 void
 Flag::add_path(Direction dir, bool water) {
+  changed();
   path_con |= BIT(dir);
   if (water) {
     endpoint &= ~BIT(dir);
@@ -232,13 +389,18 @@ Flag::add_path(Direction dir, bool water) {
     endpoint |= BIT(dir);
   }
   transporter &= ~BIT(dir);
+  game->road_network_changed();
 }
 
 void
 Flag::del_path(Direction dir) {
+  changed();
   path_con &= ~BIT(dir);
   endpoint &= ~BIT(dir);
   transporter &= ~BIT(dir);
+  game->road_network_changed();
+  // the network may fall apart
+  game->get_flag_components()->clear();
 
   if (serf_requested(dir)) {
     cancel_serf_request(dir);
@@ -275,6 +437,8 @@ Flag::pick_up_resource(unsigned int from_slot, Resource::Type *res,
   //Log::Info["flag.cc"] << "inside Flag::pick_up_resource for flag at pos " << get_position() << ", picking up res of type " << NameResource[*(res)] << " and dest " << *(dest);
   slot[from_slot].type = Resource::TypeNone;
   slot[from_slot].dir = DirectionNone;
+  slot_changed(from_slot);
+  changed();
 
   fix_scheduled();
 
@@ -339,7 +503,9 @@ Flag::drop_resource(Resource::Type res, unsigned int dest) {
       slot[i].type = res;
       slot[i].dest = dest;
       slot[i].dir = DirectionNone;
+      slot_changed(i);
       endpoint |= BIT(7);
+      changed();
       //Log::Info["flag.cc"] << "inside Flag::drop_resource, returning true";
       return true;
     }
@@ -371,6 +537,8 @@ Flag::remove_all_resources() {
       game->cancel_transported_resource((Resource::Type)res, dest);
       game->lose_resource((Resource::Type)res);
     }
+    // the flag is about to go away
+    game->get_transit_index()->set(index, i, 0);
   }
 }
 
@@ -550,7 +718,7 @@ Flag::schedule_slot_to_unknown_dest(int slot_num) {
     data.dist_from_inv = 0;
 
     //Log::Info["flag"] << "inside Flag::schedule_slot_to_unknown_dest for routable resource, about to start search";
-    search.execute(schedule_unknown_dest_cb, false, true, &data);
+    search.execute_transport(schedule_unknown_dest_cb, &data);
 
     //  this should work...
     //if (data.flag != nullptr) {
@@ -568,6 +736,7 @@ Flag::schedule_slot_to_unknown_dest(int slot_num) {
       }
       //Log::Info["flag.cc"] << "setting dest for routable resource res " << slot << " to flag index " << data.flag->get_index();
       slot[slot_num].dest = dest_bld->get_flag_index();
+      slot_changed(slot_num);
       endpoint |= BIT(7);
 
       return;
@@ -620,6 +789,7 @@ Flag::schedule_slot_to_unknown_dest(int slot_num) {
   } else {
     //Log::Info["flag.cc"] << "inside Flag::schedule_slot_to_unknown_dest, inventory was found, setting slot[" << slot_num << "].dest to flag index(r?) " << r;
     this->slot[slot_num].dest = r;
+    slot_changed(slot_num);
     endpoint |= BIT(7);
   }
   //Log::Info["flag.cc"] << "done Flag::schedule_slot_to_unknown_dest";
@@ -765,11 +935,13 @@ schedule_known_dest_cb(Flag *flag, void *data) {
   //Log::Info["flag.cc"] << "DEBUG a1 - flag at pos " << flag->get_position() << ", scheduled slot for dir " << 5 << " is " << flag->scheduled_slot(Direction(5));
   return (flag->schedule_known_dest_cb_(dest_data->src,
                                         dest_data->dest,
-                                        dest_data->slot) != 0);
+                                        dest_data->slot,
+                                        flag->get_search_dir()) != 0);
 }
 
 bool
-Flag::schedule_known_dest_cb_(Flag *src, Flag *dest, int _slot) {
+Flag::schedule_known_dest_cb_(Flag *src, Flag *dest, int _slot,
+                              Direction dir) {
   //
   // I think this is one of the few (only?) functions where the
   //  flag->search_dir is actually used the way you would expect,
@@ -780,38 +952,39 @@ Flag::schedule_known_dest_cb_(Flag *src, Flag *dest, int _slot) {
   if (this == dest) {
     //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_, destination found";
     /* Destination found */
-    if (this->search_dir != 6) {
+    if (dir != 6) {
       //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 1";
-      if (!src->is_scheduled(this->search_dir)) {
-        //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 2A, this flag at pos " << this->get_position() << ", _slot " << _slot << " is scheduled in dir " << this->search_dir;
+      if (!src->is_scheduled(dir)) {
+        //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 2A, this flag at pos " << this->get_position() << ", _slot " << _slot << " is scheduled in dir " << dir;
         /* Item is requesting to be fetched */
-        src->other_end_dir[this->search_dir] =
-          BIT(7) | (src->other_end_dir[this->search_dir] & 0x78) | _slot;
-        //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 2B, this flag at pos " << this->get_position() << ", _slot " << _slot << " is scheduled in dir " << this->search_dir;
+        src->other_end_dir[dir] =
+          BIT(7) | (src->other_end_dir[dir] & 0x78) | _slot;
+        //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 2B, this flag at pos " << this->get_position() << ", _slot " << _slot << " is scheduled in dir " << dir;
       } else {
         //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 3";
         Player *player = game->get_player(this->get_owner());
-        int other_dir = src->other_end_dir[this->search_dir];
+        int other_dir = src->other_end_dir[dir];
 
         int prio_old = player->get_flag_prio(src->slot[other_dir & 7].type);
         int prio_new = player->get_flag_prio(src->slot[_slot].type);
 
         // use new logic feature to allow priority transport of resources that can be immediately used
-        int adjusted_prio_old = Flag::get_immediate_use_adjusted_prio(src->slot[other_dir & 7].type, prio_old, dest->get_index(), game, player, search_dir, _slot);
-        int adjusted_prio_new = Flag::get_immediate_use_adjusted_prio(src->slot[_slot].type,         prio_new, dest->get_index(), game, player, search_dir, _slot);
+        int adjusted_prio_old = Flag::get_immediate_use_adjusted_prio(src->slot[other_dir & 7].type, prio_old, dest->get_index(), game, player, dir, _slot);
+        int adjusted_prio_new = Flag::get_immediate_use_adjusted_prio(src->slot[_slot].type,         prio_new, dest->get_index(), game, player, dir, _slot);
         //if (prio_new > prio_old) {
         if (adjusted_prio_new > adjusted_prio_old){
           //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 4";
           /* This item has the highest priority now */
-          src->other_end_dir[this->search_dir] =
-            (src->other_end_dir[this->search_dir] & 0xf8) | _slot;
+          src->other_end_dir[dir] =
+            (src->other_end_dir[dir] & 0xf8) | _slot;
         }
         //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_ 5";
         // add support for requested resource timeouts
         // wait, is this the wrong place???
         //  yes, it isn't needed at all here I think, this function is triggered
         //   by the flag variables set in Game::update_flags
-        src->slot[_slot].dir = this->search_dir;
+        src->slot[_slot].dir = dir;
+        src->changed();
       }
     }
     //Log::Info["flag"] << "debug: inside Flag::schedule_known_dest_cb_, returning true";
@@ -835,11 +1008,13 @@ Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
   //Log::Info["flag"] << "debug: inside Flag::schedule_slot_to_known_dest, flag at pos " << get_position();
   FlagSearch search(game);
 
-  search_num = search.get_id();
-  search_dir = DirectionNone;
+  search.mark_visited(this, DirectionNone);
   int tr = transporters();
 
   int sources = 0;
+  // at most one per dir
+  Flag *source_flags[6];
+  Direction source_dirs[6];
 
   /* Directions where transporters are idle (zero slots waiting) */
   int flags = (res_waiting[0] ^ 0x3f) & transporter;
@@ -851,9 +1026,10 @@ Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
       if (BIT_TEST(flags, k)) {
         tr &= ~BIT(k);
         Flag *other_flag = other_endpoint.f[k];
-        if (other_flag->search_num != search.get_id()) {
-          other_flag->search_dir = k;
-          search.add_source(other_flag);
+        if (!search.is_visited(other_flag)) {
+          search.add_source(other_flag, k);
+          source_flags[sources] = other_flag;
+          source_dirs[sources] = k;
           sources += 1;
         }
       }
@@ -870,9 +1046,10 @@ Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
           tr &= ~BIT(k);
           Flag *other_flag = other_endpoint.f[k];
 		      //Log::Info["flag"] << "debug: inside Flag::schedule_slot_to_known_dest 4a, dir: " << k;
-          if (other_flag->search_num != search.get_id()) {
-            other_flag->search_dir = k;
-            search.add_source(other_flag);
+          if (!search.is_visited(other_flag)) {
+            search.add_source(other_flag, k);
+            source_flags[sources] = other_flag;
+            source_dirs[sources] = k;
             sources += 1;
           }
         }
@@ -886,9 +1063,10 @@ Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
         if (BIT_TEST(flags, k)) {
           tr &= ~BIT(k);
           Flag *other_flag = other_endpoint.f[k];
-          if (other_flag->search_num != search.get_id()) {
-            other_flag->search_dir = k;
-            search.add_source(other_flag);
+          if (!search.is_visited(other_flag)) {
+            search.add_source(other_flag, k);
+            source_flags[sources] = other_flag;
+            source_dirs[sources] = k;
             sources += 1;
           }
         }
@@ -907,13 +1085,42 @@ Flag::schedule_slot_to_known_dest(int slot_, unsigned int res_waiting[4]) {
     //data.dist_from_inv = 0;
 
     //Log::Info["flag.cc"] << "DEBUGE1 - flag at pos " << get_position() << ", scheduled slot for dir " << 5 << " is " << scheduled_slot(Direction(5));
-    bool r = search.execute(schedule_known_dest_cb, false, true, &data);
+    bool r = false;
+    if (data.dest == nullptr || data.dest == this) {
+      r = search.execute(schedule_known_dest_cb, false, true, &data);
+    } else {
+      // look the route up instead of searching.  The search never passes
+      //  through this flag, while the cached hop counts may, but any route
+      //  through here is longer than this flag's own hop count.  So if the
+      //  nearest source is no further away than that, it is the one the
+      //  search would have found (the first one added, on a tie).
+      //  Otherwise do the real search
+      FlagRoutes *routes = game->get_flag_routes();
+      int best = -1;
+      int best_hops = -1;
+      for (int i = 0; i < sources; i++) {
+        int hops = routes->get_hops(source_flags[i], data.dest);
+        if (hops >= 0 && (best < 0 || hops < best_hops)) {
+          best = i;
+          best_hops = hops;
+        }
+      }
+      if (best < 0) {
+        r = false;
+      } else if (best_hops <= routes->get_hops(this, data.dest)) {
+        r = data.dest->schedule_known_dest_cb_(this, data.dest, slot_,
+                                               source_dirs[best]);
+      } else {
+        r = search.execute(schedule_known_dest_cb, false, true, &data);
+      }
+    }
     //Log::Info["flag.cc"] << "DEBUGE2 - flag at pos " << get_position() << ", scheduled slot for dir " << 5 << " is " << scheduled_slot(Direction(5));
     if (!r || data.dest == this) {
       /* Unable to deliver */
       game->cancel_transported_resource(this->slot[slot_].type,
                                         this->slot[slot_].dest);
       this->slot[slot_].dest = 0;
+      slot_changed(slot_);
       endpoint |= BIT(7);
     }
   } else {
@@ -1067,6 +1274,7 @@ Flag::invalidate_resource_path(Direction dir) {
     if (slot[i].type != Resource::TypeNone && slot[i].dir == dir) {
       slot[i].dir = DirectionNone;
       endpoint |= BIT(7);
+      changed();
     }
   }
 }
@@ -1099,9 +1307,12 @@ Flag::link_with_flag(Flag *dest_flag, bool water_path, size_t length_,
 
   dest_flag->length[in_dir] = len << 4;
   this->length[out_dir] = len << 4;
+  dest_flag->changed();
+  changed();
 
   dest_flag->other_endpoint.f[in_dir] = this;
   other_endpoint.f[out_dir] = dest_flag;
+  game->get_flag_components()->road_added(this, dest_flag);
 }
 
 void
@@ -1113,7 +1324,9 @@ Flag::restore_path_serf_info(Direction dir, SerfPathInfo *data) {
 
   add_path(dir, other_flag->is_water_path(other_dir));
 
+  other_flag->changed();
   other_flag->transporter &= ~BIT(other_dir);
+  game->road_network_changed();
 
   size_t len = Flag::get_road_length_value(data->path_len);
 
@@ -1131,6 +1344,7 @@ Flag::restore_path_serf_info(Direction dir, SerfPathInfo *data) {
 
   other_endpoint.f[dir] = other_flag;
   other_flag->other_endpoint.f[other_dir] = this;
+  game->get_flag_components()->road_added(this, other_flag);
 
   int max_serfs = max_path_serfs[len];
   if (serf_requested(dir)) max_serfs -= 1;
@@ -1204,6 +1418,39 @@ Flag::is_connected() const {
   return false;
 }
 
+unsigned int
+Flag::get_road_network() const {
+  return game->get_flag_components()->get_network(this);
+}
+
+bool
+Flag::is_connected_to_inventory() const {
+  return game->get_flag_components()->has_inventory(this);
+}
+
+void
+Flag::slot_changed(int slot_) {
+  unsigned int dest = (slot[slot_].type != Resource::TypeNone) ?
+                        slot[slot_].dest : 0;
+  game->get_transit_index()->set(index, slot_, dest);
+}
+
+void
+Flag::set_has_inventory() {
+  bld_flags |= BIT(6);
+  game->get_flag_components()->inventory_added(this);
+}
+
+void
+Flag::clear_flags() {
+  if (has_inventory()) {
+    // the network may have no inventory left
+    game->get_flag_components()->clear();
+  }
+  bld_flags = 0;
+  bld2_flags = 0;
+}
+
 /* Find a transporter at pos and change it to state. */
 static int
 change_transporter_state_at_pos(Game *game, MapPos pos, Serf::State state) {
@@ -1389,9 +1636,13 @@ Flag::merge_paths(MapPos pos_) {
 
   flag_1->other_endpoint.f[dir_1] = flag_2;
   flag_2->other_endpoint.f[dir_2] = flag_1;
+  game->get_flag_components()->road_added(flag_1, flag_2);
 
+  flag_1->changed();
+  flag_2->changed();
   flag_1->transporter &= ~BIT(dir_1);
   flag_2->transporter &= ~BIT(dir_2);
+  game->road_network_changed();
 
   size_t len = Flag::get_road_length_value((size_t)path_1_data.path_len +
                                            (size_t)path_2_data.path_len);
@@ -1435,6 +1686,12 @@ Flag::merge_paths(MapPos pos_) {
 void
 Flag::update() {
   const int max_transporters[] = { 1, 2, 3, 4, 6, 8, 11, 15 };
+  // unless something changes or this has to try again, the next update
+  //  would do the same, nothing.  Scheduling and calling transporters
+  //  depend on more than this flag
+  int old_endpoint = endpoint;
+  int old_transporter = transporter;
+  bool try_again = false;
 
   /* Count and store in bitfield which directions
    have strictly more than 0,1,2,3 slots waiting. */
@@ -1464,6 +1721,7 @@ Flag::update() {
          been scheduled for fetch. */
         int res_dir = slot[slot_].dir;
         if (res_dir < 0) {
+          try_again = true;
           //Log::Info["flag"] << "debug: inside flag::update, about to schedule a slot";
           if (slot[slot_].dest != 0) {
             /* Destination is known */
@@ -1478,6 +1736,7 @@ Flag::update() {
   }
 
   /* Update transporter flags, decide if serf needs to be sent to road */
+  int old_transporters = transporters();
   for (Direction j : cycle_directions_ccw()) {
     if (has_path(j)) {
       if (serf_requested(j)) {
@@ -1508,6 +1767,7 @@ Flag::update() {
         if (free_transporter_count(j) < (unsigned int)max_tr &&
             !serf_request_fail()) {
           //Log::Debug["flag.cc"] << "inside Flag::update, flag at pos " << pos << ", dir " << j << NameDirection[j] << ", about to call_transporter";
+          try_again = true;
           bool r = call_transporter(j, is_water_path(j));
           //Log::Debug["flag.cc"] << "inside Flag::update, flag at pos " << pos << ", dir " << j << NameDirection[j] << ", done to call_transporter, result was " << r;
           if (!r) transporter |= BIT(7);
@@ -1524,6 +1784,13 @@ Flag::update() {
       }
     }
   }
+  if (transporters() != old_transporters) {
+    game->road_network_changed();
+  }
+  if (try_again || endpoint != old_endpoint ||
+      transporter != old_transporter) {
+    changed();
+  }
   //Log::Debug["flag.cc"] << "done Flag::update";
 }
 
@@ -1565,21 +1832,21 @@ send_serf_to_road_search_cb(Flag *flag, void *data) {
 
 bool
 Flag::call_transporter(Direction dir, bool water) {
+  ReplayCommandScope command(game, ReplayCommand(ReplayCommand::TypeCallTransporter, owner, index,
+                                                 dir, water));
   Flag *src_2 = other_endpoint.f[dir];
   Direction dir_2 = get_other_end_dir(dir);
 
-  search_dir = DirectionRight;
   // got a write access violation here, src_2 was nullptr
   //  I think this is an AI- specific issue related to the missing transporter work-around
   if (src_2 == nullptr) {
     Log::Warn["flag"] << "Flag::call_transporter - nullptr found when doing Flag *src_2 = other_endpoint.f[dir], returning false  FIND OUT WHY!";
     return false;
   }
-  src_2->search_dir = DirectionDownRight;
 
   FlagSearch search(game);
-  search.add_source(this);
-  search.add_source(src_2);
+  search.add_source(this, DirectionRight);
+  search.add_source(src_2, DirectionDownRight);
 
   SendSerfToRoadData data;
   data.inventory = NULL;
@@ -1596,9 +1863,11 @@ Flag::call_transporter(Direction dir, bool water) {
 
   length[dir] |= BIT(7);
   src_2->length[dir_2] |= BIT(7);
+  changed();
+  src_2->changed();
 
   Flag *src = this;
-  if (dest_flag->search_dir == src_2->search_dir) {
+  if (search.get_dir(dest_flag) == search.get_dir(src_2)) {
     src = src_2;
     dir = dir_2;
   }
@@ -1617,7 +1886,9 @@ Flag::reset_transport(Flag *other) {
     if (other->slot[slot_].type != Resource::TypeNone &&
         other->slot[slot_].dest == index) {
       other->slot[slot_].dest = 0;
+      other->slot_changed(slot_);
       other->endpoint |= BIT(7);
+      other->changed();
 
       if (other->slot[slot_].dir != DirectionNone) {
         Direction dir = other->slot[slot_].dir;
@@ -1635,6 +1906,8 @@ Flag::reset_destination_of_stolen_resources() {
       Resource::Type res = slot[i].type;
       game->cancel_transported_resource(res, slot[i].dest);
       slot[i].dest = 0;
+      slot_changed(i);
+      changed();
     }
   }
 }
@@ -1826,3 +2099,23 @@ operator << (SaveWriterText &writer, Flag &flag) {
 
   return writer;
 }
+
+void
+Flag::add_state_hash(StateHash *hash) const {
+  hash->add(index);
+  hash->add(owner);
+  hash->add(pos);
+  hash->add(path_con);
+  hash->add(endpoint);
+  hash->add(transporter);
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    hash->add(slot[i].type);
+    hash->add(slot[i].dir);
+    hash->add(slot[i].dest);
+  }
+  hash->add_array(length, 6);
+  hash->add_array(other_end_dir, 6);
+  hash->add(bld_flags);
+  hash->add(bld2_flags);
+  hash->add(serf_waiting_for_boat);
+}
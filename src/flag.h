@@ -43,6 +43,7 @@ class Player;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Flag : public GameObject {
 
@@ -66,6 +67,8 @@ class Flag : public GameObject {
   // temporarily moving this to public for popup.cc "find resources desteind for this building's flag search"
   //ResourceSlot slot[FLAG_MAX_RES_COUNT];
 
+  // no longer used by FlagSearch, which keeps its own visit marks and
+  //  dirs per thread.  Only kept so saved games keep their format
   int search_num;
   Direction search_dir;
   int transporter;
@@ -179,23 +182,32 @@ class Flag : public GameObject {
     return ((transporter & (1 << (dir))) != 0); }
   /* Whether this flag has tried to request a transporter without success. */
   bool serf_request_fail() const { return (transporter >> 7) & 1; }
-  void serf_request_clear() { transporter &= ~BIT(7); }
+  void serf_request_clear() {
+    if (serf_request_fail()) {
+      transporter &= ~BIT(7);
+      changed();
+    }
+  }
 
   // adding support for requested resource timeouts
   size_t get_road_length(Direction dir) const { return length[dir]; }
   /* Current number of transporters on path. */
   unsigned int free_transporter_count(Direction dir) const {
     return length[dir] & 0xf; }
-  void transporter_to_serve(Direction dir) { length[dir] -= 1; }
+  void transporter_to_serve(Direction dir) { length[dir] -= 1; changed(); }
   /* Length category of path determining max number of transporters. */
   unsigned int length_category(Direction dir) const {
     return (length[dir] >> 4) & 7; }
   /* Whether a transporter serf was successfully requested for this path. */
   bool serf_requested(Direction dir) const { return (length[dir] >> 7) & 1; }
-  void cancel_serf_request(Direction dir) { length[dir] &= ~BIT(7); }
+  void cancel_serf_request(Direction dir) {
+    length[dir] &= ~BIT(7);
+    changed();
+  }
   void complete_serf_request(Direction dir) {
     length[dir] &= ~BIT(7);
     length[dir] += 1;
+    changed();
   }
 
   /* The slot that is scheduled for pickup by the given path. */
@@ -230,12 +242,14 @@ class Flag : public GameObject {
   /* Whether this inventory accepts serfs. */
   bool accepts_serfs() const { return ((bld_flags >> 7) & 1); }
 
-  void set_has_inventory() { bld_flags |= BIT(6); }
+  // these two keep the road networks' inventory counts, see
+  //  flag-components.h
+  void set_has_inventory();
   void set_accepts_resources(bool accepts) { accepts ? bld2_flags |= BIT(7) :
                                                        bld2_flags &= ~BIT(7); }
   void set_accepts_serfs(bool accepts) { accepts ? bld_flags |= BIT(7) :
                                                    bld_flags &= ~BIT(7); }
-  void clear_flags() { bld_flags = 0; bld2_flags = 0; }
+  void clear_flags();
 
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Flag &flag);
@@ -244,7 +258,11 @@ class Flag : public GameObject {
   friend SaveWriterText&
     operator << (SaveWriterText &writer, Flag &flag);
 
-  bool schedule_known_dest_cb_(Flag *src, Flag *dest, int slot);
+  // fold the fields that change as the game runs into a state hash, see
+  //  Game::get_state_hash
+  void add_state_hash(StateHash *hash) const;
+
+  bool schedule_known_dest_cb_(Flag *src, Flag *dest, int slot, Direction dir);
 
   void reset_transport(Flag *other);
 
@@ -279,7 +297,6 @@ class Flag : public GameObject {
 
   void restore_path_serf_info(Direction dir, SerfPathInfo *data);
 
-  void set_search_dir(Direction dir) { search_dir = dir; }
   // even though this returns a Direction, it is often NOT
   //  a valid Direction 0-5!! I don't know why yet
   // NOT ONLY THAT, it seems that Game::update_inventories uses the
@@ -287,11 +304,19 @@ class Flag : public GameObject {
   //  so for the castle, search_dir is always 0 / DirectionRight / East
   //  and for the next warehouse that can fulfill, it is always 1 / DirectionDownRight / SouthEast
   //  so it is not a Direction at all but a var that is used for multiple purposes??
-  Direction get_search_dir() const { return search_dir; }
-  void clear_search_id() { search_num = 0; }
+  // only meaningful inside a FlagSearch callback (or via FlagSearch::get_dir),
+  //  it is the dir the current search on this thread reached this flag with
+  Direction get_search_dir() const;
 
   bool can_demolish() const;
+  // whether the flag has any road, NOT whether it can be reached from
+  //  an inventory
   bool is_connected() const;
+  // the road network the flag is in and whether any flag in it has an
+  //  inventory, see flag-components.h.  If not, no serf or resource can
+  //  get here from one
+  unsigned int get_road_network() const;
+  bool is_connected_to_inventory() const;
 
   void merge_paths(MapPos pos);
 
@@ -301,6 +326,11 @@ class Flag : public GameObject {
   bool call_transporter(Direction dir, bool water);
 
  protected:
+  // anything Flag::update looks at changed, so Game::update_flags has to
+  //  look at this flag again
+  void changed();
+  // the slot's type or dest was written, see transit-index.h
+  void slot_changed(int slot_);
   void fix_scheduled();
 
   void schedule_slot_to_unknown_dest(int slot);
@@ -313,22 +343,45 @@ class Flag : public GameObject {
 
 typedef bool flag_search_func(Flag *flag, void *data);
 
+// breadth-first search over the flag graph, from one or more source flags
+//  each tagged with a dir, which is copied to every flag reached from it.
+// The queue and visit marks live in a per-thread Context that is reused by
+//  every search, so a search allocates nothing once the Context has grown to
+//  the number of flags, and AI threads can search at the same time as the
+//  game thread without trampling each other's marks like the old
+//  Flag::search_num did.  A search started from inside another search's
+//  callback gets its own Context.
 class FlagSearch {
  protected:
+  class Context;
+  struct Stack;
+
   Game *game;
-  std::vector<Flag*> queue;
-  int id;
+  Context *context;
+
+  static Stack &get_stack();
 
  public:
   explicit FlagSearch(Game *game);
-
-  int get_id() { return id; }
-  void add_source(Flag *flag);
+  FlagSearch(const FlagSearch&) = delete;
+  ~FlagSearch();
+
+  void add_source(Flag *flag, Direction dir = DirectionNone);
+  bool is_visited(const Flag *flag) const;
+  // mark a flag as done without searching from it
+  void mark_visited(const Flag *flag, Direction dir);
+  Direction get_dir(const Flag *flag) const;
   bool execute(flag_search_func *callback,
                bool land, bool transporter, void *data);
+  // same as execute(callback, false, true, data), but walks the visiting
+  //  order cached in Game's FlagRoutes instead of searching.  Game thread
+  //  only, and no flags may have been mark_visited
+  bool execute_transport(flag_search_func *callback, void *data);
 
   static bool single(Flag *src, flag_search_func *callback,
                      bool land, bool transporter, void *data);
+  // the innermost search on this thread, nullptr if none
+  static const FlagSearch *get_current();
 };
 
 #endif  // SRC_FLAG_H_
@@ -0,0 +1,71 @@
+/*
+ * fog-of-war.cc - per player count of the buildings that can see each tile
+ */
+
+#include "src/fog-of-war.h"
+
+#include "src/debug.h"
+
+void
+FogOfWar::clear() {
+  counts.clear();
+  stamps.clear();
+}
+
+void
+FogOfWar::reset(unsigned int tile_count) {
+  counts.assign(tile_count * FOG_OF_WAR_MAX_PLAYERS, 0);
+  stamps.assign(tile_count, 0);
+}
+
+bool
+FogOfWar::set_stamp(Map *map, MapPos pos, int owner, int radius) {
+  uint8_t stamp = 0;
+  if (owner >= 0 && radius > 0) {
+    if (owner >= FOG_OF_WAR_MAX_PLAYERS || radius > 31) {
+      throw ExceptionFreeserf("FogOfWar, player index or radius out of range");
+    }
+    stamp = static_cast<uint8_t>((owner << 5) | radius);
+  }
+  if (stamps[pos] == stamp) {
+    return false;
+  }
+  bool changed = false;
+  if (stamps[pos] != 0) {
+    changed |= apply(map, pos, stamps[pos] >> 5, stamps[pos] & 31, false);
+  }
+  if (stamp != 0) {
+    changed |= apply(map, pos, owner, radius, true);
+  }
+  stamps[pos] = stamp;
+  return changed;
+}
+
+bool
+FogOfWar::apply(Map *map, MapPos center, unsigned int owner, int radius,
+                bool add) {
+  bool changed = false;
+  // same as _spiral_dist[radius], the number of tiles within radius shells
+  unsigned int tiles = 1 + 3*radius*(radius + 1);
+  map->for_each_extended_spiral(center, tiles, [&](MapPos pos) {
+    uint16_t &count = counts[pos * FOG_OF_WAR_MAX_PLAYERS + owner];
+    if (add) {
+      if (count == UINT16_MAX) {
+        throw ExceptionFreeserf("FogOfWar, visibility count overflow");
+      }
+      if (count++ == 0 && !map->is_visible(pos, owner)) {
+        map->set_visible(pos, owner);
+        changed = true;
+      }
+    } else {
+      if (count == 0) {
+        throw ExceptionFreeserf("FogOfWar, visibility count underflow");
+      }
+      if (--count == 0 && map->is_visible(pos, owner)) {
+        map->unset_visible(pos, owner);
+        changed = true;
+      }
+    }
+  });
+  return changed;
+}
@@ -0,0 +1,49 @@
+/*
+ * fog-of-war.h - per player count of the buildings that can see each tile
+ *
+ *  option_FogOfWar used to clear visibility in the castle radius around a
+ *   changed building, then look for military buildings in twice that
+ *   radius and set visibility again for every one of them, and redraw
+ *   the frame every time.
+ *  This keeps, per tile and player, how many of the player's active
+ *   military buildings can see it.  Each building's spiral is counted up
+ *   or down once when the building changes, and the visible bit in the
+ *   map's tile_owner is only touched on the tiles whose count goes from
+ *   or to zero, so nothing else has to be looked up and a change nobody
+ *   can see does not redraw anything.
+ *  Like InfluenceField each tile remembers the stamp its building applied
+ *   (owner and visible radius) so a building can be taken away again
+ *   without knowing what it was.
+ */
+
+#ifndef SRC_FOG_OF_WAR_H_
+#define SRC_FOG_OF_WAR_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "src/map.h"
+
+#define FOG_OF_WAR_MAX_PLAYERS  4
+
+class FogOfWar {
+ protected:
+  std::vector<uint16_t> counts;  // per tile, per player
+  std::vector<uint8_t> stamps;   // per tile, 0 or owner << 5 | radius
+
+  bool apply(Map *map, MapPos center, unsigned int owner, int radius,
+             bool add);
+
+ public:
+  // forget everything, a new or loaded map, or the option turned on
+  //  mid-game.  Game::init_FogOfWar resets it for the map's size
+  void clear();
+  void reset(unsigned int tile_count);
+  bool is_empty() const { return stamps.empty(); }
+
+  // the building at pos now sees radius shells for owner, or nothing if
+  //  owner is -1.  True if any tile's visible bit changed
+  bool set_stamp(Map *map, MapPos pos, int owner, int radius);
+};
+
+#endif  // SRC_FOG_OF_WAR_H_
@@ -0,0 +1,93 @@
+/*
+ * game-command-queue.cc - commands posted by AI threads, applied by the game
+ */
+
+#include "src/game-command-queue.h"
+
+#include <utility>
+
+GameCommandQueue::GameCommandQueue()
+  : head(nullptr)
+  , closed(false) {
+}
+
+GameCommandQueue::~GameCommandQueue() {
+  close();
+}
+
+GameCommandQueue::Result
+GameCommandQueue::post(const ReplayCommand &command) {
+  return std::move(post(std::vector<ReplayCommand>{command}).front());
+}
+
+std::vector<GameCommandQueue::Result>
+GameCommandQueue::post(const std::vector<ReplayCommand> &commands) {
+  std::vector<Result> results;
+  if (commands.empty()) {
+    return results;
+  }
+  // chained newest first, the way they sit on the stack
+  Node *first = nullptr;
+  Node *last = nullptr;
+  for (const ReplayCommand &command : commands) {
+    Node *node = new Node();
+    node->command = command;
+    node->next = first;
+    results.push_back(node->result.get_future());
+    if (last == nullptr) {
+      last = node;
+    }
+    first = node;
+  }
+  if (closed.load(std::memory_order_acquire)) {
+    fail_all(first);
+    return results;
+  }
+  push(first, last);
+  // close() may have emptied the queue between the check above and the
+  //  push, in that case nobody else is going to look at it again
+  if (closed.load(std::memory_order_acquire)) {
+    fail_all(take_all());
+  }
+  return results;
+}
+
+// lock-free, whoever loses the compare-and-swap just tries again
+void
+GameCommandQueue::push(Node *first, Node *last) {
+  last->next = head.load(std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(last->next, first,
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+  }
+}
+
+// newest first on the stack, reversed here to oldest first
+GameCommandQueue::Node *
+GameCommandQueue::take_all() {
+  Node *node = head.exchange(nullptr, std::memory_order_acquire);
+  Node *reversed = nullptr;
+  while (node != nullptr) {
+    Node *next = node->next;
+    node->next = reversed;
+    reversed = node;
+    node = next;
+  }
+  return reversed;
+}
+
+void
+GameCommandQueue::fail_all(Node *node) {
+  while (node != nullptr) {
+    Node *next = node->next;
+    node->result.set_value(false);
+    delete node;
+    node = next;
+  }
+}
+
+void
+GameCommandQueue::close() {
+  closed.store(true, std::memory_order_release);
+  fail_all(take_all());
+}
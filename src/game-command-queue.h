@@ -0,0 +1,76 @@
+/*
+ * game-command-queue.h - commands posted by AI threads, applied by the game
+ *
+ *  The AI threads used to call Game::build_road, demolish_flag and friends
+ *   directly, each call bracketed by AI::mutex_lock/mutex_unlock, so every
+ *   AI write fought the game thread for the mutex in the middle of a tick.
+ *  Now they post the same typed commands the replay log uses (see
+ *   replay.h) to a GameCommandQueue and Game::update applies everything
+ *   posted so far at one fixed point, the start of the update, before any
+ *   phase runs.  The poster gets a std::future for the command's result.
+ *  Posting never blocks, it is a compare-and-swap push onto a linked
+ *   stack.  The game thread takes the whole stack with one exchange and
+ *   reverses it, so commands are applied in the order they were posted.
+ */
+
+#ifndef SRC_GAME_COMMAND_QUEUE_H_
+#define SRC_GAME_COMMAND_QUEUE_H_
+
+#include <atomic>
+#include <future>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <vector>
+
+#include "src/replay.h"
+
+class GameCommandQueue {
+ public:
+  // true if the game function the command maps to succeeded
+  typedef std::future<bool> Result;
+
+ protected:
+  typedef struct Node {
+    ReplayCommand command;
+    std::promise<bool> result;
+    Node *next;
+  } Node;
+
+  std::atomic<Node*> head;
+  std::atomic<bool> closed;
+
+  void push(Node *first, Node *last);
+  Node *take_all();
+  static void fail_all(Node *node);
+
+ public:
+  GameCommandQueue();
+  ~GameCommandQueue();
+
+  // any thread.  After close() the result is false right away
+  Result post(const ReplayCommand &command);
+  // several commands that must not have a game update between them (a road
+  //  and the flag at its end), they are applied back to back in order
+  std::vector<Result> post(const std::vector<ReplayCommand> &commands);
+
+  // game thread only, apply(command) for everything posted so far, oldest
+  //  first.  Returns the number of commands applied
+  template<class F> size_t drain(F apply) {
+    Node *node = take_all();
+    size_t count = 0;
+    while (node != nullptr) {
+      Node *next = node->next;
+      node->result.set_value(apply(node->command));
+      delete node;
+      node = next;
+      count++;
+    }
+    return count;
+  }
+
+  bool is_empty() const { return head.load(std::memory_order_acquire) == nullptr; }
+
+  // the game is going away, fail everything still queued so no AI thread
+  //  waits forever, and refuse anything posted from now on
+  void close();
+};
+
+#endif  // SRC_GAME_COMMAND_QUEUE_H_
@@ -67,10 +67,11 @@ GameManager::set_current_game(PGame new_game) {
   }
 }
 
-bool
-GameManager::start_random_game() {
-  // allow junk?  need to create defaults
-  // just set the defaults here for now, need to make these initialized and passed or otherwise work without specifying
+// allow junk?  need to create defaults
+// just set the defaults here for now, need to make these initialized and passed or otherwise work without specifying
+//  this is shared by start_random_game and the headless runner, which both start a game without the game-init box
+CustomMapGeneratorOptions
+GameManager::get_default_custom_map_generator_options() {
   CustomMapGeneratorOptions custom_map_generator_options;
   for (int x = 0; x < 23; x++){
     custom_map_generator_options.opt[x] = 1.00;
@@ -79,6 +80,12 @@ GameManager::start_random_game() {
   custom_map_generator_options.opt[CustomMapGeneratorOption::MountainIron] = 4.00;
   custom_map_generator_options.opt[CustomMapGeneratorOption::MountainCoal] = 9.00;
   custom_map_generator_options.opt[CustomMapGeneratorOption::MountainStone] = 2.00;
+  return custom_map_generator_options;
+}
+
+bool
+GameManager::start_random_game() {
+  CustomMapGeneratorOptions custom_map_generator_options = get_default_custom_map_generator_options();
 
   PGameInfo game_info(new GameInfo(Random()));
   //return start_game(game_info);
@@ -59,6 +59,8 @@ class GameManager {
   bool start_game(PGameInfo game_info, CustomMapGeneratorOptions custom_map_generator_options);
   bool load_game(const std::string &path);
 
+  static CustomMapGeneratorOptions get_default_custom_map_generator_options();
+
  protected:
   void set_current_game(PGame new_game);
 };
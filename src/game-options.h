@@ -47,6 +47,7 @@ extern bool option_ForesterMonoculture;
 extern bool option_CheckPathBeforeAttack;  // this is forced on
 extern bool option_SpinningAmigaStar;
 extern bool option_HighMinerFoodConsumption;
+extern bool option_ParallelMapUpdate;  // split Map::update over the TaskPool
 
 extern unsigned int mapgen_size;
 extern uint16_t mapgen_trees;
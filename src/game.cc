@@ -27,6 +27,8 @@
 
 #include <string>
 #include <algorithm>
+#include <atomic>
+#include <climits>
 #include <map>
 #include <memory>
 #include <sstream>
@@ -40,7 +42,9 @@
 #include "src/map.h"
 #include "src/map-generator.h"
 #include "src/map-geometry.h"
+#include "src/build-sites.h"
 
+#include "src/state-hash.h"
 #include "src/version.h" // for tick_length
 
 #define GROUND_ANALYSIS_RADIUS  25
@@ -76,6 +80,7 @@ bool option_ForesterMonoculture = false;  // this looks bad in Spring and Winter
 bool option_CheckPathBeforeAttack = true;  // this is forced on
 bool option_SpinningAmigaStar = true;
 bool option_HighMinerFoodConsumption = false;
+bool option_ParallelMapUpdate = false;  // different (still deterministic) random draws, so it is a replay option
 
 // map generator settings
 /*
@@ -165,13 +170,20 @@ Game::Game()
   , tutorial_level(0)
   , mission_level(0)
   , map_preserve_bugs(0)
-  , player_score_leader(0) {
+  , player_score_leader(0)
+  , flag_routes(this)
+  , flag_components(this)
+  , serf_update_pass(0)
+  , serf_update_tick(0)
+  , serf_update_prev_tick(0)
+  , serf_update_index(UINT_MAX) {
   players = Players(this);
   flags = Flags(this);
   inventories = Inventories(this);
   buildings = Buildings(this);
   serfs = Serfs(this);
   std::mutex mutex;
+  world_snapshot = std::make_shared<WorldSnapshot>();
 
   /* Create NULL-serf */
   serfs.allocate();
@@ -265,6 +277,7 @@ Game::reset_game_options_defaults() {
   option_CheckPathBeforeAttack = true;  // this is forced on
   option_SpinningAmigaStar = true;
   option_HighMinerFoodConsumption = false;
+  option_ParallelMapUpdate = false;
 }
 
 /* Clear the serf request bit of all flags and buildings.
@@ -291,10 +304,21 @@ Game::update_knight_morale() {
   mutex_unlock();
 }
 
+// what a search from one set of inventories finds does not depend on the
+//  resource type, only on the roads.  Game::update_inventories used to run
+//  the search again for every type it hands out, now it walks the roads
+//  once per set of sources and goes through the buildings found for each
+//  type, see there
+typedef struct InventorySweep {
+  // the flags with a building, in the order the search reaches them, and
+  //  the inventory (index into invs[]) each was reached from
+  std::vector<std::pair<Flag*, int>> buildings;
+  // per inventory, the dist_so_far after the last flag reached from it
+  int dists_from_inv[256];
+} InventorySweep;
+
 typedef struct UpdateInventoriesData {
-  Resource::Type resource;
-  int *max_prio;
-  Flag **flags;
+  std::vector<std::pair<Flag*, int>> *buildings;
   // adding support for requested resource timeouts:
   // - when requesting a resource, count the total tile distance it must travel
   //    as determined by adding up the length of the path-dirs followed in the
@@ -335,16 +359,11 @@ Game::update_inventories_cb(Flag *flag, void *d) {
   //   but for other warehouse will be 1, 2, 100, and so on
   //Log::Info["game"] << "debug: inside update_inventories_cb, flag pos = " << flag->get_position() << ", \"flag->search_dir\" i.e. inv[#] = " << inv << ", for resource " << NameResource[data->resource];
 
-  if (data->max_prio[inv] < 255 && flag->has_building()) {
-    Building *building = flag->get_building();
-
-    int bld_prio = building->get_max_priority_for_resource(data->resource, 16);
-    if (bld_prio > data->max_prio[inv]) {
-      data->max_prio[inv] = bld_prio;
-      data->flags[inv] = flag;
-      //Log::Info["game"] << "debug: case1 setting data->dists_so_far[" << inv << "] = " << data->dist_so_far;
-      data->dists_from_inv[inv] = data->dist_so_far;
-    }
+  // which of these buildings wants the resource is checked per resource
+  //  type by update_inventories, the dist recorded for it there is
+  //  overwritten below anyway
+  if (flag->has_building()) {
+    data->buildings->push_back(std::make_pair(flag, inv));
   }
   // adding support for requested resource timeouts
   //
@@ -492,6 +511,11 @@ Game::update_inventories() {
     default: arr = arr_1; break;
   }
 
+  // the searches already done this time, by their sources.  Nothing in
+  //  here changes the roads or buildings, so a set of inventories that
+  //  has a search already gets the same result again
+  std::map<FlagRoutes::Sources, InventorySweep> sweeps;
+
   while (arr[0] != Resource::TypeNone) {
     for (Player *player : players) {
       // the ONLY VALID "Inventories" are the castle and warehouse/stocks!
@@ -576,61 +600,68 @@ Game::update_inventories() {
       //  skip this resource type and move on to the next resource type
       if (n == 0) continue;
 
-      // if there ARE inventories that could supply this type of resource
-      //  start a new search
-      FlagSearch search(this);
+      // the search is the same for every resource type these inventories
+      //  are the sources of, only run it the first time
+      FlagRoutes::Sources sources;
+      for (int i = 0; i < n; i++) {
+        // NOTE - Directions only go from 0-5, but this is setting 0-256!
+        //  this may explain why elsewhere I see invalid dirs, and various
+        //  bitwise operators doing 'AND 255' on Direction integers
+        //
+        // I no longer think that search_dir actually refers to a direction at all in some cases
+        //  it looks like it is simply used to store the INVENTORY INDEX FOR THIS CURRENT SEARCH
+        //   rather than any valid Direction 0-5
+        sources.push_back(FlagRoutes::Visit(invs[i]->get_flag_index(),
+                                            (Direction)i));
+      }
+      auto found = sweeps.find(sources);
+      if (found == sweeps.end()) {
+        // if there ARE inventories that could supply this type of resource
+        //  start a new search
+        FlagSearch search(this);
+        InventorySweep &sweep = sweeps[sources];
+        for (int i = 0; i < n; i++) {
+          sweep.dists_from_inv[i] = -1;
+          // get the game->Flag* attached to the inventory building and
+          //  add it as a source to the FlagSearch
+          search.add_source(flags[invs[i]->get_flag_index()], (Direction)i);
+        }
+
+        UpdateInventoriesData data;
+        data.buildings = &sweep.buildings;
+        // adding support for requested resource timeouts
+        data.dists_from_inv = sweep.dists_from_inv;
+        data.dist_so_far = 0;
+        // I guess I need to set this explicitly?  was seeing weird behavior
+        data.prev_flag = nullptr;
+
+        //
+        // the update_inventories_cb populates above variables
+        // it always *returns* false, but the return code is meaningless
+        //
+        //Log::Info["game"] << "debug: starting Game::update_inventories flagsearch";
+        search.execute_transport(update_inventories_cb, &data);
+        found = sweeps.find(sources);
+      }
+      const InventorySweep &sweep = found->second;
 
       // each array item will map to one of the invs[], which are the
       //  valid inventories that could supply this type of resource.
       // Up to 256 inventories could be considered, but usually much fewer!
       int max_prio[256];
       Flag *flags_[256];
-      // adding support for requested resource timeouts
-      int dists_from_inv[256];
 
       // set the initial values for each inventory
       //  'n' is the number of inventories found that could supply
       //  this type of resource... i.e. the highest element
       //   of array inv[]
       for (int i = 0; i < n; i++) {
-        //Log::Info["game"] << "debug: inside Game::update_inventories, wtf0, i = " << i << ", n = " << n;
         max_prio[i] = 0;
-        flags_[i] = NULL;  // this is populated by the search callback update_inventories_cb - it is set to the flag of the nearest building
+        flags_[i] = NULL;  // this is set below to the flag of the nearest building
                            //  found that desires this resource (as indicated by the building setting its 'prio' for that stock0/1)
-        // adding support for requested resource timeouts
-        dists_from_inv[i] = -1;
-        // get the game->Flag* attached to the inventory building...
-        Flag *flag = flags[invs[i]->get_flag_index()];
-        // and set its search dir and add it as a source to the FlagSearch
-        // NOTE - Directions only go from 0-5, but this is setting 0-256!
-        //  this may explain why elsewhere I see invalid dirs, and various
-        //  bitwise operators doing 'AND 255' on Direction integers
-        //
-        // I no longer think that search_dir actually refers to a direction at all in some cases
-        //  it looks like it is simply used to store the INVENTORY INDEX FOR THIS CURRENT SEARCH
-        //   rather than any valid Direction 0-5
-        //
-        //Log::Info["game"] << "debug: inside Game::update_inventories, wtf1, i = " << i << ", n = " << n << ", (Direction)i = " << (Direction)i;
-        flag->set_search_dir((Direction)i);
-        //Log::Info["game"] << "debug: inside Game::update_inventories, wtf1, i = " << i << ", n = " << n << ", flag->get_search_dir = " << flag->get_search_dir();
-        search.add_source(flag);
       }
 
-      UpdateInventoriesData data;
-      data.resource = arr[0];
-      data.max_prio = max_prio;
-      data.flags = flags_;
-      // adding support for requested resource timeouts
-      data.dists_from_inv = dists_from_inv;
-      data.dist_so_far = 0;
-      // I guess I need to set this explicitly?  was seeing weird behavior
-      data.prev_flag = nullptr;
-
-      //
-      // the update_inventories_cb populates above variables
-      // it always *returns* false, but the return code is meaningless
-      //
-      // NOTE - the update_inventories_cb finds buildings that desire (by way of stock[x].prio value)
+      // NOTE - this finds buildings that desire (by way of stock[x].prio value)
       //  the currently selected resource (arr[x]) AND have over 16 priority.  Because buildings
       //  request priority decreases as its stored+requested res count increases, it quickly falls
       //  under the minimum 16 and so will not have any more sent.  However, other sources
@@ -639,8 +670,17 @@ Game::update_inventories() {
       // it looks like the schedule_unknown_dest_cb does not have a minimum prio
       //  and so it can fill a processing building up by directly sourcing from producers
       //
-      //Log::Info["game"] << "debug: starting Game::update_inventories flagsearch";
-      search.execute(update_inventories_cb, false, true, &data);
+      for (const std::pair<Flag*, int> &found_bld : sweep.buildings) {
+        int inv = found_bld.second;
+        if (max_prio[inv] < 255) {
+          Building *building = found_bld.first->get_building();
+          int bld_prio = building->get_max_priority_for_resource(arr[0], 16);
+          if (bld_prio > max_prio[inv]) {
+            max_prio[inv] = bld_prio;
+            flags_[inv] = found_bld.first;
+          }
+        }
+      }
 
       //  'n' is the number of inventories found that could supply
       //  this type of resource... i.e. the highest element
@@ -654,14 +694,14 @@ Game::update_inventories() {
           Resource::Type res = (Resource::Type)arr[0];
           //Log::Verbose["game"] << "destination found for resource type " << NameResource[res] << from inventory " << i;
 		  
-          // this will have been populated by the search callback update_inventories_cb - it is set to the flag of the nearest building
+          // this will have been set above - it is set to the flag of the nearest building
           //  found that desires this resource (as indicated by the building setting its 'prio' for that stock0/1)
           Building *dest_bld = flags_[i]->get_building();  
           
           //Log::Info["flag"] << "inside Game::update_inventories, about to call add_requested_resource for dest_bld of type " << NameBuilding[dest_bld->get_type()];
           // adding support for requested resource timeouts
           //if (!dest_bld->add_requested_resource(res, false)) {
-          int dist_from_inv = dists_from_inv[i];
+          int dist_from_inv = sweep.dists_from_inv[i];
           //Log::Info["flag"] << "inside Game::update_inventories, about to call dest_bld->add_requested_resource(" << NameResource[res] << ", false, " << dist_from_inv << ") for dest_bld of type " << NameBuilding[dest_bld->get_type()];
           if (!dest_bld->add_requested_resource(res, false, dist_from_inv)) {
             throw ExceptionFreeserf("Failed to request resource.");
@@ -682,27 +722,15 @@ Game::update_inventories() {
 void
 Game::update_flags() {
   mutex_lock("Game::update_flags");
-  // replacing with p1plp1 way, this works reliably
-  Flags::Iterator i = flags.begin();
-  Flags::Iterator prev = flags.begin();
-  while (i != flags.end()) {
-    prev = i;
-    Flag *flag = *i;
-    if (flag != NULL) {
-      if (flag->get_index() != 0) {
-        flag->update();
-        if (flag == NULL)
-          Log::Debug["game"] << "Game::update_flags, flag is NULL after update";
-      }
-    }
-    if (flag == NULL) {
-      Log::Debug["game"] << "Game::update_flags, flag is NULL so set i=prev";
-      i = prev;
-    }
-    else {
-      if (i != flags.end())
-        ++i;
+  // only the flags that changed or still have work to do, see
+  //  flag-worklist.h.  Flag 0 is not a real flag
+  unsigned int index = 1;
+  while (flag_worklist.take_next(&index)) {
+    Flag *flag = flags[index];
+    if (flag != nullptr) {
+      flag->update();
     }
+    index++;
   }
   mutex_unlock();
 }
@@ -861,6 +889,13 @@ Game::send_serf_to_flag(Flag *dest, Serf::Type type, Resource::Type res1,
   data.res1 = res1;  // tool1
   data.res2 = res2;  // tool2
 
+  // if no flag in dest's road network has an inventory the search below
+  //  goes through all of it to find nothing, unconnected buildings ask
+  //  for their serfs again and again
+  if (!dest->is_connected_to_inventory()) {
+    return false;
+  }
+
   // this callback returns true if either an existing idle serf can be sent out from an Inv
   //  or if a new serf can be created (consuming tools or weapons) and sent out from an Inv
   bool r = FlagSearch::single(dest, send_serf_to_flag_search_cb, true, false, &data);
@@ -926,6 +961,7 @@ Game::send_serf_to_flag(Flag *dest, Serf::Type type, Resource::Type res1,
 /* Dispatch geologist to flag. */
 bool
 Game::send_geologist(Flag *dest) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeSendGeologist, dest->get_owner(), dest->get_index()));
   return send_serf_to_flag(dest, Serf::TypeGeologist, Resource::TypeHammer, Resource::TypeNone);
 }
 
@@ -947,6 +983,22 @@ Game::update_buildings() {
 void
 Game::update_serfs() {
   mutex_lock("Game::update_serfs");
+  serf_update_pass++;
+  serf_update_prev_tick = serf_update_tick;
+  serf_update_tick = tick;
+  serf_update_index = 0;
+
+  // serfs whose countdown runs out by now are updated again.  The entry
+  //  is stale if the serf woke early, died, or fell asleep again since
+  serf_timer_wheel.advance(tick, &due_serfs);
+  for (const SerfTimerWheel::Entry &entry : due_serfs) {
+    Serf *serf = serfs[entry.serf];
+    if (serf != nullptr && serf->is_sleeping() &&
+        serf->get_wake_tick() == entry.wake_tick) {
+      serf->wake();
+    }
+  }
+
   Serfs::Iterator i = serfs.begin();
   while (i != serfs.end()) {
     Serf *serf = *i;
@@ -954,10 +1006,18 @@ Game::update_serfs() {
     if (serf == nullptr){
       continue;
     }
-    if (serf->get_index() != 0) {
+    if (serf->get_index() != 0 && !serf->is_sleeping()) {
+      unsigned int index = serf->get_index();
+      serf_update_index = index;
       serf->update();
+      // the serf may have died in its update
+      serf = serfs[index];
+      if (serf != nullptr) {
+        serf->try_sleep();
+      }
     }
   }
+  serf_update_index = UINT_MAX;
   mutex_unlock();
 }
 
@@ -1100,6 +1160,30 @@ Game::update_game_stats() {
 
 }
 
+const char *Game::update_phase_name[UpdatePhaseMax] = {
+  "map_update",
+  "player_update",
+  "update_inventories",
+  "update_flags",
+  "update_buildings",
+  "update_serfs",
+  "update_game_stats",
+  "other",
+};
+
+// add the time since phase_start to this phase and restart the clock for the
+//  next phase.  Does nothing unless the profiler turned profile_update on
+void
+Game::end_update_phase(UpdatePhase phase, std::chrono::steady_clock::time_point *phase_start) {
+  if (!profile_update) {
+    return;
+  }
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  update_phase_nsec[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - *phase_start).count();
+  update_phase_calls[phase]++;
+  *phase_start = now;
+}
+
 /* Update game state after tick increment. */
 void
 Game::update() {
@@ -1190,6 +1274,27 @@ Game::update() {
   //option_InvertMouse
   */
 
+  // replay bookkeeping.  Settings changed since the last update are recorded
+  //  before it starts, then commands due before the first phase are applied
+  if (replay_recording || replay_playing) {
+    mutex.lock();
+    if (replay_recording) {
+      record_setting_changes();
+    }
+    in_update = true;
+    update_thread_id = std::this_thread::get_id();
+    update_count++;
+    update_boundary = 0;
+    mutex.unlock();
+    if (replay_playing) {
+      apply_due_replay_commands();
+    }
+  }
+
+  // AI commands posted since the last update, always at this one point so
+  //  it does not matter where in the tick the AI thread happened to be
+  apply_queued_commands();
+
   /* Increment tick counters */
   const_tick += 1;  // NOTE!!! anything that was using const_tick to keep realtime is now accelerated by "cpu warp" game speeds 2-10!
                     //   FIND ALL PLACES THAT const_tick IS USED AND ADJUST TO USE SDL_GetTick INSTEAD!
@@ -1232,8 +1337,15 @@ Game::update() {
 
   //Log::Info["game"] << "current game_speed " << game_speed << " SDL_Timer " << tick_length << "ms, progression/game tick " << game_ticks_per_update;
 
+  std::chrono::steady_clock::time_point phase_start;
+  if (profile_update) {
+    phase_start = std::chrono::steady_clock::now();
+  }
+
   clear_serf_request_failure();
+  end_update_phase(UpdatePhaseOther, &phase_start);
   map->update(tick, &init_map_rnd);
+  end_update_phase(UpdatePhaseMap, &phase_start);
 
   /* Update players */
   // this must be mutex locked because new serfs are born during this step, and allocating new serfs invalidates any other serf iterators
@@ -1248,12 +1360,14 @@ Game::update() {
     }
     player->update();
   }
+  end_update_phase(UpdatePhasePlayers, &phase_start);
 
   /* Update knight morale */
   knight_morale_counter -= tick_diff;
   if (knight_morale_counter < 0) {
     update_knight_morale();
     knight_morale_counter += 256;
+    end_update_phase(UpdatePhaseOther, &phase_start);
   }
 
   /* Schedule resources to go out of inventories */
@@ -1261,6 +1375,7 @@ Game::update() {
   if (inventory_schedule_counter < 0) {
     update_inventories();
     inventory_schedule_counter += 64;
+    end_update_phase(UpdatePhaseInventories, &phase_start);
   }
 
 #if 0
@@ -1287,9 +1402,39 @@ Game::update() {
 #endif
 
   update_flags();
+  end_update_phase(UpdatePhaseFlags, &phase_start);
   update_buildings();
+  end_update_phase(UpdatePhaseBuildings, &phase_start);
   update_serfs();
+  end_update_phase(UpdatePhaseSerfs, &phase_start);
   update_game_stats();
+  end_update_phase(UpdatePhaseGameStats, &phase_start);
+
+  if (state_hash_interval > 0 && tick / state_hash_interval != last_tick / state_hash_interval) {
+    // the raw mutex, Game::mutex_lock would count as a replay boundary
+    mutex.lock();
+    uint64_t hash = get_state_hash();
+    mutex.unlock();
+    Log::Info["game"] << "state hash at tick " << tick << ": " << std::hex << hash << std::dec;
+  }
+
+  // nobody reads the snapshot when no AI is running (the headless runner
+  //  without -a, replays)
+  if (ai_threads_remaining > 0 &&
+      (world_snapshot_version == 0 ||
+       tick / WORLD_SNAPSHOT_TICKS != last_tick / WORLD_SNAPSHOT_TICKS)) {
+    publish_world_snapshot();
+  }
+
+  if (replay_recording || replay_playing) {
+    mutex.lock();
+    in_update = false;
+    update_boundary = ReplayCommand::AfterUpdate;
+    mutex.unlock();
+    if (replay_playing) {
+      apply_due_replay_commands();
+    }
+  }
 }
 
 /* Pause or unpause the game. */
@@ -1485,6 +1630,10 @@ Game::can_build_road(const Road &road, const Player *player, MapPos *dest,
 /* Construct a road spefified by a source and a list of directions. */
 bool
 Game::build_road(const Road &road, const Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeBuildRoad, player->get_index(), road.get_source()));
+  for (Direction dir : road.get_dirs()) {
+    command.get_command()->list.push_back(dir);
+  }
   if (road.get_length() == 0){
     Log::Warn["game"] << "inside build_road, road.get_length == 0, returning false";
     return false;
@@ -1532,8 +1681,12 @@ Game::flag_reset_transport(Flag *flag) {
   }
 
   /* Flag. */
-  for (Flag *other_flag : flags) {
-    flag->reset_transport(other_flag);
+  // only the flags holding resources for this one, see transit-index.h,
+  //  in index order like the loop over all flags was
+  std::vector<unsigned int> holding;
+  transit_index.get_flags(flag->get_index(), &holding);
+  for (unsigned int index : holding) {
+    flag->reset_transport(flags[index]);
   }
 
   /* Inventories. */
@@ -1559,8 +1712,8 @@ Game::building_remove_player_refs(Building *building) {
 
 bool
 Game::path_serf_idle_to_wait_state(MapPos pos) {
-  /* Look through serf array for the corresponding serf. */
-  for (Serf *serf : serfs) {
+  /* Look through the serfs at pos for the corresponding serf. */
+  for (Serf *serf : get_serfs_at_pos(pos)) {
     if (serf->idle_to_wait_state(pos)) {
       return true;
     }
@@ -1674,6 +1827,7 @@ Game::demolish_road_(MapPos pos) {
 /* Demolish road at position. */
 bool
 Game::demolish_road(MapPos pos, Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeDemolishRoad, player->get_index(), pos));
   if (!can_demolish_road(pos, player)) return false;
 
   return demolish_road_(pos);
@@ -1817,6 +1971,7 @@ Game::can_build_flag(MapPos pos, const Player *player) const {
 /* Build flag at pos. */
 bool
 Game::build_flag(MapPos pos, Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeBuildFlag, player->get_index(), pos));
   if (!can_build_flag(pos, player)) {
     return false;
   }
@@ -1838,6 +1993,15 @@ Game::build_flag(MapPos pos, Player *player) {
 /* Check whether military buildings are allowed at pos. */
 bool
 Game::can_build_military(MapPos pos) const {
+  return map->get_build_sites()->get(pos, BuildSites::SiteMilitary,
+                                     [this](MapPos p, bool *) {
+    return check_build_military(p);
+  });
+}
+
+// can_build_military without the cache
+bool
+Game::check_build_military(MapPos pos) const {
   /* Check that no military buildings are nearby */
   for (int i = 0; i < 1+6+12; i++) {
     MapPos p = map->pos_add_spirally(pos, i);
@@ -1856,7 +2020,7 @@ Game::can_build_military(MapPos pos) const {
 /* Return the height that is needed before a large building can be built.
    Returns negative if the needed height cannot be reached. */
 int
-Game::get_leveling_height(MapPos pos) const {
+Game::get_leveling_height(MapPos pos, bool *leveling_nearby) const {
   /* Find min and max height */
   int h_min = 31;
   int h_max = 0;
@@ -1873,6 +2037,7 @@ Game::get_leveling_height(MapPos pos) const {
     if (map->get_obj(p) == Map::ObjectLargeBuilding) {
       const Building *bld = buildings[map->get_obj_index(p)];
       if (bld->is_leveling()) { /* Leveling in progress */
+        if (leveling_nearby != nullptr) *leveling_nearby = true;
         int h = bld->get_level();
         if (h_min > h) h_min = h;
         if (h_max < h) h_max = h;
@@ -1964,6 +2129,17 @@ Game::can_build_mine(MapPos pos) const {
 /* Checks whether a large building is possible at position. */
 bool
 Game::can_build_large(MapPos pos) const {
+  return map->get_build_sites()->get(pos, BuildSites::SiteLarge,
+                                     [this](MapPos p, bool *cacheable) {
+    return check_build_large(p, cacheable);
+  });
+}
+
+// can_build_large without the cache.  A large building still leveling
+//  nearby can finish leveling without the map hearing of it, cacheable
+//  is set false when the answer looked at one
+bool
+Game::check_build_large(MapPos pos, bool *cacheable) const {
   /* Check that surroundings are passable by serfs. */
   for (int i = 0; i < 6; i++) {
     MapPos p = map->pos_add_spirally(pos, 1+i);
@@ -1991,7 +2167,9 @@ Game::can_build_large(MapPos pos) const {
   }
 
   /* Check that leveling is possible */
-  int r = get_leveling_height(pos);
+  bool leveling_nearby = false;
+  int r = get_leveling_height(pos, &leveling_nearby);
+  if (leveling_nearby) *cacheable = false;
   if (r < 0) return false;
 
   return true;
@@ -2173,6 +2351,7 @@ Game::can_build_building(MapPos pos, Building::Type type,
 /* Build building at position. */
 bool
 Game::build_building(MapPos pos, Building::Type type, Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeBuildBuilding, player->get_index(), pos, type));
   //Log::Debug["game.cc"] << "inside Game::build_building, pos " << pos << ", type " << NameBuilding[type];
   if (!can_build_building(pos, type, player)) {
     //Log::Debug["game.cc"] << "inside Game::build_building, pos " << pos << ", type " << NameBuilding[type] << " rejected because can_build_building false";
@@ -2241,6 +2420,7 @@ Game::build_building(MapPos pos, Building::Type type, Player *player) {
 //  very strange
 bool
 Game::build_castle(MapPos pos, Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeBuildCastle, player->get_index(), pos));
   if (!can_build_castle(pos, player)) {
     return false;
   }
@@ -2303,6 +2483,7 @@ Game::build_castle(MapPos pos, Player *player) {
     //map->set_height(map->move(pos, d), h);
     map->set_height_no_refresh(map->move(pos, d), h);
   }
+  map->get_build_sites()->invalidate_around(pos);
 
   update_land_ownership(pos);
 
@@ -2388,6 +2569,9 @@ Game::demolish_flag_(MapPos pos) {
   flag->remove_all_resources();
 
   flags.erase(flag->get_index());
+  road_network_changed();
+  // other flags' sets may still lead through this one
+  flag_components.clear();
 
   return true;
 }
@@ -2395,6 +2579,7 @@ Game::demolish_flag_(MapPos pos) {
 /* Demolish flag at pos. */
 bool
 Game::demolish_flag(MapPos pos, Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeDemolishFlag, player->get_index(), pos));
   if (!can_demolish_flag(pos, player)) return false;
 
   return demolish_flag_(pos);
@@ -2461,6 +2646,7 @@ Game::demolish_building_(MapPos pos) {
 /* Demolish building at pos. */
 bool
 Game::demolish_building(MapPos pos, Player *player) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeDemolishBuilding, player->get_index(), pos));
   Building *building = buildings[map->get_obj_index(pos)];
 
   if (building->get_owner() != player->get_index()) return false;
@@ -2557,44 +2743,12 @@ Game::update_land_ownership(MapPos init_pos) {
 
   /* Currently the below algorithm will only work when
      both influence_radius and calculate_radius are 8. */
-  const int influence_radius = 8;
-  const int influence_diameter = 1 + 2*influence_radius;
-
+  const int influence_radius = InfluenceField::radius;
   int calculate_radius = influence_radius;
-  int calculate_diameter = 1 + 2*calculate_radius;
-
-  size_t temp_arr_size = calculate_diameter * calculate_diameter *
-                         players.size();
-  std::unique_ptr<int[]> temp_arr =
-    std::unique_ptr<int[]>(new int[temp_arr_size]());
-
-// does this mean that larger military buildings have a stronger
-//  influence on player borders??  I always assumed it was identical!
-  const int military_influence[] = {
-    0, 1, 2, 4, 7, 12, 18, 29, -1, -1,  /* hut */
-    0, 3, 5, 8, 11, 15, 22, 30, -1, -1,  /* tower */
-    0, 6, 10, 14, 19, 23, 27, 31, -1, -1  /* fortress */
-  };
 
-  const int map_closeness[] = {
-    1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
-    1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 0, 0, 0, 0, 0, 0, 0,
-    1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1, 0, 0, 0, 0, 0, 0,
-    1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1, 0, 0, 0, 0, 0,
-    1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1, 0, 0, 0, 0,
-    1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1, 0, 0, 0,
-    1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1, 0, 0,
-    1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1, 0,
-    1, 2, 3, 4, 5, 6, 7, 8, 9, 8, 7, 6, 5, 4, 3, 2, 1,
-    0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1,
-    0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1,
-    0, 0, 0, 1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1,
-    0, 0, 0, 0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1,
-    0, 0, 0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1,
-    0, 0, 0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1,
-    0, 0, 0, 0, 0, 0, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1,
-    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1
-  };
+  if (influence_field.is_empty()) {
+    influence_field.reset(map->geom());
+  }
 
   /* Find influence from buildings in 33*33 square
      around the center. */
@@ -2608,80 +2762,66 @@ Game::update_land_ownership(MapPos init_pos) {
   //               /   /     at the center of the parallelogram
   //              /___/
   //
-  for (int i = -(influence_radius+calculate_radius);
-       i <= influence_radius+calculate_radius; i++) {
-    for (int j = -(influence_radius+calculate_radius);
-         j <= influence_radius+calculate_radius; j++) {
-      MapPos pos = map->pos_add(init_pos, j, i);
-
-      if (map->get_obj(pos) >= Map::ObjectSmallBuilding &&
-          map->get_obj(pos) <= Map::ObjectCastle &&
-          map->has_path(pos,
-                   DirectionDownRight)) {  // TODO(_): Why wouldn't this be set?
-        Building *building = get_building_at_pos(pos);
+  // every building that can reach the 17x17 square is in here, so after
+  //  bringing their stamps in the influence field up to date the field is
+  //  exactly what stamping them all from scratch used to give.  Usually
+  //  only the building at init_pos changed, the rest is a read per tile.
+  //  The pos math is done with constant masks for this map size, see
+  //  with_map_geometry
+  with_map_geometry(map->geom(), [&](const auto &geom) {
+    for (int i = -(influence_radius+calculate_radius);
+         i <= influence_radius+calculate_radius; i++) {
+      for (int j = -(influence_radius+calculate_radius);
+           j <= influence_radius+calculate_radius; j++) {
+        MapPos pos = geom.pos_add(init_pos, j, i);
+        int owner = -1;
         int mil_type = -1;
 
-        if (building->get_type() == Building::TypeCastle) {
-          /* Castle has military influence even when not done. */
-          mil_type = 2;
-        } else if (building->is_done() && building->is_active()) {
-          //Log::Debug["game.cc"] << "start of Game::update_land_ownership around pos " << init_pos << ", a building at pos " << building->get_position() << " is done and active, type is " << building->get_type() << " check if it is military";
-          switch (building->get_type()) {
-            case Building::TypeHut: mil_type = 0; break;
-            case Building::TypeTower: mil_type = 1; break;
-            case Building::TypeFortress: mil_type = 2; break;
-            default: break;
+        if (map->get_obj(pos) >= Map::ObjectSmallBuilding &&
+            map->get_obj(pos) <= Map::ObjectCastle &&
+            map->has_path(pos,
+                     DirectionDownRight)) {  // TODO(_): Why wouldn't this be set?
+          Building *building = get_building_at_pos(pos);
+
+          if (building->get_type() == Building::TypeCastle) {
+            /* Castle has military influence even when not done. */
+            mil_type = 2;
+          } else if (building->is_done() && building->is_active()) {
+            //Log::Debug["game.cc"] << "start of Game::update_land_ownership around pos " << init_pos << ", a building at pos " << building->get_position() << " is done and active, type is " << building->get_type() << " check if it is military";
+            switch (building->get_type()) {
+              case Building::TypeHut: mil_type = 0; break;
+              case Building::TypeTower: mil_type = 1; break;
+              case Building::TypeFortress: mil_type = 2; break;
+              default: break;
+            }
           }
-        }
 
-        //Log::Debug["game.cc"] << "start of Game::update_land_ownership around pos " << init_pos << ", mil_type is " << mil_type;
-
-        if (mil_type >= 0 && !building->is_burning()) {
-          //Log::Debug["game.cc"] << "start of Game::update_land_ownership around pos " << init_pos << ", mil_type is " << mil_type << ", building is not burning";
-          const int *influence = military_influence + 10*mil_type;
-          const int *closeness = map_closeness +
-                                 influence_diameter*std::max(-i, 0) +
-                                 std::max(-j, 0);
-          int *arr = temp_arr.get() +
-            (building->get_owner() * calculate_diameter*calculate_diameter) +
-            calculate_diameter * std::max(i, 0) + std::max(j, 0);
-
-          for (int k = 0; k < influence_diameter - abs(i); k++) {
-            for (int l = 0; l < influence_diameter - abs(j); l++) {
-              int inf = influence[*closeness];
-              if (inf < 0) {
-                *arr = 128;
-              } else if (*arr < 128) {
-                *arr = std::min(*arr + inf, 127);
-              }
+          //Log::Debug["game.cc"] << "start of Game::update_land_ownership around pos " << init_pos << ", mil_type is " << mil_type;
 
-              closeness += 1;
-              arr += 1;
-            }
-            closeness += abs(j);
-            arr += abs(j);
+          if (mil_type >= 0 && !building->is_burning()) {
+            owner = building->get_owner();
           }
         }
+
+        influence_field.set_stamp(pos, owner, mil_type);
       }
     }
-  }
+  });
 
   /* Update owner of 17*17 square. */
   for (int i = -calculate_radius; i <= calculate_radius; i++) {
     for (int j = -calculate_radius; j <= calculate_radius; j++) {
+      MapPos pos = map->pos_add(init_pos, j, i);
       int max_val = 0;
       int player_index = -1;
       for (Player *player : players) {
-        const int *arr = temp_arr.get() +
-          player->get_index()*calculate_diameter*calculate_diameter +
-          calculate_diameter*(i+calculate_radius) + (j+calculate_radius);
-        if (*arr > max_val) {
-          max_val = *arr;
+        int val = influence_field.get(pos, player->get_index());
+        if (val > max_val) {
+          max_val = val;
           player_index = player->get_index();
         }
       }
 
-      MapPos pos = map->pos_add(init_pos, j, i);
       int old_player = -1;
       if (map->has_owner(pos)){
         old_player = map->get_owner(pos);
@@ -2734,6 +2874,13 @@ void
 Game::init_FogOfWar() {
   Log::Debug["game.cc"] << "start of Game::init_FogOfWar for all military buildings in entire game";
   mutex_lock("Game::init_FogOfWar");
+  // start the counts over, the visible bits are whatever the buildings
+  //  stamp back in (see fog-of-war.h)
+  fog_of_war.reset(map->geom().tile_count());
+  for (MapPos pos : map->geom()) {
+    map->unset_all_visible(pos);
+  }
+  set_must_redraw_frame();
   for (Building *building : buildings) {
     update_FogOfWar(building->get_position());
   }
@@ -2744,9 +2891,6 @@ void
 Game::update_FogOfWar(MapPos init_pos) {
   //Log::Debug["game.cc"] << "start of Game::update_FogOfWar around init_pos " << init_pos;
 
-  // need to redraw terrain for FoW updates to be visible
-  set_must_redraw_frame();
-
   //const int visible_radius_by_type[25] = {0,0,0,0,0,0,0,0,0,0,0,10,0,0,0,0,0,0,0,0,0,15,19,0,21};
   // visually I like the smaller radius, but increasing it so that attackable buildings are always visible...
   //const int visible_radius_by_type[25] = {0,0,0,0,0,0,0,0,0,0,0,15,0,0,0,0,0,0,0,0,0,20,23,0,23};
@@ -2761,98 +2905,29 @@ const int _spiral_dist[49] = { 1, 7, 19, 37, 61, 91, 127, 169, 217, 271, 331, 39
     2107, 2269, 2437, 2611, 2791, 2977, 3169, 3367, 3571, 3781, 3997, 4219, 4447,
     4681, 4921, 5167, 5419, 5677, 5941, 6211, 6487, 6769 };
 
-  // IDEA - another possible way to handle FoW is to have a counter for each pos (for each player)
-  //  that indicates how many player-buildings currently contribute to the visibility of that pos
-  //  and increment/decrement as buildings occupied/lost and draw based on a nonzero value
-  //  this would avoid having to check the influence of nearby buildings and so may be much faster?
-
-  // clear the visibility bit for all players for all pos within the influence_radius
-  // along the way, note all other buildings in the area that can view tiles in this area
-  //  so that their visibility can be set again after the area is wiped
-  // NO! only unset_all_visible for the influence radius of the largest visible_radius_by_type (castle)
-  //  but look for other influential buildings at DOUBLE that radius
-  int influence_radius = visible_radius_by_type[Building::TypeCastle] * 2 + 1;  // THIS MUST BE AT LEAST *TWICE* LARGE AS THE LARGEST POSSIBLE visible_radius (castle's)
-  //if (influence_radius > 48){ // HACK to allow castle radius 24
-  //  influence_radius = 48; // extended_spiral only goes this high
-  //}
-  MapPosVector influential_buildings = {};
-  // NOTE - if the building at init_pos exists and is occupied, it will be found here and its visible and revealed radius will be set
-  //   if the building at init_pos was destroyed/lost, it will *not* be found here and so it will correctly lose visibilty
-  for (int i = 0; i < _spiral_dist[influence_radius]; i++) {
-    MapPos pos = map->pos_add_extended_spirally(init_pos, i);
-
-    // TEMP DEBUG
-    //set_debug_mark_pos(pos, "cyan");
-
-    // trying this, I think this is solution to a bug
-    if (i < _spiral_dist[visible_radius_by_type[Building::TypeCastle]]){
-      map->unset_all_visible(pos);
-    }
-
-    // look for buildings that can see this pos, for restoration
-    if (map->get_obj(pos) >= Map::ObjectSmallBuilding && map->get_obj(pos) <= Map::ObjectCastle) {
-      Building *building = get_building_at_pos(pos);
-      if (building == nullptr){
-        Log::Error["game.cc"] << "inside Game::update_FogOfWar, expecting building at pos " << pos << ", but get_building_at_pos returned a nullptr! crashing";
-        throw ExceptionFreeserf("inside Game::update_FogOfWar, expecting building at pos but get_building_at_pos returned a nullptr!");
-      }
-      if (!building->is_military()){
-        continue;
-      }
-      if (building->get_type() != Building::TypeCastle && !building->is_active()){
-        //Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, non-castle military building of type " << NameBuilding[building->get_type()] << " is not active, skipping";
-        continue;
-      }
-      /* removing AdvancedDemolition for now, see https://github.com/forkserf/forkserf/issues/180
-      if (building->is_burning() || building->is_pending_demolition()){
-        Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, military building of type " << NameBuilding[building->get_type()] << " at pos " << pos << " is burning or pending_demolition, skipping";
-        continue;
-      }
-      */
-      /* don't check this, this is bad logic
-      int bld_vis_rad = visible_radius_by_type[building->get_type()];
-      Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, military building of type " << NameBuilding[building->get_type()] << " at pos " << pos <<  " has visible radius " << bld_vis_rad;
-      if (i > _spiral_dist[bld_vis_rad]){
-        Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, military building of type " << NameBuilding[building->get_type()] << " at pos " << pos <<  " is beyond its visual radius, skipping";
-        continue;
-      }
-      */
-      //Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, military building of type " << NameBuilding[building->get_type()] << " at pos " << pos << " is within influence radius, adding to list";
-      influential_buildings.push_back(pos);
-    }
-  }
-  // restore visibility for all building in influence_radius
-  // NOTE this will frequently result in map->set_visible being called on pos
-  //  that are outside the influence_radius, because usually only part of an other_building's
-  //  visibility radius will be within the overall influence_radius being considered here
-  // It might be faster to save the list of MapPos inside the influence_radius to avoid
-  //  calling map->set_visible redundantly, but I suspect that would be slower than just doing it
-  for (MapPos bld_pos : influential_buildings){
-    Building *bld = get_building_at_pos(bld_pos);
-    if (bld == nullptr){
-      Log::Error["game.cc"] << "inside Game::update_FogOfWar, expecting bld at bld_pos " << bld_pos << ", but get_building_at_pos returned a nullptr! crashing";
-      throw ExceptionFreeserf("inside Game::update_FogOfWar, expecting bld at bld_pos but get_building_at_pos returned a nullptr!");
-    }
-    Building::Type bld_type = bld->get_type();
-    if (!bld->is_military()){
-      Log::Error["game.cc"] << "inside Game::update_FogOfWar, expecting bld at bld_pos " << bld_pos << " to be a military building, but instead it is type " << bld_type << "! crashing";
-      throw ExceptionFreeserf("inside Game::update_FogOfWar, expecting bld at bld_pos to be a military building, but it is not!");
-      continue;
-    }
-    if (!bld->is_active()){
-      // this building is burning or otherwise not occupied
-      continue;
+  // each pos keeps a count per player of the active military buildings
+  //  that can see it, see fog-of-war.h.  Only the building at init_pos
+  //  changed, so only its own stamp is taken away and/or put back, and
+  //  only the pos whose count goes from or to zero change their visible bit
+  if (fog_of_war.is_empty()) {
+    fog_of_war.reset(map->geom().tile_count());
+  }
+  int owner = -1;
+  int visible_radius = 0;
+  if (map->get_obj(init_pos) >= Map::ObjectSmallBuilding && map->get_obj(init_pos) <= Map::ObjectCastle) {
+    Building *building = get_building_at_pos(init_pos);
+    if (building == nullptr){
+      Log::Error["game.cc"] << "inside Game::update_FogOfWar, expecting building at pos " << init_pos << ", but get_building_at_pos returned a nullptr! crashing";
+      throw ExceptionFreeserf("inside Game::update_FogOfWar, expecting building at pos but get_building_at_pos returned a nullptr!");
     }
-    unsigned int player_index = bld->get_owner();
-    // set the visibility bit for all buildings according to their radius
-    // this list should always include the initial building being considered!
-    //Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, calling map->set_visible() for all pos within radius " << visible_radius_by_type[bld_type] << " of this building of type " << NameBuilding[bld_type] << " at bld_pos " << bld_pos;
-    for (int i = 0; i < _spiral_dist[visible_radius_by_type[bld_type]]; i++) {
-      MapPos pos = map->pos_add_extended_spirally(bld_pos, i);
-      //Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, calling map->set_visible() for pos " << pos << ", Player" << player_index;
-      map->set_visible(pos, player_index);
+    // a burning or not yet occupied building can't see anything
+    if (building->is_military() && building->is_active()){
+      owner = building->get_owner();
+      visible_radius = visible_radius_by_type[building->get_type()];
     }
   }
+  bool changed = fog_of_war.set_stamp(map.get(), init_pos, owner, visible_radius);
+
   // if there is an occupied building at init_pos,
   // call set_revealed for the reveal_radius, for this building only
   //  because this is the only one changing
@@ -2866,11 +2941,20 @@ const int _spiral_dist[49] = { 1, 7, 19, 37, 61, 91, 127, 169, 217, 271, 331, 39
     for (int i = 0; i < _spiral_dist[reveal_radius]; i++) {
       MapPos pos = map->pos_add_extended_spirally(init_pos, i);
       //Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, calling map->set_revealed() for pos " << pos << ", Player" << player_index;
-      map->set_revealed(pos, player_index);
+      if (!map->is_revealed(pos, player_index)) {
+        map->set_revealed(pos, player_index);
+        changed = true;
+      }
     }
   }else{
     //Log::Debug["game.cc"] << "inside of Game::update_FogOfWar, no building found at init_pos " << init_pos << ", assuming this was a destroyed/lost building.  Not setting revealed";
   }
+
+  // need to redraw terrain for FoW updates to be visible, but only if
+  //  something actually changed
+  if (changed) {
+    set_must_redraw_frame();
+  }
 }
 
 void
@@ -2954,6 +3038,8 @@ Game::occupy_enemy_building(Building *building, int player_num) {
 /* mode: 0: IN, 1: STOP, 2: OUT */
 void
 Game::set_inventory_resource_mode(Inventory *inventory, int mode) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeSetInventoryResourceMode, inventory->get_owner(),
+                                                 inventory->get_index(), mode));
   Flag *flag = flags[inventory->get_flag_index()];
 
   if (mode == 0) {
@@ -2982,6 +3068,8 @@ Game::set_inventory_resource_mode(Inventory *inventory, int mode) {
 /* mode: 0: IN, 1: STOP, 2: OUT */
 void
 Game::set_inventory_serf_mode(Inventory *inventory, int mode) {
+  ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeSetInventorySerfMode, inventory->get_owner(),
+                                                 inventory->get_index(), mode));
   Flag *flag = flags[inventory->get_flag_index()];
 
   if (mode == 0) {
@@ -3029,8 +3117,20 @@ bool
 //Game::init(unsigned int map_size, const Random &random) {
 Game::init(unsigned int map_size, const Random &random, const CustomMapGeneratorOptions custom_map_generator_options) {
   init_map_rnd = random;
+  // the game's own Random was seeded from the clock, start it from the
+  //  same seed as the map so a given seed (headless -r, a replay) plays
+  //  the same game every time
+  rnd = random;
 
   map.reset(new Map(MapGeometry(map_size)));
+  serf_pos_index.reset(0);
+  influence_field.clear();
+  fog_of_war.clear();
+  serf_timer_wheel.clear();
+  flag_worklist.clear();
+  flag_components.clear();
+  transit_index.clear();
+  road_network_changed();
 
   if (game_type == GameMission) {
     ClassicMissionMapGenerator generator(*map, init_map_rnd);
@@ -3094,20 +3194,6 @@ Game::random_int() {
   return rnd.random();
 }
 
-int
-Game::next_search_id() {
-  flag_search_counter += 1;
-
-  /* If we're back at zero the counter has overflown,
-   everything needs a reset to be safe. */
-  if (flag_search_counter == 0) {
-    flag_search_counter += 1;
-    clear_search_id();
-  }
-
-  return flag_search_counter;
-}
-
 Serf *
 Game::create_serf(int index) {
   if (index == -1) {
@@ -3119,6 +3205,13 @@ Game::create_serf(int index) {
 
 void
 Game::delete_serf(Serf *serf) {
+  // a serf asleep in an inventory still counts there until it wakes
+  serf->wake();
+  serf_pos_index.remove(serf->get_index());
+  {
+    std::lock_guard<std::mutex> lock(owner_index_mutex);
+    serf_owners.remove(serf->get_index());
+  }
   serfs.erase(serf->get_index());
 }
 
@@ -3142,6 +3235,10 @@ Game::create_inventory(int index) {
 
 void
 Game::delete_inventory(Inventory *inventory) {
+  {
+    std::lock_guard<std::mutex> lock(owner_index_mutex);
+    inventory_owners.remove(inventory->get_index());
+  }
   inventories.erase(inventory->get_index());
 }
 
@@ -3156,24 +3253,27 @@ Game::create_building(int index) {
 
 void
 Game::delete_building(Building *building) {
+  {
+    std::lock_guard<std::mutex> lock(owner_index_mutex);
+    building_owners.remove(building->get_index());
+  }
   map->set_object(building->get_position(), Map::ObjectNone, 0);
   buildings.erase(building->get_index());
 }
 
+// these return copies because AI threads call them, they only hold
+//  owner_index_mutex long enough to copy
 Game::ListSerfs
 Game::get_player_serfs(Player *player) {
   ListSerfs player_serfs;
 
-  // debug -  count how many serfs actually appear here
-  //  does it include unused serfs??
-  // it DOES include them as Serf objects, isn't that really inefficient??? can be 10k 
-  //Log::Debug["game"] << "inside get_player_serfs, game Serfs has " << serfs.size() << " items";
-  for (Serf *serf : serfs) {
-    if (serf->get_owner() == player->get_index()) {
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  for (unsigned int index : serf_owners.get(player->get_index())) {
+    Serf *serf = serfs[index];
+    if (serf != nullptr) {
       player_serfs.push_back(serf);
     }
   }
-  //Log::Debug["game"] << "inside get_player_serfs, player" << player->get_index() << " player_serfs has " << player_serfs.size() << " items";
 
   return player_serfs;
 }
@@ -3182,15 +3282,15 @@ Game::ListBuildings
 Game::get_player_buildings(Player *player) {
   ListBuildings player_buildings;
 
-  for (Building *building : buildings) {
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  for (unsigned int index : building_owners.get(player->get_index())) {
+    Building *building = buildings[index];
     // got exception here Nov 2022, adding nullptr check
     if (building == nullptr){
       Log::Warn["game.cc"] << "inside Game::get_player_buildings for Player" << player->get_index() << ", building is nullptr! skipping it";
       continue;
-    }      
-    if (building->get_owner() == player->get_index()) {
-      player_buildings.push_back(building);
     }
+    player_buildings.push_back(building);
   }
 
   return player_buildings;
@@ -3200,13 +3300,10 @@ Game::ListInventories
 Game::get_player_inventories(Player *player) {
   ListInventories player_inventories;
 
-  for (Inventory *inventory : inventories) {
-    if (inventory == nullptr){
-      // do NOT log this, once any Inventory is destroyed its index will always be a nullptr and it will repeat the message constantly
-      //Log::Warn["game.cc"] << "inside Game::get_player_inventories for player #" << player->get_index() << ", an inventory is nullptr!  was it just destroyed?  NOTE THAT THIS INVENTORY COULD HAVE BEEN OWNED BY ANY PLAYER NOT JUST Player" << player->get_index();
-      continue;
-    }
-    if (inventory->get_owner() == player->get_index()) {
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  for (unsigned int index : inventory_owners.get(player->get_index())) {
+    Inventory *inventory = inventories[index];
+    if (inventory != nullptr) {
       player_inventories.push_back(inventory);
     }
   }
@@ -3214,19 +3311,116 @@ Game::get_player_inventories(Player *player) {
   return player_inventories;
 }
 
-Game::ListSerfs
-Game::get_serfs_at_pos(MapPos pos) {
-  ListSerfs result;
+Game::PlayerSerfs
+Game::get_player_serfs_view(const Player *player) {
+  return PlayerSerfs(serf_owners.get(player->get_index()), &serfs);
+}
+
+Game::PlayerBuildings
+Game::get_player_buildings_view(const Player *player) {
+  return PlayerBuildings(building_owners.get(player->get_index()), &buildings);
+}
+
+Game::PlayerInventories
+Game::get_player_inventories_view(const Player *player) {
+  return PlayerInventories(inventory_owners.get(player->get_index()),
+                           &inventories);
+}
+
+// the NULL-serf and NULL-building at index 0 belong to nobody
+void
+Game::serf_owner_changed(Serf *serf) {
+  if (serf->get_index() == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  serf_owners.set(serf->get_index(), serf->get_owner());
+}
+
+void
+Game::building_owner_changed(Building *building) {
+  if (building->get_index() == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  building_owners.set(building->get_index(), building->get_owner());
+}
+
+void
+Game::inventory_owner_changed(Inventory *inventory) {
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  inventory_owners.set(inventory->get_index(), inventory->get_owner());
+}
 
+// a loaded game sets owners straight from the save file
+void
+Game::rebuild_owner_indexes() {
+  std::lock_guard<std::mutex> lock(owner_index_mutex);
+  serf_owners.clear();
+  building_owners.clear();
+  inventory_owners.clear();
   for (Serf *serf : serfs) {
-    if (serf->get_pos() == pos) {
-      result.push_back(serf);
+    if (serf->get_index() != 0) {
+      serf_owners.set(serf->get_index(), serf->get_owner());
     }
   }
+  for (Building *building : buildings) {
+    if (building->get_index() != 0) {
+      building_owners.set(building->get_index(), building->get_owner());
+    }
+  }
+  for (Inventory *inventory : inventories) {
+    inventory_owners.set(inventory->get_index(), inventory->get_owner());
+  }
+}
+
+// the loaders write the flags' slots directly
+void
+Game::rebuild_transit_index() {
+  transit_index.clear();
+  for (Flag *flag : flags) {
+    for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+      if (flag->get_resource_at_slot(i) != Resource::TypeNone) {
+        transit_index.set(flag->get_index(), i, flag->slot[i].dest);
+      }
+    }
+  }
+}
+
+Game::ListSerfs
+Game::get_serfs_at_pos(MapPos pos) {
+  ListSerfs result;
+
+  update_serf_pos_index();
+  serf_pos_index.for_each_at(pos, [this, &result](unsigned int index) {
+    result.push_back(serfs[index]);
+  });
+  // lowest index first, the order the full scan over serfs used to give.
+  //  Callers like Building::burnup let the first few escape
+  result.sort([](const Serf *a, const Serf *b) {
+    return a->get_index() < b->get_index();
+  });
 
   return result;
 }
 
+void
+Game::serf_pos_changed(Serf *serf) {
+  serf_pos_index.move(serf->get_index(), serf->get_pos());
+}
+
+// the map was replaced (new or loaded game), index every serf again
+void
+Game::update_serf_pos_index() {
+  if (!serf_pos_index.is_empty() || !map) {
+    return;
+  }
+  serf_pos_index.reset(map->geom().tile_count());
+  for (Serf *serf : serfs) {
+    serf_pos_index.move(serf->get_index(), serf->get_pos());
+  }
+}
+
 Game::ListSerfs
 Game::get_serfs_in_inventory(Inventory *inventory) {
   ListSerfs result;
@@ -3328,13 +3522,6 @@ Game::building_captured(Building *building) {
   }
 }
 
-void
-Game::clear_search_id() {
-  for (Flag *flag : flags) {
-    flag->clear_search_id();
-  }
-}
-
 // lock and unlock mutex during non-threadsafe
 // iterations and changes between game and AI threads
 void
@@ -3342,6 +3529,11 @@ Game::mutex_lock(const char* message){
   //Log::Verbose["game.cc"] << "inside Game::mutex_lock, thread #" << std::this_thread::get_id() << " about to lock mutex, message: " << message;
   //clock_t start = std::clock();
   mutex.lock();
+  // an AI thread may have changed player settings while the updating thread
+  //  was between two phases, record them at this boundary
+  if (replay_recording && is_update_thread()) {
+    record_setting_changes();
+  }
   //double wait_for_mutex = (std::clock() - start) / static_cast<double>(CLOCKS_PER_SEC);
   //Log::Verbose["game.cc"] << "inside Game::mutex_lock, thread #" << std::this_thread::get_id() << " has locked mutex, message: " << mutex_message << ", waited " << wait_for_mutex << "sec for lock";
   // store the lock message and start a timer so message and time-in-mutex can be printed on unlock
@@ -3354,8 +3546,335 @@ Game::mutex_unlock(){
   // message is known from lock
   //Log::Error["game.cc"] << "inside Game::mutex_unlock, thread #" << std::this_thread::get_id() << " about to unlock mutex, message: " << mutex_message;
   //double time_in_mutex = (std::clock() - mutex_timer_start) / static_cast<double>(CLOCKS_PER_SEC);
+  bool update_thread = is_update_thread();
+  if (update_thread) {
+    update_boundary++;
+  }
   mutex.unlock();
   //Log::Verbose["game.cc"] << "inside Game::mutex_unlock, thread #" << std::this_thread::get_id() << " has unlocked mutex, message: " << mutex_message << ", spent " << time_in_mutex << "sec holding lock";
+  // this is where an AI thread could have taken the lock while recording
+  if (update_thread && replay_playing) {
+    apply_due_replay_commands();
+  }
+}
+
+// capture the world into whichever snapshot buffer no AI thread is holding
+//  and make it the published one.  Only ever called from the update thread
+void
+Game::publish_world_snapshot() {
+  std::shared_ptr<WorldSnapshot> next;
+  // readers only get new references through the published pointer, so once
+  //  the spare is down to our one reference it stays that way.  Otherwise an
+  //  AI thread is still in a long loop over it, leave it to them and it is
+  //  freed when they let go
+  if (world_snapshot_spare && world_snapshot_spare.use_count() == 1) {
+    // use_count is a relaxed load.  The reader dropping its reference did
+    //  a release decrement, this fence pairs with it so its last reads of
+    //  the snapshot happen before capture writes into it again
+    std::atomic_thread_fence(std::memory_order_acquire);
+    next = std::move(world_snapshot_spare);
+  } else {
+    next = std::make_shared<WorldSnapshot>();
+  }
+  world_snapshot_spare.reset();
+  // the raw mutex, Game::mutex_lock would count as a replay boundary
+  mutex.lock();
+  next->capture(this, ++world_snapshot_version);
+  mutex.unlock();
+  world_snapshot_spare = std::atomic_exchange(&world_snapshot, next);
+}
+
+uint64_t
+Game::get_state_hash() {
+  StateHash hash;
+  hash.add(tick);
+  hash.add(const_tick);
+  hash.add(game_speed);
+  for (int i = 0; i < 3; i++) {
+    hash.add(rnd.get_state(i));
+    hash.add(init_map_rnd.get_state(i));
+  }
+  hash.add(knight_morale_counter);
+  hash.add(inventory_schedule_counter);
+  hash.add(game_stats_counter);
+  hash.add(history_counter);
+  hash.add(gold_total);
+  map->add_state_hash(&hash);
+  for (Player *player : players) {
+    player->add_state_hash(&hash);
+  }
+  for (Flag *flag : flags) {
+    flag->add_state_hash(&hash);
+  }
+  for (Inventory *inventory : inventories) {
+    inventory->add_state_hash(&hash);
+  }
+  for (Building *building : buildings) {
+    building->add_state_hash(&hash);
+  }
+  for (Serf *serf : serfs) {
+    serf->add_state_hash(&hash);
+  }
+  return hash.get();
+}
+
+// the thread running Game::update, while it is running it.  Commands that
+//  thread issues then are part of the simulation and are not recorded, and
+//  the replay itself applying commands does not move the boundary
+bool
+Game::is_update_thread() const {
+  return in_update && !replay_applying && !applying_queued_commands
+         && std::this_thread::get_id() == update_thread_id;
+}
+
+void
+Game::start_recording(PReplay replay) {
+  replay_recording = replay;
+  update_count = 0;
+  update_boundary = ReplayCommand::AfterUpdate;
+  // nothing seen yet, the first update records the full player settings
+  //  and the game speed so the replay does not depend on how they were set
+  replay_player_settings.clear();
+  replay_game_speed = ~0u;
+}
+
+PReplay
+Game::stop_recording() {
+  PReplay replay = replay_recording;
+  if (replay) {
+    replay->set_total_updates(update_count);
+  }
+  replay_recording = nullptr;
+  return replay;
+}
+
+void
+Game::start_replay(PReplay replay, bool resync_random) {
+  replay_playing = replay;
+  replay_resync_random = resync_random;
+  replay_random_mismatches = 0;
+  replay_next_command = 0;
+  update_count = 0;
+  update_boundary = ReplayCommand::AfterUpdate;
+  // commands recorded before the first update
+  apply_due_replay_commands();
+}
+
+bool
+Game::is_replay_finished() const {
+  return !replay_playing
+         || replay_next_command >= replay_playing->get_commands().size();
+}
+
+bool
+Game::should_record_command() const {
+  return replay_recording && !is_update_thread();
+}
+
+// the caller holds the game mutex (AI) or is the thread that runs
+//  Game::update (player, through the Interface), so update_count and
+//  update_boundary cannot change underneath
+void
+Game::record_command(ReplayCommand command) {
+  command.update = update_count;
+  command.boundary = in_update ? update_boundary : ReplayCommand::AfterUpdate;
+  command.random_state[0] = rnd.get_state(0);
+  command.random_state[1] = rnd.get_state(1);
+  command.random_state[2] = rnd.get_state(2);
+  replay_recording->add_command(command);
+}
+
+// player settings are plain values changed all over the UI and AI code, so
+//  rather than hooking every setter compare them to what was seen last time
+void
+Game::record_setting_changes() {
+  if (game_speed != replay_game_speed) {
+    record_command(ReplayCommand(ReplayCommand::TypeGameSpeed, 0, 0, game_speed));
+    replay_game_speed = game_speed;
+  }
+  std::vector<int> settings;
+  for (Player *player : players) {
+    unsigned int index = player->get_index();
+    if (replay_player_settings.size() <= index) {
+      replay_player_settings.resize(index + 1);
+    }
+    std::vector<int> *last = &replay_player_settings[index];
+    player->get_settings(&settings);
+    for (size_t i = 0; i < settings.size(); i++) {
+      if (i >= last->size() || (*last)[i] != settings[i]) {
+        record_command(ReplayCommand(ReplayCommand::TypePlayerSetting, index, 0,
+                                     static_cast<int>(i), settings[i]));
+      }
+    }
+    *last = settings;
+  }
+}
+
+// apply every command that was recorded at or before the current
+//  (update, boundary) position, in the order they were recorded
+void
+Game::apply_due_replay_commands() {
+  if (!replay_playing || replay_applying) {
+    return;
+  }
+  const Replay::Commands &commands = replay_playing->get_commands();
+  while (replay_next_command < commands.size()) {
+    const ReplayCommand &command = commands[replay_next_command];
+    if (command.update > update_count
+        || (command.update == update_count && command.boundary > update_boundary)) {
+      break;
+    }
+    replay_applying = true;
+    apply_replay_command(command);
+    replay_applying = false;
+    replay_next_command++;
+  }
+}
+
+void
+Game::apply_replay_command(const ReplayCommand &command) {
+  apply_command(command);
+  // the game started from the recorded seed, so the command must leave the
+  //  random state it left when it was recorded
+  Random recorded(command.random_state[0], command.random_state[1],
+                  command.random_state[2]);
+  if (rnd.get_state(0) == recorded.get_state(0) &&
+      rnd.get_state(1) == recorded.get_state(1) &&
+      rnd.get_state(2) == recorded.get_state(2)) {
+    return;
+  }
+  if (replay_random_mismatches == 0) {
+    Log::Warn["game.cc"] << "replay diverged at update " << update_count
+                         << ", command #" << replay_next_command << " (type "
+                         << command.type << ") left random state "
+                         << std::string(rnd) << ", recorded "
+                         << std::string(recorded);
+  }
+  replay_random_mismatches++;
+  if (replay_resync_random) {
+    rnd = recorded;
+  }
+}
+
+// shared by replays and the AI command queue.  A queued command was posted
+//  up to one update ago so the object it names may be gone by now, the game
+//  functions check everything else themselves
+bool
+Game::apply_command(const ReplayCommand &command) {
+  Player *player = players[command.player];
+  if (player == nullptr) {
+    return false;
+  }
+  switch (command.type) {
+  case ReplayCommand::TypeBuildRoad: {
+    Road road;
+    road.start(command.pos);
+    for (int dir : command.list) {
+      road.extend(static_cast<Direction>(dir));
+    }
+    return build_road(road, player);
+  }
+  case ReplayCommand::TypeBuildFlag:
+    return build_flag(command.pos, player);
+  case ReplayCommand::TypeBuildBuilding:
+    return build_building(command.pos, static_cast<Building::Type>(command.arg0), player);
+  case ReplayCommand::TypeBuildCastle:
+    return build_castle(command.pos, player);
+  case ReplayCommand::TypeDemolishRoad:
+    return demolish_road(command.pos, player);
+  case ReplayCommand::TypeDemolishFlag:
+    return demolish_flag(command.pos, player);
+  case ReplayCommand::TypeDemolishBuilding:
+    return demolish_building(command.pos, player);
+  case ReplayCommand::TypeSetInventoryResourceMode:
+    if (inventories[command.pos] == nullptr) {
+      return false;
+    }
+    set_inventory_resource_mode(inventories[command.pos], command.arg0);
+    return true;
+  case ReplayCommand::TypeSetInventorySerfMode:
+    if (inventories[command.pos] == nullptr) {
+      return false;
+    }
+    set_inventory_serf_mode(inventories[command.pos], command.arg0);
+    return true;
+  case ReplayCommand::TypeSendGeologist:
+    if (flags[command.pos] == nullptr) {
+      return false;
+    }
+    return send_geologist(flags[command.pos]);
+  case ReplayCommand::TypePlayerSetting:
+    player->set_setting(command.arg0, command.arg1);
+    return true;
+  case ReplayCommand::TypeStartAttack:
+    player->building_attacked = command.pos;
+    player->knights_attacking = command.arg0;
+    player->set_attacking_buildings(command.list);
+    player->start_attack();
+    return true;
+  case ReplayCommand::TypePromoteSerfs:
+    return (player->promote_serfs_to_knights(command.arg0) > 0);
+  case ReplayCommand::TypeCycleKnights:
+    player->cycle_knights();
+    return true;
+  case ReplayCommand::TypeGameSpeed:
+    game_speed = command.arg0;
+    return true;
+  // these name serfs and flags by index, by now the serf may have left the
+  //  inventory or the index may belong to something else entirely
+  case ReplayCommand::TypePromoteSerfToKnight: {
+    Inventory *inventory = inventories[command.pos];
+    Serf *serf = serfs[command.arg0];
+    if (inventory == nullptr || serf == nullptr ||
+        inventory->get_owner() != command.player ||
+        serf->get_owner() != command.player ||
+        serf->get_state() != Serf::StateIdleInStock ||
+        serf->get_idle_in_stock_inv_index() != command.pos) {
+      return false;
+    }
+    return inventory->promote_serf_to_knight(serf);
+  }
+  case ReplayCommand::TypeSetSerfLost: {
+    Serf *serf = serfs[command.pos];
+    if (serf == nullptr || serf->get_owner() != command.player) {
+      return false;
+    }
+    serf->set_lost_state();
+    return true;
+  }
+  case ReplayCommand::TypeCallTransporter: {
+    Flag *flag = flags[command.pos];
+    Direction dir = static_cast<Direction>(command.arg0);
+    if (command.arg0 < DirectionRight || command.arg0 > DirectionUp ||
+        flag == nullptr || flag->get_owner() != command.player ||
+        !flag->has_path(dir)) {
+      return false;
+    }
+    return flag->call_transporter(dir, command.arg1 != 0);
+  }
+  case ReplayCommand::TypeAutoPlaceCastle:
+    return (auto_place_castle(player) != bad_map_pos);
+  default:
+    Log::Warn["game.cc"] << "inside Game::apply_command, unknown command type " << command.type;
+    return false;
+  }
+}
+
+// the raw mutex, Game::mutex_lock would count as a replay boundary.  The
+//  commands are recorded the way a direct AI call always was, tagged with
+//  the current update and boundary
+void
+Game::apply_queued_commands() {
+  if (command_queue.is_empty()) {
+    return;
+  }
+  mutex.lock();
+  applying_queued_commands = true;
+  command_queue.drain([this](const ReplayCommand &command) {
+    return apply_command(command);
+  });
+  applying_queued_commands = false;
+  mutex.unlock();
 }
 
 SaveReaderBinary&
@@ -3433,6 +3952,13 @@ operator >> (SaveReaderBinary &reader, Game &game) {
   }
 
   game.map.reset(new Map(MapGeometry(map_size)));
+  game.serf_pos_index.reset(0);
+  game.influence_field.clear();
+  game.fog_of_war.clear();
+  game.serf_timer_wheel.clear();
+  game.flag_worklist.clear();
+  game.flag_components.clear();
+  game.transit_index.clear();
 
   reader.skip(8);
   reader >> v16;  // 200
@@ -3465,6 +3991,9 @@ operator >> (SaveReaderBinary &reader, Game &game) {
   game.load_flags(&reader, max_flag_index);
   game.load_buildings(&reader, max_building_index);
   game.load_inventories(&reader, max_inventory_index);
+  game.rebuild_owner_indexes();
+  game.rebuild_transit_index();
+  game.road_network_changed();
 
   game.game_speed = 0;
   game.game_speed_save = DEFAULT_GAME_SPEED;
@@ -3613,6 +4142,8 @@ Game::auto_place_castle(Player *player) {
     return bad_map_pos;
   }else{
     Log::Debug["game.cc"] << "inside Game::auto_place_castle(), Player" << player->get_index() << ", does not yet have a castle";
+    // recorded as one command, not as the TypeBuildCastle it ends with
+    ReplayCommandScope command(this, ReplayCommand(ReplayCommand::TypeAutoPlaceCastle, player->get_index(), 0));
     // place castle
     //   improve this so that it is more intelligent about other resources than trees/stones/building_sites
     //    but have the minimum scores reduced a bit for each area scored so it eventually settles on something
@@ -3752,6 +4283,13 @@ operator >> (SaveReaderText &reader, Game &game) {
 
   /* Initialize remaining map dimensions. */
   game.map.reset(new Map(MapGeometry(size)));
+  game.serf_pos_index.reset(0);
+  game.influence_field.clear();
+  game.fog_of_war.clear();
+  game.serf_timer_wheel.clear();
+  game.flag_worklist.clear();
+  game.flag_components.clear();
+  game.transit_index.clear();
   for (SaveReaderText* subreader : reader.get_sections("map")) {
     *subreader >> *game.map;
   }
@@ -3894,6 +4432,10 @@ operator >> (SaveReaderText &reader, Game &game) {
     game.map->set_obj_index(flag->get_position(), flag->get_index());
   }
 
+  game.rebuild_owner_indexes();
+  game.rebuild_transit_index();
+  game.road_network_changed();
+
   game.game_speed = 0;
   game.game_speed_save = DEFAULT_GAME_SPEED;
 
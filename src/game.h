@@ -27,16 +27,31 @@
 #include <string>
 #include <list>
 #include <memory>
+#include <algorithm>
+#include <chrono>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.  // for profiling Game::update phases
 #include <mutex>   //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.  // for AI thread locking
+#include <thread>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.  // for replay update thread id
 
 #include "src/player.h"
 #include "src/flag.h"
+#include "src/flag-components.h"
+#include "src/flag-routes.h"
+#include "src/flag-worklist.h"
+#include "src/fog-of-war.h"
+#include "src/influence-field.h"
 #include "src/serf.h"
 #include "src/inventory.h"
 #include "src/map.h"
 #include "src/random.h"
 #include "src/objects.h"
+#include "src/owner-index.h"
 #include "src/lookup.h"
+#include "src/game-command-queue.h"
+#include "src/replay.h"
+#include "src/serf-pos-index.h"
+#include "src/serf-timer-wheel.h"
+#include "src/transit-index.h"
+#include "src/world-snapshot.h"
 
 #define DEFAULT_GAME_SPEED  2
 #define DEFAULT_TICK_LENGTH  20
@@ -56,6 +71,21 @@ class Game {
   typedef std::list<Building*> ListBuildings;
   typedef std::list<Inventory*> ListInventories;
 
+  // phases of Game::update, used by the profiler to time each one
+  typedef enum UpdatePhase {
+    UpdatePhaseMap = 0,
+    UpdatePhasePlayers,
+    UpdatePhaseInventories,
+    UpdatePhaseFlags,
+    UpdatePhaseBuildings,
+    UpdatePhaseSerfs,
+    UpdatePhaseGameStats,
+    UpdatePhaseOther,  // serf request failure reset, knight morale
+
+    UpdatePhaseMax
+  } UpdatePhase;
+  static const char *update_phase_name[UpdatePhaseMax];
+
  protected:
   // moved to outside of Game class so AI can use the Flags typedef
   //typedef Collection<Flag, 5000> Flags;
@@ -90,7 +120,7 @@ class Game {
   unsigned int history_counter;
   Random rnd;
   uint16_t next_index;
-  uint16_t flag_search_counter;
+  uint16_t flag_search_counter;  // unused since FlagSearch keeps its own marks, still in saves
 
   uint16_t update_map_last_tick;
   int16_t update_map_counter;
@@ -114,6 +144,45 @@ class Game {
   int knight_morale_counter;
   int inventory_schedule_counter;
 
+  // serfs by position, see serf-pos-index.h.  Emptied when the map is
+  //  replaced and rebuilt by the first query after that
+  SerfPosIndex serf_pos_index;
+  // each player's objects, see owner-index.h.  Only the game thread changes
+  //  them, under owner_index_mutex because the get_player_* copies are
+  //  also made from AI threads
+  OwnerIndex serf_owners;
+  OwnerIndex building_owners;
+  OwnerIndex inventory_owners;
+  std::mutex owner_index_mutex;
+  // transport routes over the roads, see flag-routes.h
+  FlagRoutes flag_routes;
+  // flags update_flags has to look at, see flag-worklist.h.  Cleared with
+  //  the map, the new map's flags add themselves
+  FlagWorklist flag_worklist;
+  // road networks and their inventories, see flag-components.h.  Cleared
+  //  with the map and built again on first use
+  FlagComponents flag_components;
+  // flags holding resources for each destination, see transit-index.h.
+  //  Cleared with the map and rebuilt once a saved game's flags are loaded
+  TransitIndex transit_index;
+  // stamps of the military buildings, see influence-field.h.  Cleared when
+  //  the map is replaced and filled again by update_land_ownership
+  InfluenceField influence_field;
+  // option_FogOfWar visibility counts, see fog-of-war.h.  Cleared with the
+  //  map and reset by init_FogOfWar
+  FogOfWar fog_of_war;
+  // serfs skipped by update_serfs until a tick, see serf-timer-wheel.h.
+  //  Cleared with the map, the serfs of the new one are all awake
+  SerfTimerWheel serf_timer_wheel;
+  std::vector<SerfTimerWheel::Entry> due_serfs;
+  // ticks of the running (or last) update_serfs and of the one before, and
+  //  the serf it is at, UINT_MAX when it is done.  serf_update_pass counts
+  //  the update_serfs calls, Inventory orders serf slot writes by it
+  unsigned int serf_update_pass;
+  unsigned int serf_update_tick;
+  unsigned int serf_update_prev_tick;
+  unsigned int serf_update_index;
+
   bool ai_locked;
   bool signal_ai_exit;
   unsigned int ai_threads_remaining;
@@ -126,6 +195,39 @@ class Game {
   bool must_redraw_frame;  // part of hack for option_FogOfWar to allow Serf/Building to trigger frame redraw
   // I think this has to be defined here and not in Game constructor because the getter is being called before Game constructor?? not sure
   MapPos desired_cursor_pos = bad_map_pos;  // to allow Game to set the Interface/Viewport player cursor pos (during Interface::update)
+  // per-phase wall-clock time spent in Game::update, only collected when
+  //  profile_update is set so the normal game does not pay for the clock reads
+  bool profile_update = false;
+  uint64_t update_phase_nsec[UpdatePhaseMax] = {};
+  uint64_t update_phase_calls[UpdatePhaseMax] = {};
+  // deterministic replay, see replay.h.  update_count/update_boundary locate
+  //  a command in time and only change under the game mutex
+  PReplay replay_recording;
+  PReplay replay_playing;
+  size_t replay_next_command = 0;
+  unsigned int update_count = 0;
+  unsigned int update_boundary = ReplayCommand::AfterUpdate;
+  bool in_update = false;
+  std::thread::id update_thread_id;
+  bool replay_applying = false;
+  // playback only checks the recorded Random state unless told to restore it
+  bool replay_resync_random = false;
+  unsigned int replay_random_mismatches = 0;
+  // last seen player settings and game speed, changes are recorded as commands
+  std::vector<std::vector<int>> replay_player_settings;
+  unsigned int replay_game_speed = 0;
+  // debug mode, log get_state_hash every this many game ticks.  0 is off
+  unsigned int state_hash_interval = 0;
+  // read-only copies of the world for the AI threads, see world-snapshot.h.
+  //  world_snapshot is the published one and is only touched through
+  //  std::atomic_load/store, the spare is the previous one which is captured
+  //  into again once no AI thread holds it any more
+  std::shared_ptr<WorldSnapshot> world_snapshot;
+  std::shared_ptr<WorldSnapshot> world_snapshot_spare;
+  unsigned int world_snapshot_version = 0;
+  // commands posted by the AI threads, applied at the start of each update
+  GameCommandQueue command_queue;
+  bool applying_queued_commands = false;
 
  public:
   Game();
@@ -137,7 +239,7 @@ class Game {
   Random * get_rand() { return &rnd; }
 
   // tell ai to exit when a game ends
-  void stop_ai_threads() { signal_ai_exit = true; }
+  void stop_ai_threads() { signal_ai_exit = true; command_queue.close(); }
   // ai checks this every loop and exits if true
   bool should_ai_stop() { return signal_ai_exit; }
   // ai begins locked, and is unlocked by game init close
@@ -187,10 +289,53 @@ class Game {
 
   void update();
   void pause();
+
+  // for the profiler, enable/read/reset the per-phase Game::update timings
+  void set_profile_update(bool enable) { profile_update = enable; }
+  uint64_t get_update_phase_nsec(UpdatePhase phase) const { return update_phase_nsec[phase]; }
+  uint64_t get_update_phase_calls(UpdatePhase phase) const { return update_phase_calls[phase]; }
+  void reset_update_phase_stats() {
+    std::fill(std::begin(update_phase_nsec), std::end(update_phase_nsec), 0);
+    std::fill(std::begin(update_phase_calls), std::end(update_phase_calls), 0);
+  }
   void speed_increase();
   void speed_decrease();
   void speed_reset();
 
+  // record every command from now on into replay, call right after the game
+  //  is started and before any AI thread is.  Only works for new games
+  void start_recording(PReplay replay);
+  PReplay stop_recording();
+  // apply the commands of a replay while updating a game created from
+  //  Replay::create_game_info, in place of the AI threads and the player.
+  //  A command leaving the Random in another state than it was recorded
+  //  with means playback went another way, it is logged and counted.
+  //  resync_random puts the recorded state back after every command, for
+  //  replays made while the game Random was still seeded from the clock
+  void start_replay(PReplay replay, bool resync_random = false);
+  bool is_replay_finished() const;
+  unsigned int get_replay_random_mismatches() const {
+    return replay_random_mismatches; }
+  // true if a command being applied now must go into the replay, false for
+  //  commands the game issues to itself while updating
+  bool should_record_command() const;
+  void record_command(ReplayCommand command);
+
+  // 64-bit fingerprint of the map, every game object and the Random state.
+  //  Two runs that should be identical can be compared with it every N
+  //  ticks to find the first tick they diverge at
+  uint64_t get_state_hash();
+  void set_state_hash_interval(unsigned int ticks) { state_hash_interval = ticks; }
+  // for AI threads, the command is applied at the start of the next update
+  //  instead of the caller taking the game mutex, see game-command-queue.h
+  GameCommandQueue::Result post_command(const ReplayCommand &command) {
+    return command_queue.post(command); }
+  std::vector<GameCommandQueue::Result> post_commands(const std::vector<ReplayCommand> &commands) {
+    return command_queue.post(commands); }
+  // never nullptr, an empty snapshot until the first one is published
+  PWorldSnapshot get_world_snapshot() const {
+    return std::atomic_load(&world_snapshot); }
+
   // hack function to allow Serf, Building to trigger game to flush the frame
   //  so for option_FogOfWar so FoW cna be updated only when borders change
   void set_must_redraw_frame() { must_redraw_frame = true; }
@@ -216,7 +361,7 @@ class Game {
   void prepare_ground_analysis(MapPos pos, int estimates[5]);
   bool send_geologist(Flag *dest);
 
-  int get_leveling_height(MapPos pos) const;
+  int get_leveling_height(MapPos pos, bool *leveling_nearby = nullptr) const;
 
   bool can_build_military(MapPos pos) const;
   bool can_build_small(MapPos pos) const;  // NOTE - I think this misleading!  it does not consider blocking objects nor position ownership
@@ -270,7 +415,6 @@ class Game {
   int get_resource_history_index() const { return resource_history_index; }
   //void set_resource_history_index(int res) { resource_history_index = res; }
 
-  int next_search_id();
 
   Serf *create_serf(int index = -1);
   void delete_serf(Serf *serf);
@@ -284,6 +428,9 @@ class Game {
   Flag *get_flag(unsigned int index) { return flags[index]; }
   // got a segfault during flags_copy = game->get_flags... need to mutex wrap all AI game->get_flags calls?
   Flags *get_flags() { return &flags; }
+  FlagRoutes *get_flag_routes() { return &flag_routes; }
+  FlagComponents *get_flag_components() { return &flag_components; }
+  TransitIndex *get_transit_index() { return &transit_index; }
   Inventory *get_inventory(unsigned int index) { return inventories[index]; }
   Building *get_building(unsigned int index) { return buildings[index]; }
   Player *get_player(unsigned int index) { return players[index]; }
@@ -297,29 +444,76 @@ class Game {
 
   ListSerfs get_serfs_at_pos(MapPos pos);
 
+  // the set_owner functions call these so the get_player_* lists stay current
+  void serf_owner_changed(Serf *serf);
+  void building_owner_changed(Building *building);
+  void inventory_owner_changed(Inventory *inventory);
+  // get_player_* without the copy, for Player functions that run in the
+  //  game update.  Not safe from AI threads, those use get_player_*
+  typedef OwnedView<Serf, Serfs> PlayerSerfs;
+  typedef OwnedView<Building, Buildings> PlayerBuildings;
+  typedef OwnedView<Inventory, Inventories> PlayerInventories;
+  PlayerSerfs get_player_serfs_view(const Player *player);
+  PlayerBuildings get_player_buildings_view(const Player *player);
+  PlayerInventories get_player_inventories_view(const Player *player);
+  // Serf::set_pos calls this so serf_pos_index stays current
+  void serf_pos_changed(Serf *serf);
+  // the tick of the last update of the serf, what its tick would be if it
+  //  hadn't been asleep
+  unsigned int get_serf_update_tick(unsigned int index) const {
+    return (index < serf_update_index) ? serf_update_tick
+                                       : serf_update_prev_tick;
+  }
+  void schedule_serf_wake(unsigned int index, unsigned int wake_tick) {
+    serf_timer_wheel.schedule(index, wake_tick);
+  }
+  unsigned int get_serf_update_pass() const { return serf_update_pass; }
+  unsigned int get_serf_update_index() const { return serf_update_index; }
+  // Flag calls this whenever a road appears, disappears or gains or loses
+  //  its transporter, so the cached flag_routes are rebuilt
+  void road_network_changed() { flag_routes.clear(); }
+  // Flag calls this whenever something Flag::update looks at changes, or
+  //  an update still had something to do
+  void flag_changed(Flag *flag) { flag_worklist.add(flag->get_index()); }
+
   Player *get_next_player(const Player *player);
   unsigned int get_enemy_score(const Player *player) const;
   // not only when captured from enemies, this runs when newly-built friendly military buildings first occupied also
   void building_captured(Building *building);
-  void clear_search_id();
+  // used by option_FogOfWar for human players, and by the headless runner to give
+  //  every player a castle when no AI threads are running to place them
+  MapPos auto_place_castle(Player *player);
   void mutex_lock(const char* message);
   void mutex_unlock();
 
 
 
  protected:
+  void publish_world_snapshot();
+  void update_serf_pos_index();
+  void rebuild_owner_indexes();
+  void rebuild_transit_index();
   void clear_serf_request_failure();
   void update_knight_morale();
   static bool update_inventories_cb(Flag *flag, void *data);
   void update_inventories();
   void update_flags();
   static bool send_serf_to_flag_search_cb(Flag *flag, void *data);
+  bool check_build_military(MapPos pos) const;
+  bool check_build_large(MapPos pos, bool *cacheable) const;
   void update_buildings();
   void update_serfs();
   void record_player_history(int max_level, int aspect,
                              const int history_index[], const Values &values);
   int calculate_clear_winner(const Values &values);
   void update_game_stats();
+  void end_update_phase(UpdatePhase phase, std::chrono::steady_clock::time_point *phase_start);
+  bool is_update_thread() const;
+  void record_setting_changes();
+  void apply_due_replay_commands();
+  void apply_replay_command(const ReplayCommand &command);
+  bool apply_command(const ReplayCommand &command);
+  void apply_queued_commands();
   void get_resource_estimate(MapPos pos, int weight, int estimates[5]);
   bool road_segment_in_water(MapPos pos, Direction dir) const;
   void flag_reset_transport(Flag *flag);
@@ -335,10 +529,10 @@ class Game {
   void surrender_land(MapPos pos);
   void demolish_flag_and_roads(MapPos pos);
 
-  MapPos auto_place_castle(Player *player);
   bool place_castle(MapPos center_pos, int player_index, unsigned int distance, unsigned int desperation);
 
  public:
+  friend class WorldSnapshot;
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Game &game);
   friend SaveReaderText&
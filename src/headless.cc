@@ -0,0 +1,305 @@
+/*
+ * headless.cc - headless simulation runner, no SDL video/audio/event loop
+ *
+ *  Creates or loads a game through the GameManager and calls Game::update()
+ *   in a tight loop, with no SDL_AddTimer pacing, for a fixed number of
+ *   updates.  Used for long AI-vs-AI soak games on servers without a display
+ *   and for measuring simulation throughput in ticks per second.
+ *  It can also record a new game's commands to a replay file (-R) and play
+ *   one back without any AI threads (-P), see replay.h
+ */
+
+#include "src/headless.h"
+
+#include <chrono>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <string>
+#include <thread>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <vector>
+
+#include "src/ai.h"
+#include "src/command_line.h"
+#include "src/game-manager.h"
+#include "src/game-options.h"
+#include "src/log.h"
+#include "src/replay.h"
+#include "src/task-pool.h"
+#include "src/version.h"
+
+// hand every player with an AI face to the AI scheduler, the same way
+//  Interface::initialize_AI does it for the normal game
+static std::vector<AI*>
+headless_initialize_AI(PGame game) {
+  std::vector<AI*> ais;
+  Player *player = game->get_player(0);
+  unsigned int index = 0;
+  do {
+    // face: the face image that represents this player.
+    //  1-11 is AI, 12-13 is human player.  0 is invalid
+    if (player->get_face() >= 1 && player->get_face() <= 11) {
+      Log::Info["headless"] << "Initializing AI for player #" << index;
+      // each AI logger captures the current log stream when constructed
+      Log::set_file(new std::ofstream("ai_Player" + std::to_string(index) + ".txt"));
+      AI *ai = new AI(game, index);
+      game->ai_thread_starting();
+      ais.push_back(ai);
+      AIScheduler::get_instance().add(ai);
+    }
+    index++;
+    player = game->get_player(index);
+  } while (player != nullptr);
+  Log::set_file(&std::cout);
+  game->unlock_ai();
+  return ais;
+}
+
+int
+main(int argc, char *argv[]) {
+  std::string save_file;
+  std::string random_seed;
+  std::string record_file;
+  std::string replay_file;
+  unsigned int map_size = 3;
+  unsigned int updates = HEADLESS_DEFAULT_UPDATES;
+  bool command_line_updates_given = false;
+  unsigned int game_speed = HEADLESS_DEFAULT_GAME_SPEED;
+  unsigned int pacing_msec = 0;
+  unsigned int hash_interval = 0;
+  unsigned int map_threads = 0;
+  bool run_ai = false;
+  bool resync_random = false;
+
+  CommandLine command_line;
+  command_line.add_option('a', "Run AI threads for all players (AI-vs-AI)",
+                          [&run_ai](){ run_ai = true; });
+  command_line.add_option('d', "Set Debug output level")
+                .add_parameter("NUM", [](std::istream& s) {
+                  int d;
+                  s >> d;
+                  if (d >= 0 && d < Log::LevelMax) {
+                    Log::set_level(static_cast<Log::Level>(d));
+                  }
+                  return true;
+                });
+  command_line.add_option('h', "Show this help text", [&command_line](){
+                  command_line.show_help();
+                  exit(EXIT_SUCCESS);
+                });
+  command_line.add_option('H', "Log a hash of the whole game state every TICKS game ticks")
+                .add_parameter("TICKS", [&hash_interval](std::istream& s) {
+                  s >> hash_interval;
+                  return true;
+                });
+  command_line.add_option('l', "Load saved game")
+                .add_parameter("FILE", [&save_file](std::istream& s) {
+                  std::getline(s, save_file);
+                  return true;
+                });
+  command_line.add_option('m', "Map size for a new game (3-10)")
+                .add_parameter("SIZE", [&map_size](std::istream& s) {
+                  s >> map_size;
+                  return (map_size >= 3 && map_size <= 10);
+                });
+  command_line.add_option('n', "Number of Game::update() calls to run")
+                .add_parameter("UPDATES", [&updates, &command_line_updates_given](std::istream& s) {
+                  s >> updates;
+                  command_line_updates_given = true;
+                  return true;
+                });
+  command_line.add_option('p', "Sleep between updates, lets AI threads keep up (default 0)")
+                .add_parameter("MSEC", [&pacing_msec](std::istream& s) {
+                  s >> pacing_msec;
+                  return true;
+                });
+  command_line.add_option('P', "Play back a replay file, no AI threads are run")
+                .add_parameter("FILE", [&replay_file](std::istream& s) {
+                  std::getline(s, replay_file);
+                  return true;
+                });
+  command_line.add_option('S', "Replay: restore the recorded random state after each command instead of failing (older replays)",
+                          [&resync_random](){ resync_random = true; });
+  command_line.add_option('R', "Record the commands of a new game to a replay file")
+                .add_parameter("FILE", [&record_file](std::istream& s) {
+                  std::getline(s, record_file);
+                  return true;
+                });
+  command_line.add_option('r', "Random seed for a new game (16 digits 1-8)")
+                .add_parameter("SEED", [&random_seed](std::istream& s) {
+                  s >> random_seed;
+                  return (random_seed.length() == 16);
+                });
+  command_line.add_option('s', "Game speed (0-40, default 2)")
+                .add_parameter("SPEED", [&game_speed](std::istream& s) {
+                  s >> game_speed;
+                  return (game_speed <= 40);
+                });
+  command_line.add_option('t', "Split Map::update over THREADS threads (turns on ParallelMapUpdate, a replay uses its own setting)")
+                .add_parameter("THREADS", [&map_threads](std::istream& s) {
+                  s >> map_threads;
+                  return (map_threads > 0);
+                });
+  command_line.set_comment("Please report bugs to <" PACKAGE_BUGREPORT ">");
+  if (!command_line.process(argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  Log::Info["headless"] << "forkserf headless " << FORKSERF_VERSION;
+
+  if (!record_file.empty() && (!save_file.empty() || !replay_file.empty())) {
+    Log::Error["headless"] << "only a new game can be recorded";
+    return EXIT_FAILURE;
+  }
+
+  if (map_threads > 0) {
+    TaskPool::get_instance().set_max_threads(map_threads);
+  }
+
+  GameManager &game_manager = GameManager::get_instance();
+  PReplay replay;
+
+  // save games do not store option_ParallelMapUpdate, a loaded game gets it
+  //  from -t like a new one.  A replay brings its own setting, applied
+  //  below.  The thread count does not change the result either way
+  if (map_threads > 0) {
+    option_ParallelMapUpdate = true;
+  }
+
+  /* Either load a save game or a replay if specified or
+     start a new game. */
+  if (!replay_file.empty()) {
+    replay = std::make_shared<Replay>();
+    if (!replay->load(replay_file)) {
+      return EXIT_FAILURE;
+    }
+    replay->apply_game_options();
+    if (!game_manager.start_game(replay->create_game_info(), replay->get_custom_map_generator_options())) {
+      return EXIT_FAILURE;
+    }
+    game_manager.get_current_game()->start_replay(replay, resync_random);
+    // run exactly as long as the recording unless told otherwise
+    if (!command_line_updates_given) {
+      updates = replay->get_total_updates();
+    }
+    Log::Info["headless"] << "playing back replay '" << replay_file << "', " << replay->get_commands().size()
+                          << " commands over " << replay->get_total_updates() << " updates";
+  } else if (!save_file.empty()) {
+    if (!game_manager.load_game(save_file)) {
+      return EXIT_FAILURE;
+    }
+    Log::Info["headless"] << "loaded game '" << save_file << "'";
+  } else {
+    Random random = random_seed.empty() ? Random() : Random(random_seed);
+    PGameInfo game_info(new GameInfo(random));
+    game_info->set_map_size(map_size);
+    // every player is an AI, player 0 is human by default
+    game_info->get_player(0)->set_character(1);
+    CustomMapGeneratorOptions options = GameManager::get_default_custom_map_generator_options();
+    if (!game_manager.start_game(game_info, options)) {
+      return EXIT_FAILURE;
+    }
+    if (!record_file.empty()) {
+      replay = std::make_shared<Replay>(*game_info, options);
+      game_manager.get_current_game()->start_recording(replay);
+    }
+    Log::Info["headless"] << "started new game with random seed " << std::string(random) << ", map size " << map_size;
+  }
+
+  PGame game = game_manager.get_current_game();
+  game->set_state_hash_interval(hash_interval);
+
+  // load_game leaves the game paused, bring it to the requested speed.  A
+  //  replay sets the recorded speed itself
+  if (replay_file.empty()) {
+    if (game->get_game_speed() == 0) {
+      game->pause();
+    }
+    while (game->get_game_speed() < game_speed) {
+      game->speed_increase();
+    }
+    while (game->get_game_speed() > game_speed) {
+      game->speed_decrease();
+    }
+  }
+
+  std::vector<AI*> ais;
+  if (!replay_file.empty()) {
+    // the replay issues every command the players and AI did
+  } else if (run_ai) {
+    ais = headless_initialize_AI(game);
+  } else if (save_file.empty()) {
+    // without AI threads nobody would place a castle, do it the way
+    //  option_FogOfWar does for human players so the economy actually runs
+    for (unsigned int i = 0; game->get_player(i) != nullptr; i++) {
+      game->auto_place_castle(game->get_player(i));
+    }
+  }
+
+  unsigned int start_tick = game->get_tick();
+  auto start = std::chrono::steady_clock::now();
+  auto last_report = start;
+  for (unsigned int i = 1; i <= updates; i++) {
+    game->update();
+    // the AI sleeps in wall-clock time (see AI::sleep_speed_adjusted) so with no
+    //  pacing at all the game runs far ahead of it, allow a soak game to slow down
+    if (pacing_msec > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(pacing_msec));
+    }
+    if (i % HEADLESS_REPORT_INTERVAL == 0) {
+      auto now = std::chrono::steady_clock::now();
+      double secs = std::chrono::duration<double>(now - last_report).count();
+      Log::Info["headless"] << "update " << i << ", game tick " << game->get_tick()
+                            << ", " << static_cast<unsigned int>(HEADLESS_REPORT_INTERVAL / secs) << " updates/sec";
+      last_report = now;
+    }
+  }
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  unsigned int ticks = game->get_tick() - start_tick;
+
+  Log::Info["headless"] << "ran " << updates << " updates (" << ticks << " game ticks) in " << secs << " sec";
+  Log::Info["headless"] << "throughput " << static_cast<uint64_t>(updates / secs) << " updates/sec, "
+                        << static_cast<uint64_t>(ticks / secs) << " game ticks/sec";
+
+  // compare these between a recorded run and its replay, if they differ run
+  //  both again with -H to find the first tick they diverge at.  Recording
+  //  stops under the same lock, so a command an AI thread issues after the
+  //  last update is either in both the replay and the hash or in neither
+  game->get_mutex()->lock();
+  if (!record_file.empty()) {
+    game->stop_recording();
+  }
+  uint64_t state_hash = game->get_state_hash();
+  game->get_mutex()->unlock();
+  Log::Info["headless"] << "final game tick " << game->get_tick() << ", random state "
+                        << std::string(*game->get_rand()) << ", state hash " << std::hex << state_hash << std::dec;
+  if (!replay_file.empty() && !game->is_replay_finished()) {
+    Log::Warn["headless"] << "replay has commands left after " << updates << " updates";
+  }
+  unsigned int mismatches = game->get_replay_random_mismatches();
+  bool replay_diverged = (mismatches > 0 && !resync_random);
+  if (replay_diverged) {
+    Log::Error["headless"] << "replay diverged, " << mismatches
+                           << " commands left another random state than recorded";
+  } else if (mismatches > 0) {
+    Log::Warn["headless"] << "restored the recorded random state after " << mismatches << " commands";
+  }
+
+  if (!ais.empty()) {
+    // tell the AI threads to exit and give them a chance to notice
+    //  an AI in the middle of a long loop may not, in that case exit anyway
+    game->stop_ai_threads();
+    for (int i = 0; i < 100 && game->get_ai_thread_count() > 0; i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+
+  if (!record_file.empty()) {
+    if (!replay->save(record_file)) {
+      return EXIT_FAILURE;
+    }
+    Log::Info["headless"] << "recorded " << replay->get_commands().size() << " commands to '" << record_file << "'";
+  }
+
+  return replay_diverged ? EXIT_FAILURE : EXIT_SUCCESS;
+}
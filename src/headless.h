@@ -0,0 +1,17 @@
+/*
+ * headless.h - headless simulation runner, no SDL video/audio/event loop
+ */
+
+#ifndef SRC_HEADLESS_H_
+#define SRC_HEADLESS_H_
+
+// the headless runner calls Game::update() in a tight loop with no SDL_Timer
+//  pacing, so a "tick" here is one call to Game::update() and the amount of
+//  game time it represents depends on the game speed (see Game::update)
+#define HEADLESS_DEFAULT_UPDATES  50000
+// how often to log progress, in Game::update() calls
+#define HEADLESS_REPORT_INTERVAL  10000
+// game speed 2 is normal speed, 2 game ticks per update
+#define HEADLESS_DEFAULT_GAME_SPEED  2
+
+#endif  // SRC_HEADLESS_H_
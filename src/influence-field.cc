@@ -0,0 +1,99 @@
+/*
+ * influence-field.cc - military influence of every player on every tile
+ */
+
+#include "src/influence-field.h"
+
+#include "src/debug.h"
+
+// how much each military type adds by closeness, -1 claims the tile
+// does this mean that larger military buildings have a stronger
+//  influence on player borders??  I always assumed it was identical!
+static const int military_influence[] = {
+  0, 1, 2, 4, 7, 12, 18, 29, -1, -1,  /* hut */
+  0, 3, 5, 8, 11, 15, 22, 30, -1, -1,  /* tower */
+  0, 6, 10, 14, 19, 23, 27, 31, -1, -1  /* fortress */
+};
+
+// closeness of a tile to the building at the center, by row/col offset
+static const int map_closeness[] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+  1, 2, 2, 2, 2, 2, 2, 2, 2, 1, 0, 0, 0, 0, 0, 0, 0,
+  1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1, 0, 0, 0, 0, 0, 0,
+  1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1, 0, 0, 0, 0, 0,
+  1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1, 0, 0, 0, 0,
+  1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1, 0, 0, 0,
+  1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1, 0, 0,
+  1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+  1, 2, 3, 4, 5, 6, 7, 8, 9, 8, 7, 6, 5, 4, 3, 2, 1,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 7, 6, 5, 4, 3, 2, 1,
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 7, 6, 5, 4, 3, 2, 1,
+  0, 0, 0, 1, 2, 3, 4, 5, 6, 6, 6, 6, 5, 4, 3, 2, 1,
+  0, 0, 0, 0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 4, 3, 2, 1,
+  0, 0, 0, 0, 0, 1, 2, 3, 4, 4, 4, 4, 4, 4, 3, 2, 1,
+  0, 0, 0, 0, 0, 0, 1, 2, 3, 3, 3, 3, 3, 3, 3, 2, 1,
+  0, 0, 0, 0, 0, 0, 0, 1, 2, 2, 2, 2, 2, 2, 2, 2, 1,
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+void
+InfluenceField::clear() {
+  influence.clear();
+  stamps.clear();
+}
+
+void
+InfluenceField::reset(const MapGeometry &_geom) {
+  geom = _geom;
+  influence.assign(geom.tile_count() * INFLUENCE_FIELD_MAX_PLAYERS, 0);
+  stamps.assign(geom.tile_count(), 0);
+}
+
+void
+InfluenceField::set_stamp(MapPos pos, int owner, int mil_type) {
+  uint8_t stamp = 0;
+  if (owner >= 0 && mil_type >= 0) {
+    if (owner >= INFLUENCE_FIELD_MAX_PLAYERS) {
+      throw ExceptionFreeserf("InfluenceField, player index out of range");
+    }
+    stamp = static_cast<uint8_t>(1 + owner*3 + mil_type);
+  }
+  if (stamps[pos] == stamp) {
+    return;
+  }
+  if (stamps[pos] != 0) {
+    apply(pos, (stamps[pos] - 1) / 3, (stamps[pos] - 1) % 3, false);
+  }
+  if (stamp != 0) {
+    apply(pos, owner, mil_type, true);
+  }
+  stamps[pos] = stamp;
+}
+
+void
+InfluenceField::apply(MapPos center, unsigned int owner, int mil_type,
+                      bool add) {
+  const int *inf_by_closeness = military_influence + 10*mil_type;
+  for (int i = -radius; i <= radius; i++) {
+    for (int j = -radius; j <= radius; j++) {
+      int inf = inf_by_closeness[map_closeness[diameter*(i+radius) +
+                                               (j+radius)]];
+      if (inf == 0) {
+        continue;
+      }
+      MapPos pos = geom.pos_add(center, j, i);
+      uint16_t &value = influence[pos * INFLUENCE_FIELD_MAX_PLAYERS + owner];
+      int close = value >> close_shift;
+      int sum = value & sum_mask;
+      if (inf < 0) {
+        close += add ? 1 : -1;
+      } else {
+        sum += add ? inf : -inf;
+      }
+      if (close < 0 || close > 7 || sum < 0 || sum > sum_mask) {
+        throw ExceptionFreeserf("InfluenceField, influence out of range");
+      }
+      value = static_cast<uint16_t>((close << close_shift) | sum);
+    }
+  }
+}
@@ -0,0 +1,70 @@
+/*
+ * influence-field.h - military influence of every player on every tile
+ *
+ *  Game::update_land_ownership used to allocate a 17x17 array per player
+ *   and stamp every active military building of the 33x33 area around the
+ *   changed one into it, for every building that was occupied, captured
+ *   or burnt.  A fortress capture or a capitulation did that for dozens
+ *   of buildings in a row.
+ *  This keeps the stamps instead.  Each tile remembers which stamp (owner
+ *   and military type) its building has applied, and set_stamp only
+ *   subtracts/adds the 17x17 pattern when that changes, so the area scan
+ *   costs a read per tile and only the buildings that changed are
+ *   stamped again.
+ *  The original adds influence saturating at 127, and a tile right next to
+ *   a building gets 128 that nothing can beat.  Saturation can't be undone
+ *   by subtracting, so the raw sum and the count of "next to" stamps are
+ *   kept and get() turns them into the same 0-128 value.
+ */
+
+#ifndef SRC_INFLUENCE_FIELD_H_
+#define SRC_INFLUENCE_FIELD_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "src/map-geometry.h"
+
+#define INFLUENCE_FIELD_MAX_PLAYERS  4
+
+class InfluenceField {
+ public:
+  static const int radius = 8;
+  static const int diameter = 1 + 2*radius;
+
+ protected:
+  // low 13 bits are the sum of the influence, high 3 bits count the
+  //  stamps that claim the tile outright
+  static const uint16_t sum_mask = 0x1fff;
+  static const int close_shift = 13;
+
+  MapGeometry geom;
+  std::vector<uint16_t> influence;  // per tile, per player
+  std::vector<uint8_t> stamps;      // per tile, 0 or 1 + owner*3 + mil_type
+
+  void apply(MapPos pos, unsigned int owner, int mil_type, bool add);
+
+ public:
+  InfluenceField() : geom(3) {}
+
+  // forget everything, a new or loaded map.  It stays empty until
+  //  Game::update_land_ownership resets it for the new map's size
+  void clear();
+  void reset(const MapGeometry &geom);
+  bool is_empty() const { return stamps.empty(); }
+
+  // the building at pos now stamps as mil_type (0 hut, 1 tower,
+  //  2 fortress/castle) for owner, or nothing at all if owner is -1
+  void set_stamp(MapPos pos, int owner, int mil_type);
+
+  // same value the old temp array had, 0 - 127 or 128
+  int get(MapPos pos, unsigned int owner) const {
+    uint16_t value = influence[pos * INFLUENCE_FIELD_MAX_PLAYERS + owner];
+    if ((value >> close_shift) != 0) {
+      return 128;
+    }
+    return ((value & sum_mask) > 127) ? 127 : (value & sum_mask);
+  }
+};
+
+#endif  // SRC_INFLUENCE_FIELD_H_
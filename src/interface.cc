@@ -467,8 +467,7 @@ Interface::initialize_AI() {
       game->ai_thread_starting();
       // store AI pointer in game so it can be fetched by other functions (viewport, at least, for AI overlay)
       set_ai_ptr(index, ai);
-      std::thread ai_thread(&AI::start, ai);
-      ai_thread.detach();
+      AIScheduler::get_instance().add(ai);
     }
     index++;
     player = game->get_player(index);
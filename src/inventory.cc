@@ -22,9 +22,12 @@
 #include "src/inventory.h"
 
 #include <algorithm>
+#include <iterator>
+#include <vector>
 
 #include "src/savegame.h"
 #include "src/flag.h"
+#include "src/state-hash.h"
 #include "src/game.h"
 #include "src/serf.h"
 
@@ -44,6 +47,13 @@ Inventory::Inventory(Game *game, unsigned int index)
   }
 }
 
+// keeps Game::get_player_inventories current
+void
+Inventory::set_owner(unsigned int owner) {
+  this->owner = owner;
+  game->inventory_owner_changed(this);
+}
+
 Inventory::~Inventory() {
   for (int i = 0; i < 2 && out_queue[i].type != Resource::TypeNone; i++) {
     Resource::Type res = out_queue[i].type;
@@ -57,6 +67,105 @@ Inventory::~Inventory() {
   game->add_gold_total(-static_cast<int>(resources[Resource::TypeGoldOre]));
 }
 
+// serfs sent out wake up first, they are back to being polled every tick
+void
+Inventory::set_serf_mode(Inventory::Mode mode) {
+  res_dir = (res_dir & 0xF3) | (mode << 2);
+  if (mode != ModeOut || sleeping_serfs.empty()) {
+    return;
+  }
+  std::vector<unsigned int> sleeping;
+  for (const auto &type : sleeping_serfs) {
+    sleeping.insert(sleeping.end(), type.second.begin(), type.second.end());
+  }
+  for (unsigned int index : sleeping) {
+    Serf *serf = game->get_serf(index);
+    if (serf != nullptr) {
+      serf->wake();
+    }
+  }
+}
+
+unsigned int
+Inventory::get_serf(Serf::Type type) {
+  UpdateTime time;
+  return get_last_serf(type, serfs[type], &time);
+}
+
+void
+Inventory::set_serf(Serf::Type type, unsigned int serf) {
+  serfs[type] = serf;
+  serfs_set_at[type] = UpdateTime(game->get_serf_update_pass(),
+                                  game->get_serf_update_index());
+}
+
+// what serfs[type] would be if the sleeping serfs were still setting it,
+//  and when it was set
+unsigned int
+Inventory::get_last_serf(Serf::Type type, unsigned int set_value,
+                         UpdateTime *time) const {
+  auto set_at = serfs_set_at.find(type);
+  *time = (set_at != serfs_set_at.end()) ? set_at->second : UpdateTime(0, 0);
+  auto sleeping = sleeping_serfs.find(type);
+  if (sleeping == sleeping_serfs.end()) {
+    return set_value;
+  }
+  // the ones before the serf being updated already set it in this pass,
+  //  the last of them wins.  If there are none it was the last one in
+  //  the pass before
+  unsigned int pass = game->get_serf_update_pass();
+  auto next = sleeping->second.lower_bound(game->get_serf_update_index());
+  UpdateTime idle_at;
+  if (next != sleeping->second.begin()) {
+    idle_at = UpdateTime(pass, *std::prev(next));
+  } else {
+    idle_at = UpdateTime(pass - 1, *sleeping->second.rbegin());
+  }
+  if (*time > idle_at) {
+    return set_value;
+  }
+  *time = idle_at;
+  return idle_at.second;
+}
+
+// a serf that just came in has not set itself yet
+bool
+Inventory::can_serf_sleep(Serf *serf) const {
+  if (get_serf_mode() == ModeOut) {
+    return false;
+  }
+  auto set = serfs.find(serf->get_type());
+  auto set_at = serfs_set_at.find(serf->get_type());
+  return (set != serfs.end() && set->second == serf->get_index() &&
+          set_at != serfs_set_at.end() &&
+          set_at->second == UpdateTime(game->get_serf_update_pass(),
+                                       serf->get_index()));
+}
+
+void
+Inventory::serf_fell_asleep(Serf *serf) {
+  sleeping_serfs[serf->get_type()].insert(serf->get_index());
+}
+
+// from here on serfs[type] has to be set for real again
+void
+Inventory::serf_woke(Serf *serf) {
+  auto sleeping = sleeping_serfs.find(serf->get_type());
+  if (sleeping == sleeping_serfs.end() ||
+      sleeping->second.count(serf->get_index()) == 0) {
+    return;
+  }
+  UpdateTime time;
+  unsigned int value = get_last_serf(serf->get_type(), serfs[serf->get_type()],
+                                     &time);
+  serfs[serf->get_type()] = value;
+  serfs_set_at[serf->get_type()] = time;
+  sleeping->second.erase(serf->get_index());
+  if (sleeping->second.empty()) {
+    sleeping_serfs.erase(sleeping);
+  }
+}
+
 void
 Inventory::push_resource(Resource::Type resource) {
   resources[resource] += (resources[resource] < 50000) ? 1 : 0;
@@ -176,14 +285,14 @@ Inventory::call_transporter(bool water) {
   Serf *serf = NULL;
 
   if (water) {
-    if (serfs[Serf::TypeSailor] != 0) {
-      serf = game->get_serf(serfs[Serf::TypeSailor]);
-      serfs[Serf::TypeSailor] = 0;
+    if (get_serf(Serf::TypeSailor) != 0) {
+      serf = game->get_serf(get_serf(Serf::TypeSailor));
+      set_serf(Serf::TypeSailor, 0);
     } else {
-      if ((serfs[Serf::TypeGeneric] != 0) &&
+      if ((get_serf(Serf::TypeGeneric) != 0) &&
           (resources[Resource::TypeBoat] > 0)) {
-        serf = game->get_serf(serfs[Serf::TypeGeneric]);
-        serfs[Serf::TypeGeneric] = 0;
+        serf = game->get_serf(get_serf(Serf::TypeGeneric));
+        set_serf(Serf::TypeGeneric, 0);
         resources[Resource::TypeBoat]--;
         serf->set_type(Serf::TypeSailor);
         generic_count -= 1;
@@ -192,13 +301,13 @@ Inventory::call_transporter(bool water) {
       }
     }
   } else {
-    if (serfs[Serf::TypeTransporter] != 0) {
-      serf = game->get_serf(serfs[Serf::TypeTransporter]);
-      serfs[Serf::TypeTransporter] = 0;
+    if (get_serf(Serf::TypeTransporter) != 0) {
+      serf = game->get_serf(get_serf(Serf::TypeTransporter));
+      set_serf(Serf::TypeTransporter, 0);
     } else {
-      if (serfs[Serf::TypeGeneric] != 0) {
-        serf = game->get_serf(serfs[Serf::TypeGeneric]);
-        serfs[Serf::TypeGeneric] = 0;
+      if (get_serf(Serf::TypeGeneric) != 0) {
+        serf = game->get_serf(get_serf(Serf::TypeGeneric));
+        set_serf(Serf::TypeGeneric, 0);
         //Log::Debug["inventory"] << "inside call_transporter, about to call set_type";
         serf->set_type(Serf::TypeTransporter);
         generic_count -= 1;
@@ -215,11 +324,11 @@ Inventory::call_transporter(bool water) {
 
 bool
 Inventory::call_out_serf(Serf *serf) {
-  if (serfs[serf->get_type()] != serf->get_index()) {
+  if (get_serf(serf->get_type()) != serf->get_index()) {
     return false;
   }
 
-  serfs[serf->get_type()] = 0;
+  set_serf(serf->get_type(), 0);
   if (serf->get_type() == Serf::TypeGeneric) {
     generic_count--;
   }
@@ -229,11 +338,11 @@ Inventory::call_out_serf(Serf *serf) {
 
 Serf*
 Inventory::call_out_serf(Serf::Type type) {
-  if (serfs[type] == 0) {
+  if (get_serf(type) == 0) {
     return NULL;
   }
 
-  Serf *serf = game->get_serf(serfs[type]);
+  Serf *serf = game->get_serf(get_serf(type));
   if (!call_out_serf(serf)) {
     return NULL;
   }
@@ -243,12 +352,12 @@ Inventory::call_out_serf(Serf::Type type) {
 
 bool
 Inventory::call_internal(Serf *serf) {
-  if (serfs[serf->get_type()] != serf->get_index()) {
+  if (get_serf(serf->get_type()) != serf->get_index()) {
     //Log::Debug["inventory.cc"] << "inside Inventory::call_internal for specific serf with index " << serf->get_index() << " type is wrong, returning false";
     return false;
   }
 
-  serfs[serf->get_type()] = 0;
+  set_serf(serf->get_type(), 0);
 
   //Log::Debug["inventory.cc"] << "inside Inventory::call_internal for specific serf with index " << serf->get_index() << " type is correct type " << serf->get_type() << ", returning false";
 
@@ -258,18 +367,20 @@ Inventory::call_internal(Serf *serf) {
 Serf*
 Inventory::call_internal(Serf::Type type) {
   //Log::Debug["inventory.cc"] << "inside Inventory::call_internal for serf type " << type;
-  if (serfs[type] == 0) {
+  if (get_serf(type) == 0) {
     return NULL;
   }
 
-  Serf *serf = game->get_serf(serfs[type]);
-  serfs[type] = 0;
+  Serf *serf = game->get_serf(get_serf(type));
+  set_serf(type, 0);
 
   return serf;
 }
 
 bool
 Inventory::promote_serf_to_knight(Serf *serf) {
+  ReplayCommandScope command(game, ReplayCommand(ReplayCommand::TypePromoteSerfToKnight, owner, index,
+                                                 serf->get_index()));
   if (serf->get_type() != Serf::TypeGeneric) {
     return false;
   }
@@ -282,7 +393,7 @@ Inventory::promote_serf_to_knight(Serf *serf) {
   pop_resource(Resource::TypeSword);
   pop_resource(Resource::TypeShield);
   generic_count--;
-  serfs[Serf::TypeGeneric] = 0;
+  set_serf(Serf::TypeGeneric, 0);
 
   //Log::Debug["inventory"] << "inside promote_serf_to_knight, about to call set_type";
   serf->set_type(Serf::TypeKnight0);
@@ -308,8 +419,8 @@ Inventory::spawn_serf_generic() {
     serf->init_generic(this);
 
     generic_count++;
-    if (serfs[Serf::TypeGeneric] == 0) {
-      serfs[Serf::TypeGeneric] = serf->get_index();
+    if (get_serf(Serf::TypeGeneric) == 0) {
+      set_serf(Serf::TypeGeneric, serf->get_index());
     }
   }
 
@@ -393,8 +504,8 @@ Inventory::specialize_serf(Serf *serf, Serf::Type type) {
   }
 
   // what is this?  
-  if (serfs[Serf::TypeGeneric] == serf->get_index()) {
-    serfs[Serf::TypeGeneric] = 0;
+  if (get_serf(Serf::TypeGeneric) == serf->get_index()) {
+    set_serf(Serf::TypeGeneric, 0);
   }
   generic_count--;
 
@@ -409,7 +520,7 @@ Inventory::specialize_serf(Serf *serf, Serf::Type type) {
   //Log::Debug["inventory"] << "inside specialize_serf, successfully specialized a generic serf to new type " << NameSerf[type];
   serf->set_type(type);
 
-  serfs[type] = serf->get_index();
+  set_serf(type, serf->get_index());
 
   return true;
 }
@@ -422,11 +533,11 @@ Inventory::specialize_serf(Serf *serf, Serf::Type type) {
 //   see 'serf_to_knight_rate' variable
 Serf*
 Inventory::specialize_free_serf(Serf::Type type) {
-  if (serfs[Serf::TypeGeneric] == 0) {
+  if (get_serf(Serf::TypeGeneric) == 0) {
     return NULL;
   }
 
-  Serf *serf = game->get_serf(serfs[Serf::TypeGeneric]);
+  Serf *serf = game->get_serf(get_serf(Serf::TypeGeneric));
 
   if (!specialize_serf(serf, type)) {
     return NULL;
@@ -451,14 +562,14 @@ Inventory::serf_potential_count(Serf::Type type) {
 
 void
 Inventory::serf_idle_in_stock(Serf *serf) {
-  serfs[serf->get_type()] = serf->get_index();
+  set_serf(serf->get_type(), serf->get_index());
 }
 
 void
 Inventory::knight_training(Serf *serf, int p) {
   Serf::Type old_type = serf->get_type();
   int r = serf->train_knight(p);
-  if (r == 0) serfs[old_type] = 0;
+  if (r == 0) set_serf(old_type, 0);
 
   serf_idle_in_stock(serf);
 }
@@ -541,9 +652,33 @@ operator << (SaveWriterText &writer, Inventory &inventory) {
 
   for (int i = 0; i < 26; i++) {
     writer.value("resources") << inventory.resources[(Resource::Type)i];
-    writer.value("serfs") << inventory.serfs[(Serf::Type)i];
+    writer.value("serfs") << inventory.get_serf((Serf::Type)i);
   }
-  writer.value("serfs") << inventory.serfs[(Serf::Type)26];
+  writer.value("serfs") << inventory.get_serf((Serf::Type)26);
 
   return writer;
 }
+
+void
+Inventory::add_state_hash(StateHash *hash) const {
+  hash->add(index);
+  hash->add(owner);
+  hash->add(flag);
+  hash->add(building);
+  for (const auto &resource : resources) {
+    hash->add(resource.first);
+    hash->add(resource.second);
+  }
+  for (int i = 0; i < 2; i++) {
+    hash->add(out_queue[i].type);
+    hash->add(out_queue[i].dest);
+  }
+  hash->add(serfs_out);
+  hash->add(generic_count);
+  hash->add(res_dir);
+  for (const auto &serf : serfs) {
+    UpdateTime time;
+    hash->add(serf.first);
+    hash->add(get_last_serf(serf.first, serf.second, &time));
+  }
+}
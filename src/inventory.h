@@ -22,6 +22,10 @@
 #ifndef SRC_INVENTORY_H_
 #define SRC_INVENTORY_H_
 
+#include <map>
+#include <set>
+#include <utility>
+
 #include "src/resource.h"
 #include "src/serf.h"
 #include "src/objects.h"
@@ -30,6 +34,7 @@ class Flag;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Inventory : public GameObject {
  public:
@@ -59,13 +64,26 @@ class Inventory : public GameObject {
   int res_dir;
   /* Indices to serfs of each type */
   Serf::SerfMap serfs;
+  // idle serfs asleep in here, by type, see Serf::try_sleep.  Awake they
+  //  would set serfs[type] to themselves on every pass of
+  //  Game::update_serfs, so serfs only has what anything else set last and
+  //  serfs_set_at has when (pass and serf index being updated).  get_serf
+  //  works out which of them came last
+  typedef std::pair<unsigned int, unsigned int> UpdateTime;
+  std::map<Serf::Type, std::set<unsigned int>> sleeping_serfs;
+  std::map<Serf::Type, UpdateTime> serfs_set_at;
+
+  unsigned int get_serf(Serf::Type type);
+  void set_serf(Serf::Type type, unsigned int serf);
+  unsigned int get_last_serf(Serf::Type type, unsigned int set_value,
+                             UpdateTime *time) const;
 
  public:
   Inventory(Game *game, unsigned int index);
   virtual ~Inventory();
 
   unsigned int get_owner() { return owner; }
-  void set_owner(unsigned int owner) { this->owner = owner; }
+  void set_owner(unsigned int owner);
 
   int get_flag_index() { return flag; }
   void set_flag_index(int flag_index) { flag = flag_index; }
@@ -75,10 +93,9 @@ class Inventory : public GameObject {
 
   Inventory::Mode get_res_mode() { return (Inventory::Mode)(res_dir & 3); }
   void set_res_mode(Inventory::Mode mode) { res_dir = (res_dir & 0xFC) | mode; }
-  Inventory::Mode get_serf_mode() {
+  Inventory::Mode get_serf_mode() const {
     return (Inventory::Mode)((res_dir >> 2) & 3); }
-  void set_serf_mode(Inventory::Mode mode) {
-    res_dir = (res_dir & 0xF3) | (mode << 2); }
+  void set_serf_mode(Inventory::Mode mode);
   bool have_any_out_mode() { return ((res_dir & 0x0A) != 0); }
 
   int get_serf_queue_length() { return serfs_out; }
@@ -89,7 +106,7 @@ class Inventory : public GameObject {
   Serf *call_internal(Serf::Type type);
   void serf_come_back() { generic_count++; }
   size_t free_serf_count() { return generic_count; }
-  bool have_serf(Serf::Type type) { return (serfs[type] != 0); }
+  bool have_serf(Serf::Type type) { return (get_serf(type) != 0); }
 
   unsigned int get_count_of(Resource::Type resource) {
     return resources[resource]; }  // keep getting exception where when AI castle is destroyed and AI makes this call DESPITE *inventory STILL BEING VALID!
@@ -129,12 +146,22 @@ class Inventory : public GameObject {
   void serf_idle_in_stock(Serf *serf);
   void knight_training(Serf *serf, int p);
 
+  // idle serfs may only sleep while they stay in (mode in or stop), right
+  //  after they set themselves in serfs
+  bool can_serf_sleep(Serf *serf) const;
+  void serf_fell_asleep(Serf *serf);
+  void serf_woke(Serf *serf);
+
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Inventory &inventory);
   friend SaveReaderText&
     operator >> (SaveReaderText &reader, Inventory &inventory);
   friend SaveWriterText&
     operator << (SaveWriterText &writer, Inventory &inventory);
+
+  // fold the fields that change as the game runs into a state hash, see
+  //  Game::get_state_hash
+  void add_state_hash(StateHash *hash) const;
 };
 
 #endif  // SRC_INVENTORY_H_
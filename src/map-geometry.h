@@ -354,4 +354,97 @@ class MapGeometry {
   }
 };
 
+// MapGeometry with the size fixed at compile time.  Same interface, but
+//  the masks, shift and direction offsets are constants, so in a loop
+//  compiled with one of these the neighbour computations fold into
+//  immediates instead of being loaded from the MapGeometry each time.
+//  Only for hot loops, see with_map_geometry() below.
+template<unsigned int Size>
+class FixedMapGeometry {
+ public:
+  static constexpr unsigned int col_size_ = 5 + Size / 2;
+  static constexpr unsigned int row_size_ = 5 + (Size - 1) / 2;
+  static constexpr unsigned int cols_ = 1 << col_size_;
+  static constexpr unsigned int rows_ = 1 << row_size_;
+  static constexpr unsigned int col_mask_ = cols_ - 1;
+  static constexpr unsigned int row_mask_ = rows_ - 1;
+  static constexpr unsigned int row_shift_ = col_size_;
+
+  // same offsets MapGeometry::init sets up
+  static constexpr MapPos dirs[6] = {
+    1,                                           // DirectionRight
+    1 | (1 << row_shift_),                       // DirectionDownRight
+    1 << row_shift_,                             // DirectionDown
+    col_mask_,                                   // DirectionLeft
+    col_mask_ | (row_mask_ << row_shift_),       // DirectionUpLeft
+    row_mask_ << row_shift_                      // DirectionUp
+  };
+
+  unsigned int size() const { return Size; }
+  unsigned int cols() const { return cols_; }
+  unsigned int rows() const { return rows_; }
+  unsigned int col_mask() const { return col_mask_; }
+  unsigned int row_mask() const { return row_mask_; }
+  unsigned int row_shift() const { return row_shift_; }
+  unsigned int tile_count() const { return cols_ * rows_; }
+
+  int pos_col(int pos) const { return (pos & col_mask_); }
+  int pos_row(int pos) const { return ((pos >> row_shift_) & row_mask_); }
+
+  MapPos pos(int x, int y) const { return ((y << row_shift_) | x); }
+
+  MapPos pos_add(MapPos pos_, int x, int y) const {
+    return pos((pos_col(pos_) + x) & col_mask_,
+               (pos_row(pos_) + y) & row_mask_); }
+  MapPos pos_add(MapPos pos_, MapPos off) const {
+    return pos((pos_col(pos_) + pos_col(off)) & col_mask_,
+               (pos_row(pos_) + pos_row(off)) & row_mask_); }
+
+  int dist_x(MapPos pos1, MapPos pos2) const {
+    return cols_/2 - ((cols_/2 + pos_col(pos1) - pos_col(pos2)) & col_mask_);
+  }
+  int dist_y(MapPos pos1, MapPos pos2) const {
+    return rows_/2 - ((rows_/2 + pos_row(pos1) - pos_row(pos2)) & row_mask_);
+  }
+
+  MapPos move(MapPos pos, Direction dir) const {
+    return pos_add(pos, dirs[dir]); }
+
+  MapPos move_right(MapPos pos) const { return move(pos, DirectionRight); }
+  MapPos move_down_right(MapPos pos) const {
+    return move(pos, DirectionDownRight); }
+  MapPos move_down(MapPos pos) const { return move(pos, DirectionDown); }
+  MapPos move_left(MapPos pos) const { return move(pos, DirectionLeft); }
+  MapPos move_up_left(MapPos pos) const { return move(pos, DirectionUpLeft); }
+  MapPos move_up(MapPos pos) const { return move(pos, DirectionUp); }
+
+  MapPos move_right_n(MapPos pos, int n) const {
+    return pos_add(pos, dirs[DirectionRight]*n); }
+  MapPos move_down_n(MapPos pos, int n) const {
+    return pos_add(pos, dirs[DirectionDown]*n); }
+};
+
+template<unsigned int Size>
+constexpr MapPos FixedMapGeometry<Size>::dirs[6];
+
+// Run f with the FixedMapGeometry matching geom, f must be a generic
+//  lambda (or functor) taking the geometry as "const auto &", it is
+//  compiled once for every size.  Sizes 3-10 are the ones a game can be
+//  started with, anything else gets the plain MapGeometry.
+template<class F>
+void
+with_map_geometry(const MapGeometry &geom, F f) {
+  switch (geom.size()) {
+    case 3: f(FixedMapGeometry<3>()); break;
+    case 4: f(FixedMapGeometry<4>()); break;
+    case 5: f(FixedMapGeometry<5>()); break;
+    case 6: f(FixedMapGeometry<6>()); break;
+    case 7: f(FixedMapGeometry<7>()); break;
+    case 8: f(FixedMapGeometry<8>()); break;
+    case 9: f(FixedMapGeometry<9>()); break;
+    case 10: f(FixedMapGeometry<10>()); break;
+    default: f(geom); break;
+  }
+}
+
 #endif  // SRC_MAP_GEOMETRY_H_
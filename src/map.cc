@@ -70,9 +70,17 @@
 
 #include "src/debug.h"
 #include "src/savegame.h"
+#include "src/state-hash.h"
 #include "src/map-generator.h"
 #include "src/map-geometry.h"
 #include "src/game-options.h"
+#include "src/walk-clusters.h"
+#include "src/build-sites.h"
+#include "src/task-pool.h"
+
+// set while a stripe of Map::update_parallel runs on this thread, set_object
+//  collects the changed positions here instead of calling the handlers
+static thread_local std::vector<MapPos> *deferred_object_changes = nullptr;
 
 /* Facilitates quick lookup of offsets following a spiral pattern in the map data.
  The columns following the second are filled out by setup_spiral_pattern(). */
@@ -718,8 +726,15 @@ Map::Map(const MapGeometry& geom)
     throw ExceptionFreeserf("Failed to create map with size less than 3.");
   }
 
-  landscape_tiles.resize(geom_.tile_count());
-  game_tiles.resize(geom_.tile_count());
+  tile_height.resize(geom_.tile_count());
+  tile_types.resize(geom_.tile_count());
+  tile_obj.resize(geom_.tile_count());
+  tile_mineral.resize(geom_.tile_count());
+  tile_resource.resize(geom_.tile_count());
+  tile_serf.resize(geom_.tile_count());
+  tile_obj_index.resize(geom_.tile_count());
+  tile_paths.resize(geom_.tile_count());
+  tile_owner.resize(geom_.tile_count());
 
   update_state.last_tick = 0;
   update_state.counter = 0;
@@ -735,6 +750,15 @@ Map::Map(const MapGeometry& geom)
   init_spiral_pos_pattern();
   init_extended_spiral_pos_pattern();
   init_directional_fill_pos_pattern();
+
+  walk_clusters.reset(new WalkClusters(this));
+  add_change_handler(walk_clusters.get());
+  build_sites.reset(new BuildSites(this));
+  add_change_handler(build_sites.get());
+}
+
+// walk_clusters and build_sites are only complete here
+Map::~Map() {
 }
 
 /* Return a random map position.
@@ -832,13 +856,21 @@ Map::init_directional_fill_pos_pattern() {
 /* Copy tile data from map generator into map tile data. */
 void
 Map::init_tiles(const MapGenerator &generator) {
-  landscape_tiles = generator.get_landscape();
+  const std::vector<LandscapeTile> &landscape = generator.get_landscape();
+  for (MapPos pos_ : geom_) {
+    const LandscapeTile &tile = landscape[pos_];
+    tile_height[pos_] = tile.height;
+    tile_types[pos_] = ((tile.type_up & 0x0f) << 4) | (tile.type_down & 0x0f);
+    tile_obj[pos_] = tile.obj;
+    tile_mineral[pos_] = tile.mineral;
+    tile_resource[pos_] = tile.resource_amount;
+  }
 }
 
 /* Change the height of a map position. */
 void
 Map::set_height(MapPos pos, int height) {
-  landscape_tiles[pos].height = height;
+  tile_height[pos] = height;
 
   /* Mark landscape dirty */
   for (Direction d : cycle_directions_cw()) {
@@ -852,7 +884,7 @@ Map::set_height(MapPos pos, int height) {
 //   placement at game start, https://github.com/tlongstretch/freeserf-with-AI-plus/issues/38
 void
 Map::set_height_no_refresh(MapPos pos, int height) {
-  landscape_tiles[pos].height = height;
+  tile_height[pos] = height;
   // don't Mark landscape dirty, I guess it will be updated on next refresh?
   //  not sure, it might not even matter.  It seems to work fine
 }
@@ -862,10 +894,21 @@ Map::set_height_no_refresh(MapPos pos, int height) {
    building is removed. */
 void
 Map::set_object(MapPos pos, Object obj, int index) {
-  landscape_tiles[pos].obj = obj;
-  if (index >= 0) game_tiles[pos].obj_index = index;
+  tile_obj[pos] = obj;
+  if (index >= 0) tile_obj_index[pos] = tile_index(index);
   //Log::Debug["map"] << "inside set_object, setting pos " << pos << " to object " << obj << ", index " << index;
 
+  // handlers are not thread safe (the viewport is one), update_parallel
+  //  tells them afterwards
+  if (deferred_object_changes != nullptr) {
+    deferred_object_changes->push_back(pos);
+    return;
+  }
+  notify_object_changed(pos);
+}
+
+void
+Map::notify_object_changed(MapPos pos) {
   /* Notify about object change */
   for (Direction d : cycle_directions_cw()) {
     for (Handler *handler : change_handlers) {
@@ -877,33 +920,62 @@ Map::set_object(MapPos pos, Object obj, int index) {
 /* Remove resources from the ground at a map position. */
 void
 Map::remove_ground_deposit(MapPos pos, int amount) {
-  landscape_tiles[pos].resource_amount -= amount;
+  tile_resource[pos] -= amount;
 
-  if (landscape_tiles[pos].resource_amount <= 0) {
+  if (tile_resource[pos] <= 0) {
     /* Also sets the ground deposit type to none. */
-    landscape_tiles[pos].mineral = MineralsNone;
+    tile_mineral[pos] = MineralsNone;
   }
 }
 
 /* Remove fish at a map position (must be water). */
 void
 Map::remove_fish(MapPos pos, int amount) {
-  landscape_tiles[pos].resource_amount -= amount;
+  tile_resource[pos] -= amount;
 }
 
 /* Set the index of the serf occupying map position. */
 void
 Map::set_serf_index(MapPos pos, int index) {
-  game_tiles[pos].serf = index;
+  tile_serf[pos] = tile_index(index);
 
   /* TODO Mark dirty in viewport. */
 }
 
+// is_in_water and types_within on the geometry Map::update runs with
+template<class G> bool
+Map::is_in_water(const G &geom, MapPos pos) const {
+  return (is_water_tile(pos) &&
+          is_water_tile(geom.move_up_left(pos)) &&
+          type_down(geom.move_left(pos)) <= TerrainWater3 &&
+          type_up(geom.move_up(pos)) <= TerrainWater3);
+}
+
+template<class G> bool
+Map::types_within(const G &geom, MapPos pos, Terrain low, Terrain high) const {
+  if ((type_up(pos) >= low &&
+       type_up(pos) <= high) &&
+      (type_down(pos) >= low &&
+       type_down(pos) <= high) &&
+      (type_down(geom.move_left(pos)) >= low &&
+       type_down(geom.move_left(pos)) <= high) &&
+      (type_up(geom.move_up_left(pos)) >= low &&
+       type_up(geom.move_up_left(pos)) <= high) &&
+      (type_down(geom.move_up_left(pos)) >= low &&
+       type_down(geom.move_up_left(pos)) <= high) &&
+      (type_up(geom.move_up(pos)) >= low &&
+       type_up(geom.move_up(pos)) <= high)) {
+    return true;
+  }
+
+  return false;
+}
+
 /* Update public parts of the map data. */
 // any individual pos is only updated about every 20k ticks
 // every 20 ticks a new pos is updated (i.e. this function is called)
 void
-Map::update_public(MapPos pos, Random *rnd) {
+Map::update_public(MapPos pos, Random *rnd, bool remove_signs) {
 
   /* Update other map objects */
   int r;
@@ -1028,7 +1100,7 @@ Map::update_public(MapPos pos, Random *rnd) {
   case ObjectSignLargeCoal: case ObjectSignSmallCoal:
   case ObjectSignLargeStone: case ObjectSignSmallStone:
   case ObjectSignEmpty:
-    if (update_state.remove_signs_counter == 0) {
+    if (remove_signs) {
       set_object(pos, ObjectNone, -1);
     }
     break;
@@ -1053,10 +1125,10 @@ Map::update_public(MapPos pos, Random *rnd) {
 //   reasonable chance of success, changing approach to allow spawning 
 //   much more fish initially as part of mapgen, adding option_FishSpawnSlowly
 //   to make this optional
-void
-Map::update_hidden(MapPos pos, Random *rnd) {
+template<class G> void
+Map::update_hidden(const G &geom, MapPos pos, Random *rnd) {
   /* Update fish resources in water */
-  if (is_in_water(pos) && landscape_tiles[pos].resource_amount > 0) {
+  if (is_in_water(geom, pos) && tile_resource[pos] > 0) {
 
     int r = rnd->random();
 
@@ -1068,34 +1140,34 @@ Map::update_hidden(MapPos pos, Random *rnd) {
       // don't even consider spawning
     }else{
       // execute normal spawn chance roll
-      if (landscape_tiles[pos].resource_amount < 10 && (r & 0x3f00)) {
+      if (tile_resource[pos] < 10 && (r & 0x3f00)) {
         /* Spawn more fish. */
         //Log::Debug["map"] << "inside update_hidden, spawning a new fish";
-        landscape_tiles[pos].resource_amount += 1;
+        tile_resource[pos] += 1;
       }
     }
 
     /* Move in a random direction of: right, down right, left, up left */
     MapPos adj_pos = pos;
     switch ((r >> 2) & 3) {
-      case 0: adj_pos = move_right(adj_pos); break;
-      case 1: adj_pos = move_down_right(adj_pos); break;
-      case 2: adj_pos = move_left(adj_pos); break;
-      case 3: adj_pos = move_up_left(adj_pos); break;
+      case 0: adj_pos = geom.move_right(adj_pos); break;
+      case 1: adj_pos = geom.move_down_right(adj_pos); break;
+      case 2: adj_pos = geom.move_left(adj_pos); break;
+      case 3: adj_pos = geom.move_up_left(adj_pos); break;
       default: NOT_REACHED(); break;
     }
 
-    if (is_in_water(adj_pos)) {
+    if (is_in_water(geom, adj_pos)) {
       /* Migrate a fish to adjacent water space. */
-      landscape_tiles[pos].resource_amount -= 1;
-      landscape_tiles[adj_pos].resource_amount += 1;
+      tile_resource[pos] -= 1;
+      tile_resource[adj_pos] += 1;
     }
   }
 }
 
 // added features
-void
-Map::update_environment(MapPos pos, Random *rnd) { 
+template<class G> void
+Map::update_environment(const G &geom, MapPos pos, Random *rnd) {
   //Log::Debug["map"] << "inside Map::update_environment()";
   //
   // new baby trees spontaneously grow if a mature trees of same type nearby
@@ -1139,7 +1211,7 @@ Map::update_environment(MapPos pos, Random *rnd) {
     // this should be a random pos spirally, a function that I don't think exists yet, or might only exist in AI functions
     //  could use a lazy trick such as rand (hah not really random!) chance of actually trying each spot
     //  or could write new function to make it random, or pick a random direction and travel outwards instead of spirally
-    MapPos p = pos_add_spirally(pos, i);
+    MapPos p = geom.pos_add(pos, spiral_pos_pattern[i]);
     //Log::Debug["map"] << "inside Map::update_environment(), random pos " << pos << ", considering spirally pos " << p;
     // I was thinking I could re-use the Forester/ranger tree-placement rules here, but I don't understand them
     //  instead, using my own rules
@@ -1152,7 +1224,7 @@ Map::update_environment(MapPos pos, Random *rnd) {
     //  when it is done, allow Pines to grow on mountains!
     //if ( map_types_within(pos, Map::TerrainGrass0, Map::TerrainGrass3) && newtype == Map::ObjectNewTree)
     //  || map_types_within(pos, Map::TerrainGrass0, Map::TerrainGrass3)
-    if (types_within(p, Map::TerrainGrass0, Map::TerrainGrass3)){
+    if (types_within(geom, p, Map::TerrainGrass0, Map::TerrainGrass3)){
       //Log::Debug["map"] << "option_TreesReproduce is on, placing a baby tree of type " << NameObject[newtype] << ", at pos " << p << ", which is near parent tree pos " << pos;
       set_object(p, newtype, 0);
       return;
@@ -1186,30 +1258,118 @@ Map::update(unsigned int tick, Random *rnd) {
   }
 
   MapPos pos = update_state.initial_pos;
+  bool parallel = option_ParallelMapUpdate;
+  std::vector<UpdateVisit> visits;
+
+  // step with constant masks for this map size, see with_map_geometry
+  with_map_geometry(geom_, [&](const auto &geom) {
+    for (int i = 0; i < iters; i++) {
+      update_state.remove_signs_counter -= 1;
+      if (update_state.remove_signs_counter < 0) {
+        update_state.remove_signs_counter = 16;
+      }
+
+      /* Test if moving 23 positions right crosses map boundary. */
+      if (geom.pos_col(pos) + 23 < static_cast<int>(geom.cols())) {
+        pos = geom.move_right_n(pos, 23);
+      } else {
+        pos = geom.move_right_n(pos, 23);
+        pos = geom.move_down(pos);
+      }
+
+      //Log::Debug["map"] << "inside Map::update, about to call update_xxxx on pos " << pos << ", tick " << tick;
 
-  for (int i = 0; i < iters; i++) {
-    update_state.remove_signs_counter -= 1;
-    if (update_state.remove_signs_counter < 0) {
-      update_state.remove_signs_counter = 16;
+      bool remove_signs = (update_state.remove_signs_counter == 0);
+      if (parallel) {
+        visits.push_back(UpdateVisit(pos, remove_signs));
+        continue;
+      }
+
+      /* Update map at position. */
+      update_hidden(geom, pos, rnd);  // this is happening way too often, it only affects fish and too many fish are spawning
+      update_public(pos, rnd, remove_signs);
+      update_environment(geom, pos, rnd);
     }
+  });
 
-    /* Test if moving 23 positions right crosses map boundary. */
-    if (pos_col(pos) + 23 < static_cast<int>(geom_.cols())) {
-      pos = move_right_n(pos, 23);
-    } else {
-      pos = move_right_n(pos, 23);
-      pos = move_down(pos);
+  update_state.initial_pos = pos;
+
+  if (!visits.empty()) {
+    update_parallel(visits, rnd);
+  }
+}
+
+// option_ParallelMapUpdate
+//  Same visits as the serial loop, but split by column into vertical stripes
+//   of update_stripe_cols.  A visit reads at most 5 tiles away (the baby
+//   tree spiral plus types_within) and writes at most 4 away, so stripes
+//   two apart never touch the same tiles.  All even stripes run at once,
+//   then all odd ones, and inside a stripe the visits keep their order.
+//  Each stripe draws from its own Random, seeded from three draws of the
+//   game's one, and object change notifications are collected per stripe
+//   and sent afterwards in stripe order.  That makes the result the same
+//   for any thread count, but not the same as the serial loop (different
+//   draws, and neighbouring stripes see each other's changes in another
+//   order) which is why this is a game option stored in replays
+void
+Map::update_parallel(const std::vector<UpdateVisit> &visits, Random *rnd) {
+  unsigned int stripes = geom_.cols() / update_stripe_cols;
+  if (stripes < 2 || stripes % 2 != 0) {
+    // too narrow to alternate, one stripe is still deterministic
+    stripes = 1;
+  }
+
+  std::vector<std::vector<UpdateVisit>> work(stripes);
+  for (const UpdateVisit &visit : visits) {
+    unsigned int stripe = (stripes == 1) ? 0 :
+      geom_.pos_col(visit.first) / update_stripe_cols;
+    work[stripe].push_back(visit);
+  }
+
+  uint16_t base_0 = rnd->random();
+  uint16_t base_1 = rnd->random();
+  uint16_t base_2 = rnd->random();
+  std::vector<Random> stripe_rnd;
+  for (unsigned int s = 0; s < stripes; s++) {
+    // state[2] must not be 0 or the generator gets stuck
+    Random stripe_random(base_0 + s * 0x9e37, base_1 ^ (s * 0x7f4b),
+                         (base_2 ^ s) | 1);
+    for (int i = 0; i < 3; i++) {
+      stripe_random.random();
     }
+    stripe_rnd.push_back(stripe_random);
+  }
 
-    //Log::Debug["map"] << "inside Map::update, about to call update_xxxx on pos " << pos << ", tick " << tick;
+  std::vector<std::vector<MapPos>> changes(stripes);
+  auto run_stripe = [&](unsigned int s) {
+    deferred_object_changes = &changes[s];
+    with_map_geometry(geom_, [&](const auto &geom) {
+      for (const UpdateVisit &visit : work[s]) {
+        update_hidden(geom, visit.first, &stripe_rnd[s]);
+        update_public(visit.first, &stripe_rnd[s], visit.second);
+        update_environment(geom, visit.first, &stripe_rnd[s]);
+      }
+    });
+    deferred_object_changes = nullptr;
+  };
 
-    /* Update map at position. */
-    update_hidden(pos, rnd);  // this is happening way too often, it only affects fish and too many fish are spawning
-    update_public(pos, rnd);
-    update_environment(pos, rnd);
+  TaskPool &pool = TaskPool::get_instance();
+  for (unsigned int phase = 0; phase < 2; phase++) {
+    unsigned int count = (stripes + 1 - phase) / 2;
+    if (visits.size() < update_parallel_min_visits) {
+      for (unsigned int i = 0; i < count; i++) {
+        run_stripe(phase + 2 * i);
+      }
+    } else {
+      pool.run(count, [&](unsigned int i) { run_stripe(phase + 2 * i); });
+    }
   }
 
-  update_state.initial_pos = pos;
+  for (const std::vector<MapPos> &stripe_changes : changes) {
+    for (MapPos pos : stripe_changes) {
+      notify_object_changed(pos);
+    }
+  }
 }
 
 // work in progress, used for pathfinder_freewalking_serf
@@ -1321,8 +1481,8 @@ Map::place_road_segments(const Road &road) {
         Direction rev_dir = *it;
         Direction dir = reverse_direction(rev_dir);
 
-        game_tiles[pos_].paths &= ~BIT(dir);
-        game_tiles[move(pos_, dir)].paths &= ~BIT(rev_dir);
+        tile_paths[pos_] &= ~BIT(dir);
+        tile_paths[move(pos_, dir)] &= ~BIT(rev_dir);
 
         pos_ = move(pos_, dir);
       }
@@ -1330,8 +1490,8 @@ Map::place_road_segments(const Road &road) {
       return false;
     }
 
-    game_tiles[pos_].paths |= BIT(*it);
-    game_tiles[move(pos_, *it)].paths |= BIT(rev_dir);
+    tile_paths[pos_] |= BIT(*it);
+    tile_paths[move(pos_, *it)] |= BIT(rev_dir);
 
     pos_ = move(pos_, *it);
   }
@@ -1345,7 +1505,7 @@ Map::remove_road_backref_until_flag(MapPos pos_, Direction dir) {
     pos_ = move(pos_, dir);
 
     /* Clear backreference */
-    game_tiles[pos_].paths &= ~BIT(reverse_direction(dir));
+    tile_paths[pos_] &= ~BIT(reverse_direction(dir));
 
     if (get_obj(pos_) == ObjectFlag) break;
 
@@ -1399,11 +1559,11 @@ Map::remove_road_backrefs(MapPos pos_) {
 Direction
 Map::remove_road_segment(MapPos *pos, Direction dir) {
   /* Clear forward reference. */
-  game_tiles[*pos].paths &= ~BIT(dir);
+  tile_paths[*pos] &= ~BIT(dir);
   *pos = move(*pos, dir);
 
   /* Clear backreference. */
-  game_tiles[*pos].paths &= ~BIT(reverse_direction(dir));
+  tile_paths[*pos] &= ~BIT(reverse_direction(dir));
 
   /* Find next direction of path. */
   dir = DirectionNone;
@@ -1467,22 +1627,7 @@ Map::del_change_handler(Handler *handler) {
 //  is found, false if any other type found
 bool
 Map::types_within(MapPos pos, Terrain low, Terrain high) {
-  if ((type_up(pos) >= low &&
-       type_up(pos) <= high) &&
-      (type_down(pos) >= low &&
-       type_down(pos) <= high) &&
-      (type_down(move_left(pos)) >= low &&
-       type_down(move_left(pos)) <= high) &&
-      (type_up(move_up_left(pos)) >= low &&
-       type_up(move_up_left(pos)) <= high) &&
-      (type_down(move_up_left(pos)) >= low &&
-       type_down(move_up_left(pos)) <= high) &&
-      (type_up(move_up(pos)) >= low &&
-       type_up(move_up(pos)) <= high)) {
-    return true;
-  }
-
-  return false;
+  return types_within(geom_, pos, low, high);
 }
 
 bool
@@ -1495,16 +1640,15 @@ Map::operator == (const Map& rhs) const {
   }
 
   // Check all tiles
-  for (MapPos pos_ : geom_) {
-    if (this->landscape_tiles[pos_] != rhs.landscape_tiles[pos_]) {
-      return false;
-    }
-    if (this->game_tiles[pos_] != rhs.game_tiles[pos_]) {
-      return false;
-    }
-  }
-
-  return true;
+  return this->tile_height == rhs.tile_height &&
+    this->tile_types == rhs.tile_types &&
+    this->tile_obj == rhs.tile_obj &&
+    this->tile_mineral == rhs.tile_mineral &&
+    this->tile_resource == rhs.tile_resource &&
+    this->tile_serf == rhs.tile_serf &&
+    this->tile_obj_index == rhs.tile_obj_index &&
+    this->tile_paths == rhs.tile_paths &&
+    this->tile_owner == rhs.tile_owner;
 }
 
 bool
@@ -1521,42 +1665,37 @@ operator >> (SaveReaderBinary &reader, Map &map) {
   for (unsigned int y = 0; y < geom.rows(); y++) {
     for (unsigned int x = 0; x < geom.cols(); x++) {
       MapPos pos = map.pos(x, y);
-      Map::GameTile &game_tile = map.game_tiles[pos];
-      Map::LandscapeTile &landscape_tile = map.landscape_tiles[pos];
       reader >> v8;
-      game_tile.paths = v8 & 0x3f;
+      map.tile_paths[pos] = v8 & 0x3f;  // idle_serf = 0
       reader >> v8;
-      landscape_tile.height = v8 & 0x1f;
+      map.tile_height[pos] = v8 & 0x1f;
       if ((v8 >> 7) == 0x01) {
-        game_tile.owner = ((v8 >> 5) & 0x03) + 1;
+        map.tile_owner[pos] = ((v8 >> 5) & 0x03) + 1;
       }
       reader >> v8;
-      landscape_tile.type_up = (Map::Terrain)((v8 >> 4) & 0x0f);
-      landscape_tile.type_down = (Map::Terrain)(v8 & 0x0f);
+      map.tile_types[pos] = v8;  // type_up high, type_down low, same packing
       reader >> v8;
-      landscape_tile.obj = (Map::Object)(v8 & 0x7f);
-      game_tile.idle_serf = 0;  // (BIT_TEST(v8, 7) != 0);
+      map.tile_obj[pos] = (v8 & 0x7f);
+      // idle serf (BIT_TEST(v8, 7) != 0) is ignored
     }
     for (unsigned int x = 0; x < geom.cols(); x++) {
       MapPos pos = map.pos(x, y);
-      Map::GameTile &game_tile = map.game_tiles[pos];
-      Map::LandscapeTile &landscape_tile = map.landscape_tiles[pos];
       if (map.get_obj(pos) >= Map::ObjectFlag &&
           map.get_obj(pos) <= Map::ObjectCastle) {
-        landscape_tile.mineral = Map::MineralsNone;
-        landscape_tile.resource_amount = 0;
+        map.tile_mineral[pos] = Map::MineralsNone;
+        map.tile_resource[pos] = 0;
         reader >> v16;
-        game_tile.obj_index = v16;
+        map.tile_obj_index[pos] = v16;
       } else {
         reader >> v8;
-        landscape_tile.mineral = (Map::Minerals)((v8 >> 5) & 7);
-        landscape_tile.resource_amount = v8 & 0x1f;
+        map.tile_mineral[pos] = (v8 >> 5) & 7;
+        map.tile_resource[pos] = v8 & 0x1f;
         reader >> v8;
-        game_tile.obj_index = 0;
+        map.tile_obj_index[pos] = 0;
       }
 
       reader >> v16;
-      game_tile.serf = v16;
+      map.tile_serf[pos] = v16;
     }
   }
 
@@ -1585,41 +1724,43 @@ operator >> (SaveReaderText &reader, Map &map) {
   for (int y = 0; y < SAVE_MAP_TILE_SIZE; y++) {
     for (int x = 0; x < SAVE_MAP_TILE_SIZE; x++) {
       MapPos p = map.pos_add(pos, map.pos(x, y));
-      Map::GameTile &game_tile = map.game_tiles[p];
-      Map::LandscapeTile &landscape_tile = map.landscape_tiles[p];
       unsigned int val;
 
       reader.value("paths")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      game_tile.paths = val & 0x3f;
+      map.tile_paths[p] = val & 0x3f;
 
       reader.value("height")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      landscape_tile.height = val & 0x1f;
+      map.tile_height[p] = val & 0x1f;
 
       reader.value("type.up")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      landscape_tile.type_up = (Map::Terrain)val;
+      unsigned int type_up = val & 0x0f;
 
       reader.value("type.down")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      landscape_tile.type_down = (Map::Terrain)val;
+      map.tile_types[p] = (type_up << 4) | (val & 0x0f);
 
+      bool idle_serf;
       try {
         reader.value("idle_serf")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-        game_tile.idle_serf = (val != 0);
+        idle_serf = (val != 0);
         reader.value("object")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-        landscape_tile.obj = (Map::Object)val;
+        map.tile_obj[p] = val;
       } catch (...) {
         reader.value("object")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-        landscape_tile.obj = (Map::Object)(val & 0x7f);
-        game_tile.idle_serf = (BIT_TEST(val, 7) != 0);
+        map.tile_obj[p] = (val & 0x7f);
+        idle_serf = (BIT_TEST(val, 7) != 0);
+      }
+      if (idle_serf) {
+        map.set_idle_serf(p);
       }
 
       reader.value("serf")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      game_tile.serf = val;
+      map.tile_serf[p] = Map::tile_index(val);
 
       reader.value("resource.type")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      landscape_tile.mineral = (Map::Minerals)val;
+      map.tile_mineral[p] = val;
 
       reader.value("resource.amount")[y*SAVE_MAP_TILE_SIZE+x] >> val;
-      landscape_tile.resource_amount = val;
+      map.tile_resource[p] = static_cast<int>(val);
     }
   }
 
@@ -1737,3 +1878,25 @@ Road::undo() {
   return true;
 }
 
+void
+Map::add_state_hash(StateHash *hash) const {
+  hash->add(geom_.cols());
+  hash->add(geom_.rows());
+  hash->add(update_state.remove_signs_counter);
+  hash->add(update_state.last_tick);
+  hash->add(update_state.counter);
+  hash->add(update_state.initial_pos);
+  for (MapPos pos_ : geom_) {
+    hash->add(get_height(pos_));
+    hash->add(type_up(pos_));
+    hash->add(type_down(pos_));
+    hash->add(get_res_type(pos_));
+    hash->add(static_cast<int>(tile_resource[pos_]));
+    hash->add(get_obj(pos_));
+    hash->add(get_serf_index(pos_));
+    hash->add(tile_owner[pos_]);
+    hash->add(get_obj_index(pos_));
+    hash->add(paths(pos_));
+    hash->add(get_idle_serf(pos_));
+  }
+}
@@ -68,7 +68,10 @@ class Road {
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 class MapGenerator;
+class WalkClusters;
+class BuildSites;
 
 // Map data.
 //
@@ -346,50 +349,58 @@ class Map {
   };
 
  protected:
-  typedef struct GameTile {
-    unsigned int serf;
-    unsigned int owner;  // I believe this is only used to store values -1 (i.e. INTEGER_MAX) for unowned, or 0-3 for Player0 through Player3.
-                         //   Hijacking higher values for option_FogOfWar for various FoW reveal states
-                         // NOTE the *actual* in-memory values of game_tile[#].owner are 0-4 (unowned through Player3) but they
-                         //  are "minus one" when the getter and setter are used, so they fake being values -1 through 3
-                         //  so to avoid stepping on this, skip the 3rd-least-significant bit when it comes to bit-testing for FogOfWar "owner"
-                         //
-                         //    FAKE VALUES as seen by get/set_owner functions
-                         // 11111111 11111111 11111111 11111111 unowned, -1
-                         // 00000000 00000000 00000000 00000000 Player0
-                         // 00000000 00000000 00000000 00000001 Player1
-                         // 00000000 00000000 00000000 00000010 Player2
-                         // 00000000 00000000 00000000 00000011 Player3
-                         //
-                         //    REAL VALUES stored in game_tiles[#].owner variable 
-                         // 00000000 00000000 00000000 00000000 unowned
-                         // 00000000 00000000 00000000 00000001 Player0
-                         // 00000000 00000000 00000000 00000010 Player1
-                         // 00000000 00000000 00000000 00000011 Player2
-                         // 00000000 00000000 00000000 00000100 Player3
-                         // 00000000 00000000 00000xxx xxxx1xxx revealed by Player0
-                         // 00000000 00000000 00000xxx xxx1xxxx  visible by Player0
-                         // 00000000 00000000 00000xxx xx1xxxxx revealed by Player1
-                         //                   ... and so on...
-                         // 00000000 00000000 000001xx xxxxxxxx  visible by Player3
-    unsigned int obj_index;
-    uint8_t paths;
-    bool idle_serf;
-
-    bool operator == (const GameTile& rhs) const {
-      return this->paths == rhs.paths &&
-        this->serf == rhs.serf &&
-        this->owner == rhs.owner &&
-        this->idle_serf == rhs.idle_serf &&
-        this->obj_index == rhs.obj_index;
-    }
-    bool operator != (const GameTile& rhs) const {
-      return !(*this == rhs); }
-  } GameTile;
-
+  // Tile data is kept as packed per-field arrays (structure-of-arrays)
+  //  instead of one struct per tile.  A size 10 map has over a million
+  //  tiles, the old LandscapeTile + GameTile structs were ~44 bytes each,
+  //  these are 13, and a loop that only looks at objects or owners (the
+  //  viewport, Map::update, AI spiral scans) only pulls that array into
+  //  the cache.  The accessors below are the only way in, so none of the
+  //  packing shows outside of Map.
+  //  LandscapeTile is still what the map generator hands over, it is
+  //  unpacked into these by init_tiles
   MapGeometry geom_;
-  std::vector<LandscapeTile> landscape_tiles;
-  std::vector<GameTile> game_tiles;
+  std::vector<uint8_t> tile_height;
+  std::vector<uint8_t> tile_types;  // type_up in the high 4 bits, type_down in the low 4 (like the original save)
+  std::vector<uint8_t> tile_obj;
+  std::vector<uint8_t> tile_mineral;
+  std::vector<int16_t> tile_resource;  // can go below zero when fish/deposits are used up
+  std::vector<uint16_t> tile_serf;
+  std::vector<uint16_t> tile_obj_index;
+  std::vector<uint8_t> tile_paths;  // paths in the low 6 bits, idle serf in bit 7
+  // owner: I believe this is only used to store values -1 (i.e. INTEGER_MAX) for unowned, or 0-3 for Player0 through Player3.
+  //   Hijacking higher values for option_FogOfWar for various FoW reveal states
+  // NOTE the *actual* in-memory values of tile_owner[#] are 0-4 (unowned through Player3) but they
+  //  are "minus one" when the getter and setter are used, so they fake being values -1 through 3
+  //  so to avoid stepping on this, skip the 3rd-least-significant bit when it comes to bit-testing for FogOfWar "owner"
+  //
+  //    FAKE VALUES as seen by get/set_owner functions
+  // 11111111 11111111 11111111 11111111 unowned, -1
+  // 00000000 00000000 00000000 00000000 Player0
+  // 00000000 00000000 00000000 00000001 Player1
+  // 00000000 00000000 00000000 00000010 Player2
+  // 00000000 00000000 00000000 00000011 Player3
+  //
+  //    REAL VALUES stored in tile_owner[#] variable
+  // 00000000 00000000 00000000 00000000 unowned
+  // 00000000 00000000 00000000 00000001 Player0
+  // 00000000 00000000 00000000 00000010 Player1
+  // 00000000 00000000 00000000 00000011 Player2
+  // 00000000 00000000 00000000 00000100 Player3
+  // 00000000 00000000 00000xxx xxxx1xxx revealed by Player0
+  // 00000000 00000000 00000xxx xxx1xxxx  visible by Player0
+  // 00000000 00000000 00000xxx xx1xxxxx revealed by Player1
+  //                   ... and so on...
+  // 00000000 00000000 000001xx xxxxxxxx  visible by Player3
+  std::vector<uint16_t> tile_owner;
+
+  // serf and flag/building indexes are stored in 16 bits, same as the
+  //  original save format
+  static uint16_t tile_index(unsigned int index) {
+    if (index > 0xffff) {
+      throw ExceptionFreeserf("Map tile index out of range, more than 65535 serfs/flags/buildings?");
+    }
+    return static_cast<uint16_t>(index);
+  }
 
   uint16_t regions;
 
@@ -403,10 +414,16 @@ class Map {
   std::unique_ptr<MapPos[]> extended_spiral_pos_pattern;
   std::unique_ptr<MapPos[]> directional_fill_pos_pattern;
 
+  // for pathfinder_freewalking_serf, kept current as a change handler
+  std::unique_ptr<WalkClusters> walk_clusters;
+  // for Game::can_build_large and can_build_military, also a change handler
+  std::unique_ptr<BuildSites> build_sites;
+
 
  public:
 
   explicit Map(const MapGeometry& geom);
+  ~Map();
 
   const MapGeometry& geom() const { return geom_; }
 
@@ -451,6 +468,22 @@ class Map {
     return pos_add(pos_, extended_spiral_pos_pattern[off]);
   }
 
+  // call f(pos) for the first count positions of the extended spiral
+  //  around center, same order as pos_add_extended_spirally(center, i)
+  //  for i = 0..count-1 but with the geometry constant for the map size
+  template<class F> void for_each_extended_spiral(MapPos center, unsigned int count, F f) const {
+    if (count > 13445) {
+      Log::Error["map"] << "cannot use for_each_extended_spiral() beyond 13445 positions (~48 shells)";
+      throw ExceptionFreeserf("cannot use for_each_extended_spiral() beyond 13445 positions (~48 shells)");
+    }
+    const MapPos *pattern = extended_spiral_pos_pattern.get();
+    with_map_geometry(geom_, [&](const auto &geom) {
+      for (unsigned int i = 0; i < count; i++) {
+        f(geom.pos_add(center, pattern[i]));
+      }
+    });
+  }
+
   MapPos pos_add_directional_fill(MapPos pos_, unsigned int off, int dir) const {
     int dir_offset = 52 * dir;
     return pos_add(pos_, directional_fill_pos_pattern[off+dir_offset]);
@@ -490,13 +523,13 @@ class Map {
 
   /* Extractors for map data. */
   unsigned int paths(MapPos pos) const {
-    return (game_tiles[pos].paths & 0x3f); }
+    return (tile_paths[pos] & 0x3f); }
 // NOTE - because buildings have paths UpLeft/Dir4 into them
 //  this check returns true even if it is not a "road path" like you might
 //  be expecting, if you only care about roads use has_path_IMPROVED which
 //  ignores paths UpLeft/Dir4 into Buildings
   bool has_path(MapPos pos, Direction dir) const {
-    return (BIT_TEST(game_tiles[pos].paths, dir) != 0); }
+    return (BIT_TEST(tile_paths[pos], dir) != 0); }
   // improved function used only for new/AI functions that includes the UpLeft building check
   bool has_path_IMPROVED(MapPos pos, Direction dir) const {
     if (dir == DirectionUpLeft && has_building(move_up_left(pos))){
@@ -517,135 +550,125 @@ class Map {
     }
     return false;
   }
-  void add_path(MapPos pos, Direction dir) { game_tiles[pos].paths |= BIT(dir); }
-  void del_path(MapPos pos, Direction dir) { game_tiles[pos].paths &= ~BIT(dir); }
+  void add_path(MapPos pos, Direction dir) { tile_paths[pos] |= BIT(dir); }
+  void del_path(MapPos pos, Direction dir) { tile_paths[pos] &= ~BIT(dir); }
 
-  //bool has_owner(MapPos pos) const { return (game_tiles[pos].owner != 0); }  // original
-  //bool has_owner(MapPos pos) const { return (game_tiles[pos].owner & 7 != 0); }  // added support for option_FogOfWar
+  //bool has_owner(MapPos pos) const { return (tile_owner[pos] != 0); }  // original
+  //bool has_owner(MapPos pos) const { return (tile_owner[pos] & 7 != 0); }  // added support for option_FogOfWar
   bool has_owner(MapPos pos) const {
-    unsigned int tmp = game_tiles[pos].owner;
+    unsigned int tmp = tile_owner[pos];
     tmp &= 7;
     bool foo = false;
     if (tmp != 0){
       foo = true;
     }
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::has_owner, pos " << pos << " has fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner) << ", returning bool " << foo;  // added support for option_FogOfWar
-    //return (game_tiles[pos].owner & 7 != 0);
+    //Log::Debug["map.h"] << "inside Map::has_owner, pos " << pos << " has fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]) << ", returning bool " << foo;  // added support for option_FogOfWar
+    //return (tile_owner[pos] & 7 != 0);
     return foo;
   } 
-  //unsigned int get_owner(MapPos pos) const { return game_tiles[pos].owner - 1; }  // original
-  //unsigned int get_owner(MapPos pos) const { return (game_tiles[pos].owner & 7) - 1;  // added support for option_FogOfWar
+  //unsigned int get_owner(MapPos pos) const { return tile_owner[pos] - 1; }  // original
+  //unsigned int get_owner(MapPos pos) const { return (tile_owner[pos] & 7) - 1;  // added support for option_FogOfWar
   unsigned int get_owner(MapPos pos) const {
     // seems this is sometimes returning invalid values, saw player #6 (fake player)
-    unsigned int tmp = game_tiles[pos].owner;
+    unsigned int tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::get_owner, pos " << pos << " has fake owner Player" << tmp  << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::get_owner, pos " << pos << " has fake owner Player" << tmp  << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
     return tmp;
   }
-  //void set_owner(MapPos pos, unsigned int _owner) { game_tiles[pos].owner = _owner + 1; }  // original
+  //void set_owner(MapPos pos, unsigned int _owner) { tile_owner[pos] = _owner + 1; }  // original
   void set_owner(MapPos pos, unsigned int _owner) { // added support for option_FogOfWar
-    unsigned int tmp = game_tiles[pos].owner;
+    unsigned int tmp = tile_owner[pos];
     tmp &= 7;
-    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " had fake owner Player" << tmp  << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
-    game_tiles[pos].owner &= -8;  // clear the least-3-bits which hold the Player owner
-    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " applying AND " << std::bitset<11>(-8) << ", interim real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " had fake owner Player" << tmp  << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
+    tile_owner[pos] &= -8;  // clear the least-3-bits which hold the Player owner
+    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " applying AND " << std::bitset<11>(-8) << ", interim real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
     //if (_owner > 3 || _owner == -1){
     //  throw ExceptionFreeserf("_owner Player# >3 or -1 specified to Game::set_owner, invalid");
     //}
-    game_tiles[pos].owner |= _owner + 1;  // set the least-3-bits to Player owner
-    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " applying AND " << std::bitset<11>(-8) << ", interim real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
-    tmp = game_tiles[pos].owner;
+    tile_owner[pos] |= _owner + 1;  // set the least-3-bits to Player owner
+    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " applying AND " << std::bitset<11>(-8) << ", interim real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
+    tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " now has fake owner Player" << tmp  << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::set_owner, pos " << pos << " now has fake owner Player" << tmp  << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
     //Log::Debug["map.h"] << "inside Map::set_owner calling set_visible for pos " << pos << " with fake owner Player" << tmp;
     set_visible(pos, _owner);  // is this actually needed?
   } 
-  //void set_revealed(MapPos pos, unsigned int player) { game_tiles[pos].owner |= BIT(3 + player*2); }   // THIS MIGHT BE BROKEN/WRONG
+  //void set_revealed(MapPos pos, unsigned int player) { tile_owner[pos] |= BIT(3 + player*2); }   // THIS MIGHT BE BROKEN/WRONG
   void set_revealed(MapPos pos, unsigned int player) {
-    unsigned int tmp = game_tiles[pos].owner;
+    unsigned int tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::set_revealed, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
-    game_tiles[pos].owner |= BIT(3 + player*2);
-    tmp = game_tiles[pos].owner;
+    //Log::Debug["map.h"] << "inside Map::set_revealed, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
+    tile_owner[pos] |= BIT(3 + player*2);
+    tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::set_revealed, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::set_revealed, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
   }
   // void is_revealead
   void set_visible(MapPos pos, unsigned int player) {
-    unsigned int tmp = game_tiles[pos].owner;
+    unsigned int tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::set_visible, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
-    game_tiles[pos].owner |= BIT(3 + player*2 + 1);
-    tmp = game_tiles[pos].owner;
+    //Log::Debug["map.h"] << "inside Map::set_visible, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
+    tile_owner[pos] |= BIT(3 + player*2 + 1);
+    tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::set_visible, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::set_visible, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
     //set_revealed(pos, player);  // this should be independently set when setting visible now that revealed area is a bit larger than visible area
   }
   bool is_revealed(MapPos pos, unsigned int player) {
-    //Log::Debug["map.h"] << "inside Map::is_visible, pos " << pos << " has owner " << std::bitset<11>(game_tiles[pos].owner) << ", returning " << BIT_TEST(game_tiles[pos].owner, 3 + player*2);
-    return BIT_TEST(game_tiles[pos].owner, 3 + player*2);
+    //Log::Debug["map.h"] << "inside Map::is_visible, pos " << pos << " has owner " << std::bitset<11>(tile_owner[pos]) << ", returning " << BIT_TEST(tile_owner[pos], 3 + player*2);
+    return BIT_TEST(tile_owner[pos], 3 + player*2);
   } 
   bool is_visible(MapPos pos, unsigned int player) {
-    //Log::Debug["map.h"] << "inside Map::is_visible, pos " << pos << " has owner " << std::bitset<11>(game_tiles[pos].owner) << ", returning " << BIT_TEST(game_tiles[pos].owner, 3 + player*2 + 1);
-    return BIT_TEST(game_tiles[pos].owner, 3 + player*2 + 1);
+    //Log::Debug["map.h"] << "inside Map::is_visible, pos " << pos << " has owner " << std::bitset<11>(tile_owner[pos]) << ", returning " << BIT_TEST(tile_owner[pos], 3 + player*2 + 1);
+    return BIT_TEST(tile_owner[pos], 3 + player*2 + 1);
   } 
   //bool is_visible(MapPos pos, unsigned int player) {
-  //  Log::Debug["map.h"] << "inside Map::is_visible, pos " << pos << " has owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+  //  Log::Debug["map.h"] << "inside Map::is_visible, pos " << pos << " has owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
   //  unsigned int tmp = 3 + player + 1;
-  //  return BIT_TEST(game_tiles[pos].owner, tmp);
+  //  return BIT_TEST(tile_owner[pos], tmp);
   //}
-  /* this might not actually be needed, can always use unset_all_visible?
+  // a player's last building that could see pos is gone, see fog-of-war.h
   void unset_visible(MapPos pos, unsigned int player) {
-    unsigned int tmp = game_tiles[pos].owner;
-    tmp &= 7;
-    tmp--;
-    Log::Debug["map.h"] << "inside Map::unset_visible, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
-    Log::Debug["map.h"] << "inside Map::unset_visible, pos " << pos << " had fake owner Player" << tmp << ", BIT is " << std::bitset<11>(~BIT(3 + player*2 + 1));  // added support for option_FogOfWar
-    game_tiles[pos].owner &= ~BIT(3 + player*2 + 1);
-    tmp = game_tiles[pos].owner;
-    tmp &= 7;
-    tmp--;
-    Log::Debug["map.h"] << "inside Map::unset_visible, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    tile_owner[pos] &= ~BIT(3 + player*2 + 1);
   }
-  */
   void unset_all_visible(MapPos pos) {
     // 10101010000 is 1360
     // inverse is 01010101111 or 687
-    unsigned int tmp = game_tiles[pos].owner;
+    unsigned int tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::unset_all_visible, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::unset_all_visible, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
     //Log::Debug["map.h"] << "inside Map::unset_all_visible, pos " << pos << " had fake owner Player" << tmp << ", BIT is " << std::bitset<11>(687);  // added support for option_FogOfWar
-    game_tiles[pos].owner &= 687;
-    tmp = game_tiles[pos].owner;
+    tile_owner[pos] &= 687;
+    tmp = tile_owner[pos];
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::unset_all_visible, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::unset_all_visible, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
   }
-  //void del_owner(MapPos pos) { game_tiles[pos].owner = 0; } // original
+  //void del_owner(MapPos pos) { tile_owner[pos] = 0; } // original
   void del_owner(MapPos pos) {
-    int tmp = game_tiles[pos].owner;
-    //Log::Debug["map.h"] << "inside Map::del_owner, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    int tmp = tile_owner[pos];
+    //Log::Debug["map.h"] << "inside Map::del_owner, pos " << pos << " had fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
     tmp &= -8;
-    game_tiles[pos].owner = tmp;
+    tile_owner[pos] = tmp;
     tmp &= 7;
     tmp--;
-    //Log::Debug["map.h"] << "inside Map::del_owner, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(game_tiles[pos].owner);  // added support for option_FogOfWar
+    //Log::Debug["map.h"] << "inside Map::del_owner, pos " << pos << " now has fake owner Player" << tmp << ", real owner " << std::bitset<11>(tile_owner[pos]);  // added support for option_FogOfWar
   }   // added support for option_FogOfWar
 
-  unsigned int get_height(MapPos pos) const { return landscape_tiles[pos].height; }
+  unsigned int get_height(MapPos pos) const { return tile_height[pos]; }
 
-  Terrain type_up(MapPos pos) const { return landscape_tiles[pos].type_up; }
-  Terrain type_down(MapPos pos) const { return landscape_tiles[pos].type_down; }
+  Terrain type_up(MapPos pos) const { return (Terrain)(tile_types[pos] >> 4); }
+  Terrain type_down(MapPos pos) const { return (Terrain)(tile_types[pos] & 0x0f); }
 
-  unsigned int get_landscape_tiles_size() const { return landscape_tiles.size(); } // for debugging out of range map pos
+  unsigned int get_landscape_tiles_size() const { return static_cast<unsigned int>(tile_height.size()); } // for debugging out of range map pos
   
   //
   //  DO NOT MESS WITH THIS HERE, INSTEAD CHANGE THE TILES IN Viewport::draw_triangle_up/down
@@ -661,7 +684,7 @@ class Map {
   //  use it when drawing terrain, or find the function that does the drawing
   //  and change it only there instead of here
   Terrain type_up(MapPos pos) const {
-    Terrain type = landscape_tiles[pos].type_up;
+    Terrain type = type_up(pos);
     if (season == 3){
       if (type >= Terrain::TerrainTundra2){  // a bit more snow on mountains
       //if (type >= Terrain::TerrainGrass0){  // all non water-tiles become snow
@@ -674,7 +697,7 @@ class Map {
     }
   }
   Terrain type_down(MapPos pos) const {
-    Terrain type = landscape_tiles[pos].type_down;
+    Terrain type = type_down(pos);
     if (season == 3){
       if (type >= Terrain::TerrainTundra2){  // a bit more snow on mountains
       //if (type >= Terrain::TerrainGrass0){  // all non water-tiles become snow
@@ -690,23 +713,23 @@ class Map {
   
   bool types_within(MapPos pos, Terrain low, Terrain high);
 
-  Object get_obj(MapPos pos) const { return landscape_tiles[pos].obj; }
-  bool get_idle_serf(MapPos pos) const { return game_tiles[pos].idle_serf; }
-  void set_idle_serf(MapPos pos) { game_tiles[pos].idle_serf = true; }
-  void clear_idle_serf(MapPos pos) { game_tiles[pos].idle_serf = false; }
+  Object get_obj(MapPos pos) const { return (Object)tile_obj[pos]; }
+  bool get_idle_serf(MapPos pos) const { return (BIT_TEST(tile_paths[pos], 7) != 0); }
+  void set_idle_serf(MapPos pos) { tile_paths[pos] |= BIT(7); }
+  void clear_idle_serf(MapPos pos) { tile_paths[pos] &= ~BIT(7); }
 
   unsigned int get_obj_index(MapPos pos) const {
-    return game_tiles[pos].obj_index; }
+    return tile_obj_index[pos]; }
   void set_obj_index(MapPos pos, unsigned int index) {
-    game_tiles[pos].obj_index = index; }
+    tile_obj_index[pos] = tile_index(index); }
   Minerals get_res_type(MapPos pos) const {
-    return landscape_tiles[pos].mineral; }
+    return (Minerals)tile_mineral[pos]; }
   unsigned int get_res_amount(MapPos pos) const {
-    return landscape_tiles[pos].resource_amount; }
+    return tile_resource[pos]; }
   unsigned int get_res_fish(MapPos pos) const { return get_res_amount(pos); }
-  unsigned int get_serf_index(MapPos pos) const { return game_tiles[pos].serf; }
+  unsigned int get_serf_index(MapPos pos) const { return tile_serf[pos]; }
   unsigned int has_serf(MapPos pos) const {
-    return (game_tiles[pos].serf != 0); }
+    return (tile_serf[pos] != 0); }
 
   bool has_flag(MapPos pos) const { return (get_obj(pos) == ObjectFlag); }
   bool has_building(MapPos pos) const { return (get_obj(pos) >=
@@ -861,9 +884,13 @@ class Map {
   bool road_segment_in_water(MapPos pos, Direction dir);
   bool is_road_segment_valid(MapPos pos, Direction dir) const;
   bool can_serf_step_into(MapPos pos) const;
+  WalkClusters *get_walk_clusters() { return walk_clusters.get(); }
+  BuildSites *get_build_sites() { return build_sites.get(); }
 
   bool operator == (const Map& rhs) const;
   bool operator != (const Map& rhs) const;
+  // every tile and the map update state, for Game::get_state_hash
+  void add_state_hash(StateHash *hash) const;
 
   friend SaveReaderBinary&
     operator >> (SaveReaderBinary &reader, Map &map);
@@ -879,9 +906,23 @@ class Map {
   void init_extended_spiral_pos_pattern();
   void init_directional_fill_pos_pattern();
 
-  void update_public(MapPos pos, Random *rnd);
-  void update_hidden(MapPos pos, Random *rnd);
-  void update_environment(MapPos pos, Random *rnd); // tlongstretch new features
+  void update_public(MapPos pos, Random *rnd, bool remove_signs);
+  // these look at neighbours, geom is what Map::update got from
+  //  with_map_geometry.  Only instantiated in map.cc
+  template<class G> void update_hidden(const G &geom, MapPos pos, Random *rnd);
+  template<class G> void update_environment(const G &geom, MapPos pos, Random *rnd); // tlongstretch new features
+  template<class G> bool is_in_water(const G &geom, MapPos pos) const;
+  template<class G> bool types_within(const G &geom, MapPos pos, Terrain low, Terrain high) const;
+
+  // option_ParallelMapUpdate, one visit is a pos and whether signs are
+  //  removed there, see Map::update_parallel
+  typedef std::pair<MapPos, bool> UpdateVisit;
+  // columns per stripe, must stay well above the 5 tiles an update reaches
+  static const unsigned int update_stripe_cols = 16;
+  // below this many visits the stripes are run on the game thread
+  static const size_t update_parallel_min_visits = 256;
+  void update_parallel(const std::vector<UpdateVisit> &visits, Random *rnd);
+  void notify_object_changed(MapPos pos);
 };
 
 typedef std::shared_ptr<Map> PMap;
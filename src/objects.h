@@ -24,9 +24,12 @@
 
 #include <vector>
 #include <algorithm>
+#include <deque>
 #include <list>
 #include <memory>
 #include <limits>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 class Game;
@@ -50,17 +53,50 @@ class GameObject {
   unsigned int get_index() const { return index; }
 };
 
+// Objects are constructed in place in slabs of slab_size slots, index i
+//  always lives in slot i % slab_size of slab i / slab_size.  So walking
+//  the collection in index order (update_serfs, update_flags...) walks
+//  memory in order too, instead of hopping between separate heap blocks
+//  for every object.  Slabs are never given back before the collection
+//  is destroyed, an erased index's slot is simply constructed into again
+//  when the index is reused.
 template<class T, size_t growth>
 class Collection {
  protected:
   typedef std::vector<T*> Objects;
-  typedef std::list<unsigned int> FObjects;
+  // a queue, not a stack: indexes are reused oldest-freed first, the way
+  //  they always were, so replays and savegames see the same indexes
+  typedef std::deque<unsigned int> FObjects;
+
+  static const size_t slab_size = 256;
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+  typedef struct Slab {
+    Slot slots[slab_size];
+  } Slab;
+  // shared so a copy of the collection (which doesn't own the objects,
+  //  see clear) can't outlive the memory its pointers point into
+  typedef std::vector<std::shared_ptr<Slab>> Slabs;
 
   Objects objects;
   unsigned int last_object_index;
   FObjects free_object_indexes;
+  Slabs slabs;
   Game *game;
 
+  T*
+  construct(unsigned int index) {
+    while (slabs.size() * slab_size <= index) {
+      slabs.push_back(std::make_shared<Slab>());
+    }
+    void *slot = &slabs[index / slab_size]->slots[index % slab_size];
+    return new (slot) T(game, index);
+  }
+
+  static void
+  destroy(T *object) {
+    object->~T();
+  }
+
  public:
   Collection() {
     game = NULL;
@@ -71,6 +107,7 @@ class Collection {
     objects = other.objects;
     last_object_index = other.last_object_index;
     free_object_indexes = other.free_object_indexes;
+    slabs = other.slabs;
     game = other.game;
   }
 
@@ -79,16 +116,19 @@ class Collection {
     last_object_index = 0;
   }
 
+  Collection& operator = (const Collection& other) = default;
+
   virtual ~Collection() {
   }
 
   void clear() {
     for (T *&obj : objects) {
       if (obj != nullptr) {
-        delete obj;
+        destroy(obj);
       }
     }
     objects.clear();
+    free_object_indexes.clear();
   }
 
   T*
@@ -106,14 +146,14 @@ class Collection {
     if (!free_object_indexes.empty()) {
       new_index = free_object_indexes.front();
       free_object_indexes.pop_front();
-      new_object = new T(game, new_index);
+      new_object = construct(new_index);
       objects[new_index] = new_object;
     } else {
       new_index = static_cast<unsigned int>(objects.size());
       if (objects.size() == objects.capacity()) {
         objects.reserve(objects.capacity() + growth);
       }
-      new_object = new T(game, new_index);
+      new_object = construct(new_index);
       objects.push_back(new_object);
     }
 
@@ -137,7 +177,7 @@ class Collection {
         FObjects::iterator i = std::find(free_object_indexes.begin(),
                                          free_object_indexes.end(), index);
         free_object_indexes.erase(i);
-        object = new T(game, index);
+        object = construct(index);
         objects[index] = object;
       }
     } else {
@@ -148,7 +188,7 @@ class Collection {
         free_object_indexes.push_back(static_cast<unsigned int>(i));
         objects.push_back(nullptr);
       }
-      object = new T(game, index);
+      object = construct(index);
       objects.push_back(object);
     }
 
@@ -259,7 +299,7 @@ class Collection {
         free_object_indexes.push_back(index);
         objects[index] = nullptr;
       }
-      delete object;
+      destroy(object);
     }
   }
 
@@ -0,0 +1,38 @@
+/*
+ * owner-index.cc - which serfs/buildings/inventories each player owns
+ */
+
+#include "src/owner-index.h"
+
+void
+OwnerIndex::clear() {
+  for (Indexes &indexes : owned) {
+    indexes.clear();
+  }
+  listed_owner.clear();
+}
+
+void
+OwnerIndex::set(unsigned int index, unsigned int owner) {
+  if (index >= listed_owner.size()) {
+    listed_owner.resize(index + 1, -1);
+  }
+  if (listed_owner[index] == static_cast<int>(owner)) {
+    return;
+  }
+  remove(index);
+  if (owner >= OWNER_INDEX_MAX_PLAYERS) {
+    return;
+  }
+  owned[owner].insert(index);
+  listed_owner[index] = owner;
+}
+
+void
+OwnerIndex::remove(unsigned int index) {
+  if (index >= listed_owner.size() || listed_owner[index] < 0) {
+    return;
+  }
+  owned[listed_owner[index]].erase(index);
+  listed_owner[index] = -1;
+}
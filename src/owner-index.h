@@ -0,0 +1,100 @@
+/*
+ * owner-index.h - which serfs/buildings/inventories each player owns
+ *
+ *  Game::get_player_serfs and friends used to loop over the whole
+ *   Collection and check every owner, many times per AI loop and every
+ *   tick for some Player functions.  The game keeps one OwnerIndex per
+ *   Collection instead, updated by the set_owner functions and the Game
+ *   functions that erase objects, so a player's objects are found without
+ *   looking at anyone else's.
+ *  Indexes are kept sorted so iteration is still in index order, the same
+ *   order the Collection scan gave.
+ */
+
+#ifndef SRC_OWNER_INDEX_H_
+#define SRC_OWNER_INDEX_H_
+
+#include <cstddef>
+#include <iterator>
+#include <set>
+#include <vector>
+
+#define OWNER_INDEX_MAX_PLAYERS  4
+
+class OwnerIndex {
+ public:
+  typedef std::set<unsigned int> Indexes;
+
+ protected:
+  Indexes owned[OWNER_INDEX_MAX_PLAYERS];
+  std::vector<int> listed_owner;  // per object index, -1 if not listed
+  Indexes none;
+
+ public:
+  void clear();
+  // an owner outside 0-3 (a new serf is -1) just unlists the object
+  void set(unsigned int index, unsigned int owner);
+  void remove(unsigned int index);
+  const Indexes &get(unsigned int owner) const {
+    return (owner < OWNER_INDEX_MAX_PLAYERS) ? owned[owner] : none;
+  }
+};
+
+// iterate a player's objects as pointers straight out of the Collection,
+//  without copying them into a list.  Game thread only, see
+//  Game::get_player_serfs_view
+template<class T, class C> class OwnedView {
+ protected:
+  const OwnerIndex::Indexes &indexes;
+  C *collection;
+
+ public:
+  class Iterator {
+   protected:
+    OwnerIndex::Indexes::const_iterator it;
+    OwnerIndex::Indexes::const_iterator end;
+    C *collection;
+
+    void skip_missing() {
+      while (it != end && (*collection)[*it] == nullptr) {
+        ++it;
+      }
+    }
+
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef T* value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef T** pointer;
+    typedef T*& reference;
+
+    Iterator(OwnerIndex::Indexes::const_iterator _it,
+             OwnerIndex::Indexes::const_iterator _end, C *_collection)
+      : it(_it), end(_end), collection(_collection) {
+      skip_missing();
+    }
+
+    Iterator& operator++() {
+      ++it;
+      skip_missing();
+      return *this;
+    }
+
+    bool operator==(const Iterator& right) const { return it == right.it; }
+    bool operator!=(const Iterator& right) const { return it != right.it; }
+    T* operator*() const { return (*collection)[*it]; }
+  };
+
+  OwnedView(const OwnerIndex::Indexes &_indexes, C *_collection)
+    : indexes(_indexes), collection(_collection) {}
+
+  Iterator begin() const {
+    return Iterator(indexes.begin(), indexes.end(), collection);
+  }
+  Iterator end() const {
+    return Iterator(indexes.end(), indexes.end(), collection);
+  }
+  size_t size() const { return indexes.size(); }
+};
+
+#endif  // SRC_OWNER_INDEX_H_
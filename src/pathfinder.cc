@@ -21,7 +21,7 @@
 
 #include "src/pathfinder.h"
 
-#include <list>
+#include <cstdint>
 #include <vector>
 #include <algorithm>
 #include <memory>
@@ -29,6 +29,8 @@
 #include <chrono>   // for function performance timing
 #include <ctime>  // for function performance timing
 
+#include "src/walk-clusters.h"
+
 // moved to pathfinder.h
 /*
 class SearchNode;
@@ -90,6 +92,158 @@ actual_cost(Map *map, MapPos pos, Direction dir) {
 }
 */
 
+// Search state for both pathfinders, one per thread and reused by every
+//  search on it.  This used to be a shared_ptr per SearchNode, a std::list
+//  closed set searched front to back for every neighbour, and a linear scan
+//  of the open set too.  Now nodes are handed out from a pool that is only
+//  cleared (not freed) between searches, and whether a tile is open or
+//  closed is a lookup in per-tile arrays, stamped with the search's
+//  generation so they never need clearing either.
+// The open set is still a vector kept heapified with the same std::
+//  push_heap/pop_heap/make_heap calls on the same comparisons as before,
+//  only of node indexes now, so equal-cost ties are broken exactly as
+//  before and every caller gets the same path it always did.
+class PathfinderContext {
+ public:
+  static const unsigned int no_node = static_cast<unsigned int>(-1);
+
+  typedef struct Node {
+    unsigned int parent;
+    unsigned int g_score;
+    unsigned int f_score;
+    unsigned int length;  // steps back to the first node
+    MapPos pos;
+    Direction dir;
+  } Node;
+
+  std::vector<Node> nodes;
+  std::vector<unsigned int> open;
+  std::vector<uint32_t> open_gen;    // per tile
+  std::vector<uint32_t> closed_gen;  // per tile
+  std::vector<unsigned int> tile_node;  // per tile, valid if open
+  uint32_t generation;
+
+  PathfinderContext() : generation(0) {}
+
+  static PathfinderContext &get() {
+    static thread_local PathfinderContext context;
+    return context;
+  }
+
+  void start(const Map *map) {
+    nodes.clear();
+    open.clear();
+    unsigned int tile_count = map->geom().tile_count();
+    if (open_gen.size() != tile_count) {
+      open_gen.assign(tile_count, 0);
+      closed_gen.assign(tile_count, 0);
+      tile_node.assign(tile_count, no_node);
+    }
+    generation += 1;
+    if (generation == 0) {
+      std::fill(open_gen.begin(), open_gen.end(), 0);
+      std::fill(closed_gen.begin(), closed_gen.end(), 0);
+      generation = 1;
+    }
+  }
+
+  unsigned int add_node(MapPos pos, unsigned int g_score,
+                        unsigned int f_score, unsigned int parent,
+                        Direction dir) {
+    Node node;
+    node.parent = parent;
+    node.g_score = g_score;
+    node.f_score = f_score;
+    node.length = (parent == no_node) ? 0 : nodes[parent].length + 1;
+    node.pos = pos;
+    node.dir = dir;
+    nodes.push_back(node);
+    return static_cast<unsigned int>(nodes.size() - 1);
+  }
+
+  // A search node is considered less than the other if
+  // it has a larger f-score. This means that in the max-heap
+  // the lower score will go to the top.
+  bool less(unsigned int left, unsigned int right) const {
+    return nodes[left].f_score > nodes[right].f_score;
+  }
+
+  void push_open(unsigned int node) {
+    open_gen[nodes[node].pos] = generation;
+    tile_node[nodes[node].pos] = node;
+    open.push_back(node);
+    std::push_heap(open.begin(), open.end(),
+                   [this](unsigned int l, unsigned int r) { return less(l, r); });
+  }
+
+  unsigned int pop_open() {
+    std::pop_heap(open.begin(), open.end(),
+                  [this](unsigned int l, unsigned int r) { return less(l, r); });
+    unsigned int node = open.back();
+    open.pop_back();
+    open_gen[nodes[node].pos] = 0;
+    return node;
+  }
+
+  // an open node got a new score, move it to the back and heapify.  This
+  //  is the only linear scan left, and make_heap is linear anyway
+  void reorder_open(unsigned int node) {
+    std::vector<unsigned int>::iterator it =
+      std::find(open.begin(), open.end(), node);
+    iter_swap(it, open.rbegin());
+    std::make_heap(open.begin(), open.end(),
+                   [this](unsigned int l, unsigned int r) { return less(l, r); });
+  }
+
+  bool is_open(MapPos pos) const { return open_gen[pos] == generation; }
+  bool is_closed(MapPos pos) const { return closed_gen[pos] == generation; }
+  void close(MapPos pos) { closed_gen[pos] = generation; }
+
+  // the open node at pos, only call if is_open(pos)
+  unsigned int find_open(MapPos pos) const { return tile_node[pos]; }
+
+  Road get_solution(unsigned int node, MapPos start) const {
+    Road solution;
+    solution.start(start);
+    while (nodes[node].parent != no_node) {
+      solution.extend(reverse_direction(nodes[node].dir));
+      node = nodes[node].parent;
+    }
+    return solution;
+  }
+};
+
+const unsigned int PathfinderContext::no_node;
+
+// heuristic_cost/actual_cost from pathfinder.h, with the neighbour and
+//  distance math done by the geometry the search runs with
+template<class G> static unsigned int
+heuristic_cost(const G &geom, Map *map, MapPos start, MapPos end) {
+  int dist_col = geom.dist_x(start, end);
+  int dist_row = geom.dist_y(start, end);
+
+  int h_diff = abs(static_cast<int>(map->get_height(start)) -
+                   static_cast<int>(map->get_height(end)));
+  int dist = 0;
+
+  if ((dist_col > 0 && dist_row > 0) ||
+      (dist_col < 0 && dist_row < 0)) {
+    dist = std::max(abs(dist_col), abs(dist_row));
+  } else {
+    dist = abs(dist_col) + abs(dist_row);
+  }
+
+  return dist > 0 ? dist*walk_cost[h_diff/dist] : 0;
+}
+
+template<class G> static unsigned int
+actual_cost(const G &geom, Map *map, MapPos pos, Direction dir) {
+  MapPos other_pos = geom.move(pos, dir);
+  int h_diff = abs(static_cast<int>(map->get_height(pos)) -
+                   static_cast<int>(map->get_height(other_pos)));
+  return walk_cost[h_diff];
+}
+
 /* Find the shortest path from start to end (using A*) considering that
    the walking time for a serf walking in any direction of the path
    should be minimized. Returns a malloc'ed array of directions and
@@ -97,52 +251,34 @@ actual_cost(Map *map, MapPos pos, Direction dir) {
    //https://en.wikipedia.org/wiki/A*_search_algorithm
 // this function is used for plotting Roads, and so is not appropriate
 //  for pure pathfinding for freewalking serfs
-Road
-pathfinder_map(Map *map, MapPos start, MapPos end, const Road *building_road) {
-  // Unfortunately the STL priority_queue cannot be used since we
-  // would need access to the underlying sequence to determine if
-  // a node is already in the open list. We keep instead open as
-  // a vector and apply std::pop_heap and std::push_heap to keep
-  // it heapified.
-  std::vector<PSearchNode> open;
-  std::list<PSearchNode> closed;
+template<class G> static Road
+pathfinder_map(const G &geom, Map *map, MapPos start, MapPos end, const Road *building_road) {
+  PathfinderContext &context = PathfinderContext::get();
+  context.start(map);
 
   /* Create start node */
-  PSearchNode node(new SearchNode);
-  node->pos = end;
-  node->g_score = 0;
-  node->f_score = heuristic_cost(map, start, end);
+  context.push_open(context.add_node(end, 0, heuristic_cost(geom, map, start, end),
+                                     PathfinderContext::no_node,
+                                     DirectionNone));
 
-  open.push_back(node);
+  while (!context.open.empty()) {
+    unsigned int node = context.pop_open();
+    MapPos node_pos = context.nodes[node].pos;
 
-  while (!open.empty()) {
-    std::pop_heap(open.begin(), open.end(), search_node_less);
-    node = open.back();
-    open.pop_back();
-
-    if (node->pos == start) {
+    if (node_pos == start) {
       /* Construct solution */
-      Road solution;
-      solution.start(start);
-
-      while (node->parent) {
-        Direction dir = node->dir;
-        solution.extend(reverse_direction(dir));
-        node = node->parent;
-      }
-
-      return solution;
+      return context.get_solution(node, start);
     }
 
     /* Put current node on closed list. */
-    closed.push_front(node);
+    context.close(node_pos);
 
     for (Direction d : cycle_directions_cw()) {
-      MapPos new_pos = map->move(node->pos, d);
-      unsigned int cost = actual_cost(map, node->pos, d);
+      MapPos new_pos = geom.move(node_pos, d);
+      unsigned int cost = actual_cost(geom, map, node_pos, d);
 
       /* Check if neighbour is valid. */
-      if (!map->is_road_segment_valid(node->pos, d) ||
+      if (!map->is_road_segment_valid(node_pos, d) ||
           (map->get_obj(new_pos) == Map::ObjectFlag && new_pos != start)) {
         continue;
       }
@@ -153,57 +289,46 @@ pathfinder_map(Map *map, MapPos start, MapPos end, const Road *building_road) {
       }
 
       /* Check if neighbour is in closed list. */
-      bool in_closed = false;
-      for (PSearchNode closed_node : closed) {
-        if (closed_node->pos == new_pos) {
-          in_closed = true;
-          break;
-        }
-      }
+      if (context.is_closed(new_pos)) continue;
 
-      if (in_closed) continue;
+      unsigned int g_score = context.nodes[node].g_score + cost;
 
       /* See if neighbour is already in open list. */
-      bool in_open = false;
-      for (std::vector<PSearchNode>::iterator it = open.begin();
-           it != open.end(); ++it) {
-        PSearchNode n = *it;
-        if (n->pos == new_pos) {
-          in_open = true;
-          if (n->g_score >= node->g_score + cost) {
-            n->g_score = node->g_score + cost;
-            n->f_score = n->g_score + heuristic_cost(map, new_pos, start);
-            n->parent = node;
-            n->dir = d;
-
-            // Move element to the back and heapify
-            iter_swap(it, open.rbegin());
-            std::make_heap(open.begin(), open.end(), search_node_less);
-          }
-          break;
+      if (context.is_open(new_pos)) {
+        unsigned int n = context.find_open(new_pos);
+        if (context.nodes[n].g_score >= g_score) {
+          context.nodes[n].g_score = g_score;
+          context.nodes[n].f_score = g_score +
+                                     heuristic_cost(geom, map, new_pos, start);
+          context.nodes[n].parent = node;
+          context.nodes[n].length = context.nodes[node].length + 1;
+          context.nodes[n].dir = d;
+          context.reorder_open(n);
         }
+        continue;
       }
 
       /* If not found in the open set, create a new node. */
-      if (!in_open) {
-        PSearchNode new_node(new SearchNode);
-
-        new_node->pos = new_pos;
-        new_node->g_score = node->g_score + cost;
-        new_node->f_score = new_node->g_score +
-                            heuristic_cost(map, new_pos, start);
-        new_node->parent = node;
-        new_node->dir = d;
-
-        open.push_back(new_node);
-        std::push_heap(open.begin(), open.end(), search_node_less);
-      }
+      context.push_open(context.add_node(new_pos, g_score,
+                                         g_score + heuristic_cost(geom, map,
+                                                                  new_pos,
+                                                                  start),
+                                         node, d));
     }
   }
 
   return Road();
 }
 
+Road
+pathfinder_map(Map *map, MapPos start, MapPos end, const Road *building_road) {
+  Road solution;
+  with_map_geometry(map->geom(), [&](const auto &geom) {
+    solution = pathfinder_map(geom, map, start, end, building_road);
+  });
+  return solution;
+}
+
 
 
 /* Find the shortest path from start to end (using A*) considering that
@@ -225,29 +350,18 @@ pathfinder_map(Map *map, MapPos start, MapPos end, const Road *building_road) {
 //   if the target is a building, the building's flag should be used as the end pos!!!
 //
 // note that this ignores terrain height heuristic
-Road
-pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
-  //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, start pos " << start << ", dest pos " << end << ", max_dist " << max_dist << ", remember this is a REVERSE SEARCH";
-
-  if (start == bad_map_pos || end == bad_map_pos){
-    Log::Error["pathfinder.cc"] << "inside pathfinder_freewalking_serf, either start pos " << start << " or end pos " << end << " is bad_map_pos " << bad_map_pos;
-    throw ExceptionFreeserf("inside pathfinder_freewalking_serf, either start pos or end pos is bad_map_pos!");
-  }
-
+template<class G> static Road
+freewalking_search(const G &geom, Map *map, MapPos start, MapPos end, unsigned int plot_road_max_length) {
   // time this function for debugging
   //std::clock_t start_pathfinder_freewalking_serf = std::clock();
 
-  std::vector<PSearchNode> open;
-  std::list<PSearchNode> closed;
+  PathfinderContext &context = PathfinderContext::get();
+  context.start(map);
 
   /* Create start node */
-  PSearchNode node(new SearchNode);
-  node->pos = end;
-  node->g_score = 0;
-  //node->f_score = heuristic_cost(map, start, end);
-  node->f_score = 0;
-
-  open.push_back(node);
+  //node->f_score = heuristic_cost(geom, map, start, end);
+  context.push_open(context.add_node(end, 0, 0, PathfinderContext::no_node,
+                                     DirectionNone));
 
   // limit the number of *positions* considered,
   //  though this is NOT the same as maximum possible length!!
@@ -260,20 +374,17 @@ pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
   unsigned int total_pos_considered = 0;
   // reducing the values that were copied from ai_pathfinder, as this is more sensitive
   static const unsigned int plot_road_max_pos_considered = 5000;  // the maximum number of "nodes" (MapPos) considered as part of a single plot_road call before giving up
-  //static const unsigned int plot_road_max_length = 100;  // the maximum length of a road solution for plot_road before giving up
-  static const unsigned int plot_road_max_length = max_dist;  // this is now a configurable argument
 
   Road solution;
   solution.start(start);
 
-  while (!open.empty()) {
+  while (!context.open.empty()) {
     //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, A";
-    std::pop_heap(open.begin(), open.end(), search_node_less);
-    node = open.back();
-    open.pop_back();
+    unsigned int node = context.pop_open();
+    MapPos node_pos = context.nodes[node].pos;
 
-    if (node->pos == bad_map_pos){
-      Log::Error["pathfinder.cc"] << "inside pathfinder_freewalking_serf, node->pos " << node->pos << " is bad_map_pos " << bad_map_pos;
+    if (node_pos == bad_map_pos){
+      Log::Error["pathfinder.cc"] << "inside pathfinder_freewalking_serf, node->pos " << node_pos << " is bad_map_pos " << bad_map_pos;
       throw ExceptionFreeserf("inside pathfinder_freewalking_serf, node->pos is bad_map_pos!");
     }
 
@@ -289,26 +400,19 @@ pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
     total_pos_considered++;
 
     // limit the *length* considered
-    unsigned int current_length = 0;  // this is calculated in full each time, not cumulative, so it can be declared every time
-    PSearchNode tmp_length_check_node = node;
-    while (tmp_length_check_node->parent) {
-      current_length++;
-      tmp_length_check_node = tmp_length_check_node->parent;
-    }
+    //  each node keeps its length, a node's parent is always closed so it
+    //  can't change under it
+    unsigned int current_length = context.nodes[node].length;
     //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, current road-length so far for this solution is " << current_length;
     if (current_length >= plot_road_max_length){
       //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, maximum road-length reached (plot_road_max_length) " << current_length << ", ending search early";
       break;
     }
 
-    if (node->pos == start) {
+    if (node_pos == start) {
       //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, B  FOUND SOLUTION";
 
-      while (node->parent) {
-        Direction dir = node->dir;
-        solution.extend(reverse_direction(dir));
-        node = node->parent;
-      }
+      solution = context.get_solution(node, start);
 
       //double duration = (std::clock() - start_pathfinder_freewalking_serf) / static_cast<double>(CLOCKS_PER_SEC);
       //Log::Debug["pathfinder_freewalking_serf"] << "done pathfinder_freewalking_serf, call took " << duration << ", considered " << total_pos_considered << " positions";
@@ -319,12 +423,12 @@ pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
     //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, C  KEEP SEARCHING, node->pos " << node->pos << " is not yet the start pos " << start;
 
     /* Put current node on closed list. */
-    closed.push_front(node);
+    context.close(node_pos);
 
     for (Direction d : cycle_directions_cw()) {
       //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, D  Dir: " << d;
-      MapPos new_pos = map->move(node->pos, d);
-      unsigned int cost = actual_cost(map, node->pos, d);
+      MapPos new_pos = geom.move(node_pos, d);
+      unsigned int cost = actual_cost(geom, map, node_pos, d);
       // default to lowest value (255), ignore heuristics
       //unsigned int cost = 255;
 
@@ -369,56 +473,36 @@ pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
       //}
 
       /* Check if neighbour is in closed list. */
-      bool in_closed = false;
-      for (PSearchNode closed_node : closed) {
-        if (closed_node->pos == new_pos) {
-          in_closed = true;
-          //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, F, neighbor in closed";
-          break;
-        }
+      if (context.is_closed(new_pos)) {
+        //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, F, neighbor in closed";
+        continue;
       }
 
-      if (in_closed) continue;
+      unsigned int g_score = context.nodes[node].g_score + cost;
 
       /* See if neighbour is already in open list. */
-      bool in_open = false;
-      for (std::vector<PSearchNode>::iterator it = open.begin();
-           it != open.end(); ++it) {
-        PSearchNode n = *it;
-        if (n->pos == new_pos) {
-          in_open = true;
-          //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, G, neighbor in open";
-          if (n->g_score >= node->g_score + cost) {
-            //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, H, neighbor in open, this node score is less, swapping";
-            n->g_score = node->g_score + cost;
-            n->f_score = n->g_score + heuristic_cost(map, new_pos, start);
-            //n->f_score = n->g_score;
-            n->parent = node;
-            n->dir = d;
-
-            // Move element to the back and heapify
-            iter_swap(it, open.rbegin());
-            std::make_heap(open.begin(), open.end(), search_node_less);
-          }
-          break;
+      if (context.is_open(new_pos)) {
+        //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, G, neighbor in open";
+        unsigned int n = context.find_open(new_pos);
+        if (context.nodes[n].g_score >= g_score) {
+          //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, H, neighbor in open, this node score is less, swapping";
+          context.nodes[n].g_score = g_score;
+          context.nodes[n].f_score = g_score + heuristic_cost(geom, map, new_pos, start);
+          //n->f_score = n->g_score;
+          context.nodes[n].parent = node;
+          context.nodes[n].length = context.nodes[node].length + 1;
+          context.nodes[n].dir = d;
+          context.reorder_open(n);
         }
+        continue;
       }
 
       /* If not found in the open set, create a new node. */
-      if (!in_open) {
-        //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, I, creating new node";
-        PSearchNode new_node(new SearchNode);
-
-        new_node->pos = new_pos;
-        new_node->g_score = node->g_score + cost;
-        new_node->f_score = new_node->g_score + heuristic_cost(map, new_pos, start);
-        //new_node->f_score = new_node->g_score;
-        new_node->parent = node;
-        new_node->dir = d;
-
-        open.push_back(new_node);
-        std::push_heap(open.begin(), open.end(), search_node_less);
-      }
+      //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, I, creating new node";
+      //new_node->f_score = new_node->g_score;
+      context.push_open(context.add_node(new_pos, g_score,
+                                         g_score + heuristic_cost(geom, map, new_pos, start),
+                                         node, d));
     }
   }
 
@@ -427,3 +511,59 @@ pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
 
   return Road();
 }
+
+static Road
+freewalking_search(Map *map, MapPos start, MapPos end, unsigned int plot_road_max_length) {
+  Road solution;
+  with_map_geometry(map->geom(), [&](const auto &geom) {
+    solution = freewalking_search(geom, map, start, end, plot_road_max_length);
+  });
+  return solution;
+}
+
+Road
+pathfinder_freewalking_serf(Map *map, MapPos start, MapPos end, int max_dist) {
+  //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, start pos " << start << ", dest pos " << end << ", max_dist " << max_dist << ", remember this is a REVERSE SEARCH";
+
+  if (start == bad_map_pos || end == bad_map_pos){
+    Log::Error["pathfinder.cc"] << "inside pathfinder_freewalking_serf, either start pos " << start << " or end pos " << end << " is bad_map_pos " << bad_map_pos;
+    throw ExceptionFreeserf("inside pathfinder_freewalking_serf, either start pos or end pos is bad_map_pos!");
+  }
+
+  //static const unsigned int plot_road_max_length = 100;  // the maximum length of a road solution for plot_road before giving up
+  // this is now a configurable argument.  It used to be a static const, so
+  //  whichever caller came first set the limit for every later call
+  const unsigned int plot_road_max_length = max_dist;
+
+  // long walks (knights to an attack target, serfs around a lake) are
+  //  first planned over the map's walk clusters, then each short leg
+  //  between two waypoints is searched tile by tile.  If any leg fails
+  //  (the clusters are a rough picture) just search the whole way
+  std::vector<MapPos> waypoints;
+  WalkClusters *clusters = map->get_walk_clusters();
+  if (clusters != nullptr && clusters->find_waypoints(start, end, &waypoints)) {
+    Road solution;
+    solution.start(start);
+    bool ok = true;
+    for (size_t i = 1; i < waypoints.size() && ok; i++) {
+      Road leg = freewalking_search(map, waypoints[i-1], waypoints[i],
+                                    plot_road_max_length);
+      if (!leg.is_valid()) {
+        ok = false;
+        break;
+      }
+      for (Direction d : leg.get_dirs()) {
+        solution.extend(d);
+      }
+      if (solution.get_length() >= plot_road_max_length) {
+        ok = false;
+      }
+    }
+    if (ok) {
+      //Log::Debug["pathfinder.cc"] << "inside pathfinder_freewalking_serf, found path from " << start << " to " << end << " over " << waypoints.size() << " waypoints, length " << solution.get_length();
+      return solution;
+    }
+  }
+
+  return freewalking_search(map, start, end, plot_road_max_length);
+}
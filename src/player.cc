@@ -26,6 +26,7 @@
 
 #include "src/game.h"
 #include "src/log.h"
+#include "src/state-hash.h"
 #include "src/inventory.h"
 #include "src/savegame.h"
 #include "src/building.h"
@@ -410,9 +411,10 @@ Player::change_knight_occupation(int index_, int adjust_max, int delta) {
 /* Turn a number of serfs into knight for the given player. */
 int
 Player::promote_serfs_to_knights(int number) {
+  ReplayCommandScope command(game, ReplayCommand(ReplayCommand::TypePromoteSerfs, index, 0, number));
   int promoted = 0;
 
-  for (Serf *serf : game->get_player_serfs(this)) {
+  for (Serf *serf : game->get_player_serfs_view(this)) {
     if (serf->get_state() == Serf::StateIdleInStock &&
         serf->get_type() == Serf::TypeGeneric) {
       Inventory *inv = game->get_inventory(serf->get_idle_in_stock_inv_index());
@@ -590,6 +592,10 @@ Player::knights_available_for_attack(MapPos pos) {
 
 void
 Player::start_attack() {
+  ReplayCommandScope command(game, ReplayCommand(ReplayCommand::TypeStartAttack, index, building_attacked,
+                                                 knights_attacking));
+  command.get_command()->list = get_attacking_buildings();
+
   const int min_level_hut[] = { 1, 1, 2, 2, 3 };
   const int min_level_tower[] = { 1, 2, 3, 4, 6 };
   const int min_level_fortress[] = { 1, 3, 6, 9, 12 };
@@ -668,11 +674,77 @@ Player::start_attack() {
   }
 }
 
+void
+Player::get_settings(std::vector<int> *settings) const {
+  settings->clear();
+  settings->insert(settings->end(), std::begin(tool_prio), std::end(tool_prio));
+  settings->insert(settings->end(), std::begin(flag_prio), std::end(flag_prio));
+  settings->insert(settings->end(), std::begin(inventory_prio), std::end(inventory_prio));
+  settings->insert(settings->end(), std::begin(knight_occupation), std::end(knight_occupation));
+  settings->push_back(serf_to_knight_rate);
+  settings->push_back(food_stonemine);
+  settings->push_back(food_coalmine);
+  settings->push_back(food_ironmine);
+  settings->push_back(food_goldmine);
+  settings->push_back(planks_construction);
+  settings->push_back(planks_boatbuilder);
+  settings->push_back(planks_toolmaker);
+  settings->push_back(steel_toolmaker);
+  settings->push_back(steel_weaponsmith);
+  settings->push_back(coal_steelsmelter);
+  settings->push_back(coal_goldsmelter);
+  settings->push_back(coal_weaponsmith);
+  settings->push_back(wheat_pigfarm);
+  settings->push_back(wheat_mill);
+  settings->push_back(castle_knights_wanted);
+  settings->push_back(send_strongest());
+}
+
+// setting is an index into the list built by get_settings
+void
+Player::set_setting(size_t setting, int value) {
+  int *arrays[] = { tool_prio, flag_prio, inventory_prio, knight_occupation };
+  size_t sizes[] = { 9, 26, 26, 4 };
+  for (int i = 0; i < 4; i++) {
+    if (setting < sizes[i]) {
+      arrays[i][setting] = value;
+      return;
+    }
+    setting -= sizes[i];
+  }
+  int *values[] = { &serf_to_knight_rate,
+                    &food_stonemine, &food_coalmine, &food_ironmine, &food_goldmine,
+                    &planks_construction, &planks_boatbuilder, &planks_toolmaker,
+                    &steel_toolmaker, &steel_weaponsmith,
+                    &coal_steelsmelter, &coal_goldsmelter, &coal_weaponsmith,
+                    &wheat_pigfarm, &wheat_mill,
+                    &castle_knights_wanted };
+  if (setting < sizeof(values) / sizeof(values[0])) {
+    *values[setting] = value;
+    return;
+  }
+  if (value) {
+    set_send_strongest();
+  } else {
+    drop_send_strongest();
+  }
+}
+
+void
+Player::set_attacking_buildings(const std::vector<int> &buildings) {
+  attacking_building_count = 0;
+  for (int building_index : buildings) {
+    if (attacking_building_count >= 64) break;
+    attacking_buildings[attacking_building_count++] = building_index;
+  }
+}
+
 /* Begin cycling knights by sending knights from military buildings
    to inventories. The knights can then be replaced by more experienced
    knights. */
 void
 Player::cycle_knights() {
+  ReplayCommandScope command(game, ReplayCommand(ReplayCommand::TypeCycleKnights, index, 0));
   flags |= BIT(2) | BIT(4);
   knight_cycle_counter = 2400;
 }
@@ -793,7 +865,7 @@ Player::spawn_serf(Serf **serf, Inventory **inventory, bool want_knight) {
   }
   //Log::Debug["player"] << "inside spawn_serf for player " << index << ", can_spawn is true";
 
-  Game::ListInventories inventories = game->get_player_inventories(this);
+  Game::PlayerInventories inventories = game->get_player_inventories_view(this);
   if (inventories.size() < 1) {
     // this happens when all Inventories destroyed
     //Log::Warn["game.cc"] << "inside Player::spawn_serf, inventories.size is <1, it is currently " << inventories.size() << ", does this mean max inventories reached?  Game just returns false";
@@ -1073,12 +1145,12 @@ Player::update_knight_morale() {
   unsigned int military_gold = 0;
 
   /* Sum gold collected in inventories */
-  for (Inventory *inventory : game->get_player_inventories(this)) {
+  for (Inventory *inventory : game->get_player_inventories_view(this)) {
     inventory_gold += inventory->get_count_of(Resource::TypeGoldBar);
   }
 
   /* Sum gold deposited in military buildings */
-  for (Building *building : game->get_player_buildings(this)) {
+  for (Building *building : game->get_player_buildings_view(this)) {
     military_gold += building->military_gold_count();
   }
 
@@ -1529,3 +1601,30 @@ operator << (SaveWriterText &writer, Player &player) {
 
   return writer;
 }
+
+void
+Player::add_state_hash(StateHash *hash) const {
+  hash->add(index);
+  hash->add(flags);
+  hash->add(build);
+  hash->add_array(serf_count, 27);
+  hash->add_array(resource_count, 26);
+  hash->add_array(completed_building_count, 24);
+  hash->add_array(incomplete_building_count, 24);
+  hash->add(castle_inventory);
+  hash->add(knights_to_spawn);
+  hash->add(total_land_area);
+  hash->add(total_building_score);
+  hash->add(total_military_score);
+  hash->add(reproduction_counter);
+  hash->add(serf_to_knight_counter);
+  hash->add(send_generic_delay);
+  hash->add(send_knight_delay);
+  hash->add(knight_cycle_counter);
+  hash->add(knight_morale);
+  hash->add(gold_deposited);
+  hash->add(castle_knights);
+  std::vector<int> settings;
+  get_settings(&settings);
+  hash->add_array(settings.data(), settings.size());
+}
@@ -35,6 +35,7 @@ class Building;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Message {
  public:
@@ -277,6 +278,15 @@ class Player : public GameObject {
   int get_inventory_prio(int type) const { return inventory_prio[type]; }
   int *get_inventory_prio() { return inventory_prio; }
 
+  // every setting the player changes through the UI or AI (priorities,
+  //  distribution, knight occupation...) as one flat list of values, so the
+  //  replay recorder can notice changes without hooking every setter
+  void get_settings(std::vector<int> *settings) const;
+  void set_setting(size_t setting, int value);
+  std::vector<int> get_attacking_buildings() const {
+    return std::vector<int>(attacking_buildings, attacking_buildings + attacking_building_count); }
+  void set_attacking_buildings(const std::vector<int> &buildings);
+
   int get_total_military_score() const { return total_military_score; }
 
   void update();
@@ -344,6 +354,10 @@ class Player : public GameObject {
   friend SaveWriterText&
     operator << (SaveWriterText &writer, Player &player);
 
+  // fold the fields that change as the game runs into a state hash, see
+  //  Game::get_state_hash
+  void add_state_hash(StateHash *hash) const;
+
  protected:
   void create_initial_castle_serfs(Building *castle);
   bool spawn_serf(Serf **serf, Inventory **inventory, bool want_knight);
@@ -21,47 +21,307 @@
 
 #include "src/profiler.h"
 
+#include <chrono>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <fstream>
+#include <iomanip>
+#include <iostream>
 #include <string>
 #include <istream>
+#include <vector>
 
 #include "src/command_line.h"
 #include "src/log.h"
 #include "src/version.h"
 #include "src/game-manager.h"
-//#include "src/pathfinder.h"  // for player.cc pathfinder_freewalking_serf check
+#include "src/map-geometry.h"
+
+// Tick-throughput benchmark.  Each savegame is loaded, warmed up, then
+//  advanced a fixed number of Game::update() calls with the per-phase
+//  timers in Game::update turned on.  Results are written as CSV or JSON
+//  so they can be compared between releases to catch regressions in the
+//  simulation hot path.
+
+typedef struct ProfileResult {
+  std::string name;
+  unsigned int updates;
+  unsigned int ticks;
+  double seconds;
+  uint64_t nsec[Game::UpdatePhaseMax];
+  uint64_t calls[Game::UpdatePhaseMax];
+} ProfileResult;
+
+static void
+set_game_speed(PGame game, unsigned int game_speed) {
+  // load_game leaves the game paused
+  if (game->get_game_speed() == 0) {
+    game->pause();
+  }
+  while (game->get_game_speed() < game_speed) {
+    game->speed_increase();
+  }
+  while (game->get_game_speed() > game_speed) {
+    game->speed_decrease();
+  }
+}
+
+static ProfileResult
+profile_game(PGame game, const std::string &name, unsigned int warmup,
+             unsigned int updates) {
+  for (unsigned int i = 0; i < warmup; i++) {
+    game->update();
+  }
+
+  game->reset_update_phase_stats();
+  game->set_profile_update(true);
+  unsigned int start_tick = game->get_tick();
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned int i = 0; i < updates; i++) {
+    game->update();
+  }
+  auto end = std::chrono::steady_clock::now();
+  game->set_profile_update(false);
+
+  ProfileResult result;
+  result.name = name;
+  result.updates = updates;
+  result.ticks = game->get_tick() - start_tick;
+  result.seconds = std::chrono::duration<double>(end - start).count();
+  for (int phase = 0; phase < Game::UpdatePhaseMax; phase++) {
+    result.nsec[phase] = game->get_update_phase_nsec(static_cast<Game::UpdatePhase>(phase));
+    result.calls[phase] = game->get_update_phase_calls(static_cast<Game::UpdatePhase>(phase));
+  }
+  return result;
+}
+
+// Per-tile cost of neighbour computations with the runtime MapGeometry
+//  and with the FixedMapGeometry with_map_geometry picks for each size.
+//  Each pass moves every tile in all six directions and stores the
+//  result, the store is there so the runtime masks can't simply be kept
+//  in registers, the same as in real loops that write map data
+template<class G> static void
+geometry_pass(const G &geom, MapPos *out) {
+  for (MapPos pos = 0; pos < geom.tile_count(); pos++) {
+    for (Direction d : cycle_directions_cw()) {
+      out[pos*6 + d] = geom.move(pos, d);
+    }
+  }
+}
+
+// false if a fixed geometry moved anywhere differently than the runtime one
+static bool
+profile_geometry(std::ostream &out) {
+  bool all_match = true;
+  out << "size,tiles,runtime_ns_per_tile,fixed_ns_per_tile\n";
+  for (unsigned int size = 3; size <= 10; size++) {
+    MapGeometry geom(size);
+    std::vector<MapPos> moved(geom.tile_count() * 6);
+    std::vector<MapPos> moved_fixed(geom.tile_count() * 6);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PROFILER_GEOMETRY_PASSES; pass++) {
+      geometry_pass(geom, moved.data());
+    }
+    auto middle = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PROFILER_GEOMETRY_PASSES; pass++) {
+      with_map_geometry(geom, [&moved_fixed](const auto &fixed) {
+        geometry_pass(fixed, moved_fixed.data());
+      });
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    if (moved != moved_fixed) {
+      Log::Error["profiler"] << "fixed geometry for size " << size << " moves differently!";
+      all_match = false;
+    }
+    double tiles = static_cast<double>(geom.tile_count()) * PROFILER_GEOMETRY_PASSES;
+    out << size << "," << geom.tile_count() << ","
+        << std::chrono::duration<double, std::nano>(middle - start).count() / tiles << ","
+        << std::chrono::duration<double, std::nano>(end - middle).count() / tiles << "\n";
+  }
+  return all_match;
+}
+
+static void
+write_csv(std::ostream &out, const std::vector<ProfileResult> &results) {
+  out << "game,phase,calls,total_ms,us_per_update,share\n";
+  for (const ProfileResult &result : results) {
+    uint64_t total_nsec = 0;
+    for (int phase = 0; phase < Game::UpdatePhaseMax; phase++) {
+      total_nsec += result.nsec[phase];
+    }
+    for (int phase = 0; phase < Game::UpdatePhaseMax; phase++) {
+      out << result.name << "," << Game::update_phase_name[phase] << ","
+          << result.calls[phase] << ","
+          << result.nsec[phase] / 1000000.0 << ","
+          << result.nsec[phase] / 1000.0 / result.updates << ","
+          << (total_nsec ? static_cast<double>(result.nsec[phase]) / total_nsec : 0.0) << "\n";
+    }
+    out << result.name << ",total," << result.updates << ","
+        << result.seconds * 1000.0 << ","
+        << result.seconds * 1000000.0 / result.updates << ",1\n";
+  }
+}
+
+static void
+write_json(std::ostream &out, const std::vector<ProfileResult> &results) {
+  out << "{\n";
+  out << "  \"version\": \"" << FORKSERF_VERSION << "\",\n";
+  out << "  \"games\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const ProfileResult &result = results[i];
+    out << "    {\n";
+    out << "      \"name\": \"" << result.name << "\",\n";
+    out << "      \"updates\": " << result.updates << ",\n";
+    out << "      \"game_ticks\": " << result.ticks << ",\n";
+    out << "      \"seconds\": " << result.seconds << ",\n";
+    out << "      \"updates_per_sec\": " << result.updates / result.seconds << ",\n";
+    out << "      \"phases\": {\n";
+    for (int phase = 0; phase < Game::UpdatePhaseMax; phase++) {
+      out << "        \"" << Game::update_phase_name[phase] << "\": {"
+          << "\"calls\": " << result.calls[phase] << ", "
+          << "\"total_ms\": " << result.nsec[phase] / 1000000.0 << ", "
+          << "\"us_per_update\": " << result.nsec[phase] / 1000.0 / result.updates << "}"
+          << ((phase + 1 < Game::UpdatePhaseMax) ? "," : "") << "\n";
+    }
+    out << "      }\n";
+    out << "    }" << ((i + 1 < results.size()) ? "," : "") << "\n";
+  }
+  out << "  ]\n";
+  out << "}\n";
+}
 
 int
 main(int argc, char *argv[]) {
-  std::string save_file;
+  std::vector<std::string> save_files;
+  std::string random_seed;
+  std::string format = "csv";
+  std::string output_file;
+  unsigned int map_size = 3;
+  unsigned int updates = PROFILER_DEFAULT_UPDATES;
+  unsigned int warmup = PROFILER_DEFAULT_WARMUP;
+  unsigned int game_speed = 2;
+  bool geometry = false;
 
   CommandLine command_line;
+  command_line.add_option('d', "Set Debug output level")
+                .add_parameter("NUM", [](std::istream& s) {
+                  int d;
+                  s >> d;
+                  if (d >= 0 && d < Log::LevelMax) {
+                    Log::set_level(static_cast<Log::Level>(d));
+                  }
+                  return true;
+                });
+  command_line.add_option('f', "Output format, csv or json (default csv)")
+                .add_parameter("FORMAT", [&format](std::istream& s) {
+                  s >> format;
+                  return (format == "csv" || format == "json");
+                });
+  command_line.add_option('g', "Time map geometry per tile for every map size instead (CSV)", [&geometry](){
+                  geometry = true;
+                });
   command_line.add_option('h', "Show this help text", [&command_line](){
                   command_line.show_help();
                   exit(EXIT_SUCCESS);
                 });
-  command_line.add_option('l', "Load saved game")
-                .add_parameter("FILE", [&save_file](std::istream& s) {
+  command_line.add_option('l', "Load saved game, may be given more than once")
+                .add_parameter("FILE", [&save_files](std::istream& s) {
+                  std::string save_file;
                   std::getline(s, save_file);
+                  save_files.push_back(save_file);
+                  return true;
+                });
+  command_line.add_option('m', "Map size of the generated game when no savegame given (3-10)")
+                .add_parameter("SIZE", [&map_size](std::istream& s) {
+                  s >> map_size;
+                  return (map_size >= 3 && map_size <= 10);
+                });
+  command_line.add_option('n', "Number of Game::update() calls to time")
+                .add_parameter("UPDATES", [&updates](std::istream& s) {
+                  s >> updates;
+                  return (updates > 0);
+                });
+  command_line.add_option('o', "Write results to file instead of stdout")
+                .add_parameter("FILE", [&output_file](std::istream& s) {
+                  std::getline(s, output_file);
+                  return true;
+                });
+  command_line.add_option('r', "Random seed of the generated game when no savegame given (16 digits 1-8)")
+                .add_parameter("SEED", [&random_seed](std::istream& s) {
+                  s >> random_seed;
+                  return (random_seed.length() == 16);
+                });
+  command_line.add_option('s', "Game speed (1-40, default 2)")
+                .add_parameter("SPEED", [&game_speed](std::istream& s) {
+                  s >> game_speed;
+                  return (game_speed >= 1 && game_speed <= 40);
+                });
+  command_line.add_option('w', "Number of untimed warm-up updates")
+                .add_parameter("UPDATES", [&warmup](std::istream& s) {
+                  s >> warmup;
                   return true;
                 });
   command_line.set_comment("Please report bugs to <" PACKAGE_BUGREPORT ">");
-  if (!command_line.process(argc, argv) || save_file.empty()) {
+  if (!command_line.process(argc, argv)) {
     return EXIT_FAILURE;
   }
 
-  //Log::Info["profiler"] << "starts " << FREESERF_VERSION;
-  Log::Info["profiler.cc"] << "starts " << FORKSERF_VERSION;
+  // keep the game's own logging away from the results
+  Log::set_file(&std::cerr);
+
+  Log::Info["profiler"] << "starts " << FORKSERF_VERSION;
+
+  if (geometry) {
+    return profile_geometry(std::cout) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
 
   GameManager &game_manager = GameManager::get_instance();
+  std::vector<ProfileResult> results;
 
-  if (!game_manager.load_game(save_file)) {
-    return EXIT_FAILURE;
+  if (save_files.empty()) {
+    // no savegame, generate a fixed game and give every player a castle,
+    //  the same way the headless runner does
+    if (random_seed.empty()) {
+      random_seed = "3762665523225478";
+    }
+    PGameInfo game_info(new GameInfo(Random(random_seed)));
+    game_info->set_map_size(map_size);
+    if (!game_manager.start_game(game_info, GameManager::get_default_custom_map_generator_options())) {
+      return EXIT_FAILURE;
+    }
+    PGame game = game_manager.get_current_game();
+    for (unsigned int i = 0; game->get_player(i) != nullptr; i++) {
+      game->auto_place_castle(game->get_player(i));
+    }
+    set_game_speed(game, game_speed);
+    Log::Info["profiler"] << "generated game '" << random_seed << "', map size " << map_size;
+    results.push_back(profile_game(game, random_seed, warmup, updates));
   }
-  Log::Info["profiler"] << "loaded game '" << save_file << "'";
 
-  PGame game = game_manager.get_current_game();
-  while (true) {
-    game->update();
+  for (const std::string &save_file : save_files) {
+    if (!game_manager.load_game(save_file)) {
+      Log::Error["profiler"] << "failed to load game '" << save_file << "'";
+      return EXIT_FAILURE;
+    }
+    Log::Info["profiler"] << "loaded game '" << save_file << "'";
+    PGame game = game_manager.get_current_game();
+    set_game_speed(game, game_speed);
+    results.push_back(profile_game(game, save_file, warmup, updates));
+  }
+
+  std::ofstream file;
+  if (!output_file.empty()) {
+    file.open(output_file);
+    if (!file.is_open()) {
+      Log::Error["profiler"] << "cannot write to '" << output_file << "'";
+      return EXIT_FAILURE;
+    }
+  }
+  std::ostream &out = output_file.empty() ? std::cout : file;
+  if (format == "json") {
+    write_json(out, results);
+  } else {
+    write_csv(out, results);
   }
 
   return EXIT_SUCCESS;
@@ -22,14 +22,14 @@
 #ifndef SRC_PROFILER_H_
 #define SRC_PROFILER_H_
 
-// The length between game updates in miliseconds
-//   this is controlled by SDL_Timer ever TICK_LENGTH which triggers and SDL Event
-//   and is handled by the SDL_WaitEvent inside event_loop-sdl.cc EventLoopSDL::run()
-//   which also handles other SDL Events such as user input immediately
-
-// THIS IS NO LONGER SET HERE!!! profiler needs to be updated to match main game timer tick control
-#define TICK_LENGTH  20
-#define TICKS_PER_SEC  (1000/TICK_LENGTH)
+// number of Game::update() calls each savegame is advanced by, fixed so that
+//  runs are comparable between releases
+#define PROFILER_DEFAULT_UPDATES  10000
+// updates run before the timed run starts, so one-off work done right after
+//  loading (initial land ownership, first inventory schedule) is not counted
+#define PROFILER_DEFAULT_WARMUP  200
+// full-map passes per size for the -g geometry benchmark
+#define PROFILER_GEOMETRY_PASSES  20
 
 
 #endif  // SRC_PROFILER_H_
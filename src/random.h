@@ -43,6 +43,8 @@ class Random {
   }
 
   uint16_t random();
+  // raw state, for the replay log to store and restore it
+  uint16_t get_state(int i) const { return state[i]; }
 
   operator std::string() const;
   friend Random& operator^=(Random& left, const Random& right);
@@ -0,0 +1,318 @@
+/*
+ * replay.cc - deterministic command log and replay
+ */
+
+#include "src/replay.h"
+
+#include <cstring>
+#include <fstream>
+
+#include "src/game.h"
+#include "src/game-options.h"
+#include "src/log.h"
+#include "src/mission.h"
+
+// file format, all integers are stored as LEB128 varints (signed values
+//  zigzag encoded) so a typical command takes well under 16 bytes:
+//
+//   "FSRP" version
+//   random_base[3] map_size game_options mapgen_options[23] (raw doubles)
+//   player_count { face red green blue intelligence supplies reproduction
+//                  castle_col castle_row }
+//   command_count { update_delta boundary type player pos arg0 arg1
+//                   list_size list[] random_state[3] }
+//   total_updates
+#define REPLAY_MAGIC  "FSRP"
+#define REPLAY_VERSION  1
+
+// gameplay options that change the simulation, in the order of their bits.
+//  UI-only options (mouse, sounds, graphics) are left out
+static bool *replay_game_options[] = {
+  &option_CanTransportSerfsInBoats,
+  &option_QuickDemoEmptyBuildSites,
+  &option_TreesReproduce,
+  &option_BabyTreesMatureSlowly,
+  &option_ResourceRequestsTimeOut,
+  &option_PrioritizeUsableResources,
+  &option_LostTransportersClearFaster,
+  &option_FourSeasons,
+  &option_AdvancedFarming,
+  &option_FishSpawnSlowly,
+  &option_FogOfWar,
+  &option_SailorsMoveFaster,
+  &option_ForesterMonoculture,
+  &option_CheckPathBeforeAttack,
+  &option_HighMinerFoodConsumption,
+  &option_ParallelMapUpdate,
+};
+
+// command nesting depth on this thread, only depth 1 gets recorded
+static thread_local int replay_command_depth = 0;
+
+ReplayCommandScope::ReplayCommandScope(Game *_game,
+                                       const ReplayCommand &_command)
+  : game(_game)
+  , command(_command) {
+  replay_command_depth++;
+  outermost = (replay_command_depth == 1);
+}
+
+ReplayCommandScope::~ReplayCommandScope() {
+  replay_command_depth--;
+  if (outermost && game->should_record_command()) {
+    game->record_command(command);
+  }
+}
+
+Replay::Replay()
+  : random_base{0, 0, 0}
+  , map_size(0)
+  , custom_map_generator_options({})
+  , game_options(0)
+  , total_updates(0) {
+}
+
+Replay::Replay(const GameInfo &game_info,
+               const CustomMapGeneratorOptions &options)
+  : map_size(game_info.get_map_size())
+  , custom_map_generator_options(options)
+  , game_options(get_current_game_options())
+  , total_updates(0) {
+  Random random = game_info.get_random_base();
+  for (int i = 0; i < 3; i++) {
+    random_base[i] = random.get_state(i);
+  }
+  for (size_t i = 0; i < game_info.get_player_count(); i++) {
+    PPlayerInfo info = game_info.get_player(i);
+    PlayerSetup setup;
+    setup.face = info->get_face();
+    setup.red = info->get_color().red;
+    setup.green = info->get_color().green;
+    setup.blue = info->get_color().blue;
+    setup.intelligence = info->get_intelligence();
+    setup.supplies = info->get_supplies();
+    setup.reproduction = info->get_reproduction();
+    setup.castle_col = info->get_castle_pos().col;
+    setup.castle_row = info->get_castle_pos().row;
+    players.push_back(setup);
+  }
+}
+
+PGameInfo
+Replay::create_game_info() const {
+  PGameInfo game_info(new GameInfo(Random(random_base[0], random_base[1],
+                                          random_base[2])));
+  game_info->set_map_size(map_size);
+  game_info->remove_all_players();
+  for (const PlayerSetup &setup : players) {
+    Player::Color color;
+    color.red = setup.red;
+    color.green = setup.green;
+    color.blue = setup.blue;
+    PPlayerInfo info(new PlayerInfo(setup.face, color, setup.intelligence,
+                                    setup.supplies, setup.reproduction));
+    info->set_castle_pos({setup.castle_col, setup.castle_row});
+    game_info->add_player(info);
+  }
+  return game_info;
+}
+
+uint32_t
+Replay::get_current_game_options() {
+  uint32_t bits = 0;
+  for (size_t i = 0; i < sizeof(replay_game_options) / sizeof(replay_game_options[0]); i++) {
+    if (*replay_game_options[i]) {
+      bits |= (1u << i);
+    }
+  }
+  return bits;
+}
+
+void
+Replay::apply_game_options() const {
+  for (size_t i = 0; i < sizeof(replay_game_options) / sizeof(replay_game_options[0]); i++) {
+    *replay_game_options[i] = ((game_options >> i) & 1);
+  }
+}
+
+static void
+write_varint(std::ostream *out, uint64_t value) {
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      byte |= 0x80;
+    }
+    out->put(static_cast<char>(byte));
+  } while (value != 0);
+}
+
+static void
+write_signed(std::ostream *out, int64_t value) {
+  write_varint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+static uint64_t
+read_varint(std::istream *in) {
+  uint64_t value = 0;
+  int shift = 0;
+  int byte;
+  do {
+    byte = in->get();
+    if (byte == EOF || shift > 63) {
+      in->setstate(std::ios::failbit);
+      return 0;
+    }
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return value;
+}
+
+static int64_t
+read_signed(std::istream *in) {
+  uint64_t value = read_varint(in);
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+bool
+Replay::save(const std::string &path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    Log::Error["replay"] << "unable to open replay file '" << path << "' for writing";
+    return false;
+  }
+
+  file.write(REPLAY_MAGIC, 4);
+  write_varint(&file, REPLAY_VERSION);
+  for (int i = 0; i < 3; i++) {
+    write_varint(&file, random_base[i]);
+  }
+  write_varint(&file, map_size);
+  write_varint(&file, game_options);
+  for (int i = 0; i < 23; i++) {
+    uint64_t raw;
+    std::memcpy(&raw, &custom_map_generator_options.opt[i], sizeof(raw));
+    write_varint(&file, raw);
+  }
+
+  write_varint(&file, players.size());
+  for (const PlayerSetup &setup : players) {
+    write_varint(&file, setup.face);
+    write_varint(&file, setup.red);
+    write_varint(&file, setup.green);
+    write_varint(&file, setup.blue);
+    write_varint(&file, setup.intelligence);
+    write_varint(&file, setup.supplies);
+    write_varint(&file, setup.reproduction);
+    write_signed(&file, setup.castle_col);
+    write_signed(&file, setup.castle_row);
+  }
+
+  write_varint(&file, commands.size());
+  unsigned int last_update = 0;
+  for (const ReplayCommand &command : commands) {
+    write_varint(&file, command.update - last_update);
+    last_update = command.update;
+    write_varint(&file, command.boundary);
+    write_varint(&file, command.type);
+    write_varint(&file, command.player);
+    write_varint(&file, command.pos);
+    write_signed(&file, command.arg0);
+    write_signed(&file, command.arg1);
+    write_varint(&file, command.list.size());
+    for (int value : command.list) {
+      write_signed(&file, value);
+    }
+    for (int i = 0; i < 3; i++) {
+      write_varint(&file, command.random_state[i]);
+    }
+  }
+  write_varint(&file, total_updates);
+
+  if (!file.good()) {
+    Log::Error["replay"] << "failed writing replay file '" << path << "'";
+    return false;
+  }
+  return true;
+}
+
+bool
+Replay::load(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    Log::Error["replay"] << "unable to open replay file '" << path << "'";
+    return false;
+  }
+
+  char magic[4];
+  file.read(magic, 4);
+  if (!file.good() || std::memcmp(magic, REPLAY_MAGIC, 4) != 0) {
+    Log::Error["replay"] << "'" << path << "' is not a replay file";
+    return false;
+  }
+  if (read_varint(&file) != REPLAY_VERSION) {
+    Log::Error["replay"] << "'" << path << "' has an unsupported replay version";
+    return false;
+  }
+  for (int i = 0; i < 3; i++) {
+    random_base[i] = static_cast<uint16_t>(read_varint(&file));
+  }
+  map_size = static_cast<unsigned int>(read_varint(&file));
+  game_options = static_cast<uint32_t>(read_varint(&file));
+  for (int i = 0; i < 23; i++) {
+    uint64_t raw = read_varint(&file);
+    std::memcpy(&custom_map_generator_options.opt[i], &raw, sizeof(raw));
+  }
+
+  players.clear();
+  size_t player_count = read_varint(&file);
+  for (size_t i = 0; i < player_count && file.good(); i++) {
+    PlayerSetup setup;
+    setup.face = static_cast<unsigned int>(read_varint(&file));
+    setup.red = static_cast<unsigned int>(read_varint(&file));
+    setup.green = static_cast<unsigned int>(read_varint(&file));
+    setup.blue = static_cast<unsigned int>(read_varint(&file));
+    setup.intelligence = static_cast<unsigned int>(read_varint(&file));
+    setup.supplies = static_cast<unsigned int>(read_varint(&file));
+    setup.reproduction = static_cast<unsigned int>(read_varint(&file));
+    setup.castle_col = static_cast<int>(read_signed(&file));
+    setup.castle_row = static_cast<int>(read_signed(&file));
+    players.push_back(setup);
+  }
+
+  commands.clear();
+  size_t command_count = read_varint(&file);
+  unsigned int update = 0;
+  for (size_t i = 0; i < command_count && file.good(); i++) {
+    ReplayCommand command;
+    update += static_cast<unsigned int>(read_varint(&file));
+    command.update = update;
+    command.boundary = static_cast<unsigned int>(read_varint(&file));
+    uint64_t type = read_varint(&file);
+    if (type >= ReplayCommand::TypeMax) {
+      Log::Error["replay"] << "'" << path << "' has an unknown command type " << type;
+      return false;
+    }
+    command.type = static_cast<ReplayCommand::Type>(type);
+    command.player = static_cast<unsigned int>(read_varint(&file));
+    command.pos = static_cast<unsigned int>(read_varint(&file));
+    command.arg0 = static_cast<int>(read_signed(&file));
+    command.arg1 = static_cast<int>(read_signed(&file));
+    size_t list_size = read_varint(&file);
+    for (size_t j = 0; j < list_size && file.good(); j++) {
+      command.list.push_back(static_cast<int>(read_signed(&file)));
+    }
+    for (int j = 0; j < 3; j++) {
+      command.random_state[j] = static_cast<uint16_t>(read_varint(&file));
+    }
+    commands.push_back(command);
+  }
+  total_updates = static_cast<unsigned int>(read_varint(&file));
+
+  if (file.fail()) {
+    Log::Error["replay"] << "replay file '" << path << "' is truncated";
+    return false;
+  }
+  return true;
+}
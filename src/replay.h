@@ -0,0 +1,148 @@
+/*
+ * replay.h - deterministic command log and replay
+ *
+ *  Game state only moves forward through Game::update() and the public
+ *   command API (build_road, build_flag, build_building, demolish_*,
+ *   set_inventory_*_mode, Player settings/attacks...).  A Replay holds
+ *   everything needed to rebuild a new game from scratch (the GameInfo
+ *   random seed, map size, players, map generator and game options) plus
+ *   every command that was applied, tagged with the update it was applied
+ *   during.  Replaying it reproduces the game without a savegame and
+ *   without the AI threads that originally issued the commands.
+ */
+
+#ifndef SRC_REPLAY_H_
+#define SRC_REPLAY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/lookup.h"  // for CustomMapGeneratorOptions
+
+class Game;
+class GameInfo;
+typedef std::shared_ptr<GameInfo> PGameInfo;
+
+class ReplayCommand {
+ public:
+  typedef enum Type {
+    TypeBuildRoad = 0,
+    TypeBuildFlag,
+    TypeBuildBuilding,
+    TypeBuildCastle,
+    TypeDemolishRoad,
+    TypeDemolishFlag,
+    TypeDemolishBuilding,
+    TypeSetInventoryResourceMode,
+    TypeSetInventorySerfMode,
+    TypeSendGeologist,
+    TypePlayerSetting,
+    TypeStartAttack,
+    TypePromoteSerfs,
+    TypeCycleKnights,
+    TypeGameSpeed,
+    // direct fixes the AI applies to stuck serfs and flags
+    TypePromoteSerfToKnight,
+    TypeSetSerfLost,
+    TypeCallTransporter,
+    // Game::auto_place_castle as a whole, playback has to make the same
+    //  draws from the game Random to find the spot
+    TypeAutoPlaceCastle,
+
+    TypeMax
+  } Type;
+
+  // sentinel for "boundary", the command was applied after the update finished
+  static const unsigned int AfterUpdate = 0xffff;
+
+  // number of Game::update() calls since recording started.  The game tick
+  //  itself cannot be used because it does not advance while paused
+  unsigned int update;
+  // number of Game::mutex_unlock calls made by the updating thread during
+  //  that update before the command got the lock, AI threads hold the game
+  //  mutex between the update phases so this places a command exactly
+  unsigned int boundary;
+  Type type;
+  unsigned int player;
+  unsigned int pos;   // MapPos, or inventory/flag index
+  int arg0;           // building type, mode, setting, ...
+  int arg1;
+  std::vector<int> list;  // road directions, attacking buildings
+  // game Random state after the command, playback checks it to catch a
+  //  replay going another way than the recording (see Game::start_replay)
+  uint16_t random_state[3];
+
+  ReplayCommand() : update(0), boundary(AfterUpdate), type(TypeMax),
+                    player(0), pos(0), arg0(0), arg1(0),
+                    random_state{0, 0, 0} {}
+  ReplayCommand(Type _type, unsigned int _player, unsigned int _pos,
+                int _arg0 = 0, int _arg1 = 0)
+    : update(0), boundary(AfterUpdate), type(_type), player(_player),
+      pos(_pos), arg0(_arg0), arg1(_arg1), random_state{0, 0, 0} {}
+};
+
+// Put one of these at the top of each command function.  Only the outermost
+//  command on a thread is recorded (build_building calling build_flag is one
+//  command), when it goes out of scope after the command has been applied
+class ReplayCommandScope {
+ protected:
+  Game *game;
+  ReplayCommand command;
+  bool outermost;
+
+ public:
+  ReplayCommandScope(Game *game, const ReplayCommand &command);
+  ~ReplayCommandScope();
+
+  ReplayCommand *get_command() { return &command; }
+};
+
+class Replay {
+ public:
+  typedef struct PlayerSetup {
+    unsigned int face;
+    unsigned int red;
+    unsigned int green;
+    unsigned int blue;
+    unsigned int intelligence;
+    unsigned int supplies;
+    unsigned int reproduction;
+    int castle_col;
+    int castle_row;
+  } PlayerSetup;
+  typedef std::vector<ReplayCommand> Commands;
+
+ protected:
+  uint16_t random_base[3];
+  unsigned int map_size;
+  std::vector<PlayerSetup> players;
+  CustomMapGeneratorOptions custom_map_generator_options;
+  uint32_t game_options;
+  unsigned int total_updates;
+  Commands commands;
+
+ public:
+  Replay();
+  Replay(const GameInfo &game_info, const CustomMapGeneratorOptions &options);
+
+  PGameInfo create_game_info() const;
+  CustomMapGeneratorOptions get_custom_map_generator_options() const {
+    return custom_map_generator_options; }
+  // gameplay options that change the simulation, as bits
+  static uint32_t get_current_game_options();
+  void apply_game_options() const;
+
+  void add_command(const ReplayCommand &command) { commands.push_back(command); }
+  const Commands &get_commands() const { return commands; }
+  unsigned int get_total_updates() const { return total_updates; }
+  void set_total_updates(unsigned int updates) { total_updates = updates; }
+
+  bool save(const std::string &path) const;
+  bool load(const std::string &path);
+};
+
+typedef std::shared_ptr<Replay> PReplay;
+
+#endif  // SRC_REPLAY_H_
@@ -0,0 +1,63 @@
+/*
+ * serf-pos-index.cc - which serfs are at a map position
+ */
+
+#include "src/serf-pos-index.h"
+
+void
+SerfPosIndex::reset(unsigned int tile_count) {
+  first.assign(tile_count, 0);
+  next.clear();
+  prev.clear();
+  indexed_pos.clear();
+}
+
+void
+SerfPosIndex::unlink(unsigned int serf) {
+  MapPos pos = indexed_pos[serf];
+  if (prev[serf] != 0) {
+    next[prev[serf]] = next[serf];
+  } else {
+    first[pos] = next[serf];
+  }
+  if (next[serf] != 0) {
+    prev[next[serf]] = prev[serf];
+  }
+  next[serf] = 0;
+  prev[serf] = 0;
+  indexed_pos[serf] = bad_map_pos;
+}
+
+void
+SerfPosIndex::move(unsigned int serf, MapPos pos) {
+  if (serf == 0 || first.empty()) {
+    return;
+  }
+  if (serf >= indexed_pos.size()) {
+    next.resize(serf + 1, 0);
+    prev.resize(serf + 1, 0);
+    indexed_pos.resize(serf + 1, bad_map_pos);
+  }
+  if (indexed_pos[serf] == pos) {
+    return;
+  }
+  if (indexed_pos[serf] != bad_map_pos) {
+    unlink(serf);
+  }
+  if (pos >= first.size()) {
+    return;
+  }
+  next[serf] = first[pos];
+  if (first[pos] != 0) {
+    prev[first[pos]] = serf;
+  }
+  first[pos] = serf;
+  indexed_pos[serf] = pos;
+}
+
+void
+SerfPosIndex::remove(unsigned int serf) {
+  if (serf < indexed_pos.size() && indexed_pos[serf] != bad_map_pos) {
+    unlink(serf);
+  }
+}
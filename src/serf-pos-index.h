@@ -0,0 +1,54 @@
+/*
+ * serf-pos-index.h - which serfs are at a map position
+ *
+ *  Map::get_serf_index only knows the one serf standing on a tile.  Serfs
+ *   inside a building all share the building's pos, so finding "every serf
+ *   at pos" used to mean looping over every serf in the game, and that
+ *   happened for each tile of a road being removed.
+ *  This keeps a linked list of serf indexes per tile, the links live in
+ *   per-serf arrays so moving a serf never allocates.  Serf::set_pos keeps
+ *   it current through Game::serf_pos_changed.
+ */
+
+#ifndef SRC_SERF_POS_INDEX_H_
+#define SRC_SERF_POS_INDEX_H_
+
+#include <vector>
+
+#include "src/map-geometry.h"
+
+class SerfPosIndex {
+ protected:
+  // serf index 0 is the NULL-serf, so 0 also means end of list
+  std::vector<unsigned int> first;  // per tile
+  std::vector<unsigned int> next;   // per serf
+  std::vector<unsigned int> prev;   // per serf
+  std::vector<MapPos> indexed_pos;  // per serf, bad_map_pos if not indexed
+
+  void unlink(unsigned int serf);
+
+ public:
+  // forget everything, a new or loaded map.  reset(0) leaves it empty
+  //  until Game::update_serf_pos_index fills it again
+  void reset(unsigned int tile_count);
+  bool is_empty() const { return first.empty(); }
+
+  // a pos off the map (bad_map_pos, or -1 for a new serf) just removes it
+  void move(unsigned int serf, MapPos pos);
+  void remove(unsigned int serf);
+
+  template<class F> void for_each_at(MapPos pos, F f) const {
+    if (pos >= first.size()) {
+      return;
+    }
+    unsigned int serf = first[pos];
+    while (serf != 0) {
+      // f may move the serf, so step first
+      unsigned int serf_next = next[serf];
+      f(serf);
+      serf = serf_next;
+    }
+  }
+};
+
+#endif  // SRC_SERF_POS_INDEX_H_
@@ -0,0 +1,95 @@
+/*
+ * serf-timer-wheel.cc - serfs sleeping until a game tick
+ */
+
+#include "src/serf-timer-wheel.h"
+
+SerfTimerWheel::SerfTimerWheel() {
+  current = 0;
+  started = false;
+}
+
+void
+SerfTimerWheel::clear() {
+  for (int level = 0; level < level_count; level++) {
+    for (std::vector<Entry> &slot : slots[level]) {
+      slot.clear();
+    }
+  }
+  overdue.clear();
+  current = 0;
+  started = false;
+}
+
+void
+SerfTimerWheel::schedule(unsigned int serf, unsigned int wake_tick) {
+  if (!started) {
+    // nothing was handed out yet, start counting from here
+    current = wake_tick - 1;
+    started = true;
+  }
+  if (wake_tick <= current) {
+    overdue.push_back({serf, wake_tick});
+    return;
+  }
+  insert({serf, wake_tick});
+}
+
+void
+SerfTimerWheel::insert(const Entry &entry) {
+  if (entry.wake_tick < current) {
+    overdue.push_back(entry);
+    return;
+  }
+  // the slots of a level are reached in order starting after the one
+  //  current is in, so a wake tick fits a level if it is less than a
+  //  full turn of that level's slots ahead.  Anything further out waits
+  //  in the top level and is sorted again when its slot comes up
+  int level = 0;
+  while (level < level_count - 1 &&
+         (entry.wake_tick >> (slot_bits*level)) -
+           (current >> (slot_bits*level)) > slot_mask) {
+    level++;
+  }
+  unsigned int slot = (entry.wake_tick >> (slot_bits*level)) & slot_mask;
+  slots[level][slot].push_back(entry);
+}
+
+void
+SerfTimerWheel::cascade(int level, unsigned int slot) {
+  cascading.clear();
+  cascading.swap(slots[level][slot]);
+  for (const Entry &entry : cascading) {
+    insert(entry);
+  }
+}
+
+void
+SerfTimerWheel::advance(unsigned int now, std::vector<Entry> *due) {
+  due->clear();
+  if (!started) {
+    current = now;
+    started = true;
+    return;
+  }
+
+  due->insert(due->end(), overdue.begin(), overdue.end());
+  overdue.clear();
+
+  while (current < now) {
+    current++;
+    unsigned int slot = current & slot_mask;
+    if (slot == 0) {
+      // coarser slots move down a level when the finer level wraps,
+      //  top level first so its entries can go on down
+      unsigned int slot_1 = (current >> slot_bits) & slot_mask;
+      if (slot_1 == 0) {
+        cascade(2, (current >> (2*slot_bits)) & slot_mask);
+      }
+      cascade(1, slot_1);
+    }
+    std::vector<Entry> &entries = slots[0][slot];
+    due->insert(due->end(), entries.begin(), entries.end());
+    entries.clear();
+  }
+}
@@ -0,0 +1,61 @@
+/*
+ * serf-timer-wheel.h - serfs sleeping until a game tick
+ *
+ *  Most serf states do nothing but count their counter down until it runs
+ *   out: working inside a building, a knight waiting in a hut, a
+ *   woodcutter chopping.  Game::update_serfs used to call Serf::update on
+ *   each of them every tick just for that.
+ *  Now a serf in such a state falls asleep after its update (see
+ *   Serf::try_sleep) and is skipped until the tick its countdown runs out,
+ *   or until something calls one of its methods and wakes it early.  The
+ *   countdown is linear, so counting it down in one go when the serf
+ *   wakes leaves the same counter and tick as counting it every tick.
+ *   Idle serfs in a stock that only set themselves in the inventory
+ *   sleep without a wake tick, see Inventory::get_serf.
+ *  The wheel has three levels of 64 slots, 1, 64 and 4096 ticks wide.  A
+ *   wake tick goes into the finest level that reaches it and moves down a
+ *   level when the wheel gets to its slot.  Entries are never taken out,
+ *   a serf that woke early, died or fell asleep again is skipped by
+ *   Game::update_serfs when its old entry comes up.
+ */
+
+#ifndef SRC_SERF_TIMER_WHEEL_H_
+#define SRC_SERF_TIMER_WHEEL_H_
+
+#include <vector>
+
+class SerfTimerWheel {
+ public:
+  typedef struct Entry {
+    unsigned int serf;
+    unsigned int wake_tick;
+  } Entry;
+
+ protected:
+  static const int slot_bits = 6;
+  static const unsigned int slot_mask = (1 << slot_bits) - 1;
+  static const int level_count = 3;
+
+  std::vector<Entry> slots[level_count][1 << slot_bits];
+  std::vector<Entry> overdue;  // scheduled for a tick already handed out
+  std::vector<Entry> cascading;
+  unsigned int current;  // every tick up to this one was handed out
+  bool started;
+
+  void insert(const Entry &entry);
+  void cascade(int level, unsigned int slot);
+
+ public:
+  SerfTimerWheel();
+
+  // forget everything, a new or loaded map
+  void clear();
+
+  void schedule(unsigned int serf, unsigned int wake_tick);
+
+  // every entry with a wake tick up to now goes into due, which is emptied
+  //  first.  The first call after clear() only starts the wheel at now
+  void advance(unsigned int now, std::vector<Entry> *due);
+};
+
+#endif  // SRC_SERF_TIMER_WHEEL_H_
@@ -22,12 +22,14 @@
 #include "src/serf.h"
 
 #include <algorithm>
+#include <climits>
 #include <map>
 #include <sstream>
 #include <string>
 
 #include "src/game.h"
 #include "src/log.h"
+#include "src/state-hash.h"
 #include "src/debug.h"
 #include "src/misc.h"
 #include "src/inventory.h"
@@ -67,6 +69,7 @@ https://github.com/Pyrdacor/freeserf.net/commit/101de41d3933664a4db83f7858a0fa1b
                        << Serf::get_state_name(other_serf->state) \
                        << " -> " << Serf::get_state_name((new_state)) \
                        << "(" << __FUNCTION__ << ":" << __LINE__ << ")"; \
+  other_serf->wake(); \
   other_serf->state = new_state;
 
 
@@ -327,10 +330,25 @@ Serf::Serf(Game *game, unsigned int index) : GameObject(game, index) {
   s = { { 0 } };
 }
 
+// keeps Game::get_player_serfs current
+void
+Serf::set_owner(unsigned int player_num) {
+  wake();
+  owner = player_num;
+  game->serf_owner_changed(this);
+}
+
+void
+Serf::set_pos(MapPos new_pos) {
+  pos = new_pos;
+  game->serf_pos_changed(this);
+}
+
 /* Change type of serf and update all global tables
    tracking serf types. */
 void
 Serf::set_type(Serf::Type new_type) {
+  wake();
   if (new_type == type) {
     return;
   }
@@ -374,11 +392,13 @@ Serf::set_type(Serf::Type new_type) {
 //   and probably other things eventually
 void
 Serf::set_serf_state(Serf::State new_state){
+  wake();
   set_state(new_state);
 }
 
 void
 Serf::add_to_defending_queue(unsigned int next_knight_index, bool pause) {
+  wake();
   set_state(StateDefendingCastle);
   s.defending.next_knight = next_knight_index;
   if (pause) {
@@ -388,11 +408,12 @@ Serf::add_to_defending_queue(unsigned int next_knight_index, bool pause) {
 
 void
 Serf::init_generic(Inventory *inventory) {
+  wake();
   //Log::Debug["serf"] << "inside init_generic, about to call set_type";
   set_type(TypeGeneric);
   set_owner(inventory->get_owner());
   Building *building = game->get_building(inventory->get_building_index());
-  pos = building->get_position();
+  set_pos(building->get_position());
   tick = game->get_tick();
   state = StateIdleInStock;
   s.idle_in_stock.inv_index = inventory->get_index();
@@ -400,12 +421,14 @@ Serf::init_generic(Inventory *inventory) {
 
 void
 Serf::init_inventory_transporter(Inventory *inventory) {
+  wake();
   set_state(StateBuildingCastle);
   s.building_castle.inv_index = inventory->get_index();
 }
 
 void
 Serf::reset_transport(Flag *flag) {
+  wake();
   if (state == StateWalking && s.walking.dest == flag->get_index() &&
       s.walking.dir1 < 0) {
     s.walking.dir1 = -2;
@@ -442,6 +465,7 @@ bool
 Serf::path_splited(unsigned int flag_1, Direction dir_1,
                    unsigned int flag_2, Direction dir_2,
                    int *select) {
+  wake();
 
   //
   // debug stuck serf issues with StateWaitIdleOnPath
@@ -527,6 +551,7 @@ Serf::is_related_to(unsigned int dest, Direction dir) {
 
 void
 Serf::path_deleted(unsigned int dest, Direction dir) {
+  wake();
   switch (state) {
     case StateWalking:
       if (s.walking.dest == dest && s.walking.dir1 == dir) {
@@ -557,6 +582,7 @@ Serf::path_deleted(unsigned int dest, Direction dir) {
 
 void
 Serf::path_merged(Flag *flag) {
+  wake();
   if (state == StateReadyToLeaveInventory &&
       s.ready_to_leave_inventory.dest == flag->get_index()) {
     s.ready_to_leave_inventory.dest = 0;
@@ -577,6 +603,7 @@ Serf::path_merged(Flag *flag) {
 void
 Serf::path_merged2(unsigned int flag_1, Direction dir_1,
                    unsigned int flag_2, Direction dir_2) {
+  wake();
 
   //
   // debug stuck serf issues with StateWaitIdleOnPath
@@ -611,6 +638,7 @@ Serf::path_merged2(unsigned int flag_1, Direction dir_1,
 
 void
 Serf::flag_deleted(MapPos flag_pos) {
+  wake();
   switch (state) {
     case StateReadyToLeave:
     case StateLeavingBuilding:
@@ -640,6 +668,7 @@ Serf::flag_deleted(MapPos flag_pos) {
 //  the rest are killed
 bool
 Serf::castle_deleted(MapPos castle_pos, bool escape) {
+  wake();
   // I'm not sure what other state serfs in a castle could have, maybe this is to avoid
   //  breaking serfs that are in the out-queue or something like that?
   if (pos == castle_pos && (state == StateIdleInStock || state == StateReadyToLeaveInventory)) {
@@ -663,6 +692,7 @@ Serf::castle_deleted(MapPos castle_pos, bool escape) {
 void
 //Serf::building_deleted(MapPos building_pos, bool transporter) {
 Serf::building_deleted(MapPos building_pos) {
+  wake();
   Log::Debug["serf.cc"] << "inside Serf::building_deleted, pos " << building_pos << ", serf with index #" << get_index();
   // I think this sets holder of a destroyed Stock or Castle from 
   //  TypeTransporterInventory back to a normal Transporter serf
@@ -704,6 +734,7 @@ Serf::building_deleted(MapPos building_pos) {
 // this function appears to ONLY be used for road/splitting, and not normal transporter activity
 bool
 Serf::change_transporter_state_at_pos(MapPos pos_, Serf::State _state) {
+  wake();
   if (pos == pos_ &&
       //!!!! is this the cause of the WaitIdleOnRoad bug?   !!!!!
       // it seems silly that this function would check if the ARGUMENT is a valid state
@@ -722,6 +753,7 @@ Serf::change_transporter_state_at_pos(MapPos pos_, Serf::State _state) {
 
 void
 Serf::restore_path_serf_info() {
+  wake();
   if (state != StateWakeOnPath) {
     s.transporting.wait_counter = -1;
     if (s.transporting.res != Resource::TypeNone) {
@@ -738,6 +770,7 @@ Serf::restore_path_serf_info() {
 
 void
 Serf::clear_destination(unsigned int dest) {
+  wake();
   switch (state) {
     case StateWalking:
       if (s.walking.dest == dest && s.walking.dir1 < 0) {
@@ -768,6 +801,7 @@ Serf::clear_destination(unsigned int dest) {
 
 void
 Serf::clear_destination2(unsigned int dest) {
+  wake();
   switch (state) {
     case StateTransporting:
       if (s.walking.dest == dest) {
@@ -798,6 +832,7 @@ Serf::clear_destination2(unsigned int dest) {
 
 bool
 Serf::idle_to_wait_state(MapPos pos_) {
+  wake();
   if (pos == pos_ &&
       (get_state() == StateIdleOnPath || get_state() == StateWaitIdleOnPath ||
        get_state() == StateWakeAtFlag || get_state() == StateWakeOnPath)) {
@@ -894,6 +929,7 @@ Serf::can_reach_pos(MapPos dest_pos, int max_dist){
 // this says MapPos dest but I think it is actually a flag index!
 void
 Serf::go_out_from_inventory(unsigned int inventory, MapPos dest, int mode) {
+  wake();
   //Log::Debug["serf.cc"] << "inside Serf::go_out_from_inventory, a serf of type " << get_type() << " is being sent to dest pos " << pos;
   set_state(StateReadyToLeaveInventory);
   // 'mode' seems to be simply the initial Dir that the serf goes as it exists the Inventory Flag, or <1 for special cases maybe?  Such as flagsearch not finding a dest??
@@ -910,6 +946,7 @@ Serf::go_out_from_inventory(unsigned int inventory, MapPos dest, int mode) {
 
 void
 Serf::send_off_to_fight(int dist_col, int dist_row) {
+  wake();
   /* Send this serf off to fight. */
   set_state(StateKnightLeaveForWalkToFight);
   s.leave_for_walk_to_fight.dist_col = dist_col;
@@ -921,6 +958,7 @@ Serf::send_off_to_fight(int dist_col, int dist_row) {
 
 void
 Serf::stay_idle_in_stock(unsigned int inventory) {
+  wake();
   Log::Debug["serf.cc"] << "inside Serf::stay_idle_in_stock";
   set_state(StateIdleInStock);
   s.idle_in_stock.inv_index = inventory;
@@ -928,6 +966,7 @@ Serf::stay_idle_in_stock(unsigned int inventory) {
 
 void
 Serf::go_out_from_building(MapPos dest, int dir, int field_B) {
+  wake();
   set_state(StateReadyToLeave);
   s.leaving_building.field_B = field_B;
   s.leaving_building.dest = dest;
@@ -939,6 +978,8 @@ Serf::go_out_from_building(MapPos dest, int dir, int field_B) {
    from any earlier state first. */
 void
 Serf::set_lost_state() {
+  wake();
+  ReplayCommandScope command(game, ReplayCommand(ReplayCommand::TypeSetSerfLost, owner, index));
   if (state == StateWalking) {
     if (s.walking.dir1 >= 0) {
       if (s.walking.dir1 != 6) {
@@ -1355,7 +1396,7 @@ Serf::change_direction(Direction dir, int alt_end) {
           dropped_serf->set_serf_state(StateWalking);
           // serf->pos is not derived from map, it is also stored separately in Serf* object
           //  need to set it
-          dropped_serf->pos = pos;
+          dropped_serf->set_pos(pos);
           // set the dropped serf's walking dir to face away from the water path (i.e. the dir the sailor was facing before he turns back)
           dropped_serf->s.walking.dir = dir;
           // update the dropped serf's stored tick to current game tick or its next animation will cut to its end
@@ -1404,7 +1445,7 @@ Serf::change_direction(Direction dir, int alt_end) {
         return;
       }else{
         //Log::Debug["serf"] << "debug: inside Serf::change_direction, serf with index " << get_index() << " at pos " << pos << " is switching positios with serf #" << other_serf->get_index() << " at new_pos " << new_pos;
-        other_serf->pos = pos;
+        other_serf->set_pos(pos);
         map->set_serf_index(other_serf->pos, other_serf->get_index());
         other_serf->animation =
             get_walking_animation(map->get_height(other_serf->pos) -
@@ -1435,7 +1476,7 @@ Serf::change_direction(Direction dir, int alt_end) {
 
   if (!alt_end) s.walking.wait_counter = 0;
   //Log::Debug["serf"] << "debug: inside Serf::change_direction, serf with index " << get_index() << ", serf is now entering new pos " << new_pos;
-  pos = new_pos;
+  set_pos(new_pos);
   map->set_serf_index(pos, get_index());
   counter += counter_from_animation[animation];
   if (alt_end && counter < 0) {
@@ -1508,7 +1549,7 @@ Serf::transporter_move_to_flag(Flag *flag) {
         }else{
           //Log::Info["serf"] << "found passenger serf from sailor's s.transporting.pickup_serf_index value";
           passenger->set_serf_state(Serf::StateBoatPassenger);
-          passenger->pos = bad_map_pos;
+          passenger->set_pos(bad_map_pos);
           s.transporting.res = Resource::TypeSerf;
           s.transporting.passenger_serf_index = s.transporting.pickup_serf_index;
           s.transporting.passenger_serf_type = s.transporting.pickup_serf_type;
@@ -1628,7 +1669,7 @@ Serf::start_walking(Direction dir, int slope, int change_pos) {
     map->set_serf_index(new_pos, get_index());
   }
 
-  pos = new_pos;
+  set_pos(new_pos);
   //Log::Debug["serf.cc"] << "done Serf::start_walking, serf #" << get_index() << " now occupies pos " << pos;
 }
 
@@ -1960,8 +2001,7 @@ Serf::handle_serf_walking_state() {
              (option_CanTransportSerfsInBoats && src->has_path(i) && src->is_water_path(i) && src->has_transporter(i))
              ){
             Flag *other_flag = src->get_other_end_flag(i);
-            other_flag->set_search_dir(i);
-            search.add_source(other_flag);
+            search.add_source(other_flag, i);
           }
         }
         bool r = search.execute(handle_serf_walking_state_search_cb, true, false, this);
@@ -2970,7 +3010,7 @@ Serf::handle_serf_digging_state() {
             other_dir == reverse_direction(dir) &&
             other_serf->switch_waiting(other_dir)) {
           /* Do the switch */
-          other_serf->pos = pos;
+          other_serf->set_pos(pos);
           map->set_serf_index(other_serf->pos,
                                           other_serf->get_index());
           other_serf->animation =
@@ -3003,7 +3043,7 @@ Serf::handle_serf_digging_state() {
       }
 
       map->set_serf_index(new_pos, get_index());
-      pos = new_pos;
+      set_pos(new_pos);
       s.digging.substate = 3;
       counter += counter_from_animation[animation];
     } else if (s.digging.substate == 1) {
@@ -3857,8 +3897,8 @@ Serf::handle_serf_free_walking_switch_with_other() {
     other_serf->counter = counter_from_animation[other_serf->animation];
     counter = counter_from_animation[animation];
 
-    other_serf->pos = pos;
-    pos = new_pos;
+    other_serf->set_pos(pos);
+    set_pos(new_pos);
   } else {
     animation = 82;
     counter = counter_from_animation[animation];
@@ -4216,7 +4256,7 @@ Serf::handle_free_walking_common() {
           (other_dir == reverse_direction(d) || other_dir == DirectionNone) &&
           other_serf->switch_waiting(reverse_direction(d))) {
         /* Do the switch */
-        other_serf->pos = pos;
+        other_serf->set_pos(pos);
         map->set_serf_index(other_serf->pos,
                                         other_serf->get_index());
         other_serf->animation =
@@ -4229,7 +4269,7 @@ Serf::handle_free_walking_common() {
                                           map->get_height(pos), d, 1);
         counter = counter_from_animation[animation];
 
-        pos = new_pos;
+        set_pos(new_pos);
         map->set_serf_index(pos, index);
         return;
       }
@@ -7024,6 +7064,146 @@ Serf::handle_serf_cleaning_rubble_state() {
 //      destination), prepare to switch to the next Serf State - and set the appropriate initial counter value to start the *next* state's
 //      animation at the necessary frame (which is usually the beginning, but might not be)
 //
+// true if the handler for the current state does nothing but count
+//  counter down for as long as it stays above *threshold, so the serf can
+//  sleep until then.  States that look at the world every tick can't, and
+//  neither can the ones other serfs change directly: walking serfs get
+//  switched around, fighting knights are counted down by their attacker.
+//  A threshold of INT_MIN means the state doesn't count at all
+bool
+Serf::get_sleep_threshold(int *threshold) const {
+  *threshold = -1;
+  switch (state) {
+  case StateEnteringBuilding:
+    *threshold = std::max(s.entering_building.slope_len, -1);
+    return true;
+  case StateWaitForResourceOut:
+    // at 0 it stops counting and waits for the flag instead
+    *threshold = 0;
+    return (counter != 0);
+  case StateStoneCutting:
+    if (s.free_walking.neg_dist1 == 0) {
+      *threshold = s.free_walking.neg_dist2;
+    }
+    return true;
+  case StateLeavingBuilding:
+  case StateBuilding:
+  case StateLogging:
+  case StatePlanningLogging:
+  case StatePlanningPlanting:
+  case StatePlanting:
+  case StatePlanningStoneCutting:
+  case StateMining:
+  case StatePlanningFishing:
+  case StateFishing:
+  case StateFarming:
+  case StateSamplingGeoSpot:
+    return true;
+  // mode 0 waits for the building's resources
+  case StateSawing:
+    return (s.sawing.mode != 0);
+  case StateSmelting:
+    return (s.smelting.mode != 0);
+  case StateMilling:
+    return (s.milling.mode != 0);
+  case StateBaking:
+    return (s.baking.mode != 0);
+  case StatePigFarming:
+    return (s.pigfarming.mode != 0);
+  case StateButchering:
+    return (s.butchering.mode != 0);
+  case StateMakingWeapon:
+    return (s.making_weapon.mode != 0);
+  case StateMakingTool:
+    return (s.making_tool.mode != 0);
+  case StateBuildingBoat:
+    return (s.building_boat.mode != 0);
+  case StateIdleInStock:
+    // knights in training count down to their next chance to level up,
+    //  the rest only set themselves in the inventory (see
+    //  Inventory::get_serf)
+    if (type < TypeKnight0 || type > TypeKnight3) {
+      *threshold = INT_MIN;
+    }
+    return true;
+  case StateDefendingHut:
+  case StateDefendingTower:
+  case StateDefendingFortress:
+  case StateDefendingCastle:
+    if (type == TypeKnight4) {
+      *threshold = INT_MIN;
+      return true;
+    }
+    return (type >= TypeKnight0 && type <= TypeKnight3);
+  default:
+    return false;
+  }
+}
+
+void
+Serf::try_sleep() {
+  int threshold;
+  if (sleeping || !get_sleep_threshold(&threshold)) {
+    return;
+  }
+  Inventory *inventory = nullptr;
+  if (state == StateIdleInStock) {
+    inventory = game->get_inventory(s.idle_in_stock.inv_index);
+    if (inventory == nullptr || !inventory->can_serf_sleep(this)) {
+      return;
+    }
+  }
+  if (threshold == INT_MIN) {
+    sleeping = true;
+    sleep_counts_down = false;
+    if (inventory != nullptr) {
+      inventory->serf_fell_asleep(this);
+    }
+    return;
+  }
+  // only a serf that counted down in this update, one that just changed
+  //  state may still have the tick of an older one.  update() would reset
+  //  a counter this high, and the uint16_t tick must not wrap while asleep
+  unsigned int now = game->get_tick();
+  if (tick != static_cast<uint16_t>(now) || counter > 10000 ||
+      counter <= threshold || counter - threshold > 20000) {
+    return;
+  }
+  sleeping = true;
+  sleep_counts_down = true;
+  wake_tick = now + (counter - threshold);
+  game->schedule_serf_wake(index, wake_tick);
+  if (inventory != nullptr) {
+    inventory->serf_fell_asleep(this);
+  }
+}
+
+// ticks this serf would have counted down since it fell asleep
+uint16_t
+Serf::get_sleep_elapsed() const {
+  if (!sleeping || !sleep_counts_down) {
+    return 0;
+  }
+  return static_cast<uint16_t>(game->get_serf_update_tick(index) - tick);
+}
+
+void
+Serf::wake() {
+  if (!sleeping) {
+    return;
+  }
+  if (state == StateIdleInStock) {
+    Inventory *inventory = game->get_inventory(s.idle_in_stock.inv_index);
+    if (inventory != nullptr) {
+      inventory->serf_woke(this);
+    }
+  }
+  uint16_t elapsed = get_sleep_elapsed();
+  counter -= elapsed;
+  tick += elapsed;
+  sleeping = false;
+}
+
 void
 Serf::update() {
   //Log::Debug["serf.cc"] << "inside Serf::update, serf with index " << get_index() << " has type " << NameSerf[get_type()] << " and state name " << get_state_name(get_state());
@@ -7845,10 +8025,11 @@ operator << (SaveWriterText &writer, Serf &serf) {
   writer.value("type") << serf.type;
   writer.value("owner") << serf.owner;
   writer.value("animation") << serf.animation;
-  writer.value("counter") << serf.counter;
+  writer.value("counter") << serf.get_counter();
   writer.value("pos") << serf.get_game()->get_map()->pos_col(serf.pos);
   writer.value("pos") << serf.get_game()->get_map()->pos_row(serf.pos);
-  writer.value("tick") << serf.tick;
+  writer.value("tick") << static_cast<uint16_t>(serf.tick +
+                                                serf.get_sleep_elapsed());
   writer.value("state") << serf.state;
 
   switch (serf.state) {
@@ -8245,3 +8426,19 @@ Serf::print_state() {
   }
   return res.str();
 }
+
+void
+Serf::add_state_hash(StateHash *hash) const {
+  // the state union is left out, its unused bytes are not meaningful.  A
+  //  serf in a different state sooner or later differs in these too
+  hash->add(index);
+  hash->add(owner);
+  hash->add(type);
+  hash->add(animation);
+  // as if a sleeping serf had counted down every tick
+  hash->add(get_counter());
+  hash->add(pos);
+  hash->add(static_cast<uint16_t>(tick + get_sleep_elapsed()));
+  hash->add(state);
+  hash->add(was_lost);
+}
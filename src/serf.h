@@ -34,6 +34,7 @@ class Inventory;
 class SaveReaderBinary;
 class SaveReaderText;
 class SaveWriterText;
+class StateHash;
 
 class Serf : public GameObject {
  public:
@@ -183,6 +184,13 @@ class Serf : public GameObject {
   bool split_merge_tainted = false;    // note if serf has ever been involved in a fill_path_data call from a merged/split road
   unsigned int recent_dest = 0;  // store the most recent destination for each serf, in case they become Lost, try to send another serf.  Flag index
   unsigned int building_held = 0;  // the index of a building that this serf is Holder to, for sanity/corruption checks
+  // see serf-timer-wheel.h.  A sleeping serf's counter and tick are the
+  //  ones it fell asleep with, it catches up when it wakes.  A knight that
+  //  can't train any further, or a serf idle in stock, sleeps without
+  //  counting until woken
+  bool sleeping = false;
+  bool sleep_counts_down = false;
+  unsigned int wake_tick = 0;
   //
   // TODO - add a variable that stores the index of the building this Serf is holder to, if he has oen
   //   this variable then can be used to cross-check for missing serfs.  Currently it is very difficult to
@@ -408,7 +416,7 @@ class Serf : public GameObject {
   Serf(Game *game, unsigned int index);
 
   unsigned int get_owner() const { return owner; }
-  void set_owner(unsigned int player_num) { owner = player_num; }
+  void set_owner(unsigned int player_num);
 
   Type get_type() const { return type; }
   void set_type(Type type);
@@ -424,12 +432,25 @@ class Serf : public GameObject {
 
   //DEBUG stuck serfs issue, provide the associated Flag index the serf is supposedly at
   int debug_get_idle_on_path_flag() const { return s.idle_on_path.flag; }
-  void debug_set_pos(MapPos new_pos) { pos = new_pos; }
+  void debug_set_pos(MapPos new_pos) { set_pos(new_pos); }
 
   int get_animation() const { return animation; }
-  int get_counter() const { return counter; }
+  // counts down while asleep too, it is only caught up on waking
+  int get_counter() const { return counter - get_sleep_elapsed(); }
+
+  bool is_sleeping() const { return sleeping; }
+  unsigned int get_wake_tick() const { return wake_tick; }
+  // Game::update_serfs calls this after updating the serf, it falls
+  //  asleep if its state only counts down for a while
+  void try_sleep();
+  // catch up on the countdown so far, every method that changes the serf
+  //  from outside (or its state, for set_other_state) starts with this
+  void wake();
 
   MapPos get_pos() const { return pos; }
+  // every change of pos must go through here, it keeps Game's serfs by
+  //  position index current (see serf-pos-index.h)
+  void set_pos(MapPos new_pos);
 
   int train_knight(int p);
 
@@ -518,6 +539,10 @@ class Serf : public GameObject {
   friend SaveWriterText&
     operator << (SaveWriterText &writer, Serf &serf);
 
+  // fold the fields that change as the game runs into a state hash, see
+  //  Game::get_state_hash
+  void add_state_hash(StateHash *hash) const;
+
   std::string print_state();
   // moved from protected
   //   wait, does this still need to be moved?  I think I changed the approach to
@@ -540,6 +565,8 @@ class Serf : public GameObject {
   void drop_resource(Resource::Type res);
   void find_inventory();
   bool can_pass_map_pos(MapPos pos);
+  bool get_sleep_threshold(int *threshold) const;
+  uint16_t get_sleep_elapsed() const;
   void set_fight_outcome(Serf *attacker, Serf *defender);
 
   static bool handle_serf_walking_state_search_cb(Flag *flag, void *data);
@@ -0,0 +1,43 @@
+/*
+ * state-hash.h - 64-bit fingerprint of the running game state
+ *
+ *  Game::get_state_hash folds the map tiles, every serf, flag, building,
+ *   inventory and player and the game Random state into one of these.  Two
+ *   runs that are supposed to be identical (a game and its replay, or the
+ *   same replay with a different game speed or AI threading) can then be
+ *   compared every N ticks to find the first tick where they drift apart,
+ *   instead of diffing whole savegames.
+ */
+
+#ifndef SRC_STATE_HASH_H_
+#define SRC_STATE_HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+class StateHash {
+ protected:
+  uint64_t value;
+
+ public:
+  StateHash() : value(0xcbf29ce484222325ull) {}  // FNV-1a offset basis
+
+  // one word at a time, mixed first so that small values that differ in
+  //  one bit still change every bit of the result (splitmix64 finalizer)
+  void add(uint64_t word) {
+    word += 0x9e3779b97f4a7c15ull;
+    word = (word ^ (word >> 30)) * 0xbf58476d1ce4e5b9ull;
+    word = (word ^ (word >> 27)) * 0x94d049bb133111ebull;
+    word ^= (word >> 31);
+    value = (value ^ word) * 0x100000001b3ull;  // FNV-1a prime
+  }
+  template<class T> void add_array(const T *values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      add(static_cast<uint64_t>(values[i]));
+    }
+  }
+
+  uint64_t get() const { return value; }
+};
+
+#endif  // SRC_STATE_HASH_H_
@@ -0,0 +1,105 @@
+/*
+ * task-pool.cc - small worker pool for splitting one game-thread job
+ */
+
+#include "src/task-pool.h"
+
+#include <algorithm>
+#include <thread>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+
+#include "src/log.h"
+
+TaskPool::TaskPool()
+  : task(nullptr)
+  , task_count(0)
+  , next_task(0)
+  , finished_tasks(0)
+  , worker_count(0) {
+  max_threads = std::thread::hardware_concurrency();
+  // hardware_concurrency is allowed to return 0 if it can't tell
+  if (max_threads == 0) {
+    max_threads = 2;
+  }
+}
+
+// never destroyed, see AIScheduler::get_instance
+TaskPool &
+TaskPool::get_instance() {
+  static TaskPool *instance = new TaskPool();
+  return *instance;
+}
+
+void
+TaskPool::set_max_threads(unsigned int threads) {
+  std::lock_guard<std::mutex> lock(mutex);
+  max_threads = (threads > 0) ? threads : 1;
+}
+
+unsigned int
+TaskPool::get_max_threads() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return max_threads;
+}
+
+void
+TaskPool::run_tasks(std::unique_lock<std::mutex> *lock) {
+  while (task != nullptr && next_task < task_count) {
+    unsigned int index = next_task++;
+    const Task *current = task;
+    lock->unlock();
+    (*current)(index);
+    lock->lock();
+    finished_tasks++;
+    if (finished_tasks == task_count) {
+      done.notify_all();
+    }
+  }
+}
+
+void
+TaskPool::run(unsigned int count, const Task &_task) {
+  if (count == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> run_lock(run_mutex);
+  std::unique_lock<std::mutex> lock(mutex);
+
+  // the caller is one of the threads, workers only for the rest
+  unsigned int helpers = std::min(max_threads, count) - 1;
+  if (helpers == 0) {
+    lock.unlock();
+    for (unsigned int i = 0; i < count; i++) {
+      _task(i);
+    }
+    return;
+  }
+  while (worker_count < helpers) {
+    std::thread worker_thread(&TaskPool::worker, this);
+    worker_thread.detach();
+    worker_count++;
+    Log::Debug["task-pool"] << "started worker " << worker_count;
+  }
+
+  task = &_task;
+  task_count = count;
+  next_task = 0;
+  finished_tasks = 0;
+  wake.notify_all();
+
+  run_tasks(&lock);
+  while (finished_tasks < task_count) {
+    done.wait(lock);
+  }
+  task = nullptr;
+}
+
+void
+TaskPool::worker() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    while (task == nullptr || next_task >= task_count) {
+      wake.wait(lock);
+    }
+    run_tasks(&lock);
+  }
+}
@@ -0,0 +1,54 @@
+/*
+ * task-pool.h - small worker pool for splitting one game-thread job
+ *
+ *  The AIScheduler runs long independent AI loops, this is for the other
+ *   kind of parallel work: the game thread has a batch of independent
+ *   tasks (Map::update's regions) and waits until all of them are done.
+ *  run() hands task indexes out to the workers and to the calling thread
+ *   itself, so with one thread everything just runs on the caller in
+ *   index order.  Whatever the tasks do must not depend on which thread
+ *   runs them or in what order, the pool makes no promise about either.
+ *  Workers are started the first time they are needed and detached, same
+ *   as the AI workers.
+ */
+
+#ifndef SRC_TASK_POOL_H_
+#define SRC_TASK_POOL_H_
+
+#include <condition_variable>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <functional>
+#include <mutex>               //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+
+class TaskPool {
+ protected:
+  typedef std::function<void(unsigned int)> Task;
+
+  std::mutex run_mutex;  // one run() at a time
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const Task *task;
+  unsigned int task_count;
+  unsigned int next_task;
+  unsigned int finished_tasks;
+  unsigned int worker_count;
+  unsigned int max_threads;
+
+  TaskPool();
+  void worker();
+  // caller holds mutex, runs tasks until there are none left to hand out
+  void run_tasks(std::unique_lock<std::mutex> *lock);
+
+ public:
+  static TaskPool &get_instance();
+
+  // threads to use including the calling one, defaults to the core count.
+  //  Lowering it does not stop workers that are already running
+  void set_max_threads(unsigned int threads);
+  unsigned int get_max_threads();
+
+  // call task(0) .. task(count - 1) and return when all have finished
+  void run(unsigned int count, const Task &task);
+};
+
+#endif  // SRC_TASK_POOL_H_
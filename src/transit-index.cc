@@ -0,0 +1,55 @@
+/*
+ * transit-index.cc - which flags hold resources on their way to a flag
+ */
+
+#include "src/transit-index.h"
+
+#include "src/flag.h"
+
+void
+TransitIndex::clear() {
+  by_dest.clear();
+  listed_dest.clear();
+}
+
+void
+TransitIndex::set(unsigned int flag, int slot, unsigned int dest) {
+  unsigned int key = flag * FLAG_MAX_RES_COUNT + slot;
+  if (key >= listed_dest.size()) {
+    if (dest == 0) {
+      return;
+    }
+    listed_dest.resize(key + 1, 0);
+  }
+  unsigned int old_dest = listed_dest[key];
+  if (old_dest == dest) {
+    return;
+  }
+  if (old_dest != 0) {
+    auto it = by_dest.find(old_dest);
+    it->second.erase(key);
+    if (it->second.empty()) {
+      by_dest.erase(it);
+    }
+  }
+  if (dest != 0) {
+    by_dest[dest].insert(key);
+  }
+  listed_dest[key] = dest;
+}
+
+void
+TransitIndex::get_flags(unsigned int dest,
+                        std::vector<unsigned int> *flags) const {
+  flags->clear();
+  auto it = by_dest.find(dest);
+  if (it == by_dest.end()) {
+    return;
+  }
+  for (unsigned int key : it->second) {
+    unsigned int flag = key / FLAG_MAX_RES_COUNT;
+    if (flags->empty() || flags->back() != flag) {
+      flags->push_back(flag);
+    }
+  }
+}
@@ -0,0 +1,41 @@
+/*
+ * transit-index.h - which flags hold resources on their way to a flag
+ *
+ *  When a building goes away its flag has to take back the destination
+ *   of every resource still heading there.  Game::flag_reset_transport
+ *   used to look at every slot of every flag in the game for that.
+ *  This keeps, per destination flag, the flag slots whose resource is
+ *   scheduled to it.  Flag::slot_changed keeps it current, everything
+ *   that writes a slot's type or dest calls it.  Resources carried by a
+ *   serf are not in here, Serf::reset_transport also has to find serfs
+ *   walking to the flag without one so that still goes over the serfs.
+ */
+
+#ifndef SRC_TRANSIT_INDEX_H_
+#define SRC_TRANSIT_INDEX_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+class TransitIndex {
+ protected:
+  // flag slots as flag index * FLAG_MAX_RES_COUNT + slot, sorted so they
+  //  come out in flag order
+  std::map<unsigned int, std::set<unsigned int>> by_dest;
+  std::vector<unsigned int> listed_dest;  // per flag slot, 0 if not listed
+
+ public:
+  // forget everything, a new or loaded map.  Game::rebuild_transit_index
+  //  fills it again from the flags
+  void clear();
+
+  // the resource in the slot is now heading to dest.  Dest 0, no
+  //  destination (or no resource), just unlists the slot
+  void set(unsigned int flag, int slot, unsigned int dest);
+
+  // the flags holding a resource for dest, each once, lowest index first
+  void get_flags(unsigned int dest, std::vector<unsigned int> *flags) const;
+};
+
+#endif  // SRC_TRANSIT_INDEX_H_
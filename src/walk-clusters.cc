@@ -0,0 +1,331 @@
+/*
+ * walk-clusters.cc - coarse map graph for long free-walking paths
+ */
+
+#include "src/walk-clusters.h"
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <queue>
+#include <tuple>
+
+#include "src/pathfinder.h"
+
+WalkClusters::WalkClusters(Map *map_)
+  : map(map_)
+  , any_dirty(true) {
+  const MapGeometry &geom = map->geom();
+  enabled = (geom.cols() % cluster_size == 0 &&
+             geom.rows() % cluster_size == 0);
+  clusters_x = geom.cols() / cluster_size;
+  clusters_y = geom.rows() / cluster_size;
+  clusters.resize(enabled ? clusters_x * clusters_y : 0);
+  for (Cluster &cluster : clusters) {
+    cluster.dirty = true;
+  }
+}
+
+void
+WalkClusters::on_height_changed(MapPos pos) {
+  on_object_changed(pos);
+}
+
+void
+WalkClusters::on_object_changed(MapPos pos) {
+  if (!enabled) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  clusters[cluster_of(pos)].dirty = true;
+  any_dirty = true;
+}
+
+unsigned int
+WalkClusters::cluster_of(MapPos pos) const {
+  const MapGeometry &geom = map->geom();
+  return (geom.pos_row(pos) / cluster_size) * clusters_x +
+         (geom.pos_col(pos) / cluster_size);
+}
+
+unsigned int
+WalkClusters::cluster_at(int cx, int cy) const {
+  int nx = static_cast<int>(clusters_x);
+  int ny = static_cast<int>(clusters_y);
+  return ((cy % ny + ny) % ny) * clusters_x + ((cx % nx + nx) % nx);
+}
+
+bool
+WalkClusters::in_cluster(MapPos pos, unsigned int cluster) const {
+  return cluster_of(pos) == cluster;
+}
+
+// one crossing in the middle of every stretch of border where a serf can
+//  step across
+void
+WalkClusters::find_crossings(MapPos first, int step_col, int step_row,
+                             Direction across,
+                             std::vector<Crossing> *crossings) {
+  crossings->clear();
+  const MapGeometry &geom = map->geom();
+  int run_start = -1;
+  for (int i = 0; i <= static_cast<int>(cluster_size); i++) {
+    bool open = false;
+    if (i < static_cast<int>(cluster_size)) {
+      MapPos pos = geom.pos_add(first, i * step_col, i * step_row);
+      open = map->can_serf_step_into(pos) &&
+             map->can_serf_step_into(map->move(pos, across));
+    }
+    if (open && run_start < 0) {
+      run_start = i;
+    } else if (!open && run_start >= 0) {
+      int middle = (run_start + i - 1) / 2;
+      MapPos pos = geom.pos_add(first, middle * step_col, middle * step_row);
+      crossings->push_back(Crossing(pos, map->move(pos, across)));
+      run_start = -1;
+    }
+  }
+}
+
+void
+WalkClusters::rebuild() {
+  const MapGeometry &geom = map->geom();
+  std::vector<bool> relink(clusters.size(), false);
+  for (unsigned int k = 0; k < clusters.size(); k++) {
+    if (!clusters[k].dirty) {
+      continue;
+    }
+    int cx = k % clusters_x;
+    int cy = k / clusters_x;
+    // the four borders this cluster's tiles are on
+    unsigned int left = cluster_at(cx - 1, cy);
+    unsigned int up = cluster_at(cx, cy - 1);
+    MapPos corner = geom.pos(cx * cluster_size, cy * cluster_size);
+    find_crossings(geom.pos_add(corner, cluster_size - 1, 0), 0, 1,
+                   DirectionRight, &clusters[k].right);
+    find_crossings(geom.pos_add(corner, 0, cluster_size - 1), 1, 0,
+                   DirectionDown, &clusters[k].down);
+    find_crossings(geom.pos_add(corner, -1, 0), 0, 1,
+                   DirectionRight, &clusters[left].right);
+    find_crossings(geom.pos_add(corner, 0, -1), 1, 0,
+                   DirectionDown, &clusters[up].down);
+    relink[k] = true;
+    relink[left] = true;
+    relink[up] = true;
+    relink[cluster_at(cx + 1, cy)] = true;
+    relink[cluster_at(cx, cy + 1)] = true;
+  }
+  for (unsigned int k = 0; k < clusters.size(); k++) {
+    if (relink[k]) {
+      rebuild_links(k);
+    }
+    clusters[k].dirty = false;
+  }
+  any_dirty = false;
+}
+
+int
+WalkClusters::entrance_index(unsigned int cluster, MapPos pos) const {
+  const std::vector<MapPos> &entrances = clusters[cluster].entrances;
+  for (size_t i = 0; i < entrances.size(); i++) {
+    if (entrances[i] == pos) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void
+WalkClusters::rebuild_links(unsigned int k) {
+  Cluster &cluster = clusters[k];
+  int cx = k % clusters_x;
+  int cy = k / clusters_x;
+  const Cluster &left = clusters[cluster_at(cx - 1, cy)];
+  const Cluster &up = clusters[cluster_at(cx, cy - 1)];
+
+  // entrances and the step across the border each one has
+  std::vector<std::pair<MapPos, Link>> steps;
+  for (const Crossing &crossing : cluster.right) {
+    steps.push_back(std::make_pair(crossing.first, Link(crossing.second,
+      actual_cost(map, crossing.first, DirectionRight))));
+  }
+  for (const Crossing &crossing : cluster.down) {
+    steps.push_back(std::make_pair(crossing.first, Link(crossing.second,
+      actual_cost(map, crossing.first, DirectionDown))));
+  }
+  for (const Crossing &crossing : left.right) {
+    steps.push_back(std::make_pair(crossing.second, Link(crossing.first,
+      actual_cost(map, crossing.second, DirectionLeft))));
+  }
+  for (const Crossing &crossing : up.down) {
+    steps.push_back(std::make_pair(crossing.second, Link(crossing.first,
+      actual_cost(map, crossing.second, DirectionUp))));
+  }
+
+  cluster.entrances.clear();
+  cluster.links.clear();
+  for (const std::pair<MapPos, Link> &step : steps) {
+    int index = entrance_index(k, step.first);
+    if (index < 0) {
+      cluster.entrances.push_back(step.first);
+      cluster.links.push_back(std::vector<Link>());
+      index = static_cast<int>(cluster.entrances.size() - 1);
+    }
+    cluster.links[index].push_back(step.second);
+  }
+
+  const MapGeometry &geom = map->geom();
+  std::vector<int> costs;
+  for (size_t i = 0; i < cluster.entrances.size(); i++) {
+    costs_in_cluster(cluster.entrances[i], &costs);
+    for (size_t j = 0; j < cluster.entrances.size(); j++) {
+      MapPos other = cluster.entrances[j];
+      int cost = costs[(geom.pos_row(other) % cluster_size) * cluster_size +
+                       (geom.pos_col(other) % cluster_size)];
+      if (i != j && cost >= 0) {
+        cluster.links[i].push_back(Link(other, cost));
+      }
+    }
+  }
+}
+
+void
+WalkClusters::costs_in_cluster(MapPos start, std::vector<int> *costs) const {
+  const MapGeometry &geom = map->geom();
+  unsigned int cluster = cluster_of(start);
+  costs->assign(cluster_size * cluster_size, -1);
+  auto local = [&geom](MapPos pos) {
+    return (geom.pos_row(pos) % cluster_size) * cluster_size +
+           (geom.pos_col(pos) % cluster_size);
+  };
+
+  typedef std::pair<unsigned int, MapPos> Item;
+  std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+  (*costs)[local(start)] = 0;
+  open.push(Item(0, start));
+  while (!open.empty()) {
+    Item item = open.top();
+    open.pop();
+    if (static_cast<int>(item.first) > (*costs)[local(item.second)]) {
+      continue;
+    }
+    for (Direction d : cycle_directions_cw()) {
+      MapPos pos = map->move(item.second, d);
+      if (!in_cluster(pos, cluster) || !map->can_serf_step_into(pos)) {
+        continue;
+      }
+      unsigned int cost = item.first + actual_cost(map, item.second, d);
+      int &known = (*costs)[local(pos)];
+      if (known < 0 || cost < static_cast<unsigned int>(known)) {
+        known = cost;
+        open.push(Item(cost, pos));
+      }
+    }
+  }
+}
+
+bool
+WalkClusters::find_waypoints(MapPos start, MapPos end,
+                             std::vector<MapPos> *waypoints) {
+  if (!enabled) {
+    return false;
+  }
+  int dist_col = map->dist_x(start, end);
+  int dist_row = map->dist_y(start, end);
+  int dist = ((dist_col > 0 && dist_row > 0) || (dist_col < 0 && dist_row < 0))
+               ? std::max(abs(dist_col), abs(dist_row))
+               : abs(dist_col) + abs(dist_row);
+  if (dist <= static_cast<int>(cluster_size) ||
+      cluster_of(start) == cluster_of(end) ||
+      !map->can_serf_step_into(start)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (any_dirty) {
+    rebuild();
+  }
+
+  const MapGeometry &geom = map->geom();
+  auto local = [&geom](MapPos pos) {
+    return (geom.pos_row(pos) % cluster_size) * cluster_size +
+           (geom.pos_col(pos) % cluster_size);
+  };
+  unsigned int end_cluster = cluster_of(end);
+  std::vector<int> start_costs;
+  std::vector<int> end_costs;
+  costs_in_cluster(start, &start_costs);
+  costs_in_cluster(end, &end_costs);
+
+  // A* over the entrances, start and end.  Ties go to the node queued
+  //  first so the result never depends on anything but the map
+  typedef struct Node {
+    unsigned int g_score;
+    MapPos parent;
+    bool closed;
+  } Node;
+  std::map<MapPos, Node> nodes;
+  typedef std::tuple<unsigned int, unsigned int, MapPos> Item;  // f, seq, pos
+  std::priority_queue<Item, std::vector<Item>, std::greater<Item>> open;
+  unsigned int seq = 0;
+
+  nodes[start] = Node{0, bad_map_pos, false};
+  open.push(Item(heuristic_cost(map, start, end), seq++, start));
+
+  std::vector<Link> links;
+  unsigned int expanded = 0;
+  while (!open.empty() && expanded < 5000) {
+    MapPos pos = std::get<2>(open.top());
+    open.pop();
+    Node &node = nodes[pos];
+    if (node.closed) {
+      continue;
+    }
+    node.closed = true;
+    expanded++;
+
+    if (pos == end) {
+      waypoints->clear();
+      for (MapPos p = end; p != bad_map_pos; p = nodes[p].parent) {
+        waypoints->push_back(p);
+      }
+      std::reverse(waypoints->begin(), waypoints->end());
+      return true;
+    }
+
+    links.clear();
+    unsigned int cluster = cluster_of(pos);
+    if (pos == start) {
+      for (MapPos entrance : clusters[cluster].entrances) {
+        int cost = start_costs[local(entrance)];
+        if (cost >= 0) {
+          links.push_back(Link(entrance, cost));
+        }
+      }
+    } else {
+      int index = entrance_index(cluster, pos);
+      if (index >= 0) {
+        links = clusters[cluster].links[index];
+      }
+    }
+    if (cluster == end_cluster && pos != start &&
+        end_costs[local(pos)] >= 0) {
+      links.push_back(Link(end, end_costs[local(pos)]));
+    }
+
+    unsigned int g_score = node.g_score;
+    for (const Link &link : links) {
+      unsigned int new_g = g_score + link.second;
+      auto it = nodes.find(link.first);
+      if (it != nodes.end() &&
+          (it->second.closed || it->second.g_score <= new_g)) {
+        continue;
+      }
+      nodes[link.first] = Node{new_g, pos, false};
+      open.push(Item(new_g + heuristic_cost(map, link.first, end), seq++,
+                     link.first));
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,81 @@
+/*
+ * walk-clusters.h - coarse map graph for long free-walking paths
+ *
+ *  pathfinder_freewalking_serf searches tile by tile, so a knight walking
+ *   to an attack target or a serf walking around a lake explores a big
+ *   patch of the map and can still run into its position limit and give up.
+ *  This splits the map into square clusters of cluster_size tiles and
+ *   keeps, like HPA*, one entrance per open stretch of each cluster border
+ *   plus the walking cost between every two entrances of a cluster (same
+ *   walk_cost by height difference model as the pathfinder).  A long walk
+ *   is first searched over that small graph, the pathfinder then only has
+ *   to fill in the short legs between the waypoints.
+ *  Map::set_object and Map::set_height report changes through Map::Handler,
+ *   which marks the clusters around the tile dirty.  Dirty clusters (and the
+ *   neighbours they share a border with) are rebuilt at the next query, so
+ *   trees growing and buildings appearing are always accounted for.
+ *  Queries come from the game thread and AI threads, everything is done
+ *   under the mutex.
+ */
+
+#ifndef SRC_WALK_CLUSTERS_H_
+#define SRC_WALK_CLUSTERS_H_
+
+#include <mutex>  //NOLINT (build/c++11) this is a Google Chromium req, not relevant to general C++.
+#include <utility>
+#include <vector>
+
+#include "src/map.h"
+
+class WalkClusters : public Map::Handler {
+ public:
+  static const unsigned int cluster_size = 16;
+
+ protected:
+  typedef std::pair<MapPos, MapPos> Crossing;  // tile in this cluster, tile across
+  typedef std::pair<MapPos, unsigned int> Link;  // other tile, walking cost
+
+  typedef struct Cluster {
+    bool dirty;
+    // crossings over this cluster's right and bottom borders, the left and
+    //  top ones belong to the neighbours
+    std::vector<Crossing> right;
+    std::vector<Crossing> down;
+    std::vector<MapPos> entrances;
+    std::vector<std::vector<Link>> links;  // per entrance
+  } Cluster;
+
+  Map *map;
+  std::mutex mutex;
+  bool enabled;
+  unsigned int clusters_x;
+  unsigned int clusters_y;
+  std::vector<Cluster> clusters;
+  bool any_dirty;
+
+  unsigned int cluster_of(MapPos pos) const;
+  unsigned int cluster_at(int cx, int cy) const;
+  bool in_cluster(MapPos pos, unsigned int cluster) const;
+  void find_crossings(MapPos first, int step_col, int step_row,
+                      Direction across, std::vector<Crossing> *crossings);
+  void rebuild();
+  void rebuild_links(unsigned int cluster);
+  int entrance_index(unsigned int cluster, MapPos pos) const;
+  // walking cost from pos to every tile of its cluster, -1 if unreachable
+  //  without leaving the cluster.  pos itself does not need to be passable
+  void costs_in_cluster(MapPos pos, std::vector<int> *costs) const;
+
+ public:
+  explicit WalkClusters(Map *map);
+
+  // Map::Handler, called for the six tiles around a changed one
+  virtual void on_height_changed(MapPos pos);
+  virtual void on_object_changed(MapPos pos);
+
+  // false if start and end are close enough to search directly, or there
+  //  is no way between them over the cluster graph.  Otherwise waypoints
+  //  is start, the entrances to walk through in order, and end
+  bool find_waypoints(MapPos start, MapPos end, std::vector<MapPos> *waypoints);
+};
+
+#endif  // SRC_WALK_CLUSTERS_H_
@@ -0,0 +1,136 @@
+/*
+ * world-snapshot.cc - read-only copy of the game world for AI threads
+ */
+
+#include "src/world-snapshot.h"
+
+#include "src/game.h"
+#include "src/inventory.h"
+
+bool
+WorldSnapshot::FlagInfo::has_resources() const {
+  for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+    if (slot[i] != Resource::TypeNone) {
+      return true;
+    }
+  }
+  return false;
+}
+
+WorldSnapshot::WorldSnapshot()
+  : version(0)
+  , tick(0) {
+}
+
+// clear() keeps the capacity of every vector, once the spare snapshot has
+//  seen the biggest the game got it never allocates again
+void
+WorldSnapshot::capture(Game *game, unsigned int _version) {
+  version = _version;
+  tick = game->get_tick();
+
+  PMap map = game->get_map();
+  owners.resize(map->geom().tile_count());
+  for (MapPos pos : map->geom()) {
+    owners[pos] = map->has_owner(pos) ? map->get_owner(pos) + 1 : 0;
+  }
+
+  flags.clear();
+  flag_lookup.clear();
+  for (Flag *flag : game->flags) {
+    // index 0 is the NULL-flag
+    if (flag == nullptr || flag->get_index() == 0) {
+      continue;
+    }
+    FlagInfo info;
+    info.index = flag->get_index();
+    info.owner = flag->get_owner();
+    info.pos = flag->get_position();
+    info.connected = flag->is_connected();
+    info.has_building = flag->has_building();
+    info.building_index = info.has_building ?
+                            flag->get_building()->get_index() : 0;
+    info.accepts_resources = flag->accepts_resources();
+    info.paths = flag->paths();
+    info.transporters = flag->transporters();
+    for (Direction dir : cycle_directions_cw()) {
+      info.other_end_flag[dir] = 0;
+      // up-left of a flag with a building is the building, not a road
+      if (!flag->has_path(dir) ||
+          (dir == DirectionUpLeft && info.has_building)) {
+        continue;
+      }
+      Flag *other_flag = flag->get_other_end_flag(dir);
+      if (other_flag != nullptr) {
+        info.other_end_flag[dir] = other_flag->get_index();
+      }
+    }
+    info.road_network = flag->get_road_network();
+    info.connected_to_inventory = flag->is_connected_to_inventory();
+    for (int i = 0; i < FLAG_MAX_RES_COUNT; i++) {
+      info.slot[i] = flag->get_resource_at_slot(i);
+    }
+    if (info.index >= flag_lookup.size()) {
+      flag_lookup.resize(info.index + 1, -1);
+    }
+    flag_lookup[info.index] = static_cast<int>(flags.size());
+    flags.push_back(info);
+  }
+
+  buildings.clear();
+  building_lookup.clear();
+  for (Building *building : game->buildings) {
+    if (building == nullptr || building->get_index() == 0) {
+      continue;
+    }
+    BuildingInfo info;
+    info.index = building->get_index();
+    info.owner = building->get_owner();
+    info.pos = building->get_position();
+    info.type = building->get_type();
+    info.flag_index = building->get_flag_index();
+    info.done = building->is_done();
+    info.active = building->is_active();
+    info.burning = building->is_burning();
+    info.military = building->is_military();
+    info.has_serf = building->has_serf();
+    info.has_knight = building->has_knight();
+    info.threat_level = building->get_threat_level();
+    if (info.index >= building_lookup.size()) {
+      building_lookup.resize(info.index + 1, -1);
+    }
+    building_lookup[info.index] = static_cast<int>(buildings.size());
+    buildings.push_back(info);
+  }
+
+  inventories.clear();
+  for (Inventory *inventory : game->inventories) {
+    if (inventory == nullptr) {
+      continue;
+    }
+    InventoryInfo info;
+    info.index = inventory->get_index();
+    info.owner = inventory->get_owner();
+    info.flag_index = inventory->get_flag_index();
+    info.building_index = inventory->get_building_index();
+    info.resources = inventory->get_all_resources();
+    info.free_serf_count = inventory->free_serf_count();
+    inventories.push_back(info);
+  }
+}
+
+const WorldSnapshot::FlagInfo *
+WorldSnapshot::get_flag(unsigned int index) const {
+  if (index >= flag_lookup.size() || flag_lookup[index] < 0) {
+    return nullptr;
+  }
+  return &flags[flag_lookup[index]];
+}
+
+const WorldSnapshot::BuildingInfo *
+WorldSnapshot::get_building(unsigned int index) const {
+  if (index >= building_lookup.size() || building_lookup[index] < 0) {
+    return nullptr;
+  }
+  return &buildings[building_lookup[index]];
+}
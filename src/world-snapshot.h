@@ -0,0 +1,124 @@
+/*
+ * world-snapshot.h - read-only copy of the game world for AI threads
+ *
+ *  The AI threads used to copy whole Collections (Flags flags_copy =
+ *   *(game->get_flags())) or hold the game mutex while they looked
+ *   through flags and buildings, and the copied Collection still pointed
+ *   at the live Flag objects which the game thread may delete at any time.
+ *  Instead the game thread now captures the few fields the AI looks at
+ *   into a WorldSnapshot every WORLD_SNAPSHOT_TICKS game ticks and
+ *   publishes it, readers take a reference counted pointer to the current
+ *   one and can look at it for as long as they like without any locking.
+ *  A snapshot is never changed once published.  Game keeps two of them,
+ *   the published one and a spare it captures the next one into, so in
+ *   the common case no memory is allocated.
+ */
+
+#ifndef SRC_WORLD_SNAPSHOT_H_
+#define SRC_WORLD_SNAPSHOT_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "src/building.h"
+#include "src/flag.h"
+#include "src/map.h"
+#include "src/resource.h"
+
+// how often the game thread publishes a new snapshot, in game ticks.  At
+//  normal speed this is about once a second, which is far more often than
+//  the AI loops come back to look at the same thing
+#define WORLD_SNAPSHOT_TICKS  100
+
+class Game;
+
+class WorldSnapshot {
+ public:
+  typedef struct FlagInfo {
+    unsigned int index;
+    unsigned int owner;
+    MapPos pos;
+    bool connected;
+    bool has_building;
+    unsigned int building_index;  // 0 if no building
+    bool accepts_resources;  // castle or warehouse flag
+    int paths;          // Flag::paths bitmap
+    int transporters;   // Flag::transporters bitmap
+    // index of the flag at the other end of the road in each direction,
+    //  0 if none.  Never the attached building, unlike get_other_end_flag
+    unsigned int other_end_flag[6];
+    // Flag::get_road_network and is_connected_to_inventory
+    unsigned int road_network;
+    bool connected_to_inventory;
+    Resource::Type slot[FLAG_MAX_RES_COUNT];
+
+    bool has_path(Direction dir) const { return ((paths >> dir) & 1) != 0; }
+    bool has_transporter(Direction dir) const {
+      return ((transporters >> dir) & 1) != 0; }
+    bool has_resources() const;
+  } FlagInfo;
+
+  typedef struct BuildingInfo {
+    unsigned int index;
+    unsigned int owner;
+    MapPos pos;
+    Building::Type type;
+    unsigned int flag_index;
+    bool done;
+    bool active;
+    bool burning;
+    bool military;
+    bool has_serf;
+    bool has_knight;
+    size_t threat_level;
+  } BuildingInfo;
+
+  typedef struct InventoryInfo {
+    unsigned int index;
+    unsigned int owner;
+    unsigned int flag_index;
+    unsigned int building_index;
+    ResourceMap resources;
+    size_t free_serf_count;
+  } InventoryInfo;
+
+ protected:
+  unsigned int version;
+  unsigned int tick;
+  std::vector<uint8_t> owners;  // per MapPos, owner + 1, 0 is unowned
+  std::vector<FlagInfo> flags;
+  std::vector<BuildingInfo> buildings;
+  std::vector<InventoryInfo> inventories;
+  // object index -> position in the vectors above, -1 if it does not exist
+  std::vector<int> flag_lookup;
+  std::vector<int> building_lookup;
+
+ public:
+  WorldSnapshot();
+
+  // called by the game thread with the game mutex held, on a snapshot that
+  //  no reader has a reference to
+  void capture(Game *game, unsigned int version);
+
+  // the snapshot count since the game started, and the game tick it was taken
+  unsigned int get_version() const { return version; }
+  unsigned int get_tick() const { return tick; }
+
+  bool has_owner(MapPos pos) const {
+    return (pos < owners.size() && owners[pos] != 0); }
+  unsigned int get_owner(MapPos pos) const {
+    return (pos < owners.size()) ? owners[pos] - 1u : -1u; }
+
+  const std::vector<FlagInfo> &get_flags() const { return flags; }
+  const std::vector<BuildingInfo> &get_buildings() const { return buildings; }
+  const std::vector<InventoryInfo> &get_inventories() const {
+    return inventories; }
+  // nullptr if the object did not exist when the snapshot was taken
+  const FlagInfo *get_flag(unsigned int index) const;
+  const BuildingInfo *get_building(unsigned int index) const;
+};
+
+typedef std::shared_ptr<const WorldSnapshot> PWorldSnapshot;
+
+#endif  // SRC_WORLD_SNAPSHOT_H_